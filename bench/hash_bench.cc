@@ -0,0 +1,118 @@
+#include "db.h"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/format.h>
+#include <string>
+
+// A B+tree bucket against a hash bucket of KV_BENCH_HASH_KEYS keys, 10^6 by
+// default. The argument picks the bucket, 0 for the tree and 1 for the hash
+// table. pages_read counts the pages a Get or Put batch reads from the mmap.
+namespace bench {
+
+constexpr std::size_t HASH_BATCH = 100000;
+
+std::size_t HashBenchKeys() {
+  const char *v = std::getenv("KV_BENCH_HASH_KEYS");
+  return v ? std::strtoull(v, nullptr, 10) : 1000000;
+}
+
+[[nodiscard]] kv::DB::RAII_DB LoadHashDB(const std::filesystem::path &path,
+                                         bool hash, std::size_t keys) {
+  std::filesystem::remove(path);
+  auto db = kv::DB::Open(path, {.sync_mode_ = kv::SyncMode::None});
+  if (!db) {
+    return nullptr;
+  }
+  auto err = (*db)->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b", hash ? kv::BucketFlag::Hash
+                                       : kv::BucketFlag::None);
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  for (std::size_t i = 0; !err && i < keys; i += HASH_BATCH) {
+    err = (*db)->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("b");
+      for (std::size_t j = i; j < std::min(keys, i + HASH_BATCH); j++) {
+        // scattered so both buckets take random puts
+        const auto k = j * 2654435761 % keys;
+        if (auto e = b->Put(fmt::format("key{:012}", k), "value")) {
+          return e;
+        }
+      }
+      return {};
+    });
+  }
+  return err ? nullptr : std::move(*db);
+}
+
+void BM_HashGet(benchmark::State &state) {
+  const std::filesystem::path path = "./hash_bench.db";
+  const auto keys = HashBenchKeys();
+  auto db = LoadHashDB(path, state.range(0), keys);
+  if (!db) {
+    state.SkipWithError("failed to load the db");
+    return;
+  }
+  const auto before = db->GetStats().pages_read_;
+  std::size_t i = 0;
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    for (auto _ : state) {
+      const auto key = fmt::format("key{:012}", i++ * 7919 % keys);
+      benchmark::DoNotOptimize(b->Get(key));
+    }
+    return {};
+  });
+  if (err) {
+    state.SkipWithError(err->message().c_str());
+  }
+  state.counters["pages_read"] = benchmark::Counter(
+      static_cast<double>(db->GetStats().pages_read_ - before),
+      benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+  db.reset();
+  std::filesystem::remove(path);
+}
+
+// commits of 1000 new keys spread over the key range of the loaded bucket
+void BM_HashPutBatch(benchmark::State &state) {
+  constexpr std::size_t batch = 1000;
+  const std::filesystem::path path = "./hash_bench.db";
+  const auto keys = HashBenchKeys();
+  auto db = LoadHashDB(path, state.range(0), keys);
+  if (!db) {
+    state.SkipWithError("failed to load the db");
+    return;
+  }
+  const auto before = db->GetStats().pages_read_;
+  std::size_t next = 0;
+  for (auto _ : state) {
+    auto err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("b");
+      for (std::size_t j = 0; j < batch; j++, next++) {
+        const auto k = next * 2654435761 % keys;
+        if (auto e = b->Put(fmt::format("key{:012}-{}", k, next), "value")) {
+          return e;
+        }
+      }
+      return {};
+    });
+    if (err) {
+      state.SkipWithError(err->message().c_str());
+      break;
+    }
+  }
+  state.counters["pages_read"] = benchmark::Counter(
+      static_cast<double>(db->GetStats().pages_read_ - before),
+      benchmark::Counter::kAvgIterations);
+  state.counters["file_mb"] =
+      static_cast<double>(std::filesystem::file_size(path)) / (1 << 20);
+  state.SetItemsProcessed(state.iterations() * batch);
+  db.reset();
+  std::filesystem::remove(path);
+}
+
+BENCHMARK(BM_HashGet)->ArgName("hash")->Arg(0)->Arg(1);
+BENCHMARK(BM_HashPutBatch)->ArgName("hash")->Arg(0)->Arg(1);
+
+} // namespace bench
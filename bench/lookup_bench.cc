@@ -0,0 +1,68 @@
+#include "db.h"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <string>
+
+// Point lookups of a bucket through DB::View. The argument enables the bloom
+// filters (1) or not (0).
+namespace bench {
+
+constexpr std::size_t RECORDS = 100000;
+
+[[nodiscard]] kv::DB::RAII_DB LoadLookupDB(const std::filesystem::path &path,
+                                           double bloom_fp_rate) {
+  std::filesystem::remove(path);
+  auto db = kv::DB::Open(path, {.sync_mode_ = kv::SyncMode::None,
+                                .bloom_fp_rate_ = bloom_fp_rate});
+  if (!db) {
+    return nullptr;
+  }
+  auto err = (*db)->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    if (!b) {
+      return b.error();
+    }
+    auto bucket = tx.GetBucket("b");
+    for (std::size_t i = 0; i < RECORDS; i++) {
+      if (auto e = bucket->Put(fmt::format("key{:012}", i), "value")) {
+        return e;
+      }
+    }
+    return {};
+  });
+  return err ? nullptr : std::move(*db);
+}
+
+void RunLookups(benchmark::State &state, const char *prefix) {
+  const std::filesystem::path path = "./lookup_bench.db";
+  auto db = LoadLookupDB(path, state.range(0) ? 0.01 : 0);
+  if (!db) {
+    state.SkipWithError("failed to load the db");
+    return;
+  }
+  std::size_t i = 0;
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    for (auto _ : state) {
+      const auto key = fmt::format("{}{:012}", prefix, i++ * 7919 % RECORDS);
+      benchmark::DoNotOptimize(b->Get(key));
+    }
+    return {};
+  });
+  if (err) {
+    state.SkipWithError(err->message().c_str());
+  }
+  state.SetItemsProcessed(state.iterations());
+  db.reset();
+  std::filesystem::remove(path);
+}
+
+// keys that sort among the stored ones but are not there
+void BM_GetMissing(benchmark::State &state) { RunLookups(state, "key0"); }
+void BM_GetPresent(benchmark::State &state) { RunLookups(state, "key"); }
+
+BENCHMARK(BM_GetMissing)->ArgName("bloom")->Arg(0)->Arg(1);
+BENCHMARK(BM_GetPresent)->ArgName("bloom")->Arg(0)->Arg(1);
+
+} // namespace bench
@@ -0,0 +1,187 @@
+#include "disk.h"
+#include "freelist.h"
+#include "node.h"
+#include "os.h"
+#include "page.h"
+#include "slice.h"
+#include "tx_cache.h"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+// Keys of the form key000000.. sorted by their numeric suffix.
+std::vector<std::string> SortedKeys(std::size_t n) {
+  std::vector<std::string> keys;
+  keys.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    keys.push_back(fmt::format("key{:012}", i));
+  }
+  return keys;
+}
+
+void BM_SliceCompare(benchmark::State &state) {
+  // keys sharing the first bytes defeat the prefix shortcut
+  const auto shared = static_cast<std::size_t>(state.range(0));
+  std::string a(shared, 'k');
+  std::string b = a;
+  a += "a";
+  b += "b";
+  kv::Slice sa{a}, sb{b};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(sa < sb);
+  }
+}
+BENCHMARK(BM_SliceCompare)->Arg(4)->Arg(16)->Arg(64);
+
+// Fills n with the sorted keys and writes it to a page of buf.
+kv::Page &WriteNode(kv::Node &n, kv::PageBuffer &buf,
+                    const std::vector<std::string> &keys) {
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    if (n.IsLeaf()) {
+      n.Put(keys[i], keys[i]);
+    } else {
+      n.Put(keys[i], keys[i], {}, i + 3);
+    }
+  }
+  auto &p = buf.GetPage(0);
+  n.Write(p);
+  return p;
+}
+
+void BM_LeafSearch(benchmark::State &state) {
+  const auto keys = SortedKeys(state.range(0));
+  kv::Node n{};
+  kv::PageBuffer buf{4, kv::OS::DEFAULT_PAGE_SIZE};
+  auto &p = WriteNode(n, buf, keys).AsPage<kv::LeafPage>();
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<std::size_t> pick{0, keys.size() - 1};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(p.FindLastLessThan(keys[pick(rng)]));
+  }
+}
+BENCHMARK(BM_LeafSearch)->Arg(16)->Arg(64)->Arg(128);
+
+void BM_BranchSearch(benchmark::State &state) {
+  const auto keys = SortedKeys(state.range(0));
+  kv::Node n{nullptr, false};
+  kv::PageBuffer buf{4, kv::OS::DEFAULT_PAGE_SIZE};
+  auto &p = WriteNode(n, buf, keys).AsPage<kv::BranchPage>();
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<std::size_t> pick{0, keys.size() - 1};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(p.FindFirstGreaterOrEqualTo(keys[pick(rng)]));
+  }
+}
+BENCHMARK(BM_BranchSearch)->Arg(16)->Arg(64)->Arg(128);
+
+void BM_NodePut(benchmark::State &state) {
+  auto keys = SortedKeys(state.range(0));
+  std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+  for (auto _ : state) {
+    kv::Node n{};
+    for (const auto &k : keys) {
+      n.Put(k, k);
+    }
+    benchmark::DoNotOptimize(n.GetElements().size());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_NodePut)->Arg(64)->Arg(1024)->Arg(16384);
+
+void BM_SplitNode(benchmark::State &state) {
+  const std::filesystem::path path = "./split_bench.db";
+  std::filesystem::remove(path);
+  kv::DiskHandler disk;
+  if (!disk.Open(path)) {
+    state.SkipWithError("failed to open db file");
+    return;
+  }
+  kv::ShadowPageHandler handler{disk, true};
+  kv::Node n{};
+  const auto keys = SortedKeys(state.range(0));
+  for (const auto &k : keys) {
+    n.Put(k, k);
+  }
+  for (auto _ : state) {
+    auto split = handler.SplitNode(n);
+    benchmark::DoNotOptimize(split);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  disk.Close();
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_SplitNode)->Arg(1024)->Arg(16384);
+
+void BM_FreelistAllocate(benchmark::State &state) {
+  // every other id is free and the only run long enough sits at the end
+  const auto ids = static_cast<std::size_t>(state.range(0));
+  kv::PageBuffer buf{(ids * sizeof(kv::Pgid)) / kv::OS::DEFAULT_PAGE_SIZE + 2,
+                     kv::OS::DEFAULT_PAGE_SIZE};
+  auto &p = buf.GetPage(0);
+  p.SetCount(ids);
+  auto *data = p.GetDataAs<kv::Pgid>();
+  for (std::size_t i = 0; i < ids; i++) {
+    data[i] = i < ids - 8 ? 4 + 2 * i : 4 + 2 * ids + i;
+  }
+  kv::Freelist freelist;
+  for (auto _ : state) {
+    state.PauseTiming();
+    freelist.Read(p);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(freelist.Allocate(4));
+  }
+}
+BENCHMARK(BM_FreelistAllocate)->Arg(1024)->Arg(65536);
+
+void BM_MetaSum64(benchmark::State &state) {
+  kv::Meta meta;
+  meta.SetWatermark(1 << 20);
+  meta.SetTxid(12345);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(meta.Sum64());
+  }
+}
+BENCHMARK(BM_MetaSum64);
+
+void BM_PageWrite(benchmark::State &state) {
+  const auto keys = SortedKeys(state.range(0));
+  kv::Node n{};
+  for (const auto &k : keys) {
+    n.Put(k, k);
+  }
+  kv::PageBuffer buf{(n.GetStorageSize() / kv::OS::DEFAULT_PAGE_SIZE) + 1,
+                     kv::OS::DEFAULT_PAGE_SIZE};
+  auto &p = buf.GetPage(0);
+  for (auto _ : state) {
+    n.Write(p);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * n.GetStorageSize());
+}
+BENCHMARK(BM_PageWrite)->Arg(64)->Arg(1024);
+
+void BM_PageRead(benchmark::State &state) {
+  const auto keys = SortedKeys(state.range(0));
+  kv::Node n{};
+  for (const auto &k : keys) {
+    n.Put(k, k);
+  }
+  kv::PageBuffer buf{(n.GetStorageSize() / kv::OS::DEFAULT_PAGE_SIZE) + 1,
+                     kv::OS::DEFAULT_PAGE_SIZE};
+  auto &p = buf.GetPage(0);
+  n.Write(p);
+  for (auto _ : state) {
+    kv::Node read{};
+    read.Read(p);
+    benchmark::DoNotOptimize(read.GetElements().size());
+  }
+  state.SetBytesProcessed(state.iterations() * n.GetStorageSize());
+}
+BENCHMARK(BM_PageRead)->Arg(64)->Arg(1024);
+
+} // namespace bench
@@ -0,0 +1,74 @@
+#include "db.h"
+#include "typed_bucket.h"
+#include <array>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <filesystem>
+#include <tuple>
+
+// Gets of 16 byte (uint64, uint64) keys whose first words repeat in runs of
+// 64, so most probes tie on the key prefix. The argument picks the search, 0
+// for the bytewise order of Bucket and 1 for the FixedOrder of TypedBucket.
+namespace bench {
+
+using TypedKey = std::tuple<std::uint64_t, std::uint64_t>;
+using TypedKeyCodec = kv::OrderedCodec<TypedKey>;
+constexpr std::uint64_t TYPED_KEYS = 200000;
+
+[[nodiscard]] TypedKey TypedKeyAt(std::uint64_t i) { return {i / 64, i}; }
+
+[[nodiscard]] kv::DB::RAII_DB LoadTypedDB(const std::filesystem::path &path) {
+  std::filesystem::remove(path);
+  auto db = kv::DB::Open(path, {.sync_mode_ = kv::SyncMode::None});
+  if (!db) {
+    return nullptr;
+  }
+  auto err = (*db)->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("t"); !b) {
+      return b.error();
+    }
+    kv::TypedBucket<TypedKey, std::uint64_t> b{std::move(*tx.GetBucket("t"))};
+    for (std::uint64_t i = 0; i < TYPED_KEYS; i++) {
+      if (auto e = b.Put(TypedKeyAt(i), i)) {
+        return e;
+      }
+    }
+    return {};
+  });
+  return err ? nullptr : std::move(*db);
+}
+
+void BM_TypedGet(benchmark::State &state) {
+  const std::filesystem::path path = "./typed_bench.db";
+  auto db = LoadTypedDB(path);
+  if (!db) {
+    state.SkipWithError("failed to load the db");
+    return;
+  }
+  std::uint64_t i = 0;
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::TypedBucket<TypedKey, std::uint64_t> b{std::move(*tx.GetBucket("t"))};
+    for (auto _ : state) {
+      const auto key = TypedKeyAt(i++ * 7919 % TYPED_KEYS);
+      if (state.range(0)) {
+        benchmark::DoNotOptimize(b.Get(key));
+      } else {
+        std::array<std::byte, TypedKeyCodec::SIZE> buf;
+        TypedKeyCodec::Encode<true>(key, buf.data());
+        benchmark::DoNotOptimize(
+            b.Raw().Get(kv::Slice{buf.data(), buf.size()}));
+      }
+    }
+    return {};
+  });
+  if (err) {
+    state.SkipWithError(err->message().c_str());
+  }
+  state.SetItemsProcessed(state.iterations());
+  db.reset();
+  std::filesystem::remove(path);
+}
+
+BENCHMARK(BM_TypedGet)->ArgName("fixed")->Arg(0)->Arg(1);
+
+} // namespace bench
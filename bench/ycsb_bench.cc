@@ -0,0 +1,269 @@
+#include "db.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/format.h>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// YCSB style workloads run through DB::Update and DB::View. The record count,
+// value size, sync mode and value cache budget are read from
+// KV_BENCH_RECORDS, KV_BENCH_VALUE_SIZE, KV_BENCH_SYNC (full, data, none) and
+// KV_BENCH_VALUE_CACHE (bytes, 0 disables).
+namespace bench {
+
+enum class Distribution { Uniform, Zipfian, Sequential };
+
+std::size_t EnvOr(const char *name, std::size_t fallback) {
+  const char *v = std::getenv(name);
+  return v ? std::strtoull(v, nullptr, 10) : fallback;
+}
+
+kv::SyncMode SyncModeFromEnv() {
+  const char *v = std::getenv("KV_BENCH_SYNC");
+  const std::string_view mode = v ? v : "none";
+  if (mode == "full") {
+    return kv::SyncMode::Full;
+  }
+  if (mode == "data") {
+    return kv::SyncMode::Data;
+  }
+  return kv::SyncMode::None;
+}
+
+// Zipfian picks items in [0, n) with the skew of the YCSB generator, item 0
+// being the most popular (Gray et al, "Quickly generating billion-record
+// synthetic databases").
+class Zipfian {
+  static constexpr double THETA = 0.99;
+
+public:
+  explicit Zipfian(std::size_t n) noexcept : n_(n) {
+    for (std::size_t i = 1; i <= n_; i++) {
+      zetan_ += 1.0 / std::pow(static_cast<double>(i), THETA);
+    }
+    const double zeta2 = 1.0 + 1.0 / std::pow(2.0, THETA);
+    alpha_ = 1.0 / (1.0 - THETA);
+    eta_ = (1.0 - std::pow(2.0 / static_cast<double>(n_), 1.0 - THETA)) /
+           (1.0 - zeta2 / zetan_);
+  }
+
+  std::size_t Next(std::mt19937_64 &rng) noexcept {
+    const double u = std::uniform_real_distribution<double>{0.0, 1.0}(rng);
+    const double uz = u * zetan_;
+    if (uz < 1.0) {
+      return 0;
+    }
+    if (uz < 1.0 + std::pow(0.5, THETA)) {
+      return 1;
+    }
+    return static_cast<std::size_t>(
+        static_cast<double>(n_) *
+        std::pow(eta_ * u - eta_ + 1.0, alpha_));
+  }
+
+private:
+  std::size_t n_;
+  double zetan_{0};
+  double alpha_{0};
+  double eta_{0};
+};
+
+// KeyChooser picks the records operations run against.
+class KeyChooser {
+public:
+  KeyChooser(Distribution dist, std::size_t records) noexcept
+      : dist_(dist), zipf_(records) {}
+
+  // Next returns a record in [0, records), latest favours the newest ones.
+  std::size_t Next(std::mt19937_64 &rng, std::size_t records,
+                   bool latest = false) noexcept {
+    std::size_t i = 0;
+    switch (dist_) {
+    case Distribution::Uniform:
+      i = std::uniform_int_distribution<std::size_t>{0, records - 1}(rng);
+      break;
+    case Distribution::Zipfian:
+      i = std::min(zipf_.Next(rng), records - 1);
+      break;
+    case Distribution::Sequential:
+      i = seq_++ % records;
+      break;
+    }
+    return latest ? records - 1 - i : i;
+  }
+
+private:
+  Distribution dist_;
+  Zipfian zipf_;
+  std::size_t seq_{0};
+};
+
+std::string Key(std::size_t i) { return fmt::format("user{:012}", i); }
+
+// Operation mix of a workload, in percent.
+struct Workload {
+  int read_;
+  int update_;
+  int insert_;
+  int scan_;
+  int read_modify_write_;
+  // reads target the newest records
+  bool latest_;
+};
+
+constexpr Workload WORKLOAD_A{50, 50, 0, 0, 0, false};
+constexpr Workload WORKLOAD_B{95, 5, 0, 0, 0, false};
+constexpr Workload WORKLOAD_C{100, 0, 0, 0, 0, false};
+constexpr Workload WORKLOAD_D{95, 0, 5, 0, 0, true};
+constexpr Workload WORKLOAD_E{0, 0, 5, 95, 0, false};
+constexpr Workload WORKLOAD_F{50, 0, 0, 0, 50, false};
+
+// The longest scan of workload E.
+constexpr std::size_t MAX_SCAN = 100;
+
+[[nodiscard]] kv::DB::RAII_DB Load(const std::filesystem::path &path,
+                                   std::size_t records,
+                                   const std::string &value) {
+  std::filesystem::remove(path);
+  auto db = kv::DB::Open(
+      path, {.sync_mode_ = SyncModeFromEnv(),
+             .value_cache_bytes_ = EnvOr("KV_BENCH_VALUE_CACHE", 0)});
+  if (!db) {
+    return nullptr;
+  }
+  auto err = (*db)->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("usertable");
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  constexpr std::size_t batch = 1000;
+  for (std::size_t i = 0; !err && i < records; i += batch) {
+    err = (*db)->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("usertable");
+      for (std::size_t j = i; j < std::min(i + batch, records); j++) {
+        if (auto e = b->Put(Key(j), value)) {
+          return e;
+        }
+      }
+      return {};
+    });
+  }
+  return err ? nullptr : std::move(*db);
+}
+
+void RunWorkload(benchmark::State &state, Workload w) {
+  const auto dist = static_cast<Distribution>(state.range(0));
+  const std::size_t initial = EnvOr("KV_BENCH_RECORDS", 10000);
+  const std::string value(EnvOr("KV_BENCH_VALUE_SIZE", 100), 'v');
+  const std::filesystem::path path = "./ycsb_bench.db";
+  auto db = Load(path, initial, value);
+  if (!db) {
+    state.SkipWithError("failed to load the db");
+    return;
+  }
+
+  std::mt19937_64 rng{42};
+  KeyChooser chooser{dist, initial};
+  std::uniform_int_distribution<int> op{0, 99};
+  std::size_t records = initial;
+  std::vector<double> latencies;
+  std::optional<kv::Error> err;
+
+  auto read = [&](std::size_t i) {
+    return db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      benchmark::DoNotOptimize(tx.GetBucket("usertable")->Get(Key(i)));
+      return {};
+    });
+  };
+  auto write = [&](std::size_t i) {
+    return db->Update([&](kv::Tx &tx) {
+      return tx.GetBucket("usertable")->Put(Key(i), value);
+    });
+  };
+
+  for (auto _ : state) {
+    const auto start = std::chrono::steady_clock::now();
+    int dice = op(rng);
+    if ((dice -= w.read_) < 0) {
+      err = read(chooser.Next(rng, records, w.latest_));
+    } else if ((dice -= w.update_) < 0) {
+      err = write(chooser.Next(rng, records));
+    } else if ((dice -= w.insert_) < 0) {
+      err = write(records++);
+    } else if ((dice -= w.scan_) < 0) {
+      // the cursor has no iteration yet, a scan reads consecutive keys
+      const auto first = chooser.Next(rng, records);
+      const auto len =
+          std::uniform_int_distribution<std::size_t>{1, MAX_SCAN}(rng);
+      err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        auto b = tx.GetBucket("usertable");
+        for (auto i = first; i < std::min(first + len, records); i++) {
+          benchmark::DoNotOptimize(b->Get(Key(i)));
+        }
+        return {};
+      });
+    } else {
+      const auto i = chooser.Next(rng, records);
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        auto b = tx.GetBucket("usertable");
+        auto cur = b->Get(Key(i));
+        auto next = cur ? cur->ToString() : value;
+        next.back() = static_cast<char>('a' + next.size() % 26);
+        return b->Put(Key(i), next);
+      });
+    }
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    if (err) {
+      state.SkipWithError(err->message().c_str());
+      break;
+    }
+  }
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+      return latencies[static_cast<std::size_t>(
+          p * static_cast<double>(latencies.size() - 1))];
+    };
+    state.counters["p50_us"] = percentile(0.50);
+    state.counters["p99_us"] = percentile(0.99);
+    state.counters["p999_us"] = percentile(0.999);
+  }
+  state.counters["cache_hit_rate"] = db->GetStats().ValueCacheHitRate();
+  state.SetItemsProcessed(state.iterations());
+  db.reset();
+  std::filesystem::remove(path);
+}
+
+void BM_YcsbA(benchmark::State &state) { RunWorkload(state, WORKLOAD_A); }
+void BM_YcsbB(benchmark::State &state) { RunWorkload(state, WORKLOAD_B); }
+void BM_YcsbC(benchmark::State &state) { RunWorkload(state, WORKLOAD_C); }
+void BM_YcsbD(benchmark::State &state) { RunWorkload(state, WORKLOAD_D); }
+void BM_YcsbE(benchmark::State &state) { RunWorkload(state, WORKLOAD_E); }
+void BM_YcsbF(benchmark::State &state) { RunWorkload(state, WORKLOAD_F); }
+
+// The argument picks the key distribution.
+void Distributions(benchmark::internal::Benchmark *b) {
+  b->ArgName("dist");
+  for (auto d : {Distribution::Uniform, Distribution::Zipfian,
+                 Distribution::Sequential}) {
+    b->Arg(static_cast<int>(d));
+  }
+  b->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK(BM_YcsbA)->Apply(Distributions);
+BENCHMARK(BM_YcsbB)->Apply(Distributions);
+BENCHMARK(BM_YcsbC)->Apply(Distributions);
+BENCHMARK(BM_YcsbD)->Apply(Distributions);
+BENCHMARK(BM_YcsbE)->Apply(Distributions);
+BENCHMARK(BM_YcsbF)->Apply(Distributions);
+
+} // namespace bench
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "slice.h"
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace kv {
+
+// Monotonic allocator backing the memory of a transaction: its node and page
+// maps, node element vectors and key and value bytes. Deallocation is a no-op,
+// everything is released at once when the tx and its arena go away.
+class Arena final : public std::pmr::memory_resource {
+  static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+  // Allocations larger than this get a block of their own so they do not
+  // waste the rest of the current block.
+  static constexpr std::size_t LARGE_ALLOCATION = BLOCK_SIZE / 4;
+
+public:
+  Arena() noexcept = default;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  Arena(Arena &&) = delete;
+  Arena &operator=(Arena &&) = delete;
+  ~Arena() override = default;
+
+  // Copy copies the bytes of s into the arena and returns a slice of the copy.
+  [[nodiscard]] Slice Copy(const Slice &s) noexcept {
+    if (s.Size() == 0) {
+      return {};
+    }
+    auto *p = static_cast<std::byte *>(allocate(s.Size(), 1));
+    std::memcpy(p, s.Data(), s.Size());
+    return {p, s.Size()};
+  }
+
+  // MemoryUsage returns the bytes of all blocks the arena holds.
+  [[nodiscard]] std::size_t MemoryUsage() const noexcept { return usage_; }
+
+  [[nodiscard]] std::size_t BlockCount() const noexcept {
+    return blocks_.size();
+  }
+
+private:
+  void *do_allocate(std::size_t bytes, std::size_t alignment) noexcept final {
+    if (bytes > LARGE_ALLOCATION) {
+      return NewBlock(bytes + alignment, alignment, false);
+    }
+    void *p = cur_;
+    if (p && std::align(alignment, bytes, p, remaining_)) {
+      cur_ = static_cast<std::byte *>(p) + bytes;
+      remaining_ -= bytes;
+      return p;
+    }
+    p = NewBlock(BLOCK_SIZE, alignment, true);
+    cur_ = static_cast<std::byte *>(p) + bytes;
+    remaining_ -= bytes;
+    return p;
+  }
+
+  void do_deallocate(void *, std::size_t, std::size_t) noexcept final {}
+
+  [[nodiscard]] bool
+  do_is_equal(const std::pmr::memory_resource &other) const noexcept final {
+    return this == &other;
+  }
+
+  // NewBlock allocates a block of size bytes and returns its first address
+  // aligned to alignment. The current block moves to it if bump is set.
+  [[nodiscard]] void *NewBlock(std::size_t size, std::size_t alignment,
+                               bool bump) noexcept {
+    blocks_.push_back(std::make_unique_for_overwrite<std::byte[]>(size));
+    usage_ += size;
+    void *p = blocks_.back().get();
+    std::size_t space = size;
+    std::align(alignment, 0, p, space);
+    if (bump) {
+      cur_ = static_cast<std::byte *>(p);
+      remaining_ = space;
+    }
+    return p;
+  }
+
+  std::vector<std::unique_ptr<std::byte[]>> blocks_;
+  // next free byte of the current block
+  std::byte *cur_{nullptr};
+  std::size_t remaining_{0};
+  std::size_t usage_{0};
+};
+
+} // namespace kv
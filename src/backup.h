@@ -0,0 +1,232 @@
+#pragma once
+
+#include "checksum.h"
+#include "error.h"
+#include "fd.h"
+#include "file.h"
+#include "log.h"
+#include "options.h"
+#include "page.h"
+#include "page_journal.h"
+#include "type.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace kv {
+
+// BackupCopier copies byte ranges of the db file to a backup fd in chunks,
+// sleeping between chunks to keep to BackupOptions::bytes_per_sec_.
+class BackupCopier {
+public:
+  BackupCopier(int src_fd, int dst_fd, const BackupOptions &options,
+               std::size_t page_size) noexcept
+      : src_fd_(src_fd), dst_fd_(dst_fd),
+        bytes_per_sec_(options.bytes_per_sec_),
+        chunk_(std::max(options.chunk_size_, page_size)),
+        start_(std::chrono::steady_clock::now()) {
+    if (bytes_per_sec_) {
+      // small enough chunks that the throttle sleeps often and briefly
+      chunk_ = std::max(std::min(chunk_, bytes_per_sec_ / 10), page_size);
+    }
+  }
+
+  // Copy appends n bytes at offset of the db file to the backup.
+  [[nodiscard]] std::optional<Error> Copy(std::size_t offset,
+                                          std::size_t n) noexcept {
+    while (n > 0) {
+      const auto len = std::min(chunk_, n);
+      if (auto err = CopyRange(src_fd_, offset, dst_fd_, len)) {
+        return err;
+      }
+      offset += len;
+      n -= len;
+      copied_ += len;
+      if (bytes_per_sec_) {
+        const std::chrono::duration<double> due{
+            static_cast<double>(copied_) / static_cast<double>(bytes_per_sec_)};
+        std::this_thread::sleep_until(
+            start_ + std::chrono::duration_cast<std::chrono::nanoseconds>(due));
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  int src_fd_;
+  int dst_fd_;
+  std::size_t bytes_per_sec_;
+  std::size_t chunk_;
+  std::chrono::steady_clock::time_point start_;
+  std::size_t copied_{0};
+};
+
+// WriteAll writes n bytes at data to the current position of fd.
+[[nodiscard]] inline std::optional<Error> WriteAll(int fd, const void *data,
+                                                   std::size_t n) noexcept {
+  const auto *p = static_cast<const char *>(data);
+  while (n > 0) {
+    auto written = ::write(fd, p, n);
+    if (written <= 0) {
+      return Error{"IO Error"};
+    }
+    p += written;
+    n -= written;
+  }
+  return std::nullopt;
+}
+
+// Header of an incremental backup written by Tx::WriteIncrementalTo. It is
+// followed by the page runs, the meta page of the snapshot and the pages of
+// the runs in order.
+struct IncrementalHeader {
+  static constexpr std::uint64_t MAGIC = 0x4B56494E43520001;
+
+  std::uint64_t magic_{MAGIC};
+  std::uint64_t page_size_{0};
+  // txid of the copy the backup applies to
+  std::uint64_t since_{0};
+  // txid of the snapshot the backup brings the copy to
+  std::uint64_t txid_{0};
+  std::uint64_t runs_{0};
+  // crc of the header up to here and the runs
+  std::uint64_t checksum_{0};
+
+  [[nodiscard]] std::uint64_t
+  Checksum(std::span<const PageRun> runs) const noexcept {
+    auto crc = Crc32c::Value(this, offsetof(IncrementalHeader, checksum_));
+    return Crc32c::Extend(crc, runs.data(), runs.size_bytes());
+  }
+};
+
+// ApplyIncremental applies the incremental backup read from fd to the copy
+// of the db at path, which must be at the txid the backup was taken since.
+// Pages are written and synced before the metas. The meta slot not holding
+// the copy's newest meta is written and synced before the other one, so a
+// crash at any point leaves one valid meta at the old or the new txid.
+// Returns the txid the copy is at.
+[[nodiscard]] inline std::expected<Txid, Error>
+ApplyIncremental(const std::filesystem::path &path, int fd) noexcept {
+  auto read_at = [fd](void *data, std::size_t n, std::size_t offset) {
+    return PosixFile{fd}.ReadAt(data, n, offset);
+  };
+  IncrementalHeader header;
+  if (auto err = read_at(&header, sizeof(header), 0)) {
+    return std::unexpected{*err};
+  }
+  if (header.magic_ != IncrementalHeader::MAGIC ||
+      header.page_size_ < Options::MIN_PAGE_SIZE ||
+      header.page_size_ > Options::MAX_PAGE_SIZE) {
+    return std::unexpected{Error{"Not an incremental backup"}};
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == -1) {
+    return std::unexpected{Error{"IO Error"}};
+  }
+  const auto size = static_cast<std::size_t>(st.st_size);
+  // the count is not covered by the checksum until the runs are read
+  if (header.runs_ > (size - sizeof(header)) / sizeof(PageRun)) {
+    return std::unexpected{Error{"Incremental backup truncated"}};
+  }
+  std::vector<PageRun> runs(header.runs_);
+  if (auto err = read_at(runs.data(), runs.size() * sizeof(PageRun),
+                         sizeof(header))) {
+    return std::unexpected{*err};
+  }
+  if (header.checksum_ != header.Checksum(runs)) {
+    return std::unexpected{Error{"Incremental backup header corrupted"}};
+  }
+  const auto page_size = header.page_size_;
+  PageBuffer meta_page{1, page_size};
+  auto offset = sizeof(header) + runs.size() * sizeof(PageRun);
+  if (auto err = read_at(meta_page.GetBuffer().data(), page_size, offset)) {
+    return std::unexpected{*err};
+  }
+  offset += page_size;
+  // the runs must fit below the watermark of the meta and in the input
+  const auto &meta = *meta_page.GetPage(0).GetDataAs<Meta>();
+  if (meta.Validate() || meta.GetTxid() != header.txid_ ||
+      meta.GetPageSize() != page_size) {
+    return std::unexpected{Error{"Incremental backup meta page corrupted"}};
+  }
+  for (auto end = offset; const auto &run : runs) {
+    if (run.count_ > meta.GetWatermark() ||
+        run.pgid_ > meta.GetWatermark() - run.count_) {
+      return std::unexpected{
+          Error{"Incremental backup page run past the watermark"}};
+    }
+    if (end > size || run.count_ > (size - end) / page_size) {
+      return std::unexpected{Error{"Incremental backup truncated"}};
+    }
+    end += run.count_ * page_size;
+  }
+
+  Fd base{::open(path.c_str(), O_RDWR)};
+  if (!base.IsValid()) {
+    return std::unexpected{Error{"Failed to open backup copy"}};
+  }
+  PosixFile file{base.GetFd()};
+  // the copy is at the txid of its newest valid meta
+  PageBuffer metas{2, page_size};
+  if (auto err = file.ReadAt(metas.GetBuffer().data(), 2 * page_size, 0)) {
+    return std::unexpected{*err};
+  }
+  std::optional<Txid> base_txid;
+  // meta slot holding base_txid
+  Pgid base_slot = 0;
+  for (Pgid id = 0; id < 2; id++) {
+    const auto &m = *metas.GetPage(id).GetDataAs<Meta>();
+    if (!m.Validate() && m.GetPageSize() == page_size &&
+        (!base_txid || m.GetTxid() > *base_txid)) {
+      base_txid = m.GetTxid();
+      base_slot = id;
+    }
+  }
+  if (!base_txid) {
+    return std::unexpected{Error{"Backup copy has no valid meta"}};
+  }
+  if (*base_txid != header.since_) {
+    LOG_ERROR("Backup copy is at txid {}, incremental backup applies to {}",
+              *base_txid, header.since_);
+    return std::unexpected{Error{"Incremental backup does not apply to copy"}};
+  }
+
+  for (const auto &run : runs) {
+    if (::lseek(base.GetFd(), static_cast<off_t>(run.pgid_ * page_size),
+                SEEK_SET) == -1) {
+      return std::unexpected{Error{"IO Error"}};
+    }
+    const auto n = run.count_ * page_size;
+    if (auto err = CopyRange(fd, offset, base.GetFd(), n)) {
+      return std::unexpected{*err};
+    }
+    offset += n;
+  }
+  if (auto err = base.Sync()) {
+    return std::unexpected{*err};
+  }
+  for (Pgid id : {1 - base_slot, base_slot}) {
+    auto &p = meta_page.GetPage(0);
+    p.SetId(id);
+    p.UpdateChecksum(page_size);
+    if (auto err = file.WriteAt(&p, page_size, id * page_size)) {
+      return std::unexpected{*err};
+    }
+    if (auto err = base.Sync()) {
+      return std::unexpected{*err};
+    }
+  }
+  return header.txid_;
+}
+
+} // namespace kv
@@ -0,0 +1,361 @@
+#pragma once
+
+#include "disk.h"
+#include "hash_table.h"
+#include "page.h"
+#include "slice.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "tx_cache.h"
+#include "type.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace kv {
+
+// BloomFilter is a split block Bloom filter. A key sets one bit in each of
+// the 8 words of the 32 byte block its hash picks, so a probe reads a single
+// cache line and the masks of the 8 words are computed in one vectorizable
+// loop. Bits are set with relaxed atomics so lookups can run while a commit
+// adds its keys.
+class BloomFilter {
+  static constexpr std::size_t WORDS = 8;
+  static constexpr std::size_t BLOCK_BITS = WORDS * 32;
+  static constexpr std::array<std::uint32_t, WORDS> SALT = {
+      0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+public:
+  // capacity keys can be added before the false positive rate exceeds
+  // fp_rate.
+  BloomFilter(std::size_t capacity, double fp_rate) noexcept
+      : capacity_(capacity) {
+    const auto bits = static_cast<double>(capacity) * BitsPerKey(fp_rate);
+    blocks_count_ = std::max<std::size_t>(
+        1, static_cast<std::size_t>(std::ceil(bits / BLOCK_BITS)));
+    blocks_ = std::make_unique<Block[]>(blocks_count_);
+  }
+
+  [[nodiscard]] static std::uint64_t Hash(const Slice &key) noexcept {
+    return std::hash<std::string_view>{}(
+        {reinterpret_cast<const char *>(key.Data()), key.Size()});
+  }
+
+  void Add(std::uint64_t hash) noexcept {
+    auto &block = blocks_[BlockIndex(hash)];
+    const auto masks = Masks(hash);
+    for (std::size_t i = 0; i < WORDS; i++) {
+      block.words_[i].fetch_or(masks[i], std::memory_order_relaxed);
+    }
+    count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] bool MayContain(std::uint64_t hash) const noexcept {
+    const auto &block = blocks_[BlockIndex(hash)];
+    const auto masks = Masks(hash);
+    std::uint32_t missing = 0;
+    for (std::size_t i = 0; i < WORDS; i++) {
+      missing |= ~block.words_[i].load(std::memory_order_relaxed) & masks[i];
+    }
+    return missing == 0;
+  }
+
+  // Full returns whether more keys than the capacity were added.
+  [[nodiscard]] bool Full() const noexcept {
+    return count_.load(std::memory_order_relaxed) > capacity_;
+  }
+
+  [[nodiscard]] std::size_t Bytes() const noexcept {
+    return blocks_count_ * sizeof(Block);
+  }
+
+  // BitsPerKey returns the bits per key that keep a filter with 8 probes
+  // under fp_rate, with a margin for the uneven load of the blocks.
+  [[nodiscard]] static double BitsPerKey(double fp_rate) noexcept {
+    double bits = 4;
+    while (bits < 64 &&
+           std::pow(1 - std::exp(-static_cast<double>(WORDS) / bits),
+                    static_cast<double>(WORDS)) > fp_rate) {
+      bits += 0.5;
+    }
+    return bits * 1.2;
+  }
+
+private:
+  struct alignas(32) Block {
+    std::array<std::atomic<std::uint32_t>, WORDS> words_{};
+  };
+
+  [[nodiscard]] std::size_t BlockIndex(std::uint64_t hash) const noexcept {
+    return static_cast<std::size_t>(((hash >> 32) * blocks_count_) >> 32);
+  }
+
+  [[nodiscard]] static std::array<std::uint32_t, WORDS>
+  Masks(std::uint64_t hash) noexcept {
+    const auto h = static_cast<std::uint32_t>(hash);
+    std::array<std::uint32_t, WORDS> masks;
+    for (std::size_t i = 0; i < WORDS; i++) {
+      masks[i] = std::uint32_t{1} << ((h * SALT[i]) >> 27);
+    }
+    return masks;
+  }
+
+  std::size_t capacity_;
+  std::size_t blocks_count_;
+  std::unique_ptr<Block[]> blocks_;
+  std::atomic<std::size_t> count_{0};
+};
+
+// BloomFilters holds the filters of the buckets read txs looked keys up in,
+// keyed by bucket path. The first time a read tx of the latest commit needs a
+// filter it is built from the tree on a background thread, lookups go to the
+// tree until it is ready, and the commits that follow keep it up to date.
+// Buckets have no deletes, so a filter holding every key of the
+// latest commit holds every key of older snapshots too. Snapshots newer than
+// the last commit that added its keys are not filtered.
+class BloomFilters {
+  // smallest capacity a filter is built with
+  static constexpr std::size_t MIN_CAPACITY = 1024;
+
+public:
+  // Keys a commit put in the bucket at path, all_ if it put too many to
+  // record.
+  struct Written {
+    const std::string &path_;
+    std::span<const std::string> keys_;
+    bool all_;
+  };
+
+  BloomFilters(double fp_rate, Stats &stats) noexcept
+      : fp_rate_(fp_rate), stats_(stats) {}
+
+  ~BloomFilters() noexcept { Cancel(); }
+
+  // MayContain returns whether key may be in the bucket at path as seen by a
+  // tx of snapshot txid, starting to build the filter of the bucket rooted at
+  // root if needed. Returns nullopt when there is no filter to consult yet.
+  [[nodiscard]] std::optional<bool> MayContain(Txid txid,
+                                               const std::string &path,
+                                               DiskHandler &disk, Pgid root,
+                                               const Slice &key) noexcept {
+    auto filter = Get(txid, path);
+    if (!filter) {
+      if (auto epoch = Claim(txid, path)) {
+        BuildInBackground(txid, path, disk, root, *epoch);
+      }
+      return std::nullopt;
+    }
+    stats_.Add(Counter::BloomChecks);
+    if (!filter->MayContain(BloomFilter::Hash(key))) {
+      stats_.Add(Counter::BloomNegatives);
+      return false;
+    }
+    return true;
+  }
+
+  // FalsePositive counts a lookup the filter let through that found nothing.
+  void FalsePositive() noexcept { stats_.Add(Counter::BloomFalsePositives); }
+
+  // Publish adds the keys the commit of txid put to the filters and opens
+  // its snapshot to them. Called by the writer once the commit is durable.
+  void Publish(Txid txid, std::span<const Written> written) noexcept {
+    std::unique_lock lock(mu_);
+    // a commit that was never published may have put any key
+    if (txid != covered_ + 1) {
+      filters_.clear();
+    }
+    for (const auto &w : written) {
+      auto it = filters_.find(w.path_);
+      if (it == filters_.end()) {
+        continue;
+      }
+      for (const auto &key : w.keys_) {
+        it->second->Add(BloomFilter::Hash(key));
+      }
+      // rebuilt at the right size by the next lookup
+      if (w.all_ || it->second->Full()) {
+        filters_.erase(it);
+      }
+    }
+    covered_ = txid;
+  }
+
+  // Reset drops every filter, used when the db is opened or its file
+  // replaced.
+  void Reset(Txid txid) noexcept {
+    std::unique_lock lock(mu_);
+    filters_.clear();
+    building_.clear();
+    covered_ = txid;
+    epoch_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Cancel abandons the filters being built and waits for the builder to
+  // stop, which lets go of the file. Called before the file is closed or
+  // replaced.
+  void Cancel() noexcept {
+    {
+      std::unique_lock lock(mu_);
+      building_.clear();
+      epoch_.fetch_add(1, std::memory_order_relaxed);
+    }
+    builder_.Wait();
+  }
+
+  // Bytes returns the memory of the filters.
+  [[nodiscard]] std::size_t Bytes() const noexcept {
+    std::shared_lock lock(mu_);
+    std::size_t bytes = 0;
+    for (const auto &[_, f] : filters_) {
+      bytes += f->Bytes();
+    }
+    return bytes;
+  }
+
+private:
+  [[nodiscard]] std::shared_ptr<const BloomFilter>
+  Get(Txid txid, const std::string &path) const noexcept {
+    std::shared_lock lock(mu_);
+    if (txid > covered_) {
+      return nullptr;
+    }
+    auto it = filters_.find(path);
+    return it == filters_.end() ? nullptr : it->second;
+  }
+
+  // Claim returns the epoch to build the filter of path in if the tx of
+  // txid should build it. Only txs of the latest commit do, one at a time.
+  [[nodiscard]] std::optional<std::uint64_t>
+  Claim(Txid txid, const std::string &path) noexcept {
+    std::unique_lock lock(mu_);
+    if (txid != covered_ || filters_.contains(path) ||
+        !building_.insert(path).second) {
+      return std::nullopt;
+    }
+    return epoch_.load(std::memory_order_relaxed);
+  }
+
+  // BuildInBackground builds the filter of the bucket at path on the builder
+  // thread. The build keeps the file from being replaced, or is not started
+  // if a replace is pending.
+  void BuildInBackground(Txid txid, const std::string &path,
+                         DiskHandler &disk, Pgid root,
+                         std::uint64_t epoch) noexcept {
+    auto filelock = std::make_shared<std::shared_lock<std::shared_mutex>>(
+        disk.TryLockFileShared());
+    if (!filelock->owns_lock()) {
+      Install(txid, path, epoch, nullptr);
+      return;
+    }
+    builder_.Submit([this, txid, path, &disk, root, epoch, filelock] {
+      Install(txid, path, epoch, Build(disk, root, epoch));
+      filelock->unlock();
+    });
+  }
+
+  // Install keeps a filter built for txid in epoch unless a commit was
+  // published or the filters were dropped since.
+  void Install(Txid txid, const std::string &path, std::uint64_t epoch,
+               std::shared_ptr<BloomFilter> filter) noexcept {
+    std::unique_lock lock(mu_);
+    if (epoch != epoch_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    building_.erase(path);
+    if (filter && txid == covered_) {
+      filters_.insert_or_assign(path, std::move(filter));
+    }
+  }
+
+  // Build collects the keys of the committed tree rooted at root. Returns
+  // null if a page of the tree is corrupted, a filter missing its keys would
+  // hide them from every tx, or if the build was cancelled.
+  [[nodiscard]] std::shared_ptr<BloomFilter>
+  Build(DiskHandler &disk, Pgid root, std::uint64_t epoch) noexcept {
+    std::vector<std::uint64_t> hashes;
+    if (!Collect(disk, root, epoch, hashes)) {
+      return nullptr;
+    }
+    auto filter = std::make_shared<BloomFilter>(
+        std::max(2 * hashes.size(), MIN_CAPACITY), fp_rate_);
+    for (auto h : hashes) {
+      filter->Add(h);
+    }
+    return filter;
+  }
+
+  [[nodiscard]] bool Collect(DiskHandler &disk, Pgid pgid, std::uint64_t epoch,
+                             std::vector<std::uint64_t> &hashes) noexcept {
+    if (epoch != epoch_.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    std::vector<Pgid> children;
+    {
+      // held a page at a time so remapping writers do not wait for the build
+      auto mmaplock = disk.LockMmapShared();
+      // a handler per page so decoded pages are freed once read
+      ShadowPageHandler pages{disk, false};
+      auto &p = pages.GetPage(pgid);
+      if (pages.Err()) {
+        return false;
+      }
+      if (p.Flags() & static_cast<std::size_t>(PageFlag::BranchPage)) {
+        auto &branch = p.AsPage<BranchPage>();
+        for (std::size_t i = 0; i < branch.Count(); i++) {
+          children.push_back(branch.GetPgid(i));
+        }
+      } else if (p.Flags() & static_cast<std::size_t>(PageFlag::HashPage)) {
+        children = HashTable::Leaves(pages, pgid);
+        if (pages.Err()) {
+          return false;
+        }
+      } else {
+        auto &leaf = p.AsPage<LeafPage>();
+        for (std::size_t i = 0; i < leaf.Count(); i++) {
+          // nested buckets are never found by lookups
+          if (!(leaf.GetElement(i).flags_ &
+                static_cast<std::uint32_t>(LeafFlag::Bucket))) {
+            hashes.push_back(BloomFilter::Hash(leaf.GetKey(i)));
+          }
+        }
+      }
+    }
+    for (Pgid child : children) {
+      if (!Collect(disk, child, epoch, hashes)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const double fp_rate_;
+  Stats &stats_;
+  // protects the fields below
+  mutable std::shared_mutex mu_;
+  std::unordered_map<std::string, std::shared_ptr<BloomFilter>> filters_;
+  // buckets whose filter a tx is building
+  std::unordered_set<std::string> building_;
+  // last commit whose keys are in the filters
+  Txid covered_{0};
+  // bumped when the filters are dropped, builds of an older epoch are
+  // abandoned
+  std::atomic<std::uint64_t> epoch_{0};
+  // builds filters off the lookup path, destroyed first as its tasks use the
+  // fields above
+  ThreadPool builder_{1};
+};
+
+} // namespace kv
@@ -1,29 +1,91 @@
 #pragma once
 
+#include "bloom.h"
+#include "bucket_stats.h"
 #include "cursor.h"
+#include "hash_table.h"
 #include "log.h"
 #include "page.h"
 #include "persist.h"
 #include "type.h"
+#include "value_cache.h"
+#include <array>
 #include <cassert>
+#include <expected>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace kv {
 
-// Bucket associated with a tx
+// BucketState is the state of a bucket opened by a tx. The tx owns it so all
+// handles of the bucket see the root that spilling moves.
+struct BucketState {
+  // keys a write tx records before it invalidates all cached lookups
+  static constexpr std::size_t MAX_WRITTEN = 1 << 16;
+
+  BucketState(std::string name, BucketMeta meta,
+              const BucketState *parent = nullptr) noexcept
+      : name_(std::move(name)), meta_(meta) {
+    if (parent) {
+      const auto len = static_cast<std::uint32_t>(name_.size());
+      path_ = parent->path_;
+      path_.append(reinterpret_cast<const char *>(&len), sizeof(len));
+      path_.append(name_);
+    }
+  }
+
+  // Written records a key put by a write tx.
+  void Written(const Slice &key) noexcept {
+    if (written_.size() < MAX_WRITTEN) {
+      written_.push_back(key.ToString());
+    } else {
+      written_all_ = true;
+    }
+  }
+
+  std::string name_;
+  // length prefixed names from the catalog down, empty for the catalog
+  std::string path_;
+  BucketMeta meta_;
+  // the root moved, the entry in the parent bucket has to be rewritten
+  bool dirty_{false};
+  // nested buckets opened by the tx
+  std::unordered_map<std::string, std::unique_ptr<BucketState>> children_{};
+  // keys put by a write tx, published to the value cache and the bloom
+  // filters on commit
+  std::vector<std::string> written_{};
+  bool written_all_{false};
+  // hash table of a hash bucket the tx put keys in
+  std::unique_ptr<HashTable> hash_{};
+};
+
+// Bucket associated with a tx. The bucket's tree stores its key values and
+// the metas of its nested buckets, marked by LeafFlag::Bucket. The catalog of
+// top level buckets is the tree the db meta points to. Buckets created with
+// BucketFlag::Hash store their keys in a HashTable instead, they only serve
+// Get and Put and hold no nested buckets.
 class Bucket {
 private:
   // only used for write tx
   ShadowPageHandler &sp_handler_;
-  const std::string &name_;
-  const BucketMeta &meta_;
+  // meta of the tx, pages of new buckets are allocated from it
+  Meta &tx_meta_;
+  BucketState &state_;
+  // shared by the txs of the db, null when disabled
+  ValueCache *value_cache_;
+  BloomFilters *filters_;
 
 public:
-  Bucket(ShadowPageHandler &sp_handler, const std::string &name,
-         const BucketMeta &meta) noexcept
-      : sp_handler_(sp_handler), name_(name), meta_(meta) {}
+  Bucket(ShadowPageHandler &sp_handler, Meta &tx_meta, BucketState &state,
+         ValueCache *value_cache = nullptr,
+         BloomFilters *filters = nullptr) noexcept
+      : sp_handler_(sp_handler), tx_meta_(tx_meta), state_(state),
+        value_cache_(value_cache), filters_(filters) {}
 
   Bucket(const Bucket &) = delete;
   Bucket &operator=(const Bucket &) = delete;
@@ -31,28 +93,85 @@ public:
   Bucket &operator=(Bucket &&) = delete;
   ~Bucket() = default;
 
-  [[nodiscard]] const BucketMeta &GetMetaTest() const noexcept { return meta_; }
-  [[nodiscard]] const std::string &Name() const noexcept { return name_; }
+  [[nodiscard]] const BucketMeta &GetMetaTest() const noexcept {
+    return state_.meta_;
+  }
+  [[nodiscard]] const std::string &Name() const noexcept {
+    return state_.name_;
+  }
   // [[nodiscard]] bool Writable() const noexcept { return meta_.;};
-  [[nodiscard]] Cursor CreateCursor() const noexcept {
+  // CreateCursor returns a cursor over the tree of the bucket. Hash buckets
+  // keep their keys in no order and have no tree to walk.
+  [[nodiscard]] std::expected<Cursor, Error> CreateCursor() const noexcept {
     // todo: if tx is closed return err
-    auto c = Cursor{sp_handler_, meta_};
-    return c;
+    if (state_.meta_.Hashed()) {
+      return std::unexpected{Error{"Hash buckets can not be iterated"}};
+    }
+    return TreeCursor();
   }
+  // Get returns the value of key. Order breaks the ties of key prefixes in
+  // the tree search, TypedBucket passes FixedOrder for fixed width keys.
+  // Nothing is found once the tx read a corrupted page, see Tx::Err.
+  template <typename Order = BytewiseOrder>
   [[nodiscard]] std::optional<Slice> Get(const Slice &key) const noexcept {
     // validations
     LOG_INFO("getting {}", key.ToString());
-    auto c = CreateCursor();
-    auto opt = c.Seek(key);
-    if (!opt.has_value())
+    if (sp_handler_.Err()) {
       return std::nullopt;
-    auto [k, v] = opt.value();
-    if (k != key) {
+    }
+    // read txs skip keys the bloom filter rules out
+    std::optional<bool> may_contain;
+    if (filters_ && !sp_handler_.Writable()) {
+      may_contain =
+          filters_->MayContain(tx_meta_.GetTxid(), state_.path_,
+                               sp_handler_.Disk(), state_.meta_.Root(), key);
+      if (may_contain == false) {
+        return std::nullopt;
+      }
+    }
+    // read txs share their lookups through the value cache
+    const bool cached = value_cache_ && !sp_handler_.Writable();
+    std::string cache_key;
+    if (cached) {
+      cache_key = ValueCache::Key(state_.path_, key);
+      if (auto loc = value_cache_->Get(tx_meta_.GetTxid(), cache_key)) {
+        if (!loc->found_) {
+          return std::nullopt;
+        }
+        return Slice{static_cast<const std::byte *>(
+                         sp_handler_.Disk().GetAddress(loc->pos_)),
+                     loc->len_};
+      }
+    }
+    auto found = Lookup<Order>(key);
+    if (sp_handler_.Err()) {
       return std::nullopt;
     }
+    if (!found) {
+      if (may_contain) {
+        filters_->FalsePositive();
+      }
+      if (cached) {
+        value_cache_->Put(tx_meta_.GetTxid(), std::move(cache_key), {});
+      }
+      return std::nullopt;
+    }
+    auto v = *found;
+    // values of compressed leaves point into a decoded page the tx may evict
+    if (state_.meta_.Compressed()) {
+      v = sp_handler_.CopyOut(v);
+    }
     LOG_WARN("got {}", v.ToString());
+    // values of compressed leaves live in the tx and can not be shared
+    if (cached) {
+      if (auto pos = sp_handler_.Disk().MmapOffset(v.Data())) {
+        value_cache_->Put(tx_meta_.GetTxid(), std::move(cache_key),
+                          {*pos, v.Size(), true});
+      }
+    }
     return v;
   }
+  template <typename Order = BytewiseOrder>
   [[nodiscard]] std::optional<Error> Put(const Slice &key,
                                          const Slice &val) noexcept {
     LOG_INFO("putting {}", key.ToString());
@@ -60,107 +179,246 @@ public:
     if (key.Size() == 0) {
       return Error{"Key size cannot be zero."};
     }
-    auto c = CreateCursor();
-    auto _ = c.Seek(key);
+    if (sp_handler_.Err()) {
+      return sp_handler_.Err();
+    }
+    if (state_.meta_.Hashed()) {
+      if (!state_.hash_) {
+        state_.hash_ = std::make_unique<HashTable>(sp_handler_, state_.meta_);
+        if (sp_handler_.Err()) {
+          return sp_handler_.Err();
+        }
+      }
+      if (auto e = state_.hash_->Put(key, val)) {
+        return e;
+      }
+      if (value_cache_ || filters_) {
+        state_.Written(key);
+      }
+      return {};
+    }
+    auto c = TreeCursor();
+    auto opt = c.Seek<Order>(key);
+    if (opt && Order::Equal(opt->first, key) && IsBucket(c)) {
+      return Error{"Key is a bucket."};
+    }
     auto &n = c.GetNode();
+    if (sp_handler_.Err()) {
+      return sp_handler_.Err();
+    }
     n.Put(key, val);
+    if (value_cache_ || filters_) {
+      state_.Written(key);
+    }
 
     LOG_INFO("done putting {} {}", key.ToString(), n.ToString());
     return {};
   }
-};
 
-// In memory representation of the buckets meta page
-class Buckets {
-public:
-  explicit Buckets(Page &p) noexcept { Read(p); };
-
-  Buckets(Buckets &&other) = default;
-  Buckets &operator=(Buckets &&other) noexcept = default;
-  Buckets(const Buckets &other) = delete;
-  Buckets &operator=(const Buckets &other) = delete;
-
-  // Size returns the number of buckets.
-  [[nodiscard]] std::size_t Size() const noexcept { return buckets_.size(); }
-
-  // Updates bucket metadata if the current bucket's root matches the given
-  // old_id.
-  //
-  // This function ensures the bucket's root pointer stays consistent with the
-  // latest tree structure, particularly after splitting the root or
-  // rebalancing.
-  void UpdateRoot(Pgid old_id, Pgid new_id) noexcept {
-    for (auto &[name, meta] : buckets_) {
-      if (meta.Root() == old_id) {
-        LOG_DEBUG("Bucket '{}' root updated from {} to {}", name, old_id,
-                  new_id);
-        meta.SetRoot(new_id);
-      }
+  // Stats walks the tree of the bucket on threads workers and reports its
+  // shape. Only read txs can walk it, they see the tree as committed.
+  [[nodiscard]] std::expected<BucketStats, Error>
+  Stats(std::size_t threads = std::thread::hardware_concurrency()) noexcept {
+    if (sp_handler_.Writable()) {
+      return std::unexpected{Error{"Stats needs a read tx"}};
     }
+    BucketStatsWalker walker{sp_handler_.Disk(), threads};
+    return walker.Run(state_.meta_.Root());
   }
 
-  [[nodiscard]] std::optional<std::reference_wrapper<const BucketMeta>>
-  GetBucket(const std::string &name) const noexcept {
-    auto b_it = buckets_.find(name);
-    if (b_it == buckets_.end()) {
+  // GetBucket returns the nested bucket with the given name.
+  [[nodiscard]] std::optional<Bucket>
+  GetBucket(const std::string &name) noexcept {
+    if (state_.meta_.Hashed()) {
+      return {};
+    }
+    if (auto it = state_.children_.find(name); it != state_.children_.end()) {
+      return Bucket{sp_handler_, tx_meta_, *it->second, value_cache_, filters_};
+    }
+    auto c = TreeCursor();
+    auto opt = c.Seek(name);
+    if (sp_handler_.Err() || !opt || opt->first != Slice{name} ||
+        !IsBucket(c)) {
       return {};
     }
-    return std::cref(b_it->second);
+    return OpenBucket(name, BucketMeta::Decode(opt->second.Data()));
   }
 
-  // Adds a new bucket. Returns false if the bucket already exists.
-  [[nodiscard]] std::expected<std::reference_wrapper<const BucketMeta>,
-                              std::string>
-  AddBucket(std::string name, BucketMeta meta) noexcept {
-    if (buckets_.find(name) != buckets_.end()) {
-      return std::unexpected{"bucket already exists: " + name};
+  // OpenBucket returns a handle of a nested bucket whose meta is known.
+  [[nodiscard]] Bucket OpenBucket(const std::string &name,
+                                  BucketMeta meta) noexcept {
+    auto [it, _] = state_.children_.try_emplace(
+        name, std::make_unique<BucketState>(name, meta, &state_));
+    return Bucket{sp_handler_, tx_meta_, *it->second, value_cache_, filters_};
+  }
+
+  // CreateBucket creates a nested bucket. Passing BucketFlag::Compressed
+  // stores the leaf pages of the bucket compressed, BucketFlag::Hash stores
+  // its keys in a hash table.
+  [[nodiscard]] std::expected<BucketMeta, Error>
+  CreateBucket(const std::string &name,
+               BucketFlag flags = BucketFlag::None) noexcept {
+    if (!sp_handler_.Writable()) {
+      return std::unexpected{Error{"Tx not writable"}};
+    }
+    if (name.size() == 0) {
+      return std::unexpected{Error{"Bucket name required"}};
+    }
+    if (state_.meta_.Hashed()) {
+      return std::unexpected{Error{"Hash buckets can not hold buckets"}};
+    }
+    auto c = TreeCursor();
+    auto opt = c.Seek(name);
+    if (sp_handler_.Err()) {
+      return std::unexpected{*sp_handler_.Err()};
+    }
+    if (opt && opt->first == Slice{name}) {
+      return std::unexpected{
+          Error{IsBucket(c) ? "Bucket exists" : "Key exists"}};
+    }
+
+    // load the leaf before allocating, growing the mmap moves the pages the
+    // cursor points to
+    auto &n = c.GetNode();
+    auto root = NewRoot(flags);
+    if (!root) {
+      return std::unexpected{root.error()};
+    }
+
+    BucketMeta meta{*root, flags};
+    std::array<std::byte, BucketMeta::ENCODED_SIZE> val;
+    meta.Encode(val.data());
+    n.Put(name, name, {val.data(), val.size()}, 0, LeafFlag::Bucket);
+    if (value_cache_ || filters_) {
+      state_.Written(name);
     }
+    state_.children_.try_emplace(
+        name, std::make_unique<BucketState>(name, meta, &state_));
+    return meta;
+  }
 
-    auto [it, _] = buckets_.emplace(std::move(name), std::move(meta));
-    return std::cref(it->second);
+private:
+  [[nodiscard]] Cursor TreeCursor() const noexcept {
+    assert(!state_.meta_.Hashed());
+    return Cursor{sp_handler_, state_.meta_};
   }
-  [[nodiscard]] std::size_t GetStorageSize() const noexcept {
-    auto sz = PAGE_HEADER_SIZE;
-    sz += sizeof(BucketMeta) * buckets_.size();
-    for (const auto &[name, _] : buckets_) {
-      sz += name.size();
+
+  // Lookup finds the value of key in the tree or hash table of the bucket.
+  template <typename Order>
+  [[nodiscard]] std::optional<Slice> Lookup(const Slice &key) const noexcept {
+    if (state_.meta_.Hashed()) {
+      if (state_.hash_) {
+        return state_.hash_->Get(key);
+      }
+      return HashTable::Find(sp_handler_, state_.meta_.Root(), key);
     }
-    return sz;
+    auto c = TreeCursor();
+    auto opt = c.Seek<Order>(key);
+    if (!opt.has_value() || !Order::Equal(opt->first, key) || IsBucket(c)) {
+      return std::nullopt;
+    }
+    return opt->second;
   }
 
-  void Write(Page &p) const noexcept {
-    p.SetMagic();
-    p.SetFlags(PageFlag::BucketPage);
-    p.SetCount(buckets_.size());
-    Serializer s{p.Data()};
-    for (const auto &[name, b] : buckets_) {
-      LOG_DEBUG("writing {} {}", name, b.Root());
-      s.Write(name);
-      s.Write(b.Root());
+  // NewRoot writes the empty root of a new bucket.
+  [[nodiscard]] std::expected<Pgid, Error> NewRoot(BucketFlag flags) noexcept {
+    if (BucketMeta{0, flags}.Hashed()) {
+      LOG_DEBUG("Creating a hash table for bucket");
+      return HashTable::Create(sp_handler_, tx_meta_);
+    }
+    LOG_DEBUG("Creating a leaf page for bucket");
+    auto p_err = sp_handler_.AllocateShadowPage(tx_meta_, 1);
+    if (!p_err) {
+      return std::unexpected{p_err.error()};
     }
+    auto &p = p_err.value().get();
+    p.SetFlags(PageFlag::LeafPage);
+    return p.Id();
   }
 
-private:
-  void Read(Page &p) noexcept {
-    LOG_DEBUG("Starting to read bucket metadata from page with id {}", p.Id());
+  [[nodiscard]] static bool IsBucket(const Cursor &c) noexcept {
+    return c.Flags() & static_cast<std::uint32_t>(LeafFlag::Bucket);
+  }
+};
 
-    Deserializer d(p);
-    for (std::size_t i = 0; i < p.Count(); i++) {
-      auto name = d.Read<std::string>();
-      const auto root = d.Read<Pgid>();
+// BucketsCache shares the metas of top level buckets looked up by read txs
+// of the latest commit, so opening a bucket in a short read tx skips the
+// catalog search. Read txs of older commits bypass it. A write tx publishes
+// the buckets it opened when it commits.
+class BucketsCache {
+public:
+  // Get returns the cached meta of the bucket in the meta's catalog.
+  [[nodiscard]] std::optional<BucketMeta>
+  Get(const Meta &meta, const std::string &name) noexcept {
+    std::lock_guard lock(mu_);
+    if (!Current(meta)) {
+      return {};
+    }
+    auto it = buckets_.find(name);
+    if (it == buckets_.end()) {
+      misses_++;
+      return {};
+    }
+    hits_++;
+    return it->second;
+  }
 
-      LOG_DEBUG("Deserialized bucket {} with root page id {}", name, root);
-      assert(name.size() > 0 && root > 2);
+  // Put caches the meta of a bucket a read tx found in the meta's catalog.
+  void Put(const Meta &meta, const std::string &name,
+           const BucketMeta &bucket) noexcept {
+    std::lock_guard lock(mu_);
+    if (Current(meta)) {
+      buckets_.insert_or_assign(name, bucket);
+    }
+  }
 
-      assert(buckets_.find(name) == buckets_.end() &&
-             "bucket names should not be duplicate");
-      buckets_.emplace(std::move(name), BucketMeta{root});
+  // Publish moves the cache to the meta a write tx committed. Only the
+  // buckets the tx opened can have changed.
+  void Publish(const Meta &meta, const BucketState &catalog) noexcept {
+    std::lock_guard lock(mu_);
+    if (txid_ + 1 != meta.GetTxid()) {
+      buckets_.clear();
+    }
+    for (const auto &[name, b] : catalog.children_) {
+      buckets_.insert_or_assign(name, b->meta_);
     }
+    txid_ = meta.GetTxid();
+  }
+
+  // Reset empties the cache when the db file is replaced.
+  void Reset() noexcept {
+    std::lock_guard lock(mu_);
+    buckets_.clear();
+    txid_ = 0;
+  }
+
+  [[nodiscard]] std::size_t Hits() const noexcept {
+    std::lock_guard lock(mu_);
+    return hits_;
+  }
 
-    LOG_DEBUG("Finished reading {} bucket(s) from page {}", p.Count(), p.Id());
+  [[nodiscard]] std::size_t Misses() const noexcept {
+    std::lock_guard lock(mu_);
+    return misses_;
+  }
+
+private:
+  // Current returns whether the cache holds the meta's snapshot. A newer
+  // snapshot than the cached one resets the cache.
+  [[nodiscard]] bool Current(const Meta &meta) noexcept {
+    if (meta.GetTxid() > txid_) {
+      buckets_.clear();
+      txid_ = meta.GetTxid();
+    }
+    return meta.GetTxid() == txid_;
   }
 
-  std::unordered_map<std::string, BucketMeta> buckets_{};
+  // protects all fields
+  mutable std::mutex mu_;
+  std::unordered_map<std::string, BucketMeta> buckets_;
+  Txid txid_{0};
+  std::size_t hits_{0};
+  std::size_t misses_{0};
 };
 
 } // namespace kv
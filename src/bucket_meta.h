@@ -1,16 +1,54 @@
 #pragma once
 
 #include "type.h"
+#include <cstddef>
+#include <cstring>
 namespace kv {
 
+enum class BucketFlag : std::size_t {
+  None = 0x00,
+  // leaf pages of the bucket are stored compressed
+  Compressed = 0x01,
+  // keys are placed by hash in an extendible hash table, see HashTable
+  Hash = 0x02
+};
+
 class BucketMeta {
 public:
-  explicit BucketMeta(Pgid root) : root_(root) {}
+  // Size of the encoded meta, the value of the bucket's entry in its parent.
+  static constexpr std::size_t ENCODED_SIZE =
+      sizeof(Pgid) + sizeof(std::size_t);
+
+  explicit BucketMeta(Pgid root, BucketFlag flags = BucketFlag::None)
+      : root_(root), flags_(static_cast<std::size_t>(flags)) {}
 
   [[nodiscard]] Pgid Root() const noexcept { return root_; }
   void SetRoot(Pgid id) noexcept { root_ = id; }
 
+  [[nodiscard]] std::size_t Flags() const noexcept { return flags_; }
+  [[nodiscard]] bool Compressed() const noexcept {
+    return flags_ & static_cast<std::size_t>(BucketFlag::Compressed);
+  }
+  [[nodiscard]] bool Hashed() const noexcept {
+    return flags_ & static_cast<std::size_t>(BucketFlag::Hash);
+  }
+
+  // Encode writes the meta to out, which must hold ENCODED_SIZE bytes.
+  void Encode(std::byte *out) const noexcept {
+    std::memcpy(out, &root_, sizeof(root_));
+    std::memcpy(out + sizeof(root_), &flags_, sizeof(flags_));
+  }
+
+  [[nodiscard]] static BucketMeta Decode(const std::byte *in) noexcept {
+    Pgid root;
+    std::size_t flags;
+    std::memcpy(&root, in, sizeof(root));
+    std::memcpy(&flags, in + sizeof(root), sizeof(flags));
+    return BucketMeta{root, static_cast<BucketFlag>(flags)};
+  }
+
 private:
   Pgid root_;
+  std::size_t flags_;
 };
 } // namespace kv
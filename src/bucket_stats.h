@@ -0,0 +1,253 @@
+#pragma once
+
+#include "bucket_meta.h"
+#include "disk.h"
+#include "fmt/core.h"
+#include "hash_table.h"
+#include "page.h"
+#include "thread_pool.h"
+#include "tx_cache.h"
+#include <algorithm>
+#include <expected>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace kv {
+
+// Pages of one level of a bucket tree.
+struct LevelStats {
+  std::size_t pages_{0};
+  // bytes used by headers, keys and values
+  std::size_t used_bytes_{0};
+  // bytes of the page runs holding the level
+  std::size_t capacity_bytes_{0};
+
+  [[nodiscard]] double FillPercent() const noexcept {
+    return capacity_bytes_ ? 100.0 * static_cast<double>(used_bytes_) /
+                                 static_cast<double>(capacity_bytes_)
+                           : 0.0;
+  }
+};
+
+// Shape and size of a bucket tree returned by Bucket::Stats. Nested buckets
+// are counted but their trees are not walked.
+struct BucketStats {
+  // levels of the tree, 1 for a single leaf
+  std::size_t depth_{0};
+  std::size_t branch_pages_{0};
+  std::size_t leaf_pages_{0};
+  // pages past the first of multi page runs
+  std::size_t overflow_pages_{0};
+  std::size_t keys_{0};
+  std::size_t key_bytes_{0};
+  std::size_t value_bytes_{0};
+  std::size_t nested_buckets_{0};
+  // nodes that fit a single page and the key value bytes they hold
+  std::size_t inline_nodes_{0};
+  std::size_t inline_bytes_{0};
+  // nodes spanning a page run and the key value bytes they hold
+  std::size_t overflow_nodes_{0};
+  std::size_t overflow_bytes_{0};
+  // indexed by depth, the root first. Compressed leaves are measured
+  // decoded.
+  std::vector<LevelStats> levels_;
+
+  void Merge(const BucketStats &o) noexcept {
+    depth_ = std::max(depth_, o.depth_);
+    branch_pages_ += o.branch_pages_;
+    leaf_pages_ += o.leaf_pages_;
+    overflow_pages_ += o.overflow_pages_;
+    keys_ += o.keys_;
+    key_bytes_ += o.key_bytes_;
+    value_bytes_ += o.value_bytes_;
+    nested_buckets_ += o.nested_buckets_;
+    inline_nodes_ += o.inline_nodes_;
+    inline_bytes_ += o.inline_bytes_;
+    overflow_nodes_ += o.overflow_nodes_;
+    overflow_bytes_ += o.overflow_bytes_;
+    if (levels_.size() < o.levels_.size()) {
+      levels_.resize(o.levels_.size());
+    }
+    for (std::size_t i = 0; i < o.levels_.size(); i++) {
+      levels_[i].pages_ += o.levels_[i].pages_;
+      levels_[i].used_bytes_ += o.levels_[i].used_bytes_;
+      levels_[i].capacity_bytes_ += o.levels_[i].capacity_bytes_;
+    }
+  }
+
+  [[nodiscard]] std::string ToString() const noexcept {
+    std::string result = fmt::format(
+        "depth: {}\nbranch pages: {}\nleaf pages: {}\noverflow pages: {}\n"
+        "keys: {}\nkey bytes: {}\nvalue bytes: {}\nnested buckets: {}\n"
+        "inline nodes: {} ({} bytes)\noverflow nodes: {} ({} bytes)",
+        depth_, branch_pages_, leaf_pages_, overflow_pages_, keys_, key_bytes_,
+        value_bytes_, nested_buckets_, inline_nodes_, inline_bytes_,
+        overflow_nodes_, overflow_bytes_);
+    for (std::size_t i = 0; i < levels_.size(); i++) {
+      result += fmt::format("\nlevel {}: {} pages, {:.1f}% full", i,
+                            levels_[i].pages_, levels_[i].FillPercent());
+    }
+    return result;
+  }
+};
+
+// BucketStatsWalker walks a committed bucket tree from the mmap. Subtrees
+// near the root are walked as separate tasks on a thread pool, each task
+// collects its own stats and merges them once done.
+class BucketStatsWalker {
+  // Subtrees rooted above this depth are walked as separate pool tasks.
+  static constexpr std::size_t PARALLEL_DEPTH = 3;
+
+public:
+  BucketStatsWalker(DiskHandler &disk, std::size_t threads) noexcept
+      : disk_(disk), page_size_(disk.PageSize()), pool_(threads) {}
+
+  // Run walks the tree rooted at root, failing if a page is corrupted.
+  [[nodiscard]] std::expected<BucketStats, Error> Run(Pgid root) noexcept {
+    auto mmaplock = disk_.LockMmapShared();
+    Submit(root, 0);
+    pool_.Wait();
+    std::lock_guard lock(mu_);
+    if (err_) {
+      return std::unexpected{*err_};
+    }
+    return result_;
+  }
+
+private:
+  void Submit(Pgid pgid, std::size_t depth) noexcept {
+    pool_.Submit([this, pgid, depth] {
+      BucketStats stats;
+      Walk(pgid, depth, stats);
+      std::lock_guard lock(mu_);
+      result_.Merge(stats);
+    });
+  }
+
+  void Walk(Pgid pgid, std::size_t depth, BucketStats &stats) noexcept {
+    const auto &raw = disk_.GetPageFromMmap(pgid);
+    // a handler per page so decoded pages are freed once measured
+    ShadowPageHandler pages{disk_, false};
+    auto &p = pages.GetPage(pgid);
+    if (pages.Err()) {
+      std::lock_guard lock(mu_);
+      if (!err_) {
+        err_ = pages.Err();
+      }
+      return;
+    }
+    if (p.Flags() & static_cast<std::size_t>(PageFlag::HashPage)) {
+      WalkHash(pages, p, depth, stats);
+      return;
+    }
+    const bool is_leaf =
+        p.Flags() & static_cast<std::size_t>(PageFlag::LeafPage);
+    if (!is_leaf &&
+        !(p.Flags() & static_cast<std::size_t>(PageFlag::BranchPage))) {
+      return;
+    }
+
+    stats.depth_ = std::max(stats.depth_, depth + 1);
+    if (stats.levels_.size() <= depth) {
+      stats.levels_.resize(depth + 1);
+    }
+    auto &level = stats.levels_[depth];
+    level.pages_++;
+    level.capacity_bytes_ += (p.Overflow() + 1) * page_size_;
+    stats.overflow_pages_ += raw.Overflow();
+
+    std::size_t kv_bytes = 0;
+    if (is_leaf) {
+      stats.leaf_pages_++;
+      auto &leaf = p.AsPage<LeafPage>();
+      for (std::size_t i = 0; i < leaf.Count(); i++) {
+        if (leaf.GetElement(i).flags_ &
+            static_cast<std::uint32_t>(LeafFlag::Bucket)) {
+          stats.nested_buckets_++;
+          continue;
+        }
+        stats.keys_++;
+        stats.key_bytes_ += leaf.GetKey(i).Size();
+        stats.value_bytes_ += leaf.GetVal(i).Size();
+        kv_bytes += leaf.GetKey(i).Size() + leaf.GetVal(i).Size();
+      }
+      level.used_bytes_ += PAGE_HEADER_SIZE +
+                           leaf.Count() * sizeof(LeafElement) + kv_bytes;
+    } else {
+      stats.branch_pages_++;
+      auto &branch = p.AsPage<BranchPage>();
+      for (std::size_t i = 0; i < branch.Count(); i++) {
+        kv_bytes += branch.GetKey(i).Size();
+      }
+      level.used_bytes_ += PAGE_HEADER_SIZE +
+                           branch.Count() * sizeof(BranchElement) + kv_bytes;
+    }
+    if (raw.Overflow() == 0) {
+      stats.inline_nodes_++;
+      stats.inline_bytes_ += kv_bytes;
+    } else {
+      stats.overflow_nodes_++;
+      stats.overflow_bytes_ += kv_bytes;
+    }
+
+    if (is_leaf) {
+      return;
+    }
+    auto &branch = p.AsPage<BranchPage>();
+    for (std::size_t i = 0; i < branch.Count(); i++) {
+      if (depth + 1 < PARALLEL_DEPTH) {
+        Submit(branch.GetPgid(i), depth + 1);
+      } else {
+        Walk(branch.GetPgid(i), depth + 1, stats);
+      }
+    }
+  }
+
+  // WalkHash counts the directory pages of a hash table as branch pages of
+  // the root level and walks its leaves as the level below.
+  void WalkHash(ShadowPageHandler &pages, const Page &root, std::size_t depth,
+                BucketStats &stats) noexcept {
+    stats.depth_ = std::max(stats.depth_, depth + 1);
+    if (stats.levels_.size() <= depth) {
+      stats.levels_.resize(depth + 1);
+    }
+    auto &level = stats.levels_[depth];
+    const auto segments = HashTable::Segments(root);
+    stats.branch_pages_ += 1 + segments.size();
+    stats.overflow_pages_ += root.Overflow();
+    level.pages_ += 1 + segments.size();
+    level.capacity_bytes_ += (root.Overflow() + 1 + segments.size()) *
+                             page_size_;
+    level.used_bytes_ += PAGE_HEADER_SIZE + sizeof(std::uint64_t) +
+                         segments.size() * sizeof(Pgid);
+    for (Pgid id : segments) {
+      level.used_bytes_ += PAGE_HEADER_SIZE +
+                           pages.GetPage(id).Count() * sizeof(Pgid);
+    }
+    const auto leaves = HashTable::Leaves(pages, root.Id());
+    if (pages.Err()) {
+      std::lock_guard lock(mu_);
+      if (!err_) {
+        err_ = pages.Err();
+      }
+      return;
+    }
+    for (Pgid leaf : leaves) {
+      Submit(leaf, depth + 1);
+    }
+  }
+
+  DiskHandler &disk_;
+  const std::size_t page_size_;
+  // protects result_ and err_
+  std::mutex mu_;
+  BucketStats result_;
+  // first corrupted page met by the walk
+  std::optional<Error> err_{};
+  // declared last so workers are joined before the state they use is freed
+  ThreadPool pool_;
+};
+
+} // namespace kv
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "bucket.h"
+#include "disk.h"
+#include "error.h"
+#include "freelist.h"
+#include "hash_table.h"
+#include "log.h"
+#include "page.h"
+#include "thread_pool.h"
+#include "tx_cache.h"
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace kv {
+
+// Outcome of a full file check.
+struct CheckResult {
+  // pages referenced from the meta, counting overflow pages
+  std::size_t reachable_pages_{0};
+  // pages below the watermark that nothing references. Copy on write leaves
+  // these behind until pages are reclaimed so they are not reported as errors.
+  std::size_t unreachable_pages_{0};
+  std::vector<Error> errors_;
+
+  [[nodiscard]] bool Ok() const noexcept { return errors_.empty(); }
+};
+
+// Checker walks the freelist, the catalog and every bucket tree of a meta
+// snapshot and verifies that each page below the watermark is referenced at
+// most once, that page checksums match and that keys are sorted within and
+// across pages.
+// Subtrees are checked in parallel on a thread pool.
+class Checker {
+  // Subtrees rooted above this depth are checked as separate pool tasks.
+  static constexpr std::size_t PARALLEL_DEPTH = 3;
+
+public:
+  Checker(DiskHandler &disk, const Meta &meta, std::size_t threads) noexcept
+      : disk_(disk), meta_(meta), page_size_(disk.PageSize()),
+        refs_(std::make_unique<std::atomic<std::uint32_t>[]>(
+            meta.GetWatermark())),
+        pool_(threads) {}
+
+  [[nodiscard]] CheckResult Run() noexcept {
+    auto mmaplock = disk_.LockMmapShared();
+    const Pgid watermark = meta_.GetWatermark();
+    LOG_INFO("Checking {} pages with {} threads", watermark, pool_.Size());
+
+    if (watermark * page_size_ > disk_.MmapSize()) {
+      AddError(
+          fmt::format("watermark {} is beyond the mapped file", watermark));
+      return Result();
+    }
+
+    for (Pgid id : {EVEN_META_PAGE_ID, ODD_META_PAGE_ID}) {
+      if (auto *p = CheckPage(id)) {
+        Reference(*p);
+      }
+    }
+
+    if (auto *p = CheckPage(meta_.GetFreelist()); p && Reference(*p)) {
+      Freelist freelist;
+      freelist.Read(*p);
+      for (Pgid id : freelist.All()) {
+        Reference(id, 0);
+      }
+    }
+
+    // the catalog tree leads to the trees of all buckets
+    CheckTree(meta_.GetBuckets(), 0, std::nullopt, std::nullopt);
+    pool_.Wait();
+
+    return Result();
+  }
+
+private:
+  // CheckPage validates the header and checksum of a page and returns it, or
+  // nullptr if it is unusable.
+  [[nodiscard]] Page *CheckPage(Pgid id) noexcept {
+    if (id >= meta_.GetWatermark()) {
+      AddError(fmt::format("page {} is beyond the watermark", id));
+      return nullptr;
+    }
+    auto *p = reinterpret_cast<Page *>(disk_.GetAddress(id * page_size_));
+    if (!p->ValidMagic() || p->Id() != id) {
+      AddError(fmt::format("page {} has an invalid header", id));
+      return nullptr;
+    }
+    if (id + p->Overflow() >= meta_.GetWatermark()) {
+      AddError(fmt::format("page {} overflows past the watermark", id));
+      return nullptr;
+    }
+    if (!p->VerifyChecksum(page_size_, meta_.GetWatermark() - id)) {
+      AddError(fmt::format("page {} checksum mismatch", id));
+      return nullptr;
+    }
+    return p;
+  }
+
+  // Reference marks a page run as used. Returns false if any page of the run
+  // is out of range or already referenced.
+  bool Reference(Pgid id, std::size_t overflow) noexcept {
+    bool ok = true;
+    for (Pgid i = id; i <= id + overflow; i++) {
+      if (i >= meta_.GetWatermark()) {
+        AddError(fmt::format("page {} is beyond the watermark", i));
+        return false;
+      }
+      if (refs_[i].fetch_add(1, std::memory_order_relaxed) != 0) {
+        AddError(fmt::format("page {} is referenced more than once", i));
+        ok = false;
+      }
+    }
+    return ok;
+  }
+
+  bool Reference(const Page &p) noexcept {
+    return Reference(p.Id(), p.Overflow());
+  }
+
+  // CheckTree checks the subtree rooted at pgid whose keys must lie within
+  // [lower, upper).
+  void CheckTree(Pgid pgid, std::size_t depth, std::optional<std::string> lower,
+                 std::optional<std::string> upper) noexcept {
+    auto *raw = CheckPage(pgid);
+    if (!raw || !Reference(*raw)) {
+      return;
+    }
+
+    // a handler per page so decoded pages are freed once checked
+    ShadowPageHandler pages{disk_, false};
+    auto &p = pages.GetPage(pgid);
+    if (pages.Err()) {
+      AddError(pages.Err()->message());
+      return;
+    }
+    const bool is_leaf =
+        p.Flags() & static_cast<std::size_t>(PageFlag::LeafPage);
+    const bool is_branch =
+        p.Flags() & static_cast<std::size_t>(PageFlag::BranchPage);
+    if (p.Flags() & static_cast<std::size_t>(PageFlag::HashPage)) {
+      CheckHash(p, depth);
+      return;
+    }
+    if (!is_leaf && !is_branch) {
+      AddError(fmt::format("page {} is not a tree page", pgid));
+      return;
+    }
+    if (is_branch && p.Count() == 0) {
+      AddError(fmt::format("branch page {} is empty", pgid));
+      return;
+    }
+
+    auto key_at = [&](std::size_t i) {
+      return is_leaf ? p.AsPage<LeafPage>().GetKey(i)
+                     : p.AsPage<BranchPage>().GetKey(i);
+    };
+    auto prefix_at = [&](std::size_t i) {
+      return is_leaf ? p.AsPage<LeafPage>().GetElement(i).prefix_
+                     : p.AsPage<BranchPage>().GetElement(i).prefix_;
+    };
+    for (std::size_t i = 0; i < p.Count(); i++) {
+      const auto key = key_at(i);
+      if (prefix_at(i) != key.Prefix()) {
+        AddError(fmt::format("page {} key {} prefix does not match", pgid, i));
+      }
+      if (i > 0 && !(key_at(i - 1) < key)) {
+        AddError(fmt::format("page {} keys are not sorted at {}", pgid, i));
+      }
+      if ((lower && key < Slice{*lower}) ||
+          (upper && !(key < Slice{*upper}))) {
+        AddError(fmt::format("page {} key {} is outside of its parent range",
+                             pgid, i));
+      }
+    }
+    if (is_leaf) {
+      auto &leaf = p.AsPage<LeafPage>();
+      for (std::size_t i = 0; i < leaf.Count(); i++) {
+        if (!(leaf.GetElement(i).flags_ &
+              static_cast<std::uint32_t>(LeafFlag::Bucket))) {
+          continue;
+        }
+        if (leaf.GetVal(i).Size() != BucketMeta::ENCODED_SIZE) {
+          AddError(fmt::format("page {} bucket {} has a bad meta", pgid, i));
+          continue;
+        }
+        const Pgid root = BucketMeta::Decode(leaf.GetVal(i).Data()).Root();
+        pool_.Submit([this, root] {
+          CheckTree(root, 0, std::nullopt, std::nullopt);
+        });
+      }
+      return;
+    }
+
+    auto &branch = p.AsPage<BranchPage>();
+    for (std::size_t i = 0; i < branch.Count(); i++) {
+      // the first child also holds keys smaller than its separator
+      auto child_lower = i == 0 ? lower : branch.GetKey(i).ToString();
+      auto child_upper =
+          i + 1 < branch.Count() ? branch.GetKey(i + 1).ToString() : upper;
+      const Pgid child = branch.GetPgid(i);
+      if (depth + 1 < PARALLEL_DEPTH) {
+        pool_.Submit([this, child, depth, child_lower, child_upper] {
+          CheckTree(child, depth + 1, child_lower, child_upper);
+        });
+      } else {
+        CheckTree(child, depth + 1, child_lower, child_upper);
+      }
+    }
+  }
+
+  // CheckHash checks the directory of the hash table rooted at root and the
+  // leaves it points to. The slots of a leaf must be an aligned run whose
+  // length is a power of two.
+  void CheckHash(const Page &root, std::size_t depth) noexcept {
+    const auto segments = HashTable::Segments(root);
+    const std::size_t per = HashTable::SegmentSlots(page_size_);
+    std::vector<Pgid> slots;
+    for (Pgid id : segments) {
+      auto *segment = CheckPage(id);
+      if (!segment || !Reference(*segment)) {
+        return;
+      }
+      auto s = HashTable::Slots(*segment);
+      if (s.size() > per) {
+        AddError(fmt::format("hash segment {} has {} slots", id, s.size()));
+        return;
+      }
+      slots.insert(slots.end(), s.begin(), s.end());
+    }
+    if (!std::has_single_bit(slots.size())) {
+      AddError(fmt::format("hash table {} has {} slots", root.Id(),
+                           slots.size()));
+      return;
+    }
+    for (std::size_t start = 0; start < slots.size();) {
+      std::size_t end = start + 1;
+      while (end < slots.size() && slots[end] == slots[start]) {
+        end++;
+      }
+      const auto run = end - start;
+      if (!std::has_single_bit(run) || start % run != 0) {
+        AddError(fmt::format("hash table {} leaf {} has a bad slot run",
+                             root.Id(), slots[start]));
+      }
+      CheckTree(slots[start], depth + 1, std::nullopt, std::nullopt);
+      start = end;
+    }
+  }
+
+  void AddError(std::string msg) noexcept {
+    LOG_ERROR("Check failed: {}", msg);
+    std::lock_guard lock(errlock_);
+    errors_.emplace_back(msg);
+  }
+
+  [[nodiscard]] CheckResult Result() noexcept {
+    CheckResult result;
+    for (Pgid i = 0; i < meta_.GetWatermark(); i++) {
+      if (refs_[i].load(std::memory_order_relaxed) > 0) {
+        result.reachable_pages_++;
+      } else {
+        result.unreachable_pages_++;
+      }
+    }
+    std::lock_guard lock(errlock_);
+    result.errors_ = std::move(errors_);
+    return result;
+  }
+
+  DiskHandler &disk_;
+  // snapshot being checked
+  const Meta meta_;
+  const std::size_t page_size_;
+  // number of references to each page below the watermark
+  std::unique_ptr<std::atomic<std::uint32_t>[]> refs_;
+  // mutex to protect errors_
+  std::mutex errlock_;
+  std::vector<Error> errors_;
+  // declared last so workers are joined before the state they use is freed
+  ThreadPool pool_;
+};
+
+} // namespace kv
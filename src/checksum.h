@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace kv {
+
+// CRC32C (Castagnoli) used for page and meta checksums. Uses the SSE4.2 crc32
+// instruction when the cpu supports it and falls back to slicing-by-8.
+class Crc32c final {
+  static constexpr std::uint32_t POLY = 0x82F63B78;
+  using Table = std::array<std::array<std::uint32_t, 256>, 8>;
+
+public:
+  // Value returns the crc of n bytes at data.
+  [[nodiscard]] static std::uint32_t Value(const void *data,
+                                           std::size_t n) noexcept {
+    return Extend(0, data, n);
+  }
+
+  // Extend returns the crc of the concatenation of the bytes crc was computed
+  // over and n bytes at data.
+  [[nodiscard]] static std::uint32_t Extend(std::uint32_t crc, const void *data,
+                                            std::size_t n) noexcept {
+    static const bool hw = HardwareSupported();
+    return hw ? ExtendHw(crc, data, n) : ExtendSw(crc, data, n);
+  }
+
+  // ExtendSw is the portable slicing-by-8 implementation.
+  [[nodiscard]] static std::uint32_t ExtendSw(std::uint32_t crc,
+                                              const void *data,
+                                              std::size_t n) noexcept {
+    static const Table table = MakeTable();
+    const auto *p = static_cast<const std::uint8_t *>(data);
+    std::uint32_t c = ~crc;
+    while (n >= 8) {
+      std::uint64_t w;
+      std::memcpy(&w, p, sizeof(w));
+      w ^= c;
+      c = table[7][w & 0xFF] ^ table[6][(w >> 8) & 0xFF] ^
+          table[5][(w >> 16) & 0xFF] ^ table[4][(w >> 24) & 0xFF] ^
+          table[3][(w >> 32) & 0xFF] ^ table[2][(w >> 40) & 0xFF] ^
+          table[1][(w >> 48) & 0xFF] ^ table[0][w >> 56];
+      p += 8;
+      n -= 8;
+    }
+    while (n--) {
+      c = table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+  }
+
+private:
+  static constexpr Table MakeTable() noexcept {
+    Table t{};
+    for (std::uint32_t i = 0; i < 256; i++) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+      }
+      t[0][i] = c;
+    }
+    for (std::size_t k = 1; k < 8; k++) {
+      for (std::size_t i = 0; i < 256; i++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+      }
+    }
+    return t;
+  }
+
+#if defined(__x86_64__)
+  [[nodiscard]] static bool HardwareSupported() noexcept {
+    return __builtin_cpu_supports("sse4.2");
+  }
+
+  [[nodiscard]] __attribute__((target("sse4.2"))) static std::uint32_t
+  ExtendHw(std::uint32_t crc, const void *data, std::size_t n) noexcept {
+    const auto *p = static_cast<const std::uint8_t *>(data);
+    std::uint64_t c = ~crc;
+    while (n >= 8) {
+      std::uint64_t w;
+      std::memcpy(&w, p, sizeof(w));
+      c = _mm_crc32_u64(c, w);
+      p += 8;
+      n -= 8;
+    }
+    auto c32 = static_cast<std::uint32_t>(c);
+    while (n--) {
+      c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return ~c32;
+  }
+#else
+  [[nodiscard]] static bool HardwareSupported() noexcept { return false; }
+
+  [[nodiscard]] static std::uint32_t
+  ExtendHw(std::uint32_t crc, const void *data, std::size_t n) noexcept {
+    return ExtendSw(crc, data, n);
+  }
+#endif
+};
+
+} // namespace kv
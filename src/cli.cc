@@ -10,7 +10,11 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  auto db_or_err = DB::Open(argv[1]);
+  Options options;
+  // keep the page journal of a db that has one up to date
+  options.page_journal_ =
+      std::filesystem::exists(PageJournal::PathFor(argv[1]));
+  auto db_or_err = DB::Open(argv[1], options);
   if (!db_or_err) {
     std::cerr << "Failed to open DB: " << db_or_err.error().message()
               << std::endl;
@@ -68,8 +72,126 @@ int main(int argc, char **argv) {
         continue;
       }
       db->DebugPrintBucketPages(bucket);
+    } else if (command == "check") {
+      auto result = db->Check();
+      std::cout << "reachable pages: " << result.reachable_pages_
+                << ", unreachable pages: " << result.unreachable_pages_
+                << std::endl;
+      for (const auto &e : result.errors_) {
+        std::cout << "error: " << e.message() << std::endl;
+      }
+      std::cout << (result.Ok() ? "OK" : "CORRUPTED") << std::endl;
+    } else if (command == "bucket-stats") {
+      std::string bucket;
+      iss >> bucket;
+      if (bucket.empty()) {
+        std::cout << "Usage: bucket-stats <bucket>" << std::endl;
+        continue;
+      }
+      auto err = db->View([&](Tx &tx) -> std::optional<Error> {
+        auto bucket_opt = tx.GetBucket(bucket);
+        if (!bucket_opt.has_value()) {
+          std::cout << "Bucket not found" << std::endl;
+          return {};
+        }
+        auto stats = bucket_opt->Stats();
+        if (!stats) {
+          return stats.error();
+        }
+        std::cout << stats->ToString() << std::endl;
+        return {};
+      });
+      if (err.has_value()) {
+        std::cerr << "Error: " << err.value().message() << std::endl;
+      }
+    } else if (command == "compact") {
+      double fill_percent = 1.0;
+      iss >> fill_percent;
+      if (auto err = db->Compact(fill_percent)) {
+        std::cerr << "Error: " << err->message() << std::endl;
+      } else {
+        std::cout << "OK" << std::endl;
+      }
+    } else if (command == "backup") {
+      std::string path;
+      double mb_per_sec = 0;
+      iss >> path >> mb_per_sec;
+      if (path.empty()) {
+        std::cout << "Usage: backup <path> [MB/s]" << std::endl;
+        continue;
+      }
+      Fd fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+      if (!fd.IsValid()) {
+        std::cerr << "Error: failed to open " << path << std::endl;
+        continue;
+      }
+      BackupOptions options;
+      options.bytes_per_sec_ = static_cast<std::size_t>(mb_per_sec * (1 << 20));
+      auto err = db->View([&](Tx &tx) -> std::optional<Error> {
+        auto written = tx.WriteTo(fd.GetFd(), options);
+        if (!written) {
+          return written.error();
+        }
+        std::cout << "wrote " << *written << " bytes at txid " << tx.GetTxid()
+                  << std::endl;
+        return fd.Sync();
+      });
+      if (err.has_value()) {
+        std::cerr << "Error: " << err.value().message() << std::endl;
+      }
+    } else if (command == "backup-since") {
+      std::string path;
+      Txid since = 0;
+      double mb_per_sec = 0;
+      if (!(iss >> path >> since)) {
+        std::cout << "Usage: backup-since <path> <txid> [MB/s]" << std::endl;
+        continue;
+      }
+      iss >> mb_per_sec;
+      Fd fd{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+      if (!fd.IsValid()) {
+        std::cerr << "Error: failed to open " << path << std::endl;
+        continue;
+      }
+      BackupOptions options;
+      options.bytes_per_sec_ = static_cast<std::size_t>(mb_per_sec * (1 << 20));
+      auto err = db->View([&](Tx &tx) -> std::optional<Error> {
+        auto written = tx.WriteIncrementalTo(fd.GetFd(), since, options);
+        if (!written) {
+          return written.error();
+        }
+        std::cout << "wrote " << *written << " bytes at txid " << tx.GetTxid()
+                  << std::endl;
+        return fd.Sync();
+      });
+      if (err.has_value()) {
+        std::cerr << "Error: " << err.value().message() << std::endl;
+      }
+    } else if (command == "restore") {
+      std::string copy;
+      std::string path;
+      iss >> copy >> path;
+      if (copy.empty() || path.empty()) {
+        std::cout << "Usage: restore <copy> <incremental backup>" << std::endl;
+        continue;
+      }
+      Fd fd{::open(path.c_str(), O_RDONLY)};
+      if (!fd.IsValid()) {
+        std::cerr << "Error: failed to open " << path << std::endl;
+        continue;
+      }
+      auto txid = ApplyIncremental(copy, fd.GetFd());
+      if (!txid) {
+        std::cerr << "Error: " << txid.error().message() << std::endl;
+      } else {
+        std::cout << "copy at txid " << *txid << std::endl;
+      }
+    } else if (command == "stats") {
+      std::cout << db->GetStats().ToString() << std::endl;
     } else {
-      std::cout << "Unknown command. Supported: get, scan, exit" << std::endl;
+      std::cout << "Unknown command. Supported: get, scan, check, stats, "
+                   "bucket-stats, compact, backup, backup-since, restore, exit"
+                << std::endl;
     }
   }
 
@@ -0,0 +1,292 @@
+#pragma once
+
+#include "bucket_meta.h"
+#include "disk.h"
+#include "error.h"
+#include "hash_table.h"
+#include "log.h"
+#include "node.h"
+#include "page.h"
+#include "tx_cache.h"
+#include <array>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kv {
+
+// Compactor copies every bucket of a meta snapshot into a freshly created db.
+// Trees are written bottom up as their sorted entries stream in, nodes packed
+// to the fill percent the destination was opened with, so every page of the
+// copy is reachable from the single meta written at the end. Hash buckets keep
+// their directory, only the pages move.
+class Compactor {
+  // Written pages are flushed to the destination file in batches of this
+  // many bytes.
+  static constexpr std::size_t BATCH_BYTES = 32 << 20;
+
+public:
+  // dst_meta is the meta of the empty destination, its catalog page is
+  // overwritten.
+  Compactor(DiskHandler &src, const Meta &meta, DiskHandler &dst,
+            const Meta &dst_meta) noexcept
+      : src_(src), meta_(meta), dst_(dst), dst_meta_(dst_meta),
+        out_(std::make_unique<ShadowPageHandler>(dst, true)) {
+    dst_meta_.IncrementTxid();
+    dst_meta_.SetWatermark(BUCKET_PAGE_ID);
+  }
+
+  [[nodiscard]] std::optional<Error> Run() noexcept {
+    auto mmaplock = src_.LockMmapShared();
+    auto root = CopyTree(meta_.GetBuckets(), false);
+    if (!root) {
+      return root.error();
+    }
+    if (auto e = Flush()) {
+      return e;
+    }
+    dst_meta_.SetBuckets(*root);
+    return WriteMeta();
+  }
+
+private:
+  // TreeWriter packs the entries of one tree, added in key order, into nodes
+  // and writes each node once it is full, a level above the other.
+  class TreeWriter {
+  public:
+    TreeWriter(Compactor &c, bool compressed) noexcept
+        : c_(c), compressed_(compressed) {}
+
+    [[nodiscard]] std::optional<Error>
+    Add(std::size_t level, const Slice &key, const Slice &val, Pgid pgid,
+        LeafFlag flags) noexcept {
+      if (level == levels_.size()) {
+        levels_.push_back(NewNode(level));
+      }
+      const Node &n = *levels_[level];
+      const auto size =
+          n.GetElementHeaderSize() + key.Size() + val.Size();
+      if (n.GetElements().size() >= MIN_KEY_PER_PAGE &&
+          n.GetStorageSize() + size >= c_.out_->FillThreshold(n)) {
+        if (auto e = Flush(level)) {
+          return e;
+        }
+      }
+      levels_[level]->Put(key, key, val, pgid, flags);
+      return std::nullopt;
+    }
+
+    // Finish writes the nodes left on every level and returns the root.
+    [[nodiscard]] std::expected<Pgid, Error> Finish() noexcept {
+      if (levels_.empty()) {
+        levels_.push_back(NewNode(0));
+      }
+      for (std::size_t level = 0; level + 1 < levels_.size(); level++) {
+        if (auto e = Flush(level)) {
+          return std::unexpected{*e};
+        }
+      }
+      auto &root = *levels_.back();
+      if (auto e = c_.Write(root)) {
+        return std::unexpected{*e};
+      }
+      return root.GetPgid().value();
+    }
+
+  private:
+    [[nodiscard]] std::unique_ptr<Node> NewNode(std::size_t level) noexcept {
+      // every node owns its arena, freed once the node is written
+      auto n = std::make_unique<Node>(nullptr, level == 0);
+      n->SetCompressed(compressed_);
+      return n;
+    }
+
+    // Flush writes the node of level and adds it to the level above.
+    [[nodiscard]] std::optional<Error> Flush(std::size_t level) noexcept {
+      auto n = std::move(levels_[level]);
+      levels_[level] = NewNode(level);
+      if (auto e = c_.Write(*n)) {
+        return e;
+      }
+      return Add(level + 1, n->GetElements().front().key_, {},
+                 n->GetPgid().value(), LeafFlag::None);
+    }
+
+    Compactor &c_;
+    const bool compressed_;
+    // node being filled on each level, leaves first
+    std::vector<std::unique_ptr<Node>> levels_;
+  };
+
+  // CopyTree copies the tree rooted at pgid and returns the root of the copy.
+  [[nodiscard]] std::expected<Pgid, Error> CopyTree(Pgid pgid,
+                                                    bool compressed) noexcept {
+    TreeWriter tree{*this, compressed};
+    if (auto e = CopyEntries(pgid, tree)) {
+      return std::unexpected{*e};
+    }
+    return tree.Finish();
+  }
+
+  // CopyEntries adds the entries of the subtree at pgid to tree, copying
+  // nested buckets first so their entries point to the copies.
+  [[nodiscard]] std::optional<Error> CopyEntries(Pgid pgid,
+                                                 TreeWriter &tree) noexcept {
+    // a handler per page so decoded pages are freed once copied
+    ShadowPageHandler pages{src_, false};
+    auto &p = pages.GetPage(pgid);
+    if (pages.Err()) {
+      return pages.Err();
+    }
+    if (p.Flags() & static_cast<std::size_t>(PageFlag::BranchPage)) {
+      auto &branch = p.AsPage<BranchPage>();
+      for (std::size_t i = 0; i < branch.Count(); i++) {
+        if (auto e = CopyEntries(branch.GetPgid(i), tree)) {
+          return e;
+        }
+      }
+      return std::nullopt;
+    }
+
+    auto &leaf = p.AsPage<LeafPage>();
+    for (std::size_t i = 0; i < leaf.Count(); i++) {
+      const auto key = leaf.GetKey(i);
+      auto val = leaf.GetVal(i);
+      const auto flags = static_cast<LeafFlag>(leaf.GetElement(i).flags_);
+      std::array<std::byte, BucketMeta::ENCODED_SIZE> encoded;
+      if (leaf.GetElement(i).flags_ &
+          static_cast<std::uint32_t>(LeafFlag::Bucket)) {
+        auto meta = BucketMeta::Decode(val.Data());
+        auto root = meta.Hashed() ? CopyHash(meta)
+                                  : CopyTree(meta.Root(), meta.Compressed());
+        if (!root) {
+          return root.error();
+        }
+        meta.SetRoot(*root);
+        meta.Encode(encoded.data());
+        val = {encoded.data(), encoded.size()};
+      }
+      if (auto e = tree.Add(0, key, val, 0, flags)) {
+        return e;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // CopyHash copies the hash table of a bucket, leaves first, and returns the
+  // root of the copy.
+  [[nodiscard]] std::expected<Pgid, Error>
+  CopyHash(const BucketMeta &meta) noexcept {
+    ShadowPageHandler pages{src_, false};
+    const auto &root = pages.GetPage(meta.Root());
+    if (pages.Err()) {
+      return std::unexpected{*pages.Err()};
+    }
+    // the slots of a leaf are consecutive, copy each leaf once
+    std::vector<std::vector<Pgid>> segments;
+    std::unordered_map<Pgid, Pgid> copies;
+    for (Pgid segment : HashTable::Segments(root)) {
+      ShadowPageHandler segment_pages{src_, false};
+      const auto &s = segment_pages.GetPage(segment);
+      if (segment_pages.Err()) {
+        return std::unexpected{*segment_pages.Err()};
+      }
+      auto &slots = segments.emplace_back();
+      for (Pgid id : HashTable::Slots(s)) {
+        auto [it, inserted] = copies.try_emplace(id, 0);
+        if (inserted) {
+          auto copy = CopyHashLeaf(id, meta.Compressed());
+          if (!copy) {
+            return std::unexpected{copy.error()};
+          }
+          it->second = *copy;
+        }
+        slots.push_back(it->second);
+      }
+    }
+
+    std::vector<Pgid> segment_ids;
+    for (const auto &slots : segments) {
+      auto p = out_->AllocateShadowPage(dst_meta_, 1);
+      if (!p) {
+        return std::unexpected{p.error()};
+      }
+      HashTable::WriteSegmentPage(p->get(), slots);
+      segment_ids.push_back(p->get().Id());
+    }
+    auto r = out_->AllocateShadowPage(
+        dst_meta_, HashTable::RootPages(segment_ids.size(), dst_.PageSize()));
+    if (!r) {
+      return std::unexpected{r.error()};
+    }
+    HashTable::WriteRootPage(r->get(), HashTable::Depth(root), segment_ids);
+    written_ += (segment_ids.size() + r->get().Overflow() + 1) *
+                dst_.PageSize();
+    return r->get().Id();
+  }
+
+  [[nodiscard]] std::expected<Pgid, Error>
+  CopyHashLeaf(Pgid pgid, bool compressed) noexcept {
+    ShadowPageHandler pages{src_, false};
+    auto &p = pages.GetPage(pgid);
+    if (pages.Err()) {
+      return std::unexpected{*pages.Err()};
+    }
+    Node n{nullptr, true};
+    n.SetCompressed(compressed);
+    n.Read(p);
+    if (auto e = Write(n)) {
+      return std::unexpected{*e};
+    }
+    return n.GetPgid().value();
+  }
+
+  // Write writes n to the destination, flushing a full batch first.
+  [[nodiscard]] std::optional<Error> Write(Node &n) noexcept {
+    if (written_ >= BATCH_BYTES) {
+      if (auto e = Flush()) {
+        return e;
+      }
+    }
+    written_ += n.GetStorageSize();
+    return out_->WriteNode(dst_meta_, n);
+  }
+
+  // Flush writes the pages of the batch to the destination and starts a new
+  // batch, so the memory of a batch is released once it is written.
+  [[nodiscard]] std::optional<Error> Flush() noexcept {
+    if (auto e = out_->WriteDirtyPages(dst_meta_.GetTxid())) {
+      return e;
+    }
+    out_ = std::make_unique<ShadowPageHandler>(dst_, true);
+    written_ = 0;
+    return std::nullopt;
+  }
+
+  // WriteMeta points both meta pages of the destination to the copy.
+  [[nodiscard]] std::optional<Error> WriteMeta() noexcept {
+    const auto page_size = dst_.PageSize();
+    PageBuffer metas{2, page_size};
+    for (Pgid id = 0; id < 2; id++) {
+      auto &p = metas.GetPage(id);
+      dst_meta_.Write(p);
+      p.SetId(id);
+      p.UpdateChecksum(page_size);
+    }
+    LOG_INFO("Compacted copy has {} pages", dst_meta_.GetWatermark());
+    return dst_.WritePageBuffer(metas, 0);
+  }
+
+  DiskHandler &src_;
+  const Meta meta_;
+  DiskHandler &dst_;
+  Meta dst_meta_;
+  // pages of the batch being written to the destination
+  std::unique_ptr<ShadowPageHandler> out_;
+  std::size_t written_{0};
+};
+
+} // namespace kv
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+
+namespace kv {
+
+// LZ77 block codec in the spirit of LZ4. A compressed block is a series of
+// sequences, each made of a token byte, an optional literal length extension,
+// the literal bytes, a 2 byte little endian match offset and an optional match
+// length extension. The high nibble of the token is the literal length and the
+// low nibble is the match length minus MIN_MATCH, a nibble of 15 means more
+// length bytes follow. The last sequence carries literals only.
+class LzCodec final {
+  static constexpr std::size_t MIN_MATCH = 4;
+  static constexpr std::size_t MAX_OFFSET = 0xFFFF;
+  static constexpr std::size_t HASH_BITS = 12;
+  static constexpr std::size_t RUN_MASK = 0x0F;
+
+public:
+  // Worst case size of compressing n bytes of incompressible input.
+  [[nodiscard]] static constexpr std::size_t
+  MaxCompressedSize(std::size_t n) noexcept {
+    return n + n / 255 + 16;
+  }
+
+  // Upper bound of the decompressed size of n bytes, every length extension
+  // byte expands to at most 255 bytes.
+  [[nodiscard]] static constexpr std::size_t
+  MaxDecompressedSize(std::size_t n) noexcept {
+    return n * 255;
+  }
+
+  // Compresses src into dst. Returns the number of bytes written or nullopt if
+  // dst is too small.
+  [[nodiscard]] static std::optional<std::size_t>
+  Compress(std::span<const std::byte> src, std::span<std::byte> dst) noexcept {
+    std::array<std::uint32_t, 1 << HASH_BITS> table{};
+    const auto *in = reinterpret_cast<const std::uint8_t *>(src.data());
+    auto *out = reinterpret_cast<std::uint8_t *>(dst.data());
+    const std::size_t in_sz = src.size();
+    const std::size_t out_sz = dst.size();
+
+    std::size_t ip = 0;
+    std::size_t op = 0;
+    std::size_t anchor = 0;
+
+    while (in_sz >= MIN_MATCH && ip + MIN_MATCH <= in_sz) {
+      const auto h = Hash(Load32(in + ip));
+      const std::size_t candidate = table[h];
+      table[h] = static_cast<std::uint32_t>(ip);
+
+      if (candidate >= ip || ip - candidate > MAX_OFFSET ||
+          Load32(in + candidate) != Load32(in + ip)) {
+        ip++;
+        continue;
+      }
+
+      std::size_t match_len = MIN_MATCH;
+      while (ip + match_len < in_sz &&
+             in[candidate + match_len] == in[ip + match_len]) {
+        match_len++;
+      }
+
+      if (!EmitSequence(out, out_sz, op, in + anchor, ip - anchor,
+                        ip - candidate, match_len)) {
+        return std::nullopt;
+      }
+      ip += match_len;
+      anchor = ip;
+    }
+
+    if (!EmitSequence(out, out_sz, op, in + anchor, in_sz - anchor, 0, 0)) {
+      return std::nullopt;
+    }
+    return op;
+  }
+
+  // Decompresses src into dst. Returns the number of bytes written or nullopt
+  // if src is malformed or does not fit into dst.
+  [[nodiscard]] static std::optional<std::size_t>
+  Decompress(std::span<const std::byte> src,
+             std::span<std::byte> dst) noexcept {
+    const auto *in = reinterpret_cast<const std::uint8_t *>(src.data());
+    auto *out = reinterpret_cast<std::uint8_t *>(dst.data());
+    const std::size_t in_sz = src.size();
+    const std::size_t out_sz = dst.size();
+
+    std::size_t ip = 0;
+    std::size_t op = 0;
+    while (ip < in_sz) {
+      const std::uint8_t token = in[ip++];
+
+      auto lit_len = ReadLength(in, in_sz, ip, token >> 4);
+      if (!lit_len || ip + *lit_len > in_sz || op + *lit_len > out_sz) {
+        return std::nullopt;
+      }
+      std::memcpy(out + op, in + ip, *lit_len);
+      ip += *lit_len;
+      op += *lit_len;
+
+      // the last sequence only carries literals
+      if (ip == in_sz) {
+        break;
+      }
+
+      if (ip + 2 > in_sz) {
+        return std::nullopt;
+      }
+      const std::size_t offset = in[ip] | (in[ip + 1] << 8);
+      ip += 2;
+      auto match_len = ReadLength(in, in_sz, ip, token & RUN_MASK);
+      if (!match_len || offset == 0 || offset > op) {
+        return std::nullopt;
+      }
+      const std::size_t len = *match_len + MIN_MATCH;
+      if (op + len > out_sz) {
+        return std::nullopt;
+      }
+      // byte by byte since the match may overlap the output being produced
+      for (std::size_t i = 0; i < len; i++) {
+        out[op + i] = out[op - offset + i];
+      }
+      op += len;
+    }
+    return op;
+  }
+
+private:
+  [[nodiscard]] static std::uint32_t Load32(const std::uint8_t *p) noexcept {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  [[nodiscard]] static std::size_t Hash(std::uint32_t v) noexcept {
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+  }
+
+  [[nodiscard]] static bool WriteLength(std::uint8_t *out, std::size_t out_sz,
+                                        std::size_t &op,
+                                        std::size_t len) noexcept {
+    while (len >= 0xFF) {
+      if (op >= out_sz) {
+        return false;
+      }
+      out[op++] = 0xFF;
+      len -= 0xFF;
+    }
+    if (op >= out_sz) {
+      return false;
+    }
+    out[op++] = static_cast<std::uint8_t>(len);
+    return true;
+  }
+
+  [[nodiscard]] static std::optional<std::size_t>
+  ReadLength(const std::uint8_t *in, std::size_t in_sz, std::size_t &ip,
+             std::size_t nibble) noexcept {
+    std::size_t len = nibble;
+    if (nibble != RUN_MASK) {
+      return len;
+    }
+    while (true) {
+      if (ip >= in_sz) {
+        return std::nullopt;
+      }
+      const std::uint8_t b = in[ip++];
+      len += b;
+      if (b != 0xFF) {
+        return len;
+      }
+    }
+  }
+
+  // Writes one sequence. A match_len of 0 writes a literal only sequence.
+  [[nodiscard]] static bool
+  EmitSequence(std::uint8_t *out, std::size_t out_sz, std::size_t &op,
+               const std::uint8_t *literals, std::size_t lit_len,
+               std::size_t offset, std::size_t match_len) noexcept {
+    if (op >= out_sz) {
+      return false;
+    }
+    const std::size_t ml = match_len ? match_len - MIN_MATCH : 0;
+    std::uint8_t &token = out[op++];
+    token = static_cast<std::uint8_t>((std::min(lit_len, RUN_MASK) << 4) |
+                                      std::min(ml, RUN_MASK));
+
+    if (lit_len >= RUN_MASK &&
+        !WriteLength(out, out_sz, op, lit_len - RUN_MASK)) {
+      return false;
+    }
+    if (op + lit_len > out_sz) {
+      return false;
+    }
+    std::memcpy(out + op, literals, lit_len);
+    op += lit_len;
+
+    if (match_len == 0) {
+      return true;
+    }
+    if (op + 2 > out_sz) {
+      return false;
+    }
+    out[op++] = static_cast<std::uint8_t>(offset & 0xFF);
+    out[op++] = static_cast<std::uint8_t>(offset >> 8);
+    if (ml >= RUN_MASK && !WriteLength(out, out_sz, op, ml - RUN_MASK)) {
+      return false;
+    }
+    return true;
+  }
+};
+
+} // namespace kv
@@ -4,6 +4,7 @@
 #include "log.h"
 #include "node.h"
 #include "page.h"
+#include "trace.h"
 #include "tx_cache.h"
 #include "type.h"
 #include <cstdint>
@@ -16,11 +17,15 @@ public:
       : tx_cache_(tx_cache), b_meta_(b_meta) {};
 
   // Places the cursor at the node where we would insert the seek slice
-  // After using this method the cursor should always point to a leaf node
+  // After using this method the cursor should always point to a leaf node.
+  // Order breaks ties of equal key prefixes, see FixedOrder.
+  template <typename Order = BytewiseOrder>
   [[nodiscard]] std::optional<std::pair<Slice, Slice>>
   Seek(const Slice &seek) noexcept {
     stack_.clear();
-    Search(seek, b_meta_.Root());
+    KV_TRACE1(cursor__seek__start, b_meta_.Root());
+    Search<Order>(seek, b_meta_.Root());
+    KV_TRACE1(cursor__seek__done, stack_.size());
     auto node = stack_.back();
     if (node.index_ == -1 || (std::size_t)node.index_ >= node.Size()) {
       PrintStack();
@@ -31,6 +36,15 @@ public:
     return GetKeyValue();
   }
 
+  // Flags returns the LeafFlag bits of the element found by the last Seek.
+  [[nodiscard]] std::uint32_t Flags() const noexcept {
+    const auto &node = stack_.back();
+    if (node.n_) {
+      return node.n_->GetElements()[node.index_].flags_;
+    }
+    return node.p_->AsPage<LeafPage>().GetElement(node.index_).flags_;
+  }
+
   // Get the current leaf node
   [[nodiscard]] Node &GetNode() noexcept {
     assert(!stack_.empty());
@@ -51,6 +65,7 @@ public:
               stack_[0].p_->Id());
     if (cur == nullptr) {
       cur = &tx_cache_.GetOrCreateNode(stack_[0].p_->Id(), nullptr);
+      cur->SetCompressed(b_meta_.Compressed());
     }
     for (int i = 0; i < (int)stack_.size() - 1; i++) {
       assert(!stack_[i].IsLeaf());
@@ -82,7 +97,7 @@ private:
   }
   // Search recursively performs a binary search against a given page/node until
   // it finds a given key
-  void Search(const Slice &key, Pgid pgid) {
+  template <typename Order> void Search(const Slice &key, Pgid pgid) {
     LOG_INFO("searching {}", pgid);
     auto [p, n] = tx_cache_.GetPageOrNode(pgid);
     stack_.push_back(TreeNode{p, n});
@@ -91,7 +106,7 @@ private:
       LOG_INFO("is leaf pid: {}", node.p_->Id());
       if (node.n_) {
         LOG_INFO("node : {}", node.n_->ToString());
-        auto [index, _] = node.n_->FindFirstGreaterOrEqualTo(key);
+        auto [index, _] = node.n_->GetElements().LowerBound<Order>(key);
         index_ = index;
         LOG_INFO("node : {}, index: {}, search key: {}", node.n_->ToString(),
                  index_, key.ToString());
@@ -100,16 +115,15 @@ private:
         auto &p = node.p_->AsPage<LeafPage>();
         LOG_INFO("hi: {} {} {} {}", static_cast<const void *>(&p), p.Id(),
                  p.ToStringVerbose(), p.ToString());
-        index_ = p.FindLastLessThan(key) + 1;
+        index_ = p.LowerBound<Order>(key).first;
         LOG_INFO("index: {}", index_);
         node.index_ = index_;
       }
     } else {
       LOG_INFO("is branch pid: {}", node.p_->Id());
       const auto [index, exact] =
-          node.n_
-              ? node.n_->FindFirstGreaterOrEqualTo(key)
-              : node.p_->AsPage<BranchPage>().FindFirstGreaterOrEqualTo(key);
+          node.n_ ? node.n_->GetElements().LowerBound<Order>(key)
+                  : node.p_->AsPage<BranchPage>().LowerBound<Order>(key);
 
       std::size_t adjusted_index = (!exact && index > 0) ? index - 1 : index;
       stack_.back().index_ = adjusted_index;
@@ -119,7 +133,7 @@ private:
               ? node.n_->GetElements()[adjusted_index].pgid_
               : node.p_->AsPage<BranchPage>().GetElement(adjusted_index).pgid_;
 
-      Search(key, child_pgid);
+      Search<Order>(key, child_pgid);
     }
   }
 
@@ -1,20 +1,27 @@
 #pragma once
 
+#include "check.h"
+#include "compact.h"
 #include "disk.h"
 #include "error.h"
 #include "log.h"
+#include "options.h"
 #include "page.h"
 #include "scope.h"
+#include "trace.h"
 #include "tx.h"
+#include "value_cache.h"
 #include <cassert>
 #include <expected>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <thread>
 #include <unistd.h>
 
 namespace kv {
@@ -27,7 +34,8 @@ public:
   using RAII_DB = std::unique_ptr<DB, std::function<void(DB *)>>;
 
   [[nodiscard]] static std::expected<RAII_DB, Error>
-  Open(const std::filesystem::path &path) noexcept {
+  Open(const std::filesystem::path &path,
+       const Options &options = {}) noexcept {
     auto db = std::unique_ptr<DB, std::function<void(DB *)>>(
         new DB{}, [](DB *db_ptr) {
           if (db_ptr) {
@@ -36,7 +44,7 @@ public:
           }
         });
 
-    auto file_sz_or_err = db->disk_handler_.Open(path);
+    auto file_sz_or_err = db->disk_handler_.Open(path, options);
     if (!file_sz_or_err)
       return std::unexpected{file_sz_or_err.error()};
     auto file_sz = file_sz_or_err.value();
@@ -51,9 +59,16 @@ public:
       }
     }
 
+    if (options.value_cache_bytes_) {
+      db->value_cache_ = std::make_unique<ValueCache>(
+          options.value_cache_bytes_, db->disk_handler_.GetStats());
+    }
+    if (options.bloom_fp_rate_ > 0) {
+      db->bloom_filters_ = std::make_unique<BloomFilters>(
+          options.bloom_fp_rate_, db->disk_handler_.GetStats());
+    }
     // set up meta* reference
     db->Init();
-    assert(db->even_meta_);
     // check the file to detect corruption
     LOG_INFO("Checking file to detect corruption.");
     auto err_opt = db->Validate();
@@ -74,9 +89,63 @@ public:
     // recover
 
     db->opened_ = true;
+
+    if (options.check_mode_ == CheckMode::Blocking) {
+      auto result = db->Check();
+      if (!result.Ok()) {
+        auto err = result.errors_.front();
+        db->Close();
+        return std::unexpected{err};
+      }
+    } else if (options.check_mode_ == CheckMode::Background) {
+      db->background_check_ = db->CheckAsync();
+    }
     return db;
   }
 
+  // Check verifies the whole file as of the latest committed meta, walking the
+  // freelist and every bucket tree on a pool of threads.
+  [[nodiscard]] CheckResult
+  Check(std::size_t threads = std::thread::hardware_concurrency()) noexcept {
+    Meta meta;
+    {
+      std::lock_guard metalock(metalock_);
+      meta = GetCurrentMeta();
+    }
+    Checker checker{disk_handler_, meta, threads};
+    return checker.Run();
+  }
+
+  // CheckAsync runs Check on a background thread. Reads are served while it
+  // runs, commits that need to grow the mmap wait for it to finish.
+  [[nodiscard]] std::shared_future<CheckResult> CheckAsync(
+      std::size_t threads = std::thread::hardware_concurrency()) noexcept {
+    return std::async(std::launch::async, [this, threads] {
+             return Check(threads);
+           }).share();
+  }
+
+  // BackgroundCheck waits for the check started by CheckMode::Background.
+  [[nodiscard]] std::optional<CheckResult> BackgroundCheck() noexcept {
+    if (!background_check_.valid()) {
+      return std::nullopt;
+    }
+    return background_check_.get();
+  }
+
+  // SetVerifyChecksums toggles verification of page checksums when
+  // transactions first touch a page.
+  void SetVerifyChecksums(bool verify) noexcept {
+    disk_handler_.SetVerifyChecksums(verify);
+  }
+
+  // Sync fsyncs every commit so far, for use with SyncMode::Periodic and
+  // SyncMode::None. It also reports the first periodic fsync that failed
+  // since the last Sync, commits never fail on those.
+  [[nodiscard]] std::optional<Error> Sync() noexcept {
+    return disk_handler_.SyncNow();
+  }
+
   // Close the DB and release all resources
   void Close() noexcept {
     LOG_INFO("Closing db, releasing resources");
@@ -84,6 +153,12 @@ public:
       LOG_INFO("DB is not opened or is already closed, no need to close");
       return;
     }
+    if (background_check_.valid()) {
+      background_check_.wait();
+    }
+    if (bloom_filters_) {
+      bloom_filters_->Cancel();
+    }
     disk_handler_.Close();
     opened_ = false;
   }
@@ -98,13 +173,18 @@ public:
   }
 
   std::expected<Tx, Error> BeginRWTx() noexcept {
-    std::lock_guard writerlock(writerlock_);
+    // held by the tx until it commits or rolls back
+    std::unique_lock writerlock(writerlock_);
     std::lock_guard metalock(metalock_);
     if (!opened_)
       return std::unexpected{Error{"DB not opened"}};
+    if (disk_handler_.ReadOnly())
+      return std::unexpected{Error{"DB opened read only"}};
     // Tx takes in a copy of the db meta
     LOG_DEBUG("---Creating transaction---");
-    Tx tx{disk_handler_, true, GetCurrentMeta()};
+    Tx tx{disk_handler_, true, GetCurrentMeta(), buckets_cache_,
+          value_cache_.get(), bloom_filters_.get(), std::move(writerlock)};
+    KV_TRACE1(rwtx__begin, tx.GetTxid());
     txs.push_back(&tx);
     rwtx_ = &tx;
 
@@ -116,7 +196,9 @@ public:
     std::lock_guard metalock(metalock_);
     if (!opened_)
       return std::unexpected{Error{"DB not opened"}};
-    Tx tx{disk_handler_, false, GetCurrentMeta()};
+    Tx tx{disk_handler_, false, GetCurrentMeta(), buckets_cache_,
+          value_cache_.get(), bloom_filters_.get()};
+    KV_TRACE1(rtx__begin, tx.GetTxid());
     txs.push_back(&tx);
     // add read only txid to freelist
 
@@ -155,6 +237,119 @@ public:
     return tx.Commit();
   }
 
+  // View runs fn in a read only transaction. Fails if fn read a corrupted
+  // page even when fn itself returned no error.
+  [[nodiscard]] std::optional<Error>
+  View(const std::function<std::optional<Error>(Tx &)> &fn) noexcept {
+    auto tx_or_err = Begin(false);
+    if (!tx_or_err)
+      return tx_or_err.error();
+    auto &tx = tx_or_err.value();
+    auto err_opt = fn(tx);
+    tx.Rollback();
+    if (!err_opt) {
+      return tx.Err();
+    }
+    return err_opt;
+  }
+
+  [[nodiscard]] std::size_t PageSize() const noexcept {
+    return disk_handler_.PageSize();
+  }
+
+  [[nodiscard]] const Options &GetOptions() const noexcept {
+    return disk_handler_.GetOptions();
+  }
+
+  // Compact rewrites the db into a fresh file with every bucket in key order
+  // and its pages packed to fill_percent, then swaps it in. It waits for an
+  // open write tx to finish and new write txs wait for it. Reads keep going
+  // until the swap, which waits for open read txs to finish. Calling it while
+  // holding a tx deadlocks.
+  [[nodiscard]] std::optional<Error>
+  Compact(double fill_percent = 1.0) noexcept {
+    std::lock_guard writerlock(writerlock_);
+    if (!opened_) {
+      return Error{"DB not opened"};
+    }
+    if (disk_handler_.ReadOnly()) {
+      return Error{"DB opened read only"};
+    }
+    Meta meta;
+    {
+      std::lock_guard metalock(metalock_);
+      meta = GetCurrentMeta();
+    }
+
+    auto tmp = disk_handler_.Path();
+    tmp += ".compact";
+    std::filesystem::remove(tmp);
+    Options options = disk_handler_.GetOptions();
+    options.page_size_ = disk_handler_.PageSize();
+    options.fill_percent_ = fill_percent;
+    options.check_mode_ = CheckMode::None;
+    options.sync_mode_ = SyncMode::None;
+    options.page_journal_ = false;
+    options.value_cache_bytes_ = 0;
+    options.bloom_fp_rate_ = 0;
+    std::size_t size = 0;
+    {
+      auto dst_or_err = Open(tmp, options);
+      if (!dst_or_err) {
+        return dst_or_err.error();
+      }
+      auto &dst = *dst_or_err;
+      Compactor compactor{disk_handler_, meta, dst->disk_handler_,
+                          dst->GetCurrentMeta()};
+      if (auto e = compactor.Run()) {
+        std::filesystem::remove(tmp);
+        return e;
+      }
+      if (auto e = dst->Sync()) {
+        std::filesystem::remove(tmp);
+        return e;
+      }
+      size = dst->GetCurrentMeta().GetWatermark() * dst->PageSize();
+    }
+    LOG_INFO("Compacted {} into {} bytes", disk_handler_.Path().string(), size);
+    // nothing past the watermark is referenced
+    std::error_code ec;
+    std::filesystem::resize_file(tmp, size, ec);
+    if (ec) {
+      std::filesystem::remove(tmp);
+      return Error{"Failed to truncate compacted file: " + ec.message()};
+    }
+
+    // filters being built read the old file
+    if (bloom_filters_) {
+      bloom_filters_->Cancel();
+    }
+    std::lock_guard metalock(metalock_);
+    if (auto e = disk_handler_.Replace(tmp)) {
+      // a failed rename leaves the old file open and the copy behind
+      std::filesystem::remove(tmp, ec);
+      opened_ = disk_handler_.IsOpen();
+      return e;
+    }
+    // txids start over in the new file
+    buckets_cache_.Reset();
+    return Init();
+  }
+
+  // GetStats returns a snapshot of the db counters and commit latencies.
+  [[nodiscard]] StatsSnapshot GetStats() noexcept {
+    auto snap = disk_handler_.GetStats().Snapshot();
+    snap.freelist_size_ = disk_handler_.FreelistSize();
+    std::lock_guard statslock(statslock_);
+    snap.tx_cnt_ = stats_.tx_cnt_;
+    snap.open_tx_cnt_ = stats_.open_tx_cnt_;
+    return snap;
+  }
+
+  [[nodiscard]] const BucketsCache &GetBucketsCache() const noexcept {
+    return buckets_cache_;
+  }
+
   /// Debug utility to print all pages of a bucket by page id traversal.
   ///
   /// This starts from the bucket’s root page id and traverses recursively,
@@ -183,15 +378,27 @@ private:
   // Initialize the internal fields of the db
   std::optional<Error> Init() noexcept {
     LOG_DEBUG("Initializing database");
-    even_meta_ =
-        disk_handler_.GetPageFromMmap(EVEN_META_PAGE_ID).GetDataAs<Meta>();
-    odd_meta_ =
-        disk_handler_.GetPageFromMmap(ODD_META_PAGE_ID).GetDataAs<Meta>();
-    LOG_DEBUG("yo {}", even_meta_->ToString());
-    LOG_DEBUG("yo {}", odd_meta_->ToString());
+    LOG_DEBUG("yo {}", EvenMeta().ToString());
+    LOG_DEBUG("yo {}", OddMeta().ToString());
+    if (value_cache_) {
+      value_cache_->Reset(GetCurrentMeta().GetTxid());
+    }
+    if (bloom_filters_) {
+      bloom_filters_->Reset(GetCurrentMeta().GetTxid());
+    }
     return {};
   }
 
+  // The meta pages are looked up on every use since growing the mmap moves
+  // them.
+  [[nodiscard]] Meta &EvenMeta() noexcept {
+    return *disk_handler_.GetPageFromMmap(EVEN_META_PAGE_ID).GetDataAs<Meta>();
+  }
+
+  [[nodiscard]] Meta &OddMeta() noexcept {
+    return *disk_handler_.GetPageFromMmap(ODD_META_PAGE_ID).GetDataAs<Meta>();
+  }
+
   std::optional<Error> InitNewDatabaseFile() noexcept {
     LOG_INFO("InitNewDatabaseFile");
     PageBuffer buf{4, disk_handler_.PageSize()};
@@ -206,7 +413,7 @@ private:
     m_even.SetPageSize(disk_handler_.PageSize());
     m_even.SetFreelist(FREELIST_PAGE_ID);
     m_even.SetBuckets(BUCKET_PAGE_ID);
-    m_even.SetWatermark(3);
+    m_even.SetWatermark(INIT_WATERMARK);
     m_even.SetTxid(0);
     m_even.SetChecksum(m_even.Sum64());
 
@@ -220,7 +427,7 @@ private:
     m_odd.SetPageSize(disk_handler_.PageSize());
     m_odd.SetFreelist(FREELIST_PAGE_ID);
     m_odd.SetBuckets(BUCKET_PAGE_ID);
-    m_odd.SetWatermark(3);
+    m_odd.SetWatermark(INIT_WATERMARK);
     m_odd.SetTxid(1);
     m_odd.SetChecksum(m_odd.Sum64());
 
@@ -230,18 +437,23 @@ private:
 
     auto &bucket_p = buf.GetPage(BUCKET_PAGE_ID);
     bucket_p.SetId(BUCKET_PAGE_ID);
-    bucket_p.SetFlags(PageFlag::BucketPage);
+    // the catalog starts as an empty leaf
+    bucket_p.SetFlags(PageFlag::LeafPage);
+
+    for (Pgid id = 0; id < INIT_WATERMARK; id++) {
+      buf.GetPage(id).UpdateChecksum(disk_handler_.PageSize());
+    }
 
     auto e = disk_handler_.WritePageBuffer(buf, 0);
     if (e.has_value()) {
       return e;
     }
-    return disk_handler_.Sync();
+    return disk_handler_.SyncNow();
   }
 
   [[nodiscard]] std::optional<Error> Validate() noexcept {
     // Validate the meta
-    if (even_meta_->Validate() && odd_meta_->Validate()) {
+    if (EvenMeta().Validate() && OddMeta().Validate()) {
       return Error{"both meta invalid"};
     }
     return std::nullopt;
@@ -266,14 +478,18 @@ private:
       for (std::size_t i = 0; i < branch.Count(); ++i) {
         TraverseAndPrintPage(branch.GetPgid(i), depth + 1);
       }
+    } else if (page.Flags() &
+               static_cast<std::size_t>(PageFlag::CompressedPage)) {
+      LOG_WARN("{}CompressedPage {}: count {}, overflow {}", indent, pgid,
+               page.Count(), page.Overflow());
     } else {
       LOG_INFO("{}Unknown page type for pgid {}", indent, pgid);
     }
   }
 
   [[nodiscard]] Meta GetCurrentMeta() noexcept {
-    auto m0 = *even_meta_;
-    auto m1 = *odd_meta_;
+    auto m0 = EvenMeta();
+    auto m1 = OddMeta();
     LOG_DEBUG("m1 {}, m0 {}", m1.ToString(), m0.ToString());
     if (m1.GetTxid() < m0.GetTxid()) {
       std::swap(m0, m1);
@@ -291,13 +507,13 @@ private:
 private:
   struct Stats {
     // total number of started read tx
-    std::size_t tx_cnt_;
+    std::size_t tx_cnt_{0};
     // number of currently open read transactions
-    std::size_t open_tx_cnt_;
+    std::size_t open_tx_cnt_{0};
   };
   // mutex to protect the meta pages
   std::mutex metalock_;
-  // only allow one writer to the database at a time
+  // only allow one writer to the database at a time, held by the write tx
   std::mutex writerlock_;
   // whether the db is opened or not. Close() will only work if opened_ is true
   bool opened_{false};
@@ -311,8 +527,13 @@ private:
   std::mutex statslock_;
   // write tx
   Tx *rwtx_;
-  // Meta
-  Meta *even_meta_;
-  Meta *odd_meta_;
+  // decoded bucket catalog of the latest meta, shared by txs
+  BucketsCache buckets_cache_;
+  // point lookups shared by read txs, set by Options::value_cache_bytes_
+  std::unique_ptr<ValueCache> value_cache_;
+  // filters of missing keys for read txs, set by Options::bloom_fp_rate_
+  std::unique_ptr<BloomFilters> bloom_filters_;
+  // full file check started by CheckMode::Background
+  std::shared_future<CheckResult> background_check_;
 };
 } // namespace kv
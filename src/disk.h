@@ -2,27 +2,51 @@
 
 #include "error.h"
 #include "fd.h"
+#include "file.h"
 #include "freelist.h"
 #include "mmap.h"
+#include "options.h"
 #include "os.h"
 #include "page.h"
+#include "page_journal.h"
 #include "shadow_page.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <expected>
-#include <fstream>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <sys/uio.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+#include <vector>
 namespace kv {
 
 class DiskHandler final {
-  static constexpr std::size_t INIT_MMAP_SIZE = 1 << 30;
+  // Buffers per vectored write, the iovec limit on Linux and macOS.
+  static constexpr std::size_t MAX_IOV = 1024;
 
 public:
   DiskHandler() noexcept = default;
+  DiskHandler(const DiskHandler &) = delete;
+  DiskHandler &operator=(const DiskHandler &) = delete;
+  ~DiskHandler() { StopFlusher(); }
+
   [[nodiscard]] std::expected<std::size_t, Error>
-  Open(std::filesystem::path path) noexcept {
-    constexpr auto flags = (O_RDWR | O_CREAT);
+  Open(std::filesystem::path path, const Options &options = {}) noexcept {
+    const auto flags = options.read_only_ ? O_RDONLY : (O_RDWR | O_CREAT);
     constexpr auto mode = 0666;
     LOG_TRACE("Opening db file: {}", path.string());
+    options_ = options;
 
     // acquire a file descriptor
     auto fd = ::open(path.c_str(), flags, mode);
@@ -33,36 +57,80 @@ public:
     }
     fd_ = Fd{fd};
     path_ = path;
-    page_size_ = OS::OSPageSize();
+    file_ = std::make_unique<PosixFile>(fd_.GetFd());
+    if (options.wrap_file_) {
+      file_ = options.wrap_file_(std::move(file_));
+    }
 
-    // acquire file descriptor lock
-    if (::flock(fd_.GetFd(), LOCK_EX) == -1) {
+    // acquire file descriptor lock, readers can share the file
+    if (::flock(fd_.GetFd(), options.read_only_ ? LOCK_SH : LOCK_EX) == -1) {
       LOG_ERROR("Failed to lock db file");
       Close();
       return std::unexpected{Error{"Failed to lock db file"}};
     }
 
-    // open fstream for io
-    fs_.open(path, std::ios::in | std::ios::out | std::ios::binary);
-    if (!fs_.is_open()) {
-      LOG_ERROR("Failed to open db file after creation: {}", path.string());
+    auto file_sz_or_err = OS::FileSize(path_);
+    if (!file_sz_or_err) {
       Close();
-      return std::unexpected{Error{"IO error"}};
+      return std::unexpected{file_sz_or_err.error()};
+    }
+    auto file_sz = file_sz_or_err.value();
+
+    // an existing file keeps the page size it was created with
+    if (file_sz > 0) {
+      auto page_size_opt = ReadPageSize();
+      if (!page_size_opt) {
+        Close();
+        return std::unexpected{Error{"Failed to read page size from meta"}};
+      }
+      if (options.page_size_ != 0 && options.page_size_ != *page_size_opt) {
+        LOG_WARN("Ignoring page size {}, file uses page size {}",
+                 options.page_size_, *page_size_opt);
+      }
+      page_size_ = *page_size_opt;
+    } else if (options.read_only_) {
+      Close();
+      return std::unexpected{Error{"Can not initialize a read only db"}};
+    } else {
+      page_size_ = options.page_size_ ? options.page_size_ : OS::OSPageSize();
+    }
+    if (page_size_ < Options::MIN_PAGE_SIZE ||
+        page_size_ > Options::MAX_PAGE_SIZE ||
+        (page_size_ & (page_size_ - 1)) != 0) {
+      Close();
+      return std::unexpected{Error{"Invalid page size"}};
+    }
+
+    pool_.SetPageSize(page_size_);
+    if (options.direct_io_ && !options.read_only_) {
+      OpenDirect();
     }
-    fs_.exceptions(std::ios::goodbit);
 
     // set up mmap for io
-    if (auto err_opt = mmap_handle_.Mmap(path_, fd_.GetFd(), INIT_MMAP_SIZE)) {
+    mmap_handle_.Configure(page_size_, options.read_only_);
+    if (auto err_opt = mmap_handle_.Mmap(path_, fd_.GetFd(),
+                                         options.initial_mmap_size_)) {
+      Close();
       return std::unexpected{*err_opt};
     }
 
-    auto file_sz_or_err = OS::FileSize(path_);
-    if (!file_sz_or_err) {
-      Close();
-      return std::unexpected{file_sz_or_err.error()};
+    if (options.page_journal_ &&
+        (!options.read_only_ ||
+         std::filesystem::exists(PageJournal::PathFor(path_)))) {
+      if (auto err = journal_.Open(PageJournal::PathFor(path_),
+                                   options.read_only_)) {
+        Close();
+        return std::unexpected{*err};
+      }
     }
 
-    auto file_sz = file_sz_or_err.value();
+    if (options.sync_mode_ == SyncMode::Periodic &&
+        options.sync_interval_.count() > 0) {
+      stop_flusher_ = false;
+      flusher_ = std::thread{[this] { RunFlusher(); }};
+    }
+
+    file_size_.store(file_sz, std::memory_order_release);
     opened_ = true;
     return file_sz;
   }
@@ -83,33 +151,69 @@ public:
     return p;
   }
 
-  [[nodiscard]] void *GetAddress(std::size_t pos) const noexcept {
-    return static_cast<std::byte *>(mmap_handle_.MmapPtr()) + pos;
+  // LockMmapShared keeps the mmap from being remapped while held. Used by
+  // threads that read pages outside of the writer.
+  [[nodiscard]] std::shared_lock<std::shared_mutex> LockMmapShared() noexcept {
+    return std::shared_lock{mmaplock_};
   }
 
-  [[nodiscard]] std::expected<PageBuffer, Error>
-  CreatePageBufferFromDisk(std::size_t offset, std::size_t size) noexcept {
-    assert(opened_);
-    if (!fs_.is_open()) {
-      return std::unexpected{Error{"Fs is not open"}};
-    }
+  // LockFileShared keeps Replace from swapping the file while held. Read txs
+  // hold it for their lifetime.
+  [[nodiscard]] std::shared_lock<std::shared_mutex> LockFileShared() noexcept {
+    return std::shared_lock{filelock_};
+  }
 
-    if (fs_.exceptions() != std::ios::goodbit) {
-      return std::unexpected{Error{"Fs exceptions must be disabled"}};
+  // TryLockFileShared is LockFileShared that gives up instead of waiting, the
+  // returned lock owns nothing if the file is locked by Replace.
+  [[nodiscard]] std::shared_lock<std::shared_mutex>
+  TryLockFileShared() noexcept {
+    return std::shared_lock{filelock_, std::try_to_lock};
+  }
+
+  // DupFd returns a descriptor of the db file that stays on the same file
+  // when Replace swaps it.
+  [[nodiscard]] std::expected<Fd, Error> DupFd() noexcept {
+    std::shared_lock mmaplock(mmaplock_);
+    auto fd = ::dup(fd_.GetFd());
+    if (fd == -1) {
+      return std::unexpected{Error{"Failed to dup db fd"}};
     }
+    return Fd{fd};
+  }
 
-    fs_.seekg(offset, std::ios::beg);
-    if (!fs_) {
-      return std::unexpected{Error{"Failed to seek to the offset"}};
+  [[nodiscard]] std::size_t MmapSize() const noexcept {
+    return mmap_handle_.Size();
+  }
+
+  // FilePages returns the number of whole pages in the file. The mmap may
+  // reach past them, touching a page there faults.
+  [[nodiscard]] std::size_t FilePages() const noexcept {
+    return file_size_.load(std::memory_order_acquire) / page_size_;
+  }
+
+  [[nodiscard]] void *GetAddress(std::size_t pos) const noexcept {
+    return static_cast<std::byte *>(mmap_handle_.MmapPtr()) + pos;
+  }
+
+  // MmapOffset returns the file offset of p if it points into the mmap.
+  [[nodiscard]] std::optional<std::size_t>
+  MmapOffset(const void *p) const noexcept {
+    const auto *base = static_cast<const std::byte *>(mmap_handle_.MmapPtr());
+    const auto *b = static_cast<const std::byte *>(p);
+    if (b < base || b >= base + mmap_handle_.Size()) {
+      return std::nullopt;
     }
+    return static_cast<std::size_t>(b - base);
+  }
 
+  [[nodiscard]] std::expected<PageBuffer, Error>
+  CreatePageBufferFromDisk(std::size_t offset, std::size_t size) noexcept {
+    assert(opened_);
     PageBuffer buffer(size, page_size_);
-    fs_.read(reinterpret_cast<char *>(buffer.GetBuffer().data()),
-             size * page_size_);
-    if (!fs_) {
-      return std::unexpected{Error{"Failed to read data from disk"}};
+    if (auto err = file_->ReadAt(buffer.GetBuffer().data(), size * page_size_,
+                                 offset)) {
+      return std::unexpected{*err};
     }
-
     return buffer;
   }
 
@@ -117,42 +221,259 @@ public:
     // assert(opened_);
     // release the mmap region to trigger the deconstructor that will unmap the
     // region
-    if (fs_.is_open()) {
-      fs_.close();
+    StopFlusher();
+    if (file_ && options_.sync_mode_ == SyncMode::Periodic &&
+        unsynced_commits_ > 0) {
+      if (auto err = SyncNow()) {
+        LOG_ERROR("Final sync failed: {}", err->message());
+      }
     }
+    file_.reset();
+    direct_file_.reset();
+    auto direct_err = direct_fd_.Reset();
+    assert(!direct_err);
     mmap_handle_.Reset();
+    journal_.Close();
     auto e = fd_.Reset();
     assert(!e);
   }
 
+  // IsOpen reports whether the db file is open, false after a Replace that
+  // failed past the rename.
+  [[nodiscard]] bool IsOpen() const noexcept { return fd_.IsValid(); }
+
   [[nodiscard]] std::size_t PageSize() const noexcept {
     assert(opened_);
     return page_size_;
   }
 
+  [[nodiscard]] const std::filesystem::path &Path() const noexcept {
+    return path_;
+  }
+
+  // Replace swaps the db file for the file at from, which must have the same
+  // page size, and reopens it. The rename is atomic and fsynced, so a crash
+  // leaves either file in place. If the rename fails the old file stays
+  // open. Read txs and readers holding LockMmapShared are waited for.
+  [[nodiscard]] std::optional<Error>
+  Replace(const std::filesystem::path &from) noexcept {
+    std::unique_lock filelock(filelock_);
+    std::unique_lock mmaplock(mmaplock_);
+    if (::rename(from.c_str(), path_.c_str()) == -1) {
+      LOG_ERROR("Failed to rename {} to {}", from.string(), path_.string());
+      return Error{"Failed to replace db file"};
+    }
+    // the old file is unlinked but stays open until now
+    Close();
+    auto dir = path_.parent_path().empty() ? "." : path_.parent_path();
+    Fd dir_fd{::open(dir.c_str(), O_RDONLY)};
+    if (auto err = dir_fd.Sync()) {
+      return err;
+    }
+    auto file_sz_or_err = Open(path_, options_);
+    if (!file_sz_or_err) {
+      return file_sz_or_err.error();
+    }
+    // page ids of the old file mean nothing in the new one
+    if (journal_.IsOpen()) {
+      if (auto err = journal_.Reset()) {
+        Close();
+        return err;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // JournalPages records the page runs a commit wrote in the page journal
+  // when Options::page_journal_ is set. pages are sorted by id.
+  [[nodiscard]] std::optional<Error>
+  JournalPages(Txid txid, std::span<Page *const> pages) noexcept {
+    if (!journal_.IsOpen()) {
+      return std::nullopt;
+    }
+    std::vector<PageRun> runs;
+    for (const auto *p : pages) {
+      if (!runs.empty() && runs.back().pgid_ + runs.back().count_ == p->Id()) {
+        runs.back().count_ += p->Overflow() + 1;
+      } else {
+        runs.push_back({p->Id(), p->Overflow() + 1});
+      }
+    }
+    return journal_.Append(txid, runs);
+  }
+
+  // Journal returns the page journal, open when Options::page_journal_ is
+  // set.
+  [[nodiscard]] const PageJournal &Journal() const noexcept {
+    return journal_;
+  }
+
   [[nodiscard]] std::optional<Error> WritePageBuffer(PageBuffer &buf,
                                                      Pgid start_pgid) noexcept {
     return WriteRaw(reinterpret_cast<char *>(buf.GetBuffer().data()),
                     buf.GetBuffer().size(), start_pgid * page_size_);
   }
 
+  // WritePage writes a page run. Runs in page aligned buffers bypass the page
+  // cache when direct io is on.
   [[nodiscard]] std::optional<Error> WritePage(const Page &p) noexcept {
     const auto size = (p.Overflow() + 1) * PageSize();
-    return WriteRaw(reinterpret_cast<const char *>(&p), size,
-                    p.Id() * PageSize());
+    const auto offset = p.Id() * PageSize();
+    stats_.Add(Counter::PagesWritten, p.Overflow() + 1);
+    KV_TRACE2(write__page, p.Id(), p.Overflow() + 1);
+    if (direct_file_ && Aligned(p)) {
+      if (auto err = direct_file_->WriteAt(&p, size, offset)) {
+        return err;
+      }
+      Written(offset, offset + size);
+      return std::nullopt;
+    }
+    return WriteRaw(reinterpret_cast<const char *>(&p), size, offset);
+  }
+
+  // WritePages writes page runs sorted by id. Runs that are adjacent on disk
+  // are coalesced into a single vectored write.
+  [[nodiscard]] std::optional<Error>
+  WritePages(std::span<Page *const> pages) noexcept {
+    std::vector<iovec> iov;
+    std::size_t i = 0;
+    while (i < pages.size()) {
+      const bool direct = direct_file_ && Aligned(*pages[i]);
+      const std::size_t offset = pages[i]->Id() * page_size_;
+      Pgid next = pages[i]->Id();
+      iov.clear();
+      while (i < pages.size() && pages[i]->Id() == next &&
+             iov.size() < MAX_IOV &&
+             (direct_file_ && Aligned(*pages[i])) == direct) {
+        const std::size_t run = pages[i]->Overflow() + 1;
+        iov.push_back({pages[i], run * page_size_});
+        next += run;
+        i++;
+      }
+      auto &file = direct ? *direct_file_ : *file_;
+      if (auto err = file.WriteVAt(iov, offset)) {
+        return err;
+      }
+      stats_.Add(Counter::PagesWritten, next - offset / page_size_);
+      KV_TRACE2(write__page, offset / page_size_, next - offset / page_size_);
+      Written(offset, next * page_size_);
+    }
+    return std::nullopt;
   }
 
-  [[nodiscard]] std::optional<Error> Sync() const noexcept {
-    return fd_.Sync();
+  // DirectIO returns whether page runs are written with O_DIRECT.
+  [[nodiscard]] bool DirectIO() const noexcept {
+    return direct_file_ != nullptr;
+  }
+
+  [[nodiscard]] PagePool &Pool() noexcept { return pool_; }
+
+  // SpillPool returns the workers serializing dirty nodes on commit, or
+  // nullptr if commits serialize on the committing thread. The pool is started
+  // by the first commit that needs it.
+  [[nodiscard]] ThreadPool *SpillPool() noexcept {
+    std::call_once(spill_pool_once_, [this] {
+      const std::size_t threads = options_.spill_threads_
+                                      ? options_.spill_threads_
+                                      : std::thread::hardware_concurrency();
+      if (threads > 1) {
+        spill_pool_ = std::make_unique<ThreadPool>(threads);
+      }
+    });
+    return spill_pool_.get();
   }
 
-  // Allocate a shadow page
+  // Sync is the write barrier of a commit, called once the data pages and once
+  // the meta page are written. What it flushes depends on the sync mode.
+  [[nodiscard]] std::optional<Error> Sync() noexcept {
+    PhaseTimer timer{stats_, Phase::Sync};
+    switch (options_.sync_mode_) {
+    case SyncMode::Full:
+      return TimedSync([this] { return file_->Sync(); });
+    case SyncMode::Data:
+      return TimedSync([this] { return file_->DataSync(); });
+    case SyncMode::Range: {
+      if (unsynced_end_ <= unsynced_begin_) {
+        return std::nullopt;
+      }
+      auto err = TimedSync([this] {
+        return file_->SyncRange(unsynced_begin_,
+                                unsynced_end_ - unsynced_begin_);
+      });
+      unsynced_begin_ = SIZE_MAX;
+      unsynced_end_ = 0;
+      return err;
+    }
+    case SyncMode::Periodic:
+    case SyncMode::None:
+      return std::nullopt;
+    }
+    return std::nullopt;
+  }
+
+  // Committed is called once the meta page of a commit is written. Under
+  // SyncMode::Periodic every sync_every_commits_ th commit fsyncs. The commit
+  // has landed by then, so a failed fsync does not fail it, it is kept for
+  // the next SyncNow.
+  void Committed() noexcept {
+    if (options_.sync_mode_ != SyncMode::Periodic) {
+      return;
+    }
+    std::lock_guard synclock(synclock_);
+    unsynced_commits_++;
+    if (options_.sync_every_commits_ == 0 ||
+        unsynced_commits_ < options_.sync_every_commits_) {
+      return;
+    }
+    PeriodicSync();
+  }
+
+  // SyncNow fsyncs the file whatever the sync mode. It fails with the first
+  // periodic fsync that failed since the last SyncNow, if any.
+  [[nodiscard]] std::optional<Error> SyncNow() noexcept {
+    std::lock_guard synclock(synclock_);
+    unsynced_commits_ = 0;
+    auto err = TimedSync([this] { return file_->Sync(); });
+    if (sync_err_) {
+      return std::exchange(sync_err_, std::nullopt);
+    }
+    return err;
+  }
+
+  // GetStats returns the counters and histograms of the db.
+  [[nodiscard]] Stats &GetStats() noexcept { return stats_; }
+
+  // FreelistSize returns the number of pages in the freelist.
+  [[nodiscard]] std::size_t FreelistSize() const noexcept {
+    return freelist_.All().size();
+  }
+
+  [[nodiscard]] const Options &GetOptions() const noexcept { return options_; }
+
+  [[nodiscard]] bool ReadOnly() const noexcept { return options_.read_only_; }
+
+  // Whether transactions verify page checksums on first touch.
+  [[nodiscard]] bool VerifyChecksums() const noexcept {
+    return options_.verify_checksums_;
+  }
+  void SetVerifyChecksums(bool verify) noexcept {
+    options_.verify_checksums_ = verify;
+  }
+
+  // Allocate a shadow page run of count pages from the page pool
   [[nodiscard]] std::expected<ShadowPage, Error>
   Allocate(Meta &rwtx_meta, std::size_t count) noexcept {
-    auto shadow_page = ShadowPage{PageBuffer(count, page_size_)};
-    auto &p = shadow_page.Get();
-    p.SetOverflow(count - 1);
+    auto id_or_err = AllocateExtent(rwtx_meta, count);
+    if (!id_or_err) {
+      return std::unexpected{id_or_err.error()};
+    }
+    return NewShadowPage(id_or_err.value(), count);
+  }
 
+  // AllocateExtent reserves a contiguous run of count pages and returns its
+  // first page id. The mmap grows at most once per extent.
+  [[nodiscard]] std::expected<Pgid, Error>
+  AllocateExtent(Meta &rwtx_meta, std::size_t count) noexcept {
     // // don't use freelist for now
     // auto id_opt = freelist_.Allocate(count);
     // // valid allocation
@@ -161,47 +482,248 @@ public:
     // }
 
     auto cur_wm = rwtx_meta.GetWatermark();
-    p.SetId(cur_wm);
-    assert(p.Id() > 2);
-    auto min_sz = (p.Id() + count) * page_size_;
+    assert(cur_wm > 2);
+    auto min_sz = (cur_wm + count) * page_size_;
     if (min_sz > mmap_handle_.Size()) {
+      std::unique_lock mmaplock(mmaplock_);
+      const auto old_sz = mmap_handle_.Size();
       auto err = mmap_handle_.Mmap(path_, fd_.GetFd(), min_sz);
       if (err) {
         return std::unexpected{*err};
       }
+      stats_.Add(Counter::MmapRemaps);
+      KV_TRACE2(mmap__remap, old_sz, mmap_handle_.Size());
     }
 
     rwtx_meta.SetWatermark(cur_wm + count);
+    KV_TRACE2(allocate, cur_wm, count);
+    return cur_wm;
+  }
+
+  // NewShadowPage returns a buffer from the page pool for the run of count
+  // pages at id of an extent.
+  [[nodiscard]] ShadowPage NewShadowPage(Pgid id, std::size_t count) noexcept {
+    auto shadow_page = ShadowPage{PageBuffer(count, page_size_, pool_)};
+    auto &p = shadow_page.Get();
+    p.SetId(id);
+    p.SetOverflow(count - 1);
     return shadow_page;
   }
 
 private:
+  // Aligned returns whether a page buffer can be written with O_DIRECT.
+  [[nodiscard]] bool Aligned(const Page &p) const noexcept {
+    return reinterpret_cast<std::uintptr_t>(&p) % page_size_ == 0;
+  }
+
+  // OpenDirect opens a second descriptor that bypasses the page cache. Not all
+  // filesystems support it (tmpfs does not), and O_DIRECT writes must be
+  // aligned to the block size of the device. Writes otherwise stay buffered.
+  void OpenDirect() noexcept {
+#if defined(O_DIRECT)
+    auto fd = ::open(path_.c_str(), O_RDWR | O_DIRECT);
+    if (fd == -1) {
+      LOG_WARN("O_DIRECT is not supported for {}, using buffered writes",
+               path_.string());
+      return;
+    }
+    if (const auto align = DirectAlignment(fd); page_size_ % align != 0) {
+      LOG_WARN("Page size {} is not a multiple of the direct io alignment {} "
+               "of {}, using buffered writes",
+               page_size_, align, path_.string());
+      ::close(fd);
+      return;
+    }
+    direct_fd_ = Fd{fd};
+#elif defined(F_NOCACHE)
+    auto fd = ::open(path_.c_str(), O_RDWR);
+    if (fd == -1 || ::fcntl(fd, F_NOCACHE, 1) == -1) {
+      LOG_WARN("F_NOCACHE is not supported, using buffered writes");
+      if (fd != -1) {
+        ::close(fd);
+      }
+      return;
+    }
+    direct_fd_ = Fd{fd};
+#else
+    LOG_WARN("Direct io is not supported, using buffered writes");
+    return;
+#endif
+    direct_file_ = std::make_unique<PosixFile>(direct_fd_.GetFd());
+    if (options_.wrap_file_) {
+      direct_file_ = options_.wrap_file_(std::move(direct_file_));
+    }
+  }
+
+  // DirectAlignment returns the offset and length alignment of O_DIRECT io on
+  // fd. Kernels without STATX_DIOALIGN report the preferred io size, which is
+  // a multiple of the logical block size.
+  [[nodiscard]] static std::size_t DirectAlignment(int fd) noexcept {
+#if defined(STATX_DIOALIGN)
+    struct statx stx {};
+    if (::statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align > 0) {
+      return stx.stx_dio_offset_align;
+    }
+#endif
+    struct stat st {};
+    if (::fstat(fd, &st) == 0 && st.st_blksize > 0) {
+      return static_cast<std::size_t>(st.st_blksize);
+    }
+    return OS::DEFAULT_PAGE_SIZE;
+  }
+
+  // ReadPageSize returns the page size stored in the meta of an existing file.
+  // The even meta is at offset 0 whatever the page size. If it is corrupted the
+  // odd meta is probed at every supported page size.
+  [[nodiscard]] std::optional<std::size_t> ReadPageSize() const noexcept {
+    alignas(Page) std::array<std::byte, PAGE_HEADER_SIZE + sizeof(Meta)> buf;
+    auto read_meta = [&](std::size_t offset) -> std::optional<Meta> {
+      if (file_->ReadAt(buf.data(), buf.size(), offset)) {
+        return std::nullopt;
+      }
+      auto &p = *reinterpret_cast<Page *>(buf.data());
+      if (!p.ValidMagic()) {
+        return std::nullopt;
+      }
+      const auto &m = *p.GetDataAs<Meta>();
+      if (m.Validate().has_value()) {
+        return std::nullopt;
+      }
+      return m;
+    };
+
+    if (auto m = read_meta(0)) {
+      return m->GetPageSize();
+    }
+    for (std::size_t sz = Options::MIN_PAGE_SIZE; sz <= Options::MAX_PAGE_SIZE;
+         sz <<= 1) {
+      if (auto m = read_meta(sz); m && m->GetPageSize() == sz) {
+        return sz;
+      }
+    }
+    return std::nullopt;
+  }
+
   [[nodiscard]] std::optional<Error> WriteRaw(const char *data, size_t size,
                                               std::size_t offset) noexcept {
-    fs_.seekp(offset);
-    fs_.write(data, size);
-    if (fs_.fail()) {
-      return Error{"IO Error"};
+    if (auto err = file_->WriteAt(data, size, offset)) {
+      return err;
+    }
+    Written(offset, offset + size);
+    return std::nullopt;
+  }
+
+  // Written records that [begin, end) of the file was written.
+  void Written(std::size_t begin, std::size_t end) noexcept {
+    unsynced_begin_ = std::min(unsynced_begin_, begin);
+    unsynced_end_ = std::max(unsynced_end_, end);
+    if (end > file_size_.load(std::memory_order_relaxed)) {
+      file_size_.store(end, std::memory_order_release);
+    }
+  }
+
+  // TimedSync runs a sync of the file and counts it.
+  template <typename Fn>
+  [[nodiscard]] std::optional<Error> TimedSync(Fn &&sync) noexcept {
+    KV_TRACE(fsync__start);
+    const auto start = std::chrono::steady_clock::now();
+    auto err = sync();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+    KV_TRACE1(fsync__done, ns);
+    stats_.Add(Counter::Fsyncs);
+    stats_.Add(Counter::FsyncNanos, ns);
+    return err;
+  }
+
+  // RunFlusher fsyncs pending commits every sync_interval_ until stopped.
+  void RunFlusher() noexcept {
+    std::unique_lock synclock(synclock_);
+    while (!stop_flusher_) {
+      flusher_cv_.wait_for(synclock, options_.sync_interval_,
+                           [this] { return stop_flusher_; });
+      if (stop_flusher_ || unsynced_commits_ == 0) {
+        continue;
+      }
+      PeriodicSync();
+    }
+  }
+
+  // PeriodicSync fsyncs the pending commits with synclock_ held. A failure is
+  // logged, counted and kept in sync_err_ for SyncNow.
+  void PeriodicSync() noexcept {
+    unsynced_commits_ = 0;
+    auto err = TimedSync([this] { return file_->Sync(); });
+    if (!err) {
+      return;
+    }
+    LOG_ERROR("Periodic sync failed: {}", err->message());
+    stats_.Add(Counter::FsyncErrors);
+    if (!sync_err_) {
+      sync_err_ = std::move(err);
+    }
+  }
+
+  void StopFlusher() noexcept {
+    if (!flusher_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard synclock(synclock_);
+      stop_flusher_ = true;
     }
-    return fd_.Sync(); // flush to disk
+    flusher_cv_.notify_all();
+    flusher_.join();
   }
 
 private:
   bool opened_{false};
   // path of the database file
   std::filesystem::path path_{""};
-  // fstream of the database file
-  std::fstream fs_;
   // file descriptor handle
   Fd fd_;
+  // positional io on fd_, possibly wrapped by Options::wrap_file_
+  std::unique_ptr<File> file_;
+  // O_DIRECT descriptor for page runs when Options::direct_io_ is set
+  Fd direct_fd_;
+  std::unique_ptr<File> direct_file_;
+  // recycles shadow page buffers across commits
+  PagePool pool_;
+  // serializes the dirty nodes of large commits
+  std::once_flag spill_pool_once_;
+  std::unique_ptr<ThreadPool> spill_pool_;
   // page size of the db
   std::size_t page_size_{OS::DEFAULT_PAGE_SIZE};
-  // mutex to protect mmap access
-  std::mutex mmaplock_;
+  // options the db was opened with
+  Options options_;
+  // byte range written since the last SyncMode::Range sync, writer only
+  std::size_t unsynced_begin_{SIZE_MAX};
+  std::size_t unsynced_end_{0};
+  // bytes in the file, grown by the writer and read by every tx
+  std::atomic<std::size_t> file_size_{0};
+  // protects the periodic sync state below
+  std::mutex synclock_;
+  std::condition_variable flusher_cv_;
+  // commits whose meta has not been fsynced under SyncMode::Periodic
+  std::size_t unsynced_commits_{0};
+  // first periodic fsync that failed since the last SyncNow
+  std::optional<Error> sync_err_;
+  bool stop_flusher_{false};
+  std::thread flusher_;
+  // held shared by read txs so Replace waits for them to finish
+  std::shared_mutex filelock_;
+  // protects the mmap from being remapped under concurrent readers
+  std::shared_mutex mmaplock_;
   // mmap handle that will unmap when released
   MmapDataHandle mmap_handle_;
   // Freelist used to track reusable pages
   Freelist freelist_;
+  // counters and commit latencies reported by DB::GetStats
+  Stats stats_;
+  // page runs written per commit, for incremental backups
+  PageJournal journal_;
 };
 
 } // namespace kv
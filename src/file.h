@@ -0,0 +1,206 @@
+#pragma once
+
+#include "error.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <optional>
+#include <span>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+namespace kv {
+
+// File is the positional io interface the DiskHandler writes the db file
+// through. Reads of committed pages go through the mmap instead. Tests wrap it
+// to inject faults and to simulate crashes.
+class File {
+public:
+  virtual ~File() = default;
+
+  [[nodiscard]] virtual std::optional<Error>
+  WriteAt(const void *data, std::size_t n, std::size_t offset) noexcept = 0;
+  // WriteVAt writes the buffers back to back starting at offset.
+  [[nodiscard]] virtual std::optional<Error>
+  WriteVAt(std::span<const iovec> iov, std::size_t offset) noexcept {
+    for (const auto &v : iov) {
+      if (auto err = WriteAt(v.iov_base, v.iov_len, offset)) {
+        return err;
+      }
+      offset += v.iov_len;
+    }
+    return std::nullopt;
+  }
+  [[nodiscard]] virtual std::optional<Error>
+  ReadAt(void *data, std::size_t n, std::size_t offset) noexcept = 0;
+  // Sync flushes data and metadata of the file to stable storage.
+  [[nodiscard]] virtual std::optional<Error> Sync() noexcept = 0;
+  // DataSync flushes data and the metadata needed to read it back.
+  [[nodiscard]] virtual std::optional<Error> DataSync() noexcept = 0;
+  // SyncRange starts writeback of [offset, offset + n) and waits for it. It
+  // neither flushes metadata nor the device write cache.
+  [[nodiscard]] virtual std::optional<Error>
+  SyncRange(std::size_t offset, std::size_t n) noexcept = 0;
+};
+
+// PosixFile implements File on a file descriptor it does not own.
+class PosixFile final : public File {
+public:
+  explicit PosixFile(int fd) noexcept : fd_(fd) {}
+
+  [[nodiscard]] std::optional<Error>
+  WriteAt(const void *data, std::size_t n, std::size_t offset) noexcept final {
+    const auto *p = static_cast<const char *>(data);
+    while (n > 0) {
+      auto written = ::pwrite(fd_, p, n, static_cast<off_t>(offset));
+      if (written <= 0) {
+        return Error{"IO Error"};
+      }
+      p += written;
+      n -= written;
+      offset += written;
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<Error>
+  WriteVAt(std::span<const iovec> iov, std::size_t offset) noexcept final {
+    auto written = ::pwritev(fd_, iov.data(), static_cast<int>(iov.size()),
+                             static_cast<off_t>(offset));
+    if (written < 0) {
+      return Error{"IO Error"};
+    }
+    // finish a short write buffer by buffer
+    auto done = static_cast<std::size_t>(written);
+    for (const auto &v : iov) {
+      if (done >= v.iov_len) {
+        done -= v.iov_len;
+      } else {
+        auto err = WriteAt(static_cast<const std::byte *>(v.iov_base) + done,
+                           v.iov_len - done, offset + done);
+        if (err) {
+          return err;
+        }
+        done = 0;
+      }
+      offset += v.iov_len;
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<Error>
+  ReadAt(void *data, std::size_t n, std::size_t offset) noexcept final {
+    auto *p = static_cast<char *>(data);
+    while (n > 0) {
+      auto read = ::pread(fd_, p, n, static_cast<off_t>(offset));
+      if (read <= 0) {
+        return Error{"Failed to read data from disk"};
+      }
+      p += read;
+      n -= read;
+      offset += read;
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<Error> Sync() noexcept final {
+    if (::fsync(fd_) == -1) {
+      return Error{"Error syncing fd"};
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<Error> DataSync() noexcept final {
+#if defined(__APPLE__)
+    return Sync();
+#else
+    if (::fdatasync(fd_) == -1) {
+      return Error{"Error syncing fd"};
+    }
+    return std::nullopt;
+#endif
+  }
+
+  [[nodiscard]] std::optional<Error>
+  SyncRange(std::size_t offset, std::size_t n) noexcept final {
+#if defined(__linux__)
+    constexpr unsigned int flags = SYNC_FILE_RANGE_WAIT_BEFORE |
+                                   SYNC_FILE_RANGE_WRITE |
+                                   SYNC_FILE_RANGE_WAIT_AFTER;
+    if (::sync_file_range(fd_, static_cast<off_t>(offset),
+                          static_cast<off_t>(n), flags) == -1) {
+      return Error{"Error syncing file range"};
+    }
+    return std::nullopt;
+#else
+    (void)offset;
+    (void)n;
+    return DataSync();
+#endif
+  }
+
+private:
+  int fd_;
+};
+
+// CopyRange copies n bytes at offset of in_fd to the current position of
+// out_fd. On Linux the data never leaves the kernel: copy_file_range between
+// files, sendfile when out_fd is a pipe or socket or the kernel cannot copy
+// across filesystems.
+[[nodiscard]] inline std::optional<Error>
+CopyRange(int in_fd, std::size_t offset, int out_fd, std::size_t n) noexcept {
+#if defined(__linux__)
+  auto off = static_cast<off_t>(offset);
+  bool use_sendfile = false;
+  while (n > 0) {
+    ssize_t copied = 0;
+    if (!use_sendfile) {
+      copied = ::copy_file_range(in_fd, &off, out_fd, nullptr, n, 0);
+      if (copied == -1 && (errno == EXDEV || errno == EINVAL ||
+                           errno == ENOSYS || errno == EOPNOTSUPP)) {
+        use_sendfile = true;
+        continue;
+      }
+    } else {
+      copied = ::sendfile(out_fd, in_fd, &off, n);
+    }
+    if (copied == -1 && errno == EINTR) {
+      continue;
+    }
+    if (copied < 0) {
+      return Error{"IO Error"};
+    }
+    if (copied == 0) {
+      return Error{"Unexpected end of file"};
+    }
+    n -= static_cast<std::size_t>(copied);
+  }
+  return std::nullopt;
+#else
+  std::array<char, 1 << 16> buf;
+  while (n > 0) {
+    auto read = ::pread(in_fd, buf.data(), std::min(n, buf.size()),
+                        static_cast<off_t>(offset));
+    if (read <= 0) {
+      return Error{"Failed to read data from disk"};
+    }
+    for (ssize_t done = 0; done < read;) {
+      auto written = ::write(out_fd, buf.data() + done, read - done);
+      if (written <= 0) {
+        return Error{"IO Error"};
+      }
+      done += written;
+    }
+    n -= read;
+    offset += read;
+  }
+  return std::nullopt;
+#endif
+}
+
+} // namespace kv
@@ -0,0 +1,521 @@
+#pragma once
+
+#include "arena.h"
+#include "bucket_meta.h"
+#include "error.h"
+#include "node.h"
+#include "page.h"
+#include "slice.h"
+#include "tx_cache.h"
+#include "type.h"
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace kv {
+
+// HashTable is the extendible hash table of a bucket created with
+// BucketFlag::Hash. A key lives in the leaf the top bits of its hash pick, so
+// a lookup reads the root, one directory segment and one leaf whatever the
+// size of the bucket.
+//
+// The root page holds the global depth and the ids of the directory segments,
+// a segment holds the leaf ids of SegmentSlots consecutive slots. The slots of
+// a leaf of local depth l are an aligned run of 2^(depth - l) slots. A leaf
+// that outgrows its page splits on the next hash bit, doubling the directory
+// if it used every bit. Leaves are ordinary leaf pages, keys sorted, so they
+// are encoded, compressed and written like the leaves of a tree.
+//
+// A write tx loads the segments it touches and keeps the leaves it changed as
+// nodes. Their slots point to DIRTY ids until the spill writes them.
+class HashTable {
+  // slot ids of leaves changed by the tx have this bit set
+  static constexpr Pgid DIRTY = Pgid{1} << 63;
+  // a leaf whose keys share this many hash bits is left to overflow
+  static constexpr std::size_t MAX_DEPTH = 32;
+
+public:
+  // Hash is MurmurHash64A of the key. It places keys on disk so it must not
+  // change.
+  [[nodiscard]] static std::uint64_t Hash(const Slice &key) noexcept {
+    constexpr std::uint64_t M = 0xc6a4a7935bd1e995ULL;
+    constexpr int R = 47;
+    const auto *data = key.Data();
+    const std::size_t len = key.Size();
+    std::uint64_t h = 0x9747b28cULL ^ (len * M);
+    std::size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= len; i += sizeof(std::uint64_t)) {
+      std::uint64_t k;
+      std::memcpy(&k, data + i, sizeof(k));
+      k *= M;
+      k ^= k >> R;
+      k *= M;
+      h ^= k;
+      h *= M;
+    }
+    if (i < len) {
+      std::uint64_t k = 0;
+      for (std::size_t j = len; j > i; j--) {
+        k = (k << 8) | std::to_integer<std::uint64_t>(data[j - 1]);
+      }
+      h ^= k;
+      h *= M;
+    }
+    h ^= h >> R;
+    h *= M;
+    h ^= h >> R;
+    return h;
+  }
+
+  // SegmentSlots returns the slots a segment page holds, a power of two so a
+  // leaf run never straddles a segment unless it spans whole segments.
+  [[nodiscard]] static std::size_t
+  SegmentSlots(std::size_t page_size) noexcept {
+    return std::bit_floor((page_size - PAGE_HEADER_SIZE) / sizeof(Pgid));
+  }
+
+  // Create writes the root, segment and leaf of an empty table and returns
+  // the id of the root.
+  [[nodiscard]] static std::expected<Pgid, Error>
+  Create(ShadowPageHandler &pages, Meta &meta) noexcept {
+    auto leaf = pages.AllocateShadowPage(meta, 1);
+    if (!leaf) {
+      return std::unexpected{leaf.error()};
+    }
+    leaf->get().SetFlags(PageFlag::LeafPage);
+    auto segment = pages.AllocateShadowPage(meta, 1);
+    if (!segment) {
+      return std::unexpected{segment.error()};
+    }
+    const Pgid leaf_id = leaf->get().Id();
+    WriteSegmentPage(segment->get(), {&leaf_id, 1});
+    const Pgid segment_id = segment->get().Id();
+    auto root = pages.AllocateShadowPage(meta, 1);
+    if (!root) {
+      return std::unexpected{root.error()};
+    }
+    WriteRootPage(root->get(), 0, {&segment_id, 1});
+    return root->get().Id();
+  }
+
+  // Find looks key up in the committed table rooted at root. Nothing is
+  // found once a page of the table is unreadable, see pages.Err().
+  [[nodiscard]] static std::optional<Slice>
+  Find(ShadowPageHandler &pages, Pgid root, const Slice &key) noexcept {
+    auto &r = pages.GetPage(root);
+    if (pages.Err()) {
+      return std::nullopt;
+    }
+    const auto slot = Slot(Hash(key), Depth(r));
+    const auto per = SegmentSlots(pages.Disk().PageSize());
+    const auto &segment = pages.GetPage(Segments(r)[slot / per]);
+    if (pages.Err()) {
+      return std::nullopt;
+    }
+    return FindInLeaf(pages, Slots(segment)[slot % per], key);
+  }
+
+  // Segments returns the segment ids of a root page.
+  [[nodiscard]] static std::span<const Pgid>
+  Segments(const Page &root) noexcept {
+    return {reinterpret_cast<const Pgid *>(
+                static_cast<const std::byte *>(root.Data()) +
+                sizeof(std::uint64_t)),
+            root.Count()};
+  }
+
+  // Slots returns the leaf ids of a segment page.
+  [[nodiscard]] static std::span<const Pgid>
+  Slots(const Page &segment) noexcept {
+    return {static_cast<const Pgid *>(segment.Data()), segment.Count()};
+  }
+
+  // Leaves returns the ids of the leaves of the committed table rooted at
+  // root, each once, in slot order. The list stops short if a directory page
+  // is unreadable, see pages.Err().
+  [[nodiscard]] static std::vector<Pgid> Leaves(ShadowPageHandler &pages,
+                                                Pgid root) noexcept {
+    std::vector<Pgid> leaves;
+    auto &r = pages.GetPage(root);
+    if (pages.Err()) {
+      return leaves;
+    }
+    for (Pgid segment : Segments(r)) {
+      auto &s = pages.GetPage(segment);
+      if (pages.Err()) {
+        return leaves;
+      }
+      for (Pgid id : Slots(s)) {
+        // the slots of a leaf are consecutive
+        if (leaves.empty() || leaves.back() != id) {
+          leaves.push_back(id);
+        }
+      }
+    }
+    return leaves;
+  }
+
+  HashTable(ShadowPageHandler &pages, const BucketMeta &meta) noexcept
+      : pages_(pages), compressed_(meta.Compressed()),
+        per_segment_(SegmentSlots(pages.Disk().PageSize())),
+        arena_(std::make_unique<Arena>()) {
+    // left empty if the root is unreadable, the tx fails with pages.Err()
+    auto &root = pages.GetPage(meta.Root());
+    if (pages.Err()) {
+      return;
+    }
+    depth_ = Depth(root);
+    for (Pgid id : Segments(root)) {
+      segments_.push_back({id, {}, false});
+    }
+  }
+
+  HashTable(const HashTable &) = delete;
+  HashTable &operator=(const HashTable &) = delete;
+
+  [[nodiscard]] std::optional<Slice> Get(const Slice &key) const noexcept {
+    const auto id = SlotAt(Slot(Hash(key), depth_));
+    if (!id) {
+      return std::nullopt;
+    }
+    if (!(*id & DIRTY)) {
+      return FindInLeaf(pages_, *id, key);
+    }
+    const auto &elements = leaves_.at(*id).node_.GetElements();
+    auto [i, exact] = elements.LowerBound(key);
+    if (!exact) {
+      return std::nullopt;
+    }
+    return elements[i].val_;
+  }
+
+  // Put fails if a page of the table is unreadable, the table is left
+  // half changed and the tx must not commit.
+  [[nodiscard]] std::optional<Error> Put(const Slice &key,
+                                         const Slice &val) noexcept {
+    const auto slot = Slot(Hash(key), depth_);
+    auto id = SlotAt(slot);
+    if (id && !(*id & DIRTY)) {
+      id = Materialize(slot, *id);
+    }
+    if (!id) {
+      return pages_.Err();
+    }
+    leaves_.at(*id).node_.Put(key, val);
+    if (!Split(*id)) {
+      return pages_.Err();
+    }
+    return std::nullopt;
+  }
+
+  // Dirty returns whether the tx changed the table.
+  [[nodiscard]] bool Dirty() const noexcept { return !leaves_.empty(); }
+
+  // DirtyLeaves returns the leaves changed by the tx in a fixed order.
+  [[nodiscard]] std::vector<Node *> DirtyLeaves() noexcept {
+    std::vector<std::pair<Pgid, Node *>> dirty;
+    dirty.reserve(leaves_.size());
+    for (auto &[id, leaf] : leaves_) {
+      dirty.emplace_back(id, &leaf.node_);
+    }
+    std::sort(dirty.begin(), dirty.end());
+    std::vector<Node *> nodes;
+    nodes.reserve(dirty.size());
+    for (auto &[_, n] : dirty) {
+      nodes.push_back(n);
+    }
+    return nodes;
+  }
+
+  // DirtySegments returns the indexes of the segments to rewrite.
+  [[nodiscard]] std::vector<std::size_t> DirtySegments() const noexcept {
+    std::vector<std::size_t> dirty;
+    for (std::size_t i = 0; i < segments_.size(); i++) {
+      if (segments_[i].dirty_) {
+        dirty.push_back(i);
+      }
+    }
+    return dirty;
+  }
+
+  // WriteSegment writes segment i to p. Dirty leaves must have been written
+  // so their nodes know their pages.
+  void WriteSegment(std::size_t i, Page &p) noexcept {
+    auto &s = segments_[i];
+    std::vector<Pgid> slots;
+    slots.reserve(s.slots_.size());
+    for (Pgid id : s.slots_) {
+      slots.push_back(id & DIRTY ? leaves_.at(id).node_.GetPgid().value()
+                                 : id);
+    }
+    WriteSegmentPage(p, slots);
+    s.pgid_ = p.Id();
+    s.dirty_ = false;
+  }
+
+  // RootPages returns the length of the page run of the root.
+  [[nodiscard]] std::size_t RootPages() const noexcept {
+    return RootPages(segments_.size(), pages_.Disk().PageSize());
+  }
+
+  // WriteRoot writes the root to p once the segments are written.
+  void WriteRoot(Page &p) const noexcept {
+    std::vector<Pgid> segments;
+    segments.reserve(segments_.size());
+    for (const auto &s : segments_) {
+      segments.push_back(s.pgid_);
+    }
+    WriteRootPage(p, depth_, segments);
+  }
+
+  // Depth returns the global depth of a root page.
+  [[nodiscard]] static std::size_t Depth(const Page &root) noexcept {
+    return Deserializer{root}.Read<std::uint64_t>();
+  }
+
+  // RootPages returns the length of the page run of a root with segments
+  // segments.
+  [[nodiscard]] static std::size_t RootPages(std::size_t segments,
+                                             std::size_t page_size) noexcept {
+    const auto sz =
+        PAGE_HEADER_SIZE + sizeof(std::uint64_t) + segments * sizeof(Pgid);
+    return (sz / page_size) + 1;
+  }
+
+  // WriteSegmentPage writes a segment holding the leaf ids slots to p.
+  static void WriteSegmentPage(Page &p, std::span<const Pgid> slots) noexcept {
+    p.SetFlags(PageFlag::HashPage);
+    p.SetCount(slots.size());
+    Serializer w{p.Data()};
+    for (Pgid id : slots) {
+      w.Write(id);
+    }
+  }
+
+  // WriteRootPage writes a root of global depth depth over the segment ids
+  // segments to p.
+  static void WriteRootPage(Page &p, std::size_t depth,
+                            std::span<const Pgid> segments) noexcept {
+    p.SetFlags(PageFlag::HashPage);
+    p.SetCount(segments.size());
+    Serializer w{p.Data()};
+    w.Write(static_cast<std::uint64_t>(depth));
+    for (Pgid id : segments) {
+      w.Write(id);
+    }
+  }
+
+private:
+  struct Segment {
+    // page of the committed segment, stale once dirty
+    Pgid pgid_;
+    // slots of the segment, empty until loaded
+    std::vector<Pgid> slots_;
+    bool dirty_;
+  };
+
+  struct Leaf {
+    Node node_;
+    // local depth, the hash bits all keys of the leaf share
+    std::size_t depth_;
+  };
+
+  [[nodiscard]] static std::size_t Slot(std::uint64_t hash,
+                                        std::size_t depth) noexcept {
+    return depth == 0 ? 0 : hash >> (64 - depth);
+  }
+
+  [[nodiscard]] static std::optional<Slice>
+  FindInLeaf(ShadowPageHandler &pages, Pgid pgid, const Slice &key) noexcept {
+    auto &p = pages.GetPage(pgid);
+    if (pages.Err()) {
+      return std::nullopt;
+    }
+    auto &leaf = p.AsPage<LeafPage>();
+    auto [i, exact] = leaf.LowerBound(key);
+    if (!exact) {
+      return std::nullopt;
+    }
+    return leaf.GetVal(i);
+  }
+
+  // SlotAt returns the leaf id in slot i, nullopt if its segment is
+  // unreadable.
+  [[nodiscard]] std::optional<Pgid> SlotAt(std::size_t i) const noexcept {
+    const auto &s = segments_[i / per_segment_];
+    if (!s.slots_.empty()) {
+      return s.slots_[i % per_segment_];
+    }
+    auto &p = pages_.GetPage(s.pgid_);
+    if (pages_.Err()) {
+      return std::nullopt;
+    }
+    return Slots(p)[i % per_segment_];
+  }
+
+  [[nodiscard]] bool SetSlot(std::size_t i, Pgid id) noexcept {
+    auto *s = Load(i / per_segment_);
+    if (!s) {
+      return false;
+    }
+    s->slots_[i % per_segment_] = id;
+    s->dirty_ = true;
+    return true;
+  }
+
+  // Load reads the slots of segment i into the tx, nullptr if its page is
+  // unreadable.
+  [[nodiscard]] Segment *Load(std::size_t i) noexcept {
+    auto &s = segments_[i];
+    if (s.slots_.empty()) {
+      auto &p = pages_.GetPage(s.pgid_);
+      if (pages_.Err()) {
+        return nullptr;
+      }
+      auto slots = Slots(p);
+      s.slots_.assign(slots.begin(), slots.end());
+    }
+    return &s;
+  }
+
+  // Materialize turns the committed leaf at slot into a node of the tx and
+  // points its slots to the node. The slots of the leaf are the largest
+  // aligned run around slot that starts and ends with it, as a run twice as
+  // long holds other leaves at one of its ends, so depth_ steps find it.
+  [[nodiscard]] std::optional<Pgid> Materialize(std::size_t slot,
+                                                Pgid pgid) noexcept {
+    std::size_t run = 1;
+    while (run < (std::size_t{1} << depth_)) {
+      const std::size_t start = slot & ~(2 * run - 1);
+      const auto first = SlotAt(start);
+      const auto last = SlotAt(start + 2 * run - 1);
+      if (!first || !last) {
+        return std::nullopt;
+      }
+      if (*first != pgid || *last != pgid) {
+        break;
+      }
+      run *= 2;
+    }
+    auto &p = pages_.GetPage(pgid);
+    if (pages_.Err()) {
+      return std::nullopt;
+    }
+    const Pgid id = next_dirty_++;
+    auto [it, _] = leaves_.try_emplace(
+        id, Leaf{Node{nullptr, true, arena_.get()},
+                 depth_ - static_cast<std::size_t>(std::countr_zero(run))});
+    it->second.node_.SetCompressed(compressed_);
+    it->second.node_.Read(p);
+    const std::size_t start = slot & ~(run - 1);
+    for (std::size_t i = start; i < start + run; i++) {
+      if (!SetSlot(i, id)) {
+        return std::nullopt;
+      }
+    }
+    return id;
+  }
+
+  // Split splits the leaf until its halves fit a page. Returns false if a
+  // segment it has to change is unreadable.
+  [[nodiscard]] bool Split(Pgid id) noexcept {
+    auto &leaf = leaves_.at(id);
+    const auto &elements = leaf.node_.GetElements();
+    if (leaf.node_.GetStorageSize() <= pages_.Disk().PageSize() ||
+        elements.size() < 2 || leaf.depth_ >= MAX_DEPTH) {
+      return true;
+    }
+    const auto first = Hash(elements.front().key_);
+    // keys sharing the whole hash can never be told apart
+    bool same = true;
+    for (const auto &e : elements) {
+      same = same && Hash(e.key_) == first;
+    }
+    if (same) {
+      return true;
+    }
+    if (leaf.depth_ == depth_ && !Double()) {
+      return false;
+    }
+
+    // the leaf keeps the keys whose next hash bit is 0
+    const auto bit = 63 - leaf.depth_;
+    std::vector<NodeElement> low;
+    std::vector<NodeElement> high;
+    for (const auto &e : elements) {
+      ((Hash(e.key_) >> bit) & 1 ? high : low).push_back(e);
+    }
+    const Pgid sibling = next_dirty_++;
+    auto [it, _] = leaves_.try_emplace(
+        sibling, Leaf{Node{nullptr, true, arena_.get()}, leaf.depth_ + 1});
+    auto &s = it->second.node_;
+    s.SetCompressed(compressed_);
+    auto &n = leaf.node_;
+    n.GetElements().clear();
+    for (const auto &e : low) {
+      n.GetElements().push_back(e);
+    }
+    for (const auto &e : high) {
+      s.GetElements().push_back(e);
+    }
+
+    const std::size_t run = std::size_t{1} << (depth_ - leaf.depth_);
+    const std::size_t start = Slot(first, depth_) & ~(run - 1);
+    for (std::size_t i = start + run / 2; i < start + run; i++) {
+      if (!SetSlot(i, sibling)) {
+        return false;
+      }
+    }
+    leaf.depth_++;
+    return Split(id) && Split(sibling);
+  }
+
+  // Double doubles the directory, each slot becomes two slots of its leaf.
+  // Returns false if a segment is unreadable.
+  [[nodiscard]] bool Double() noexcept {
+    std::vector<Pgid> slots;
+    slots.reserve(std::size_t{2} << depth_);
+    for (std::size_t i = 0; i < segments_.size(); i++) {
+      auto *s = Load(i);
+      if (!s) {
+        return false;
+      }
+      for (Pgid id : s->slots_) {
+        slots.push_back(id);
+        slots.push_back(id);
+      }
+    }
+    depth_++;
+    segments_.clear();
+    for (std::size_t i = 0; i < slots.size(); i += per_segment_) {
+      const auto end = std::min(slots.size(), i + per_segment_);
+      segments_.push_back(
+          {0, {slots.begin() + static_cast<std::ptrdiff_t>(i),
+               slots.begin() + static_cast<std::ptrdiff_t>(end)},
+           true});
+    }
+    return true;
+  }
+
+  ShadowPageHandler &pages_;
+  const bool compressed_;
+  const std::size_t per_segment_;
+  // backs the keys and values of the dirty leaves
+  std::unique_ptr<Arena> arena_;
+  // global depth, the directory has 2^depth_ slots
+  std::size_t depth_{0};
+  std::vector<Segment> segments_;
+  // leaves changed by the tx keyed by their DIRTY id
+  std::unordered_map<Pgid, Leaf> leaves_;
+  Pgid next_dirty_{DIRTY};
+};
+
+} // namespace kv
@@ -3,8 +3,14 @@
 #include "fmt/core.h"
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <ctime>
+#include <memory>
 #include <string>
+#include <thread>
 
 // Log levels
 enum class LogLevel {
@@ -17,8 +23,19 @@ enum class LogLevel {
   ALL = 0
 };
 
-// Define the current log level
-constexpr auto CURRENT_LOG_LEVEL = LogLevel::OFF;
+// Levels below this are compiled out, their call sites and arguments vanish
+constexpr auto COMPILED_LOG_LEVEL = LogLevel::ALL;
+
+// The level logged at runtime, adjustable with SetLogLevel
+inline std::atomic<LogLevel> CURRENT_LOG_LEVEL{LogLevel::OFF};
+
+inline void SetLogLevel(LogLevel level) noexcept {
+  CURRENT_LOG_LEVEL.store(level, std::memory_order_relaxed);
+}
+
+[[nodiscard]] inline LogLevel GetLogLevel() noexcept {
+  return CURRENT_LOG_LEVEL.load(std::memory_order_relaxed);
+}
 
 // Time format and output stream
 constexpr auto LOG_LOG_TIME_FORMAT = "%M:%S";
@@ -48,8 +65,12 @@ constexpr std::string_view PastLastSlash(std::string_view str) {
 #define __FUNCTION__ ""
 #endif
 
-constexpr bool IsLogLevelEnabled(LogLevel level) {
-  return level >= CURRENT_LOG_LEVEL;
+constexpr bool IsLogLevelCompiled(LogLevel level) {
+  return level >= COMPILED_LOG_LEVEL;
+}
+
+inline bool IsLogLevelEnabled(LogLevel level) noexcept {
+  return IsLogLevelCompiled(level) && level >= GetLogLevel();
 }
 
 inline std::string FormatLogHeader(std::string_view file, int line,
@@ -94,32 +115,169 @@ inline std::string FormatLogHeader(std::string_view file, int line,
                      formatted_header + " " + type);
 }
 
+// LogRing is a bounded lock free multi producer queue of formatted lines
+// drained by a single writer thread, so logging threads never wait on the
+// output stream. Lines are dropped and counted when the ring is full.
+class LogRing {
+  static constexpr std::size_t CAPACITY = 4096;
+
+public:
+  LogRing() noexcept : slots_(std::make_unique<Slot[]>(CAPACITY)) {
+    for (std::size_t i = 0; i < CAPACITY; i++) {
+      slots_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+    writer_ = std::thread([this] { Run(); });
+  }
+
+  LogRing(const LogRing &) = delete;
+  LogRing &operator=(const LogRing &) = delete;
+
+  ~LogRing() {
+    stop_.store(true, std::memory_order_release);
+    writer_.join();
+  }
+
+  void Push(std::string line) noexcept {
+    auto pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &slot = slots_[pos % CAPACITY];
+      auto seq = slot.seq_.load(std::memory_order_acquire);
+      auto diff = static_cast<std::int64_t>(seq - pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          slot.line_ = std::move(line);
+          slot.seq_.store(pos + 1, std::memory_order_release);
+          return;
+        }
+      } else if (diff < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Flush waits until every line pushed before the call is written.
+  void Flush() noexcept {
+    const auto target = head_.load(std::memory_order_acquire);
+    while (written_.load(std::memory_order_acquire) < target) {
+      std::this_thread::yield();
+    }
+  }
+
+  [[nodiscard]] std::uint64_t Dropped() const noexcept {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> seq_;
+    std::string line_;
+  };
+
+  // Drain writes the ready lines and returns how many there were.
+  std::size_t Drain(FILE *out) noexcept {
+    std::size_t n = 0;
+    for (;; n++) {
+      auto &slot = slots_[tail_ % CAPACITY];
+      if (slot.seq_.load(std::memory_order_acquire) != tail_ + 1) {
+        break;
+      }
+      std::fwrite(slot.line_.data(), 1, slot.line_.size(), out);
+      slot.line_.clear();
+      slot.seq_.store(tail_ + CAPACITY, std::memory_order_release);
+      tail_++;
+    }
+    if (n > 0) {
+      std::fflush(out);
+      written_.store(tail_, std::memory_order_release);
+    }
+    return n;
+  }
+
+  void Run() noexcept;
+
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<std::uint64_t> head_{0};
+  alignas(64) std::uint64_t tail_{0};
+  std::atomic<std::uint64_t> written_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<bool> stop_{false};
+  std::thread writer_;
+};
+
+// Lines go through the ring when set, otherwise they are printed and flushed
+// by the logging thread.
+inline std::atomic<bool> LOG_ASYNC{false};
+
+[[nodiscard]] inline LogRing &GetLogRing() noexcept {
+  static LogRing ring;
+  return ring;
+}
+
+inline void LogRing::Run() noexcept {
+  for (;;) {
+    const bool stop = stop_.load(std::memory_order_acquire);
+    if (Drain(LOG_OUTPUT_STREAM) == 0) {
+      if (stop) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+}
+
+// SetLogAsync switches between the ring sink and synchronous printing.
+inline void SetLogAsync(bool async) noexcept {
+  if (async) {
+    (void)GetLogRing();
+  } else if (LOG_ASYNC.load(std::memory_order_acquire)) {
+    GetLogRing().Flush();
+  }
+  LOG_ASYNC.store(async, std::memory_order_release);
+}
+
+// FlushLog waits for lines queued on the ring to be written.
+inline void FlushLog() noexcept {
+  if (LOG_ASYNC.load(std::memory_order_acquire)) {
+    GetLogRing().Flush();
+  }
+}
+
 template <LogLevel level, typename... Args>
 void Log(std::string_view file, int line, const char *func,
          const std::string &message, Args &&...args) {
-  if constexpr (IsLogLevelEnabled(level)) {
-    auto header = LogHeader(file, line, func, level);
-    fmt::print(LOG_OUTPUT_STREAM, "{}", header);
-    if constexpr (sizeof...(Args) == 0) {
-      fmt::print(LOG_OUTPUT_STREAM, "{}", message);
-    } else {
-      auto formatted_message =
-          fmt::format(fmt::runtime(message), std::forward<Args>(args)...);
-      fmt::print(LOG_OUTPUT_STREAM, "{}", formatted_message);
-    }
-    fmt::print(LOG_OUTPUT_STREAM, "\n");
+  auto out = LogHeader(file, line, func, level);
+  if constexpr (sizeof...(Args) == 0) {
+    out += message;
+  } else {
+    out += fmt::format(fmt::runtime(message), std::forward<Args>(args)...);
+  }
+  out += '\n';
 
-    fflush(LOG_OUTPUT_STREAM); // Ensure log is flushed
+  if (LOG_ASYNC.load(std::memory_order_acquire)) {
+    GetLogRing().Push(std::move(out));
+    return;
   }
+  fmt::print(LOG_OUTPUT_STREAM, "{}", out);
+  fflush(LOG_OUTPUT_STREAM); // Ensure log is flushed
 }
 
-#define LOG_ERROR(...)                                                         \
-  Log<LogLevel::ERROR>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define LOG_WARN(...)                                                          \
-  Log<LogLevel::WARN>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define LOG_INFO(...)                                                          \
-  Log<LogLevel::INFO>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define LOG_DEBUG(...)                                                         \
-  Log<LogLevel::DEBUG>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
-#define LOG_TRACE(...)                                                         \
-  Log<LogLevel::TRACE>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+// The level is checked before the arguments are evaluated, so a disabled log
+// line costs one relaxed load and compiled out levels cost nothing.
+#define LOG_AT(level, ...)                                                     \
+  do {                                                                         \
+    if constexpr (IsLogLevelCompiled(level)) {                                 \
+      if (IsLogLevelEnabled(level)) {                                          \
+        Log<level>(__SHORT_FILE__, __LINE__, __FUNCTION__, __VA_ARGS__);       \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LogLevel::ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LogLevel::WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) LOG_AT(LogLevel::TRACE, __VA_ARGS__)
@@ -3,6 +3,7 @@
 #include "error.h"
 #include "log.h"
 #include "os.h"
+#include <algorithm>
 #include <cassert>
 #include <mutex>
 #include <optional>
@@ -58,7 +59,8 @@ public:
 
     Unmap(); // unmap previous before mmpaing
 
-    void *b = mmap(nullptr, mmap_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int prot = read_only_ ? PROT_READ : (PROT_READ | PROT_WRITE);
+    void *b = mmap(nullptr, mmap_sz, prot, MAP_SHARED, fd, 0);
     if (b == MAP_FAILED) {
       return Error("Failed to mmap");
     }
@@ -76,7 +78,16 @@ public:
     return std::nullopt;
   }
 
+  // Configure sets the page size mappings are rounded to and whether pages
+  // are mapped read only.
+  void Configure(std::size_t page_size, bool read_only) noexcept {
+    page_size_ = page_size;
+    read_only_ = read_only;
+  }
+
   [[nodiscard]] std::size_t MmapSize(std::size_t request_sz) const noexcept {
+    // always map at least a page, all sizes below are then page multiples
+    request_sz = std::max(request_sz, page_size_);
     std::size_t step = 1 << 30; // 1GB
     if (request_sz <= step) {
       for (std::size_t i = 15; i <= 30; ++i) {
@@ -127,6 +138,7 @@ public:
 
 private:
   std::size_t page_size_{OS::DEFAULT_PAGE_SIZE};
+  bool read_only_{false};
   void *mmap_ptr_{nullptr};
   std::size_t size_{0};
   // mutex to protect mmap access
@@ -1,25 +1,194 @@
 #pragma once
 
+#include "arena.h"
 #include "fmt/format.h"
 #include "page.h"
 #include "persist.h"
 #include "slice.h"
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <vector>
 
 namespace kv {
 
+struct NodeElement {
+  Pgid pgid_;
+  Slice key_;
+  Slice val_;
+  // LeafFlag bits, only used by leaf elements
+  std::uint32_t flags_;
+};
+
+// NodeElements is a gap buffer of node elements with a parallel array of the
+// first 8 key bytes as big endian integers. Searches binary search the prefix
+// array and only compare key bytes on a tie. Inserts move the gap to the
+// insertion point, so runs of nearby inserts (sequential or clustered keys)
+// move no elements.
+class NodeElements {
+public:
+  class Iterator {
+  public:
+    Iterator(const NodeElements *elements, std::size_t i) noexcept
+        : elements_(elements), i_(i) {}
+    const NodeElement &operator*() const noexcept { return (*elements_)[i_]; }
+    const NodeElement *operator->() const noexcept {
+      return &(*elements_)[i_];
+    }
+    Iterator &operator++() noexcept {
+      i_++;
+      return *this;
+    }
+    bool operator==(const Iterator &other) const noexcept = default;
+
+  private:
+    const NodeElements *elements_;
+    std::size_t i_;
+  };
+
+  explicit NodeElements(std::pmr::memory_resource *mr) noexcept
+      : elements_(mr), prefixes_(mr) {}
+
+  [[nodiscard]] std::size_t size() const noexcept {
+    return elements_.size() - gap_len_;
+  }
+  [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+  [[nodiscard]] const NodeElement &operator[](std::size_t i) const noexcept {
+    assert(i < size());
+    return elements_[Physical(i)];
+  }
+  [[nodiscard]] const NodeElement &front() const noexcept { return (*this)[0]; }
+
+  [[nodiscard]] Iterator begin() const noexcept { return {this, 0}; }
+  [[nodiscard]] Iterator end() const noexcept { return {this, size()}; }
+
+  // Bytes returns the total size of all keys and values.
+  [[nodiscard]] std::size_t Bytes() const noexcept { return bytes_; }
+
+  void reserve(std::size_t n) noexcept {
+    if (n > elements_.size()) {
+      Grow(n - size());
+    }
+  }
+
+  void clear() noexcept {
+    gap_start_ = 0;
+    gap_len_ = elements_.size();
+    bytes_ = 0;
+  }
+
+  void push_back(const NodeElement &e) noexcept { Insert(size(), e); }
+
+  void Insert(std::size_t i, const NodeElement &e) noexcept {
+    assert(i <= size());
+    if (gap_len_ == 0) {
+      Grow(size());
+    }
+    MoveGap(i);
+    elements_[gap_start_] = e;
+    prefixes_[gap_start_] = e.key_.Prefix();
+    gap_start_++;
+    gap_len_--;
+    bytes_ += e.key_.Size() + e.val_.Size();
+  }
+
+  void Set(std::size_t i, const NodeElement &e) noexcept {
+    auto &old = elements_[Physical(i)];
+    bytes_ -= old.key_.Size() + old.val_.Size();
+    bytes_ += e.key_.Size() + e.val_.Size();
+    old = e;
+    prefixes_[Physical(i)] = e.key_.Prefix();
+  }
+
+  // LowerBound returns the index of the first key not less than key and
+  // whether that key equals key. Prefix ties are broken with Order.
+  template <typename Order = BytewiseOrder>
+  [[nodiscard]] std::pair<std::size_t, bool>
+  LowerBound(const Slice &key) const noexcept {
+    const std::uint64_t prefix = key.Prefix();
+    std::size_t lo = 0;
+    std::size_t hi = size();
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      const std::size_t phys = Physical(mid);
+      const bool less = prefixes_[phys] != prefix
+                            ? prefixes_[phys] < prefix
+                            : Order::TieLess(elements_[phys].key_, key);
+      if (less) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return {lo, lo < size() && prefixes_[Physical(lo)] == prefix &&
+                    Order::TieEqual(elements_[Physical(lo)].key_, key)};
+  }
+
+private:
+  [[nodiscard]] std::size_t Physical(std::size_t i) const noexcept {
+    return i < gap_start_ ? i : i + gap_len_;
+  }
+
+  void MoveGap(std::size_t i) noexcept {
+    if (i < gap_start_) {
+      std::move_backward(elements_.begin() + i,
+                         elements_.begin() + gap_start_,
+                         elements_.begin() + gap_start_ + gap_len_);
+      std::move_backward(prefixes_.begin() + i,
+                         prefixes_.begin() + gap_start_,
+                         prefixes_.begin() + gap_start_ + gap_len_);
+    } else if (i > gap_start_) {
+      std::move(elements_.begin() + gap_start_ + gap_len_,
+                elements_.begin() + i + gap_len_,
+                elements_.begin() + gap_start_);
+      std::move(prefixes_.begin() + gap_start_ + gap_len_,
+                prefixes_.begin() + i + gap_len_,
+                prefixes_.begin() + gap_start_);
+    }
+    gap_start_ = i;
+  }
+
+  // Grow widens the gap so at least n more elements fit.
+  void Grow(std::size_t n) noexcept {
+    const std::size_t old_cap = elements_.size();
+    const std::size_t cap = std::max({old_cap * 2, old_cap + n, MIN_CAPACITY});
+    const std::size_t tail = old_cap - gap_start_ - gap_len_;
+    elements_.resize(cap);
+    prefixes_.resize(cap);
+    // shift the elements after the gap to the new end
+    std::move_backward(elements_.begin() + gap_start_ + gap_len_,
+                       elements_.begin() + old_cap, elements_.end());
+    std::move_backward(prefixes_.begin() + gap_start_ + gap_len_,
+                       prefixes_.begin() + old_cap, prefixes_.end());
+    gap_len_ = cap - gap_start_ - tail;
+  }
+
+  static constexpr std::size_t MIN_CAPACITY = 8;
+
+  // elements with a gap of gap_len_ slots at gap_start_
+  std::pmr::vector<NodeElement> elements_;
+  std::pmr::vector<std::uint64_t> prefixes_;
+  std::size_t gap_start_{0};
+  std::size_t gap_len_{0};
+  std::size_t bytes_{0};
+};
+
 // in memory version of a page
 class Node {
 
 private:
-  struct NodeElement {
-    Pgid pgid_;
-    Slice key_;
-    Slice val_;
-  };
-  std::vector<NodeElement> elements_;
+  // arena holding the node's elements and key value bytes
+  Arena *arena_;
+  // arena of a node created outside of a transaction
+  std::unique_ptr<Arena> owned_arena_;
+  NodeElements elements_;
   bool is_leaf_ = true;
+  // whether the node belongs to a bucket with compressed leaf pages
+  bool compressed_ = false;
   std::size_t depth_{0};
   // The node has empty pgid if it is newly created and hasn't claimed a page id
   // yet todo
@@ -30,15 +199,23 @@ private:
   Slice parent_key_;
 
 public:
-  Node(Node *parent = nullptr, bool is_leaf = true) noexcept
-      : is_leaf_(is_leaf), parent_(parent) {}
+  Node(Node *parent = nullptr, bool is_leaf = true,
+       Arena *arena = nullptr) noexcept
+      : arena_(arena),
+        owned_arena_(arena ? nullptr : std::make_unique<Arena>()),
+        elements_(arena ? arena : owned_arena_.get()), is_leaf_(is_leaf),
+        parent_(parent) {
+    if (!arena_) {
+      arena_ = owned_arena_.get();
+    }
+  }
   // prevent copying
   Node(const Node &) = delete;
   Node &operator=(const Node &) = delete;
 
-  // allow moving
+  // allow moving, assignment could free the arena elements_ lives in
   Node(Node &&) noexcept = default;
-  Node &operator=(Node &&) noexcept = default;
+  Node &operator=(Node &&) = delete;
 
   [[nodiscard]] std::string ToString() const noexcept {
     std::vector<std::string> element_strs;
@@ -66,16 +243,18 @@ public:
   void Read(Page &p) noexcept {
     pgid_ = p.Id();
     is_leaf_ = (p.Flags() & static_cast<std::size_t>(PageFlag::LeafPage));
-    elements_.resize(p.Count());
+    elements_.clear();
+    elements_.reserve(p.Count());
     for (std::size_t i = 0; i < p.Count(); i++) {
       if (is_leaf_) {
         LeafPage &leaf_p = p.AsPage<LeafPage>();
-        elements_[i].key_ = leaf_p.GetKey(i);
-        elements_[i].val_ = leaf_p.GetVal(i);
+        elements_.push_back({0, arena_->Copy(leaf_p.GetKey(i)),
+                             arena_->Copy(leaf_p.GetVal(i)),
+                             leaf_p.GetElement(i).flags_});
       } else {
         auto &branch_p = p.AsPage<BranchPage>();
-        elements_[i].key_ = branch_p.GetKey(i);
-        elements_[i].pgid_ = branch_p.GetPgid(i);
+        elements_.push_back(
+            {branch_p.GetPgid(i), arena_->Copy(branch_p.GetKey(i)), {}, 0});
       }
     }
     if (!elements_.empty()) {
@@ -105,8 +284,10 @@ public:
         std::size_t cur_offset = serializer.Offset();
         e.offset_ = cur_offset;
 
+        e.prefix_ = elements_[i].key_.Prefix();
         e.ksize_ = elements_[i].key_.Size();
         e.vsize_ = elements_[i].val_.Size();
+        e.flags_ = elements_[i].flags_;
 
         serializer.WriteBytes(elements_[i].key_.Data(), e.ksize_);
         serializer.WriteBytes(elements_[i].val_.Data(), e.vsize_);
@@ -117,6 +298,7 @@ public:
         std::size_t cur_offset = serializer.Offset();
         e.offset_ = cur_offset;
 
+        e.prefix_ = elements_[i].key_.Prefix();
         e.ksize_ = elements_[i].key_.Size();
         e.pgid_ = elements_[i].pgid_;
 
@@ -128,11 +310,7 @@ public:
   }
 
   [[nodiscard]] std::size_t GetStorageSize() const noexcept {
-    auto sz = GetHeaderSize();
-    for (const auto &e : elements_) {
-      sz += e.key_.Size() + e.val_.Size();
-    }
-    return sz;
+    return GetHeaderSize() + elements_.Bytes();
   }
 
   [[nodiscard]] std::size_t GetElementHeaderSize() const noexcept {
@@ -145,32 +323,26 @@ public:
     return header_size;
   }
 
-  // todo change this to own the memory
+  // Put copies the key and value into the node's arena.
   void Put(const Slice &key, const Slice &val) noexcept { Put(key, key, val); }
 
-  // todo change this to own the memory
   void Put(const Slice &key, Pgid pgid) noexcept { Put(key, key, {}, pgid); }
 
   void Put(const Slice &old_key, const Slice &new_key, const Slice &val,
-           Pgid pgid = 0) noexcept {
+           Pgid pgid = 0, LeafFlag flags = LeafFlag::None) noexcept {
     auto [index, exact] = FindFirstGreaterOrEqualTo(old_key);
+    NodeElement e{pgid, arena_->Copy(new_key), arena_->Copy(val),
+                  static_cast<std::uint32_t>(flags)};
     if (!exact) {
-      elements_.insert(elements_.begin() + index, {pgid, new_key, val});
+      elements_.Insert(index, e);
     } else {
-      elements_[index] = {pgid, new_key, val};
+      elements_.Set(index, e);
     }
   }
 
   [[nodiscard]] std::pair<std::size_t, bool>
   FindFirstGreaterOrEqualTo(const Slice &key) const noexcept {
-    for (std::size_t i = 0; i < elements_.size(); ++i) {
-      if (elements_[i].key_ >= key) { // i.e., elements_[i].key_ >= key
-        bool exact = (elements_[i].key_ == key);
-        return {i, exact};
-      }
-    }
-    // If not found, return size() and false
-    return {static_cast<std::size_t>(elements_.size()), false};
+    return elements_.LowerBound(key);
   }
 
   [[nodiscard]] Node &Root(std::size_t depth = 0) noexcept {
@@ -218,17 +390,21 @@ public:
 
   [[nodiscard]] bool IsLeaf() const noexcept { return is_leaf_; }
 
+  [[nodiscard]] bool Compressed() const noexcept { return compressed_; }
+
+  void SetCompressed(bool compressed) noexcept { compressed_ = compressed; }
+
   [[nodiscard]] Slice GetParentKey() const noexcept { return parent_key_; }
 
   [[nodiscard]] std::optional<Pgid> GetPgid() const noexcept { return pgid_; }
 
   void SetPgid(Pgid pgid) noexcept { pgid_ = pgid; }
 
-  [[nodiscard]] std::vector<NodeElement> &GetElements() noexcept {
-    return elements_;
-  }
+  [[nodiscard]] Arena *GetArena() const noexcept { return arena_; }
+
+  [[nodiscard]] NodeElements &GetElements() noexcept { return elements_; }
 
-  [[nodiscard]] const std::vector<NodeElement> &GetElements() const noexcept {
+  [[nodiscard]] const NodeElements &GetElements() const noexcept {
     return elements_;
   }
 };
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "file.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace kv {
+
+// How commits make their writes durable. Every mode writes the data pages
+// before the meta page, so a process crash never loses a commit; the modes
+// differ in what survives an os crash or power loss.
+enum class SyncMode {
+  // fsync after the data pages and after the meta page. Every commit that
+  // returned is durable.
+  Full,
+  // fdatasync instead of fsync. Same guarantees as Full on filesystems that
+  // persist the file size with fdatasync (ext4, xfs), skips timestamp updates.
+  Data,
+  // sync_file_range over the pages written by the commit. Writes reach the
+  // device in order but neither the device cache nor the file size is
+  // flushed, so a power loss may lose recent commits or roll back to an older
+  // meta.
+  Range,
+  // No sync on commit. A background flusher fsyncs every sync_interval_ and
+  // the commit that reaches sync_every_commits_ fsyncs inline, so an os crash
+  // loses at most that many commits. Unsynced meta pages may be written back
+  // before the data they reference, open with CheckMode::Blocking after a crash
+  // to detect it. A failed periodic fsync does not fail the commit, it is
+  // counted in Stats and reported by the next DB::Sync.
+  Periodic,
+  // Never sync, DB::Sync flushes on demand. An os crash may lose any commit
+  // since the last DB::Sync with the same caveat as Periodic.
+  None
+};
+
+// How much of the file DB::Open verifies beyond the meta pages.
+enum class CheckMode {
+  // only validate the meta pages
+  None,
+  // run a full check before Open returns and fail on any error
+  Blocking,
+  // return right away and run a full check in the background
+  Background
+};
+
+// Options used to open a DB.
+struct Options {
+  static constexpr std::size_t MIN_PAGE_SIZE = 1 << 10;
+  static constexpr std::size_t MAX_PAGE_SIZE = 1 << 20;
+
+  // Page size of a new database file, 0 uses the os page size. Must be a power
+  // of two. Existing files keep the page size stored in their meta.
+  std::size_t page_size_{0};
+  // Size of the initial mmap. The mmap grows when the file outgrows it.
+  std::size_t initial_mmap_size_{1 << 30};
+  SyncMode sync_mode_{SyncMode::Full};
+  // SyncMode::Periodic fsyncs after this many commits, 0 disables.
+  std::size_t sync_every_commits_{100};
+  // SyncMode::Periodic fsyncs pending commits this often, 0 disables the
+  // flusher thread.
+  std::chrono::milliseconds sync_interval_{1000};
+  // Fraction of a page nodes are filled to when they split.
+  double fill_percent_{0.5};
+  // Open the file read only with a shared lock, write txs are rejected.
+  bool read_only_{false};
+  // Write page runs with O_DIRECT so commits do not fill the page cache with
+  // copies of pages the mmap already holds. Falls back to buffered writes on
+  // filesystems without O_DIRECT and for page sizes below the device block
+  // size.
+  bool direct_io_{false};
+  // Threads serializing the dirty pages of large commits, 0 uses the hardware
+  // concurrency and 1 serializes on the committing thread.
+  std::size_t spill_threads_{0};
+  // Verify page checksums when transactions first touch a page.
+  bool verify_checksums_{true};
+  // Memory budget of the value cache shared by the point lookups of read
+  // txs, 0 disables it.
+  std::size_t value_cache_bytes_{0};
+  // False positive rate of the bloom filters that answer point lookups of
+  // read txs for missing keys, 0 disables them. Filters are kept in memory
+  // and built per bucket in the background on first use.
+  double bloom_fp_rate_{0};
+  CheckMode check_mode_{CheckMode::None};
+  // Record the pages every commit writes in the <path>.pagelog sidecar so
+  // Tx::WriteIncrementalTo can copy only the pages written since a txid.
+  bool page_journal_{false};
+  // Wraps the file the db writes through, used to inject faults in tests.
+  std::function<std::unique_ptr<File>(std::unique_ptr<File>)> wrap_file_{};
+};
+
+// Options of Tx::WriteTo.
+struct BackupOptions {
+  // Bytes per second the copy is throttled to, 0 copies at full speed.
+  std::size_t bytes_per_sec_{0};
+  // Bytes copied per call into the kernel.
+  std::size_t chunk_size_{8 << 20};
+};
+
+} // namespace kv
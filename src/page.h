@@ -1,21 +1,25 @@
 #pragma once
 
+#include "checksum.h"
 #include "error.h"
 #include "log.h"
+#include "page_pool.h"
 #include "slice.h"
 #include "type.h"
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <expected>
 #include <memory>
 #include <optional>
 #include <span>
 #include <type_traits>
+#include <utility>
 
 namespace kv {
 
-constexpr std::size_t VERSION_NUMBER = 1;
+constexpr std::size_t VERSION_NUMBER = 4;
 constexpr std::size_t MAGIC = 0xED0CDAED;
 
 constexpr Pgid EVEN_META_PAGE_ID = 0;
@@ -31,7 +35,17 @@ enum class PageFlag : std::size_t {
   LeafPage = 0x02,
   MetaPage = 0x04,
   BucketPage = 0x08,
-  FreelistPage = 0x10
+  FreelistPage = 0x10,
+  // a leaf page whose data region is LzCodec compressed
+  CompressedPage = 0x20,
+  // a root or directory segment of a hash bucket
+  HashPage = 0x40
+};
+
+enum class LeafFlag : std::uint32_t {
+  None = 0x00,
+  // the value is the BucketMeta of a nested bucket
+  Bucket = 0x01
 };
 
 template <typename T>
@@ -45,6 +59,8 @@ protected:
   std::size_t overflow_;
   std::size_t count_;
   std::size_t magic_;
+  // CRC32C of the whole page run, computed with this field excluded
+  std::size_t checksum_;
 
 public:
   Page() = default;
@@ -54,6 +70,7 @@ public:
   Page &operator=(Page &&other) noexcept = delete;
   ~Page() = default;
   void AssertMagic() const noexcept { assert(magic_ == MAGIC); }
+  [[nodiscard]] bool ValidMagic() const noexcept { return magic_ == MAGIC; }
   void SetMagic() noexcept { magic_ = MAGIC; }
 
   void SetId(Pgid id) noexcept { pgid_ = id; }
@@ -67,6 +84,44 @@ public:
   [[nodiscard]] std::size_t Flags() const noexcept { return flags_; }
   [[nodiscard]] Pgid Id() const noexcept { return pgid_; }
   [[nodiscard]] std::size_t Overflow() const noexcept { return overflow_; }
+  [[nodiscard]] std::size_t Checksum() const noexcept { return checksum_; }
+
+  // ComputeChecksum returns the CRC32C of the page header, excluding the
+  // checksum field, and the data of all (overflow + 1) pages.
+  [[nodiscard]] std::uint32_t
+  ComputeChecksum(std::size_t page_size) const noexcept {
+    static_assert(offsetof(Page, checksum_) + sizeof(checksum_) ==
+                      sizeof(Page),
+                  "checksum_ must be the last page header field");
+    const auto *base = reinterpret_cast<const std::byte *>(this);
+    auto crc = Crc32c::Value(base, offsetof(Page, checksum_));
+    return Crc32c::Extend(crc, base + sizeof(Page),
+                          (overflow_ + 1) * page_size - sizeof(Page));
+  }
+
+  // UpdateChecksum stamps the page right before it is written to disk.
+  void UpdateChecksum(std::size_t page_size) noexcept {
+    checksum_ = ComputeChecksum(page_size);
+  }
+
+  // ZeroTail clears the page run past its first used bytes. Pooled buffers
+  // hold whatever their previous user left there, which must not reach disk.
+  void ZeroTail(std::size_t used, std::size_t page_size) noexcept {
+    const std::size_t run = (overflow_ + 1) * page_size;
+    assert(used <= run);
+    std::memset(reinterpret_cast<std::byte *>(this) + used, 0, run - used);
+  }
+
+  // VerifyChecksum checks a page read from disk. The overflow comes from the
+  // same unverified header, a run longer than the max_pages available from
+  // this page on counts as a mismatch instead of being hashed.
+  [[nodiscard]] bool VerifyChecksum(std::size_t page_size,
+                                    std::size_t max_pages) const noexcept {
+    if (overflow_ >= max_pages) {
+      return false;
+    }
+    return checksum_ == ComputeChecksum(page_size);
+  }
 
   template <typename T> [[nodiscard]] T *GetDataAs() noexcept {
     return reinterpret_cast<T *>(Data());
@@ -95,13 +150,18 @@ struct LeafElement {
   std::size_t offset_; // the offset between the start of page and the start of
                        // the key address
   std::size_t ksize_;
-  std::size_t vsize_;
+  std::uint32_t vsize_;
+  // LeafFlag bits of the element
+  std::uint32_t flags_;
+  // Slice::Prefix of the key, searches compare it before the key bytes
+  std::uint64_t prefix_;
 };
 
 struct BranchElement {
   std::size_t offset_;
   std::size_t ksize_;
   Pgid pgid_;
+  std::uint64_t prefix_;
 };
 
 constexpr std::size_t BRANCH_ELEMENT_SIZE = sizeof(BranchElement);
@@ -132,6 +192,31 @@ public:
             elements_[i].ksize_};
   }
 
+  // LowerBound returns the index of the first key not less than key and
+  // whether that key equals key. Probes compare the inline key prefixes and
+  // only break prefix ties with Order.
+  template <typename Order = BytewiseOrder>
+  [[nodiscard]] std::pair<std::size_t, bool>
+  LowerBound(const Slice &key) const noexcept {
+    const std::uint64_t prefix = key.Prefix();
+    std::size_t lo = 0;
+    std::size_t hi = Count();
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      const std::uint64_t mid_prefix = elements_[mid].prefix_;
+      const bool less = mid_prefix != prefix
+                            ? mid_prefix < prefix
+                            : Order::TieLess(GetKey(mid), key);
+      if (less) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return {lo, lo < Count() && elements_[lo].prefix_ == prefix &&
+                    Order::TieEqual(GetKey(lo), key)};
+  }
+
 protected:
   static_assert(std::is_trivially_copyable_v<T>);
   static_assert(std::is_standard_layout_v<T>);
@@ -152,12 +237,8 @@ public:
             elements_[i].vsize_};
   }
   [[nodiscard]] int FindLastLessThan(const Slice &key) const noexcept {
-    for (int i = static_cast<int>(Count()) - 1; i >= 0; --i) {
-      if (GetKey(i) < key) {
-        return i;
-      }
-    }
-    return -1; // key is less than all keys
+    // -1 if key is less than all keys
+    return static_cast<int>(LowerBound(key).first) - 1;
   }
 
   [[nodiscard]] std::string ToString() const noexcept {
@@ -179,8 +260,9 @@ public:
     for (std::size_t i = 0; i < Count(); ++i) {
       const auto &e = elements_[i];
       result +=
-          fmt::format("  {{ index: {}, offset: {}, ksize: {}, vsize: {} }}\n",
-                      i, e.offset_, e.ksize_, e.vsize_);
+          fmt::format("  {{ index: {}, offset: {}, ksize: {}, vsize: {}, "
+                      "flags: {} }}\n",
+                      i, e.offset_, e.ksize_, e.vsize_, e.flags_);
     }
     result += "]";
     return result;
@@ -196,16 +278,8 @@ public:
 
   [[nodiscard]] std::pair<std::size_t, bool>
   FindFirstGreaterOrEqualTo(const Slice &key) const noexcept {
-    for (int i = 0; i < static_cast<int>(Count()); ++i) {
-      Slice cur_key = GetKey(i);
-      if (!(cur_key < key)) { // i.e., cur_key >= key
-        bool exact = (cur_key == key);
-        return {i, exact};
-      }
-    }
-    // If all keys are less than the input key, return Count() as insertion
-    // point
-    return {static_cast<int>(Count()), false};
+    // Count() as insertion point if all keys are less than key
+    return LowerBound(key);
   }
   [[nodiscard]] std::string ToString() const noexcept {
     std::string result = "BranchPage[";
@@ -225,42 +299,81 @@ class PageBuffer final {
 public:
   PageBuffer(std::size_t size, std::size_t page_size) noexcept
       : size_(size), page_size_(page_size), total_bytes_(size * page_size),
-        buffer_(std::make_unique<std::byte[]>(total_bytes_)) {
+        buffer_(std::make_unique<std::byte[]>(total_bytes_)),
+        data_(buffer_.get()) {
+    for (std::size_t i = 0; i < size; i++) {
+      GetPage(i).SetMagic();
+    }
+  }
+
+  // PageBuffer recycled through the pool. Only the page headers are zeroed,
+  // the rest holds whatever the previous user left until the writer of the
+  // page clears what it leaves unused, see Page::ZeroTail.
+  PageBuffer(std::size_t size, std::size_t page_size, PagePool &pool) noexcept
+      : size_(size), page_size_(page_size), total_bytes_(size * page_size),
+        data_(pool.Acquire(size)), pool_(&pool) {
+    assert(pool.PageSize() == page_size);
     for (std::size_t i = 0; i < size; i++) {
+      std::memset(data_ + i * page_size_, 0, PAGE_HEADER_SIZE);
       GetPage(i).SetMagic();
     }
   }
 
   // Move constructor
-  PageBuffer(PageBuffer &&other) noexcept = default;
+  PageBuffer(PageBuffer &&other) noexcept
+      : size_(other.size_), page_size_(other.page_size_),
+        total_bytes_(other.total_bytes_), buffer_(std::move(other.buffer_)),
+        data_(std::exchange(other.data_, nullptr)),
+        pool_(std::exchange(other.pool_, nullptr)) {}
   // Move assignment
-  PageBuffer &operator=(PageBuffer &&other) noexcept = default;
+  PageBuffer &operator=(PageBuffer &&other) noexcept {
+    if (this != &other) {
+      Release();
+      size_ = other.size_;
+      page_size_ = other.page_size_;
+      total_bytes_ = other.total_bytes_;
+      buffer_ = std::move(other.buffer_);
+      data_ = std::exchange(other.data_, nullptr);
+      pool_ = std::exchange(other.pool_, nullptr);
+    }
+    return *this;
+  }
 
   // Delete copy
   PageBuffer(const PageBuffer &) = delete;
   PageBuffer &operator=(const PageBuffer &) = delete;
 
-  ~PageBuffer() noexcept = default;
+  ~PageBuffer() noexcept { Release(); }
 
   [[nodiscard]] std::span<std::byte> GetBuffer() noexcept {
-    return std::span<std::byte>(buffer_.get(), total_bytes_);
+    return std::span<std::byte>(data_, total_bytes_);
   }
 
   [[nodiscard]] std::span<std::byte> GetPageSpan(Pgid pgid) noexcept {
     assert(pgid < size_);
-    return std::span<std::byte>(buffer_.get() + pgid * page_size_, page_size_);
+    return std::span<std::byte>(data_ + pgid * page_size_, page_size_);
   }
 
   [[nodiscard]] Page &GetPage(Pgid pgid) noexcept {
     assert(pgid < size_);
-    return *reinterpret_cast<Page *>(buffer_.get() + pgid * page_size_);
+    return *reinterpret_cast<Page *>(data_ + pgid * page_size_);
   }
 
 private:
   std::size_t size_;
   std::size_t page_size_;
   std::size_t total_bytes_;
+  void Release() noexcept {
+    if (pool_ && data_) {
+      pool_->Release(data_, size_);
+    }
+  }
+
+  // null when the memory comes from a pool
   std::unique_ptr<std::byte[]> buffer_;
+  std::byte *data_;
+  // pool the memory goes back to
+  PagePool *pool_{nullptr};
 };
 ;
 
@@ -279,6 +392,8 @@ private:
 public:
   [[nodiscard]] Pgid GetWatermark() const noexcept { return watermark_; }
   [[nodiscard]] Pgid GetBuckets() const noexcept { return buckets_; }
+  [[nodiscard]] Pgid GetFreelist() const noexcept { return freelist_; }
+  [[nodiscard]] std::size_t GetPageSize() const noexcept { return page_size_; }
   [[nodiscard]] Pgid GetTxid() const noexcept { return txid_; }
   void SetMagic(std::size_t magic) noexcept { magic_ = magic; }
   void SetVersion(std::size_t ver) noexcept { version_ = ver; }
@@ -298,19 +413,10 @@ public:
                        watermark_, txid_, checksum_);
   }
 
+  // Sum64 returns the CRC32C of all the meta fields preceding the checksum.
   [[nodiscard]] std::size_t Sum64() const noexcept {
-    constexpr std::size_t FNV_OFFSET_BASIS_64 = 14695981039346656037ULL;
-    constexpr std::size_t FNV_PRIME_64 = 1099511628211;
-
-    const auto *ptr = reinterpret_cast<const uint8_t *>(this);
     constexpr std::size_t length = offsetof(Meta, checksum_);
-
-    std::size_t hash = FNV_OFFSET_BASIS_64;
-    for (std::size_t i = 0; i < length; ++i) {
-      hash ^= ptr[i];
-      hash *= FNV_PRIME_64;
-    }
-    return hash;
+    return Crc32c::Value(this, length);
   }
 
   void Write(Page &p) noexcept {
@@ -336,7 +442,6 @@ public:
     if (magic_ == MAGIC && version_ == VERSION_NUMBER && checksum_ == Sum64()) {
       return std::nullopt;
     }
-    std::abort();
     return Error{"Meta validation failed"};
   }
 };
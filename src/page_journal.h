@@ -0,0 +1,172 @@
+#pragma once
+
+#include "checksum.h"
+#include "error.h"
+#include "fd.h"
+#include "log.h"
+#include "type.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <fcntl.h>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <unistd.h>
+#include <vector>
+
+namespace kv {
+
+// A run of consecutive pages written by a commit.
+struct PageRun {
+  std::uint64_t pgid_{0};
+  std::uint64_t count_{0};
+};
+
+// PageJournal is the append only sidecar of the db file that records the page
+// runs each commit wrote, tagged with its txid. Records are appended after
+// the data pages of the commit are synced but are not synced themselves: a
+// crash may lose the tail, which Since reports as a gap so the caller falls
+// back to a full backup. A commit that fails after its record leaves a record
+// for a txid that is reused, Since merges both.
+class PageJournal {
+  struct RecordHeader {
+    std::uint64_t txid_;
+    std::uint32_t runs_;
+    // crc of the header up to here and the runs
+    std::uint32_t checksum_;
+  };
+
+public:
+  [[nodiscard]] static std::filesystem::path
+  PathFor(const std::filesystem::path &db_path) noexcept {
+    auto path = db_path;
+    path += ".pagelog";
+    return path;
+  }
+
+  [[nodiscard]] std::optional<Error>
+  Open(const std::filesystem::path &path, bool read_only) noexcept {
+    const auto flags = read_only ? O_RDONLY : (O_RDWR | O_CREAT | O_APPEND);
+    auto fd = ::open(path.c_str(), flags, 0666);
+    if (fd == -1) {
+      LOG_ERROR("Failed to open page journal {}", path.string());
+      return Error{"Failed to open page journal"};
+    }
+    fd_ = Fd{fd};
+    return std::nullopt;
+  }
+
+  void Close() noexcept {
+    auto e = fd_.Reset();
+    assert(!e);
+  }
+
+  [[nodiscard]] bool IsOpen() const noexcept { return fd_.IsValid(); }
+
+  // Reset drops every record, used once the page ids of the db changed.
+  [[nodiscard]] std::optional<Error> Reset() noexcept {
+    if (::ftruncate(fd_.GetFd(), 0) == -1) {
+      return Error{"Failed to truncate page journal"};
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] std::optional<Error>
+  Append(Txid txid, std::span<const PageRun> runs) noexcept {
+    std::vector<std::byte> record(sizeof(RecordHeader) +
+                                  runs.size_bytes());
+    RecordHeader header{txid, static_cast<std::uint32_t>(runs.size()), 0};
+    header.checksum_ = Checksum(header, runs);
+    std::memcpy(record.data(), &header, sizeof(header));
+    std::memcpy(record.data() + sizeof(header), runs.data(), runs.size_bytes());
+    // a single write so concurrent readers never see half a record
+    auto written = ::write(fd_.GetFd(), record.data(), record.size());
+    if (written != static_cast<ssize_t>(record.size())) {
+      return Error{"Failed to append to page journal"};
+    }
+    return std::nullopt;
+  }
+
+  // Since returns the sorted and merged page runs written by the txids in
+  // (since, until]. Fails if a txid in the range has no record.
+  [[nodiscard]] std::expected<std::vector<PageRun>, Error>
+  Since(Txid since, Txid until) const noexcept {
+    auto size = ::lseek(fd_.GetFd(), 0, SEEK_END);
+    if (size == -1) {
+      return std::unexpected{Error{"Failed to read page journal"}};
+    }
+    std::vector<std::byte> data(static_cast<std::size_t>(size));
+    for (std::size_t done = 0; done < data.size();) {
+      auto read = ::pread(fd_.GetFd(), data.data() + done, data.size() - done,
+                          static_cast<off_t>(done));
+      if (read <= 0) {
+        return std::unexpected{Error{"Failed to read page journal"}};
+      }
+      done += read;
+    }
+
+    std::vector<PageRun> runs;
+    std::vector<bool> seen(until > since ? until - since : 0);
+    for (std::size_t offset = 0;
+         offset + sizeof(RecordHeader) <= data.size();) {
+      RecordHeader header;
+      std::memcpy(&header, data.data() + offset, sizeof(header));
+      const auto end = offset + sizeof(header) + header.runs_ * sizeof(PageRun);
+      if (end > data.size()) {
+        break;
+      }
+      std::vector<PageRun> record(header.runs_);
+      std::memcpy(record.data(), data.data() + offset + sizeof(header),
+                  record.size() * sizeof(PageRun));
+      if (header.checksum_ != Checksum(header, record)) {
+        LOG_WARN("Page journal corrupted at offset {}", offset);
+        break;
+      }
+      if (header.txid_ > since && header.txid_ <= until) {
+        seen[header.txid_ - since - 1] = true;
+        runs.insert(runs.end(), record.begin(), record.end());
+      }
+      offset = end;
+    }
+    if (auto it = std::find(seen.begin(), seen.end(), false);
+        it != seen.end()) {
+      LOG_ERROR("Page journal has no record of txid {}",
+                since + 1 + (it - seen.begin()));
+      return std::unexpected{Error{"Page journal does not cover the txids"}};
+    }
+    return Merge(std::move(runs));
+  }
+
+private:
+  [[nodiscard]] static std::uint32_t
+  Checksum(const RecordHeader &header, std::span<const PageRun> runs) noexcept {
+    auto crc = Crc32c::Value(&header, offsetof(RecordHeader, checksum_));
+    return Crc32c::Extend(crc, runs.data(), runs.size_bytes());
+  }
+
+  [[nodiscard]] static std::vector<PageRun>
+  Merge(std::vector<PageRun> runs) noexcept {
+    std::sort(runs.begin(), runs.end(), [](const PageRun &a, const PageRun &b) {
+      return a.pgid_ < b.pgid_;
+    });
+    std::vector<PageRun> merged;
+    for (const auto &r : runs) {
+      if (!merged.empty() &&
+          r.pgid_ <= merged.back().pgid_ + merged.back().count_) {
+        auto &last = merged.back();
+        last.count_ = std::max(last.pgid_ + last.count_, r.pgid_ + r.count_) -
+                      last.pgid_;
+      } else {
+        merged.push_back(r);
+      }
+    }
+    return merged;
+  }
+
+  Fd fd_;
+};
+
+} // namespace kv
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace kv {
+
+// PagePool recycles page aligned buffers for shadow and decoded pages across
+// transactions. Buffers are handed out as is, without zeroing, since the node
+// serializer overwrites every byte that is read back.
+class PagePool final {
+  // Page runs longer than this are allocated and freed directly.
+  static constexpr std::size_t MAX_POOLED_RUN = 16;
+  // Upper bound on the number of idle pages kept by the pool.
+  static constexpr std::size_t MAX_IDLE_PAGES = 4096;
+
+public:
+  PagePool() noexcept = default;
+  PagePool(const PagePool &) = delete;
+  PagePool &operator=(const PagePool &) = delete;
+
+  ~PagePool() { Clear(); }
+
+  // SetPageSize frees the idle buffers and switches to a new page size.
+  void SetPageSize(std::size_t page_size) noexcept {
+    Clear();
+    std::lock_guard lock(mu_);
+    page_size_ = page_size;
+  }
+
+  [[nodiscard]] std::size_t PageSize() const noexcept { return page_size_; }
+
+  // Acquire returns an uninitialized page aligned buffer of count pages.
+  [[nodiscard]] std::byte *Acquire(std::size_t count) noexcept {
+    assert(count > 0);
+    if (count <= MAX_POOLED_RUN) {
+      std::lock_guard lock(mu_);
+      auto &free = free_[count - 1];
+      if (!free.empty()) {
+        auto *p = free.back();
+        free.pop_back();
+        idle_pages_ -= count;
+        hits_++;
+        return p;
+      }
+      misses_++;
+    }
+    return static_cast<std::byte *>(
+        ::operator new(count * page_size_, std::align_val_t{page_size_}));
+  }
+
+  // Release hands a buffer of count pages back to the pool.
+  void Release(std::byte *p, std::size_t count) noexcept {
+    if (count <= MAX_POOLED_RUN) {
+      std::lock_guard lock(mu_);
+      if (idle_pages_ + count <= MAX_IDLE_PAGES) {
+        free_[count - 1].push_back(p);
+        idle_pages_ += count;
+        return;
+      }
+    }
+    ::operator delete(p, std::align_val_t{page_size_});
+  }
+
+  // Hits returns how many pooled acquisitions reused an idle buffer.
+  [[nodiscard]] std::size_t Hits() const noexcept {
+    std::lock_guard lock(mu_);
+    return hits_;
+  }
+
+  [[nodiscard]] std::size_t Misses() const noexcept {
+    std::lock_guard lock(mu_);
+    return misses_;
+  }
+
+  [[nodiscard]] std::size_t IdlePages() const noexcept {
+    std::lock_guard lock(mu_);
+    return idle_pages_;
+  }
+
+private:
+  void Clear() noexcept {
+    std::lock_guard lock(mu_);
+    for (auto &free : free_) {
+      for (auto *p : free) {
+        ::operator delete(p, std::align_val_t{page_size_});
+      }
+      free.clear();
+    }
+    idle_pages_ = 0;
+  }
+
+  std::size_t page_size_{4096};
+  // protects the free lists and counters
+  mutable std::mutex mu_;
+  // idle buffers indexed by run length - 1
+  std::array<std::vector<std::byte *>, MAX_POOLED_RUN> free_;
+  std::size_t idle_pages_{0};
+  std::size_t hits_{0};
+  std::size_t misses_{0};
+};
+
+} // namespace kv
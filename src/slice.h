@@ -1,6 +1,8 @@
 #pragma once
 
-#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <string>
 #include <cstring>
 #include <compare>
@@ -8,40 +10,53 @@
 
 namespace kv {
 
-// Owning byte sequence
+// Non owning view of a byte sequence. The bytes must outlive the slice, nodes
+// copy the slices they keep into the transaction arena.
 class Slice {
 public:
   Slice() noexcept = default;
 
   // Construct from raw data and size
-  Slice(const std::byte* data, size_t size)
-      : data_(data, data + size) {}
+  Slice(const std::byte* data, size_t size) noexcept
+      : data_(data), size_(size) {}
 
   // Construct from std::string
-  Slice(const std::string& str)
-      : data_(reinterpret_cast<const std::byte*>(str.data()),
-              reinterpret_cast<const std::byte*>(str.data()) + str.size()) {}
+  Slice(const std::string& str) noexcept
+      : data_(reinterpret_cast<const std::byte*>(str.data())),
+        size_(str.size()) {}
 
   // Construct from const char*
-  Slice(const char* str)
-      : data_(reinterpret_cast<const std::byte*>(str),
-              reinterpret_cast<const std::byte*>(str) + std::strlen(str)) {}
+  Slice(const char* str) noexcept
+      : data_(reinterpret_cast<const std::byte*>(str)),
+        size_(std::strlen(str)) {}
 
-  const std::byte* Data() const noexcept { return data_.data(); }
-  size_t Size() const noexcept { return data_.size(); }
+  const std::byte* Data() const noexcept { return data_; }
+  size_t Size() const noexcept { return size_; }
 
   std::byte operator[](size_t index) const noexcept {
     assert(index < Size());
     return data_[index];
   }
 
+  // Prefix packs the first 8 bytes big endian and zero padded, so prefixes
+  // order like the slices they come from.
+  uint64_t Prefix() const noexcept {
+    uint64_t prefix = 0;
+    if (size_ == 0) return prefix;
+    std::memcpy(&prefix, data_, std::min<size_t>(size_, 8));
+    if constexpr (std::endian::native == std::endian::little) {
+      prefix = std::byteswap(prefix);
+    }
+    return prefix;
+  }
+
   std::string ToString() const {
     return std::string(reinterpret_cast<const char*>(Data()), Size());
   }
 
   std::strong_ordering operator<=>(const Slice& other) const noexcept {
     const size_t min_len = std::min(Size(), other.Size());
-    const int cmp = std::memcmp(Data(), other.Data(), min_len);
+    const int cmp = min_len ? std::memcmp(Data(), other.Data(), min_len) : 0;
 
     if (cmp < 0) return std::strong_ordering::less;
     if (cmp > 0) return std::strong_ordering::greater;
@@ -57,7 +72,8 @@ public:
     std::string result;
     result.reserve(Size() * 2);
 
-    for (std::byte b : data_) {
+    for (size_t i = 0; i < size_; i++) {
+      std::byte b = data_[i];
       unsigned char byte = static_cast<unsigned char>(b);
       result.push_back(hex_digits[byte >> 4]);
       result.push_back(hex_digits[byte & 0x0F]);
@@ -67,7 +83,68 @@ public:
   }
 
 private:
-  std::vector<std::byte> data_;
+  const std::byte* data_{nullptr};
+  size_t size_{0};
+};
+
+// Key orders break the ties of searches that compare key prefixes first.
+// TieLess and TieEqual are only called on keys with equal prefixes, Equal on
+// any two keys.
+//
+// BytewiseOrder compares the key bytes.
+struct BytewiseOrder {
+  static bool TieLess(const Slice& a, const Slice& b) noexcept {
+    return a < b;
+  }
+  static bool TieEqual(const Slice& a, const Slice& b) noexcept {
+    return a == b;
+  }
+  static bool Equal(const Slice& a, const Slice& b) noexcept {
+    return a == b;
+  }
+};
+
+// FixedOrder is the order of buckets whose keys are N bytes, picked at
+// compile time by TypedBucket. Keys of up to 8 bytes with equal prefixes are
+// equal, longer keys compare their following 8 byte words as integers. Keys
+// of another size, like the names of nested buckets, compare bytewise.
+template <size_t N> struct FixedOrder {
+  static bool TieLess(const Slice& a, const Slice& b) noexcept {
+    if (a.Size() != N || b.Size() != N) {
+      return a < b;
+    }
+    for (size_t i = 8; i < N; i += 8) {
+      const auto wa = Word(a, i);
+      const auto wb = Word(b, i);
+      if (wa != wb) {
+        return wa < wb;
+      }
+    }
+    return false;
+  }
+  static bool TieEqual(const Slice& a, const Slice& b) noexcept {
+    if (a.Size() != N || b.Size() != N) {
+      return a == b;
+    }
+    for (size_t i = 8; i < N; i += 8) {
+      if (Word(a, i) != Word(b, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  static bool Equal(const Slice& a, const Slice& b) noexcept {
+    if (a.Size() != N || b.Size() != N) {
+      return a == b;
+    }
+    // a constant size compare is inlined as word compares
+    return std::memcmp(a.Data(), b.Data(), N) == 0;
+  }
+
+private:
+  static uint64_t Word(const Slice& s, size_t offset) noexcept {
+    return Slice{s.Data() + offset, std::min<size_t>(N - offset, 8)}.Prefix();
+  }
 };
 
 } // namespace kv
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "fmt/core.h"
+#include "trace.h"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace kv {
+
+enum class Counter : std::size_t {
+  // pages looked up in the mmap by txs
+  PagesRead,
+  // pages written to the file, counting overflow pages
+  PagesWritten,
+  // nodes that were split on spill
+  Splits,
+  // nodes decoded from pages into a tx
+  NodesMaterialized,
+  // shadow page runs handed out to dirty nodes
+  ShadowPagesAllocated,
+  // times the mmap was grown
+  MmapRemaps,
+  Fsyncs,
+  FsyncNanos,
+  // SyncMode::Periodic fsyncs that failed after their commits landed
+  FsyncErrors,
+  // point lookups served by the value cache and those that missed it
+  ValueCacheHits,
+  ValueCacheMisses,
+  ValueCacheEvictions,
+  // point lookups that consulted a bloom filter, those it answered and those
+  // it let through that found nothing
+  BloomChecks,
+  BloomNegatives,
+  BloomFalsePositives,
+  Count
+};
+
+// Phases of a commit timed by the commit latency histograms.
+enum class Phase : std::size_t { Spill, Write, Sync, Meta, Count };
+
+// Histogram of durations in power of two nanosecond buckets.
+struct Histogram {
+  static constexpr std::size_t BUCKETS = 64;
+
+  [[nodiscard]] static std::size_t Bucket(std::uint64_t ns) noexcept {
+    return ns == 0 ? 0 : std::bit_width(ns) - 1;
+  }
+
+  // Percentile returns the upper bound of the bucket holding the p th
+  // fraction of the samples.
+  [[nodiscard]] std::chrono::nanoseconds Percentile(double p) const noexcept {
+    if (count_ == 0) {
+      return {};
+    }
+    const auto rank = static_cast<std::uint64_t>(p * (count_ - 1)) + 1;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < BUCKETS; i++) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        return std::chrono::nanoseconds{(std::uint64_t{2} << i) - 1};
+      }
+    }
+    return std::chrono::nanoseconds{UINT64_MAX >> 1};
+  }
+
+  [[nodiscard]] std::chrono::nanoseconds Mean() const noexcept {
+    return std::chrono::nanoseconds{count_ ? sum_ns_ / count_ : 0};
+  }
+
+  [[nodiscard]] std::string ToString() const noexcept {
+    return fmt::format("count: {}, mean: {}us, p50: {}us, p99: {}us, "
+                       "p999: {}us",
+                       count_, Mean().count() / 1000,
+                       Percentile(0.5).count() / 1000,
+                       Percentile(0.99).count() / 1000,
+                       Percentile(0.999).count() / 1000);
+  }
+
+  std::array<std::uint64_t, BUCKETS> buckets_{};
+  std::uint64_t count_{0};
+  std::uint64_t sum_ns_{0};
+};
+
+// Point in time view of the db metrics returned by DB::GetStats.
+struct StatsSnapshot {
+  std::uint64_t pages_read_{0};
+  std::uint64_t pages_written_{0};
+  std::uint64_t splits_{0};
+  std::uint64_t nodes_materialized_{0};
+  std::uint64_t shadow_pages_allocated_{0};
+  std::uint64_t mmap_remaps_{0};
+  std::uint64_t fsyncs_{0};
+  std::chrono::nanoseconds fsync_time_{0};
+  std::uint64_t fsync_errors_{0};
+  std::uint64_t value_cache_hits_{0};
+  std::uint64_t value_cache_misses_{0};
+  std::uint64_t value_cache_evictions_{0};
+  std::uint64_t bloom_checks_{0};
+  std::uint64_t bloom_negatives_{0};
+  std::uint64_t bloom_false_positives_{0};
+  // pages in the freelist, including pages pending release
+  std::size_t freelist_size_{0};
+  // total number of started read tx
+  std::size_t tx_cnt_{0};
+  // number of currently open read transactions
+  std::size_t open_tx_cnt_{0};
+  // commit latency per phase
+  Histogram spill_;
+  Histogram write_;
+  Histogram sync_;
+  Histogram meta_;
+
+  [[nodiscard]] double ValueCacheHitRate() const noexcept {
+    const auto lookups = value_cache_hits_ + value_cache_misses_;
+    return lookups ? static_cast<double>(value_cache_hits_) /
+                         static_cast<double>(lookups)
+                   : 0.0;
+  }
+
+  [[nodiscard]] std::string ToString() const noexcept {
+    return fmt::format(
+        "pages read: {}\npages written: {}\nsplits: {}\n"
+        "nodes materialized: {}\nshadow pages allocated: {}\n"
+        "freelist size: {}\nmmap remaps: {}\nfsyncs: {} ({}us, {} failed)\n"
+        "value cache: {} hits, {} misses ({:.1f}%), {} evictions\n"
+        "bloom filters: {} checks, {} negatives, {} false positives\n"
+        "read txs: {} ({} open)\ncommit spill: {}\ncommit write: {}\n"
+        "commit sync: {}\ncommit meta: {}",
+        pages_read_, pages_written_, splits_, nodes_materialized_,
+        shadow_pages_allocated_, freelist_size_, mmap_remaps_, fsyncs_,
+        fsync_time_.count() / 1000, fsync_errors_, value_cache_hits_,
+        value_cache_misses_, 100.0 * ValueCacheHitRate(),
+        value_cache_evictions_, bloom_checks_, bloom_negatives_,
+        bloom_false_positives_, tx_cnt_, open_tx_cnt_, spill_.ToString(),
+        write_.ToString(), sync_.ToString(), meta_.ToString());
+  }
+};
+
+// Stats collects the counters and commit histograms of a db. Each thread adds
+// to its own cache line sized shard with relaxed atomics, shards are summed
+// when a snapshot is taken.
+class Stats {
+  static constexpr std::size_t SHARDS = 32;
+
+public:
+  Stats() noexcept : shards_(std::make_unique<Shard[]>(SHARDS)) {}
+
+  void Add(Counter c, std::uint64_t n = 1) noexcept {
+    Local().counters_[static_cast<std::size_t>(c)].fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  void Record(Phase phase, std::chrono::nanoseconds d) noexcept {
+    const auto ns = static_cast<std::uint64_t>(d.count());
+    auto &h = Local().phases_[static_cast<std::size_t>(phase)];
+    h.buckets_[Histogram::Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    h.count_.fetch_add(1, std::memory_order_relaxed);
+    h.sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] StatsSnapshot Snapshot() const noexcept {
+    std::array<std::uint64_t, static_cast<std::size_t>(Counter::Count)> c{};
+    std::array<Histogram, static_cast<std::size_t>(Phase::Count)> h{};
+    for (std::size_t s = 0; s < SHARDS; s++) {
+      const auto &shard = shards_[s];
+      for (std::size_t i = 0; i < c.size(); i++) {
+        c[i] += shard.counters_[i].load(std::memory_order_relaxed);
+      }
+      for (std::size_t p = 0; p < h.size(); p++) {
+        const auto &from = shard.phases_[p];
+        for (std::size_t b = 0; b < Histogram::BUCKETS; b++) {
+          h[p].buckets_[b] += from.buckets_[b].load(std::memory_order_relaxed);
+        }
+        h[p].count_ += from.count_.load(std::memory_order_relaxed);
+        h[p].sum_ns_ += from.sum_ns_.load(std::memory_order_relaxed);
+      }
+    }
+    auto counter = [&](Counter i) { return c[static_cast<std::size_t>(i)]; };
+    auto phase = [&](Phase i) { return h[static_cast<std::size_t>(i)]; };
+    StatsSnapshot snap;
+    snap.pages_read_ = counter(Counter::PagesRead);
+    snap.pages_written_ = counter(Counter::PagesWritten);
+    snap.splits_ = counter(Counter::Splits);
+    snap.nodes_materialized_ = counter(Counter::NodesMaterialized);
+    snap.shadow_pages_allocated_ = counter(Counter::ShadowPagesAllocated);
+    snap.mmap_remaps_ = counter(Counter::MmapRemaps);
+    snap.fsyncs_ = counter(Counter::Fsyncs);
+    snap.fsync_time_ = std::chrono::nanoseconds{counter(Counter::FsyncNanos)};
+    snap.fsync_errors_ = counter(Counter::FsyncErrors);
+    snap.value_cache_hits_ = counter(Counter::ValueCacheHits);
+    snap.value_cache_misses_ = counter(Counter::ValueCacheMisses);
+    snap.value_cache_evictions_ = counter(Counter::ValueCacheEvictions);
+    snap.bloom_checks_ = counter(Counter::BloomChecks);
+    snap.bloom_negatives_ = counter(Counter::BloomNegatives);
+    snap.bloom_false_positives_ = counter(Counter::BloomFalsePositives);
+    snap.spill_ = phase(Phase::Spill);
+    snap.write_ = phase(Phase::Write);
+    snap.sync_ = phase(Phase::Sync);
+    snap.meta_ = phase(Phase::Meta);
+    return snap;
+  }
+
+private:
+  struct AtomicHistogram {
+    std::array<std::atomic<std::uint64_t>, Histogram::BUCKETS> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_ns_{0};
+  };
+
+  struct alignas(64) Shard {
+    std::array<std::atomic<std::uint64_t>,
+               static_cast<std::size_t>(Counter::Count)>
+        counters_{};
+    std::array<AtomicHistogram, static_cast<std::size_t>(Phase::Count)>
+        phases_{};
+  };
+
+  // Local returns the shard of the calling thread. Threads are spread over
+  // the shards round robin the first time they record anything.
+  [[nodiscard]] Shard &Local() noexcept {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t index =
+        next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return shards_[index];
+  }
+
+  std::unique_ptr<Shard[]> shards_;
+};
+
+// PhaseTimer records the time from its construction to its destruction as a
+// commit phase.
+class PhaseTimer {
+public:
+  PhaseTimer(Stats &stats, Phase phase) noexcept
+      : stats_(stats), phase_(phase),
+        start_(std::chrono::steady_clock::now()) {
+    KV_TRACE1(commit__phase__start, static_cast<int>(phase_));
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+  ~PhaseTimer() {
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    KV_TRACE2(commit__phase__done, static_cast<int>(phase_),
+              std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                  .count());
+    stats_.Record(phase_, elapsed);
+  }
+
+private:
+  Stats &stats_;
+  Phase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace kv
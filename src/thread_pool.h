@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kv {
+
+// Fixed size pool of worker threads. Tasks may submit further tasks and Wait
+// blocks until every submitted task, including those, has finished.
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t threads) noexcept {
+    threads = std::max<std::size_t>(threads, 1);
+    workers_.reserve(threads);
+    for (std::size_t i = 0; i < threads; i++) {
+      workers_.emplace_back([this] { Run(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mu_);
+      stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto &w : workers_) {
+      w.join();
+    }
+  }
+
+  [[nodiscard]] std::size_t Size() const noexcept { return workers_.size(); }
+
+  void Submit(std::function<void()> task) noexcept {
+    {
+      std::lock_guard lock(mu_);
+      tasks_.push_back(std::move(task));
+      pending_++;
+    }
+    work_cv_.notify_one();
+  }
+
+  // Wait blocks until all submitted tasks have completed. Must not be called
+  // from a task.
+  void Wait() noexcept {
+    std::unique_lock lock(mu_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+private:
+  void Run() noexcept {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mu_);
+        work_cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+      {
+        std::lock_guard lock(mu_);
+        pending_--;
+        if (pending_ == 0) {
+          done_cv_.notify_all();
+        }
+      }
+    }
+  }
+
+  std::mutex mu_;
+  // signaled when a task is queued or the pool stops
+  std::condition_variable work_cv_;
+  // signaled when the last pending task finishes
+  std::condition_variable done_cv_;
+  std::deque<std::function<void()>> tasks_;
+  // number of queued and running tasks
+  std::size_t pending_{0};
+  bool stop_{false};
+  std::vector<std::thread> workers_;
+};
+
+} // namespace kv
@@ -0,0 +1,35 @@
+#pragma once
+
+// Static tracepoints for perf and bpftrace, compiled in with the KV_USDT
+// build option. Probes live in the "kv" provider, e.g.
+//   bpftrace -e 'usdt:./kv_cli:kv:commit__phase__done { ... }'
+// Without the option they expand to nothing; arguments only appear in an
+// unevaluated sizeof, so locals kept for a probe do not trip -Wunused.
+// Example scripts are in tools/bpftrace, they leave the binary out
+// (usdt::kv:<probe>) and attach to a process given with -p <pid>.
+#ifdef KV_USDT
+#include <sys/sdt.h>
+#define KV_TRACE(probe) DTRACE_PROBE(kv, probe)
+#define KV_TRACE1(probe, a) DTRACE_PROBE1(kv, probe, a)
+#define KV_TRACE2(probe, a, b) DTRACE_PROBE2(kv, probe, a, b)
+#define KV_TRACE3(probe, a, b, c) DTRACE_PROBE3(kv, probe, a, b, c)
+#else
+#define KV_TRACE(probe)                                                        \
+  do {                                                                         \
+  } while (0)
+#define KV_TRACE1(probe, a)                                                    \
+  do {                                                                         \
+    (void)sizeof(a);                                                           \
+  } while (0)
+#define KV_TRACE2(probe, a, b)                                                 \
+  do {                                                                         \
+    (void)sizeof(a);                                                           \
+    (void)sizeof(b);                                                           \
+  } while (0)
+#define KV_TRACE3(probe, a, b, c)                                              \
+  do {                                                                         \
+    (void)sizeof(a);                                                           \
+    (void)sizeof(b);                                                           \
+    (void)sizeof(c);                                                           \
+  } while (0)
+#endif
@@ -1,24 +1,42 @@
 #pragma once
 
+#include "backup.h"
 #include "bucket.h"
 #include "disk.h"
 #include "error.h"
 #include "log.h"
 #include "page.h"
+#include "trace.h"
 #include "tx_cache.h"
+#include "value_cache.h"
 #include <expected>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 namespace kv {
 
 class Tx {
 
 public:
-  Tx(DiskHandler &disk, bool writable, Meta db_meta) noexcept
+  // A write tx holds writerlock, the writer lock of the db, until it commits
+  // or rolls back.
+  Tx(DiskHandler &disk, bool writable, Meta db_meta,
+     BucketsCache &buckets_cache, ValueCache *value_cache = nullptr,
+     BloomFilters *filters = nullptr,
+     std::unique_lock<std::mutex> writerlock = {}) noexcept
       : open_(true), disk_(disk), tx_handler_(disk, writable),
-        writable_(writable), meta_(db_meta),
-        buckets_(Buckets{disk.GetPageFromMmap(meta_.GetBuckets())}) {
+        writable_(writable), meta_(db_meta), buckets_cache_(buckets_cache),
+        value_cache_(value_cache), filters_(filters),
+        catalog_(std::make_unique<BucketState>(
+            "", BucketMeta{meta_.GetBuckets()})),
+        writerlock_(std::move(writerlock)) {
     LOG_DEBUG("tx got meta {}", meta_.ToString());
+    if (!writable_) {
+      filelock_ = disk_.LockFileShared();
+    }
     if (writable_) {
       LOG_DEBUG("incrementing txid ");
       meta_.IncrementTxid();
@@ -31,28 +49,51 @@ public:
   Tx(Tx &&) = default;
   Tx &operator=(Tx &&) noexcept = delete;
 
-  void Rollback() noexcept { LOG_INFO("Rolling back tx"); };
+  void Rollback() noexcept {
+    LOG_INFO("Rolling back tx");
+    open_ = false;
+    Unlock();
+  };
 
   [[nodiscard]] bool Writable() const noexcept { return writable_; }
 
+  // MemoryUsage returns the bytes of the arena backing the tx's nodes and
+  // pages. It is released in one go when the tx ends.
+  [[nodiscard]] std::size_t MemoryUsage() const noexcept {
+    return tx_handler_.MemoryUsage();
+  }
+
+  // Err returns the first corrupted page seen by the tx.
+  [[nodiscard]] const std::optional<Error> &Err() const noexcept {
+    return tx_handler_.Err();
+  }
+
   [[nodiscard]] std::optional<Error> Commit() noexcept {
     LOG_INFO("Transaction committing");
-    auto e = tx_handler_.Spill(meta_, buckets_);
+    if (!open_) {
+      return Error{"Tx not open"};
+    }
+    if (!writable_) {
+      return Error{"Tx not writable"};
+    }
+    if (Err()) {
+      LOG_ERROR("Refusing to commit tx that read a corrupted page");
+      return Err();
+    }
+    KV_TRACE1(commit__start, meta_.GetTxid());
+    std::optional<Error> e;
+    {
+      PhaseTimer timer{disk_.GetStats(), Phase::Spill};
+      e = tx_handler_.Spill(meta_, *catalog_);
+    }
     if (e) {
       return e;
     }
-    auto p_e = tx_handler_.AllocateShadowPage(
-        meta_, (buckets_.GetStorageSize() / disk_.PageSize()) + 1);
-    if (!p_e) {
-      return p_e.error();
-    }
-    auto &p = p_e.value().get();
-    LOG_DEBUG("Writing buckets to newly allocated p {}", p.Id());
-    buckets_.Write(p);
-    meta_.SetBuckets(p.Id());
+    // the catalog root only moves when a top level bucket entry changed
+    meta_.SetBuckets(catalog_->meta_.Root());
 
     // Writing all dirty pages to disk.
-    e = tx_handler_.WriteDirtyPages();
+    e = tx_handler_.WriteDirtyPages(meta_.GetTxid());
     if (e) {
       return e;
     }
@@ -60,56 +101,225 @@ public:
     if (e) {
       return e;
     }
+    open_ = false;
+    buckets_cache_.Publish(meta_, *catalog_);
+    if (value_cache_ || filters_) {
+      PublishWritten();
+    }
+    KV_TRACE1(commit__done, meta_.GetTxid());
 
-    return std::nullopt;
+    disk_.Committed();
+    Unlock();
+    return {};
   }
 
   // GetBucket retrievs the bucket with given name
   [[nodiscard]] std::optional<Bucket>
   GetBucket(const std::string &name) noexcept {
-    auto b = buckets_.GetBucket(name);
-    if (!b.has_value()) {
-      return {};
+    auto catalog = Catalog();
+    if (writable_ || catalog_->children_.contains(name)) {
+      return catalog.GetBucket(name);
+    }
+    // read txs of the same commit share the bucket metas they look up
+    if (auto meta = buckets_cache_.Get(meta_, name)) {
+      return catalog.OpenBucket(name, *meta);
+    }
+    auto b = catalog.GetBucket(name);
+    if (b && !Err()) {
+      buckets_cache_.Put(meta_, name, b->GetMetaTest());
     }
-    return Bucket{tx_handler_, name, b.value().get()};
+    return b;
   }
 
+  // CreateBucket creates a new bucket. Passing BucketFlag::Compressed stores
+  // the leaf pages of the bucket compressed.
   [[nodiscard]] std::expected<BucketMeta, Error>
-  CreateBucket(const std::string &name) noexcept {
+  CreateBucket(const std::string &name,
+               BucketFlag flags = BucketFlag::None) noexcept {
     if (!open_) {
       return std::unexpected{Error{"Tx not open"}};
     }
-    if (!writable_) {
-      return std::unexpected{Error{"Tx not writable"}};
+    return Catalog().CreateBucket(name, flags);
+  }
+
+  // WriteTo writes a consistent copy of the db as of this read tx to fd,
+  // starting at its current offset, and returns the bytes written. Pages
+  // below the watermark of the tx are never rewritten, so they are copied
+  // from the db file inside the kernel while writers go on. Both meta pages of
+  // the copy hold the meta of the tx.
+  [[nodiscard]] std::expected<std::size_t, Error>
+  WriteTo(int fd, const BackupOptions &options = {}) noexcept {
+    if (auto err = CheckBackup()) {
+      return std::unexpected{*err};
     }
-    if (buckets_.GetBucket(name)) {
-      return std::unexpected{Error{"Bucket exists"}};
+    const auto page_size = disk_.PageSize();
+    PageBuffer metas{2, page_size};
+    for (Pgid id = 0; id < 2; id++) {
+      WriteMetaPage(metas.GetPage(id), id);
     }
-    if (name.size() == 0) {
-      return std::unexpected{Error{"Bucket name required"}};
+    if (auto err = WriteAll(fd, metas.GetBuffer().data(), 2 * page_size)) {
+      return std::unexpected{*err};
     }
 
-    LOG_DEBUG("Creating a leaf page for bucket");
-    auto p_err = tx_handler_.AllocateShadowPage(meta_, 1);
-    if (!p_err) {
-      return std::unexpected{p_err.error()};
+    // a dup of the fd keeps reading this file if the db is compacted
+    auto src = disk_.DupFd();
+    if (!src) {
+      return std::unexpected{src.error()};
     }
-    auto &p = p_err.value().get();
-    p.SetFlags(PageFlag::LeafPage);
-    auto b = buckets_.AddBucket(name, BucketMeta{p.Id()});
-    assert(b);
-    return b.value();
+    const auto end = meta_.GetWatermark() * page_size;
+    BackupCopier copier{src->GetFd(), fd, options, page_size};
+    if (auto err = copier.Copy(2 * page_size, end - 2 * page_size)) {
+      return std::unexpected{*err};
+    }
+    LOG_INFO("Backup of txid {} wrote {} pages", meta_.GetTxid(),
+             meta_.GetWatermark());
+    return end;
   }
 
+  // WriteIncrementalTo writes the pages committed after txid since up to this
+  // read tx to fd, starting at its current offset, and returns the bytes
+  // written. The pages are looked up in the page journal, so the db must be
+  // opened with Options::page_journal_ since txid since. ApplyIncremental
+  // brings a copy at txid since to the txid of this tx.
+  [[nodiscard]] std::expected<std::size_t, Error>
+  WriteIncrementalTo(int fd, Txid since,
+                     const BackupOptions &options = {}) noexcept {
+    if (auto err = CheckBackup()) {
+      return std::unexpected{*err};
+    }
+    if (!disk_.Journal().IsOpen()) {
+      return std::unexpected{Error{"Page journal not enabled"}};
+    }
+    if (since > meta_.GetTxid()) {
+      return std::unexpected{Error{"Incremental backup since a future txid"}};
+    }
+    auto runs_or_err = disk_.Journal().Since(since, meta_.GetTxid());
+    if (!runs_or_err) {
+      return std::unexpected{runs_or_err.error()};
+    }
+    // pages of failed commits may lie past the watermark
+    std::vector<PageRun> runs;
+    for (auto run : *runs_or_err) {
+      run.count_ = std::min(run.pgid_ + run.count_, meta_.GetWatermark()) -
+                   std::min(run.pgid_, meta_.GetWatermark());
+      if (run.count_ > 0) {
+        runs.push_back(run);
+      }
+    }
+
+    const auto page_size = disk_.PageSize();
+    IncrementalHeader header;
+    header.page_size_ = page_size;
+    header.since_ = since;
+    header.txid_ = meta_.GetTxid();
+    header.runs_ = runs.size();
+    header.checksum_ = header.Checksum(runs);
+    PageBuffer meta_page{1, page_size};
+    WriteMetaPage(meta_page.GetPage(0), 0);
+    if (auto err = WriteAll(fd, &header, sizeof(header))) {
+      return std::unexpected{*err};
+    }
+    if (auto err = WriteAll(fd, runs.data(), runs.size() * sizeof(PageRun))) {
+      return std::unexpected{*err};
+    }
+    if (auto err = WriteAll(fd, meta_page.GetBuffer().data(), page_size)) {
+      return std::unexpected{*err};
+    }
+
+    auto src = disk_.DupFd();
+    if (!src) {
+      return std::unexpected{src.error()};
+    }
+    BackupCopier copier{src->GetFd(), fd, options, page_size};
+    std::size_t pages = 0;
+    for (const auto &run : runs) {
+      if (auto err =
+              copier.Copy(run.pgid_ * page_size, run.count_ * page_size)) {
+        return std::unexpected{*err};
+      }
+      pages += run.count_;
+    }
+    LOG_INFO("Incremental backup of txids {} to {} wrote {} pages", since,
+             meta_.GetTxid(), pages);
+    return sizeof(header) + runs.size() * sizeof(PageRun) +
+           (pages + 1) * page_size;
+  }
+
+  [[nodiscard]] Txid GetTxid() const noexcept { return meta_.GetTxid(); }
+
 private:
   [[nodiscard]] Meta &GetMeta() noexcept { return meta_; }
+  [[nodiscard]] Bucket Catalog() noexcept {
+    return Bucket{tx_handler_, meta_, *catalog_, value_cache_, filters_};
+  }
+  // PublishWritten hands the keys the commit put to the value cache and the
+  // bloom filters.
+  void PublishWritten() noexcept {
+    std::vector<const BucketState *> states;
+    CollectStates(*catalog_, states);
+    if (value_cache_) {
+      std::vector<std::string> keys;
+      bool all = false;
+      for (const auto *state : states) {
+        all |= state->written_all_;
+        for (const auto &key : state->written_) {
+          keys.push_back(ValueCache::Key(state->path_, key));
+        }
+      }
+      value_cache_->Publish(meta_.GetTxid(), keys, all);
+    }
+    if (filters_) {
+      std::vector<BloomFilters::Written> written;
+      for (const auto *state : states) {
+        written.push_back({state->path_, state->written_, state->written_all_});
+      }
+      filters_->Publish(meta_.GetTxid(), written);
+    }
+  }
+  static void CollectStates(const BucketState &state,
+                            std::vector<const BucketState *> &states) noexcept {
+    states.push_back(&state);
+    for (const auto &[_, child] : state.children_) {
+      CollectStates(*child, states);
+    }
+  }
+  [[nodiscard]] std::optional<Error> CheckBackup() const noexcept {
+    if (!open_) {
+      return Error{"Tx not open"};
+    }
+    if (writable_) {
+      return Error{"Backups need a read tx"};
+    }
+    return std::nullopt;
+  }
+
+  // WriteMetaPage writes the meta of the tx as the meta page with id.
+  void WriteMetaPage(Page &p, Pgid id) const noexcept {
+    auto meta = meta_;
+    meta.Write(p);
+    p.SetId(id);
+    p.UpdateChecksum(disk_.PageSize());
+  }
+
+  // Unlock lets the next writer in once the tx is done.
+  void Unlock() noexcept {
+    if (writerlock_.owns_lock()) {
+      writerlock_.unlock();
+    }
+  }
+
   // WriteMeta writes the meta to the disk.
   [[nodiscard]] std::optional<Error> WriteMeta() noexcept {
     PageBuffer buf{1, disk_.PageSize()};
     auto &p = buf.GetPage(0);
     meta_.Write(p);
+    p.UpdateChecksum(disk_.PageSize());
     // Write the meta page to file.
-    auto err = disk_.WritePage(p);
+    std::optional<Error> err;
+    {
+      PhaseTimer timer{disk_.GetStats(), Phase::Meta};
+      err = disk_.WritePage(p);
+    }
     if (err) {
       return err;
     }
@@ -125,6 +335,15 @@ private:
   ShadowPageHandler tx_handler_;
   bool writable_{false};
   Meta meta_;
-  Buckets buckets_;
+  BucketsCache &buckets_cache_;
+  ValueCache *value_cache_;
+  BloomFilters *filters_;
+  // the catalog tree of top level buckets, held by pointer so bucket handles
+  // stay valid when the tx is moved
+  std::unique_ptr<BucketState> catalog_;
+  // keeps DB::Compact from swapping the file under a read tx
+  std::shared_lock<std::shared_mutex> filelock_;
+  // the writer lock of the db, held by a write tx while it is open
+  std::unique_lock<std::mutex> writerlock_;
 };
 } // namespace kv
@@ -1,36 +1,164 @@
 #include "tx_cache.h"
 #include "bucket.h"
+#include "cursor.h"
+#include <array>
 namespace kv {
 
 [[nodiscard]] std::optional<Error>
-ShadowPageHandler::Spill(Meta &meta, Buckets &buckets) noexcept {
+ShadowPageHandler::Spill(Meta &meta, BucketState &catalog) noexcept {
   LOG_INFO("Starting Spill: preparing nodes for persistence.");
 
-  std::vector<Node *> nodes_to_process;
-  std::vector<std::unique_ptr<Node>> owned_new_roots;
-  std::vector<Node *> old_roots;
-
-  // Collect raw pointers to existing nodes
+  Trees trees;
   for (auto &[pgid, n] : nodes_) {
     LOG_DEBUG("Collecting node with pgid {}", pgid);
-    nodes_to_process.push_back(&n);
+    trees[n.Root().GetPgid().value()].insert(&n);
   }
 
-  LOG_DEBUG("Collected {} nodes. Sorting by descending depth.",
-            nodes_to_process.size());
+  auto e = SpillBucket(meta, catalog, trees);
+  if (e) {
+    return e;
+  }
 
-  std::sort(nodes_to_process.begin(), nodes_to_process.end(),
-            [](Node *a, Node *b) { return a->GetDepth() > b->GetDepth(); });
+  LOG_INFO("Spill complete. All nodes persisted.");
+  return {};
+}
+
+[[nodiscard]] std::optional<Error>
+ShadowPageHandler::SpillBucket(Meta &meta, BucketState &b,
+                               Trees &trees) noexcept {
+  if (b.meta_.Hashed()) {
+    return SpillHash(meta, b);
+  }
+  for (auto &[name, child] : b.children_) {
+    auto e = SpillBucket(meta, *child, trees);
+    if (e) {
+      return e;
+    }
+    if (!child->dirty_) {
+      continue;
+    }
+
+    LOG_DEBUG("Moving bucket {} to root {}", name, child->meta_.Root());
+    std::array<std::byte, BucketMeta::ENCODED_SIZE> val;
+    child->meta_.Encode(val.data());
+    Cursor c{*this, b.meta_};
+    (void)c.Seek(name);
+    auto &leaf = c.GetNode();
+    leaf.Put(name, name, {val.data(), val.size()}, 0, LeafFlag::Bucket);
+    // the path to the entry is dirty now
+    auto &tree = trees[b.meta_.Root()];
+    for (Node *n = &leaf; n != nullptr; n = n->GetParentPtr()) {
+      tree.insert(n);
+    }
+    child->dirty_ = false;
+  }
 
-  std::size_t i = 0;
-  while (i < nodes_to_process.size()) {
-    Node &n = *nodes_to_process[i++];
-    LOG_INFO("Processing node at depth {}: {}", n.GetDepth(), n.ToString());
+  auto it = trees.find(b.meta_.Root());
+  if (it == trees.end()) {
+    return {};
+  }
+  const Pgid old_root = b.meta_.Root();
+  auto e = SpillTree(meta, {it->second.begin(), it->second.end()}, b.meta_);
+  if (e) {
+    return e;
+  }
+  b.dirty_ = b.meta_.Root() != old_root;
+  return {};
+}
 
-    auto new_nodes_opt = SplitNode(n);
+[[nodiscard]] std::optional<Error>
+ShadowPageHandler::SpillHash(Meta &meta, BucketState &b) noexcept {
+  auto *table = b.hash_.get();
+  if (!table || !table->Dirty()) {
+    return {};
+  }
+  std::vector<NodeWrite> writes;
+  for (Node *n : table->DirtyLeaves()) {
+    writes.emplace_back(n);
+  }
+  LOG_INFO("Spilling {} hash leaves of bucket {}", writes.size(), b.name_);
+  auto e = WriteNodes(meta, writes);
+  if (e) {
+    return e;
+  }
+  for (auto &w : writes) {
+    w.node_->SetPgid(w.page_->Id());
+  }
 
-    if (new_nodes_opt.has_value()) {
+  // the segments point to the leaves and the root to the segments
+  const auto segments = table->DirtySegments();
+  auto id_or_err = disk_.AllocateExtent(meta, segments.size());
+  if (!id_or_err) {
+    return id_or_err.error();
+  }
+  disk_.GetStats().Add(Counter::ShadowPagesAllocated, segments.size());
+  Pgid id = id_or_err.value();
+  for (auto i : segments) {
+    auto [it, _] = shadow_pages_.emplace(id, disk_.NewShadowPage(id, 1));
+    auto &p = it->second.Get();
+    table->WriteSegment(i, p);
+    p.ZeroTail(PAGE_HEADER_SIZE + p.Count() * sizeof(Pgid), disk_.PageSize());
+    id++;
+  }
+  auto root = AllocateShadowPage(meta, table->RootPages());
+  if (!root) {
+    return root.error();
+  }
+  table->WriteRoot(root->get());
+  b.meta_.SetRoot(root->get().Id());
+  b.dirty_ = true;
+  return {};
+}
+
+[[nodiscard]] std::optional<Error>
+ShadowPageHandler::SpillTree(Meta &meta, std::vector<Node *> nodes_to_process,
+                             BucketMeta &bucket) noexcept {
+  std::vector<std::unique_ptr<Node>> owned_new_roots;
+  std::vector<Node *> old_roots;
+
+  LOG_DEBUG("Collected {} nodes. Sorting by descending depth.",
+            nodes_to_process.size());
+
+  // Nodes of a level are sorted by key so each level is written as one
+  // extent in key order, scans then read physically adjacent pages.
+  std::sort(nodes_to_process.begin(), nodes_to_process.end(),
+            [](Node *a, Node *b) {
+              if (a->GetDepth() != b->GetDepth()) {
+                return a->GetDepth() > b->GetDepth();
+              }
+              return a->GetParentKey() < b->GetParentKey();
+            });
+
+  // Nodes are spilled a level at a time. The nodes of a level are serialized
+  // in parallel, their parents are only updated once the level is written.
+  std::size_t begin = 0;
+  while (begin < nodes_to_process.size()) {
+    std::size_t end = begin;
+    while (end < nodes_to_process.size() &&
+           nodes_to_process[end]->GetDepth() ==
+               nodes_to_process[begin]->GetDepth()) {
+      end++;
+    }
+    LOG_INFO("Spilling {} node(s) at depth {}", end - begin,
+             nodes_to_process[begin]->GetDepth());
+
+    // nodes split off the level, alive until their parents are updated
+    std::vector<std::vector<Node>> splits;
+    std::vector<NodeWrite> writes;
+    // node of the level each write comes from
+    std::vector<Node *> origins;
+    for (std::size_t i = begin; i < end; i++) {
+      Node &n = *nodes_to_process[i];
+      LOG_INFO("Processing node at depth {}: {}", n.GetDepth(), n.ToString());
+
+      auto new_nodes_opt = SplitNode(n);
+      if (!new_nodes_opt.has_value()) {
+        writes.emplace_back(&n);
+        origins.push_back(&n);
+        continue;
+      }
       LOG_INFO("Node split into {} sub-nodes.", new_nodes_opt->size());
+      disk_.GetStats().Add(Counter::Splits);
 
       if (!n.GetParent().has_value()) {
         LOG_DEBUG("Node has no parent -> it is root");
@@ -39,74 +167,68 @@ ShadowPageHandler::Spill(Meta &meta, Buckets &buckets) noexcept {
           old_roots.push_back(&n);
         }
 
-        owned_new_roots.push_back(std::make_unique<Node>(nullptr, false));
+        owned_new_roots.push_back(
+            std::make_unique<Node>(nullptr, false, arena_.get()));
         Node *new_root_ptr = owned_new_roots.back().get();
+        new_root_ptr->SetCompressed(n.Compressed());
         n.SetParent(new_root_ptr);
 
-        // Only process new root after the current pass completes
+        // Only process new root after the current level completes
         nodes_to_process.push_back(new_root_ptr);
       }
 
-      for (auto &new_node : *new_nodes_opt) {
-        std::size_t sz = new_node.GetStorageSize();
-        auto p_or_err = AllocateShadowPage(meta, (sz / disk_.PageSize()) + 1);
-        if (!p_or_err) {
-          return p_or_err.error();
-        }
-
-        auto &p = p_or_err.value().get();
-        new_node.Write(p);
-        new_node.SetPgid(p.Id());
+      for (auto &new_node : splits.emplace_back(std::move(*new_nodes_opt))) {
         new_node.SetParent(n.GetParentPtr());
+        writes.emplace_back(&new_node);
+        origins.push_back(&n);
+      }
+    }
 
-        LOG_DEBUG("Sub-node written to page {}.", p.Id());
+    auto e = WriteNodes(meta, writes);
+    if (e) {
+      return e;
+    }
 
-        Slice old_key = (&new_node == &new_nodes_opt->at(0))
-                            ? n.GetParentKey()
-                            : new_node.GetElements()[0].key_;
-        if (auto parent = new_node.GetParent()) {
+    for (std::size_t i = 0; i < writes.size(); i++) {
+      Node &n = *writes[i].node_;
+      const Pgid id = writes[i].page_->Id();
+      if (&n != origins[i]) {
+        LOG_DEBUG("Sub-node written to page {}.", id);
+        // the first split node replaces the entry of the node it came from
+        const bool first = i == 0 || origins[i - 1] != origins[i];
+        Slice old_key =
+            first ? origins[i]->GetParentKey() : n.GetElements()[0].key_;
+        n.SetPgid(id);
+        if (auto parent = n.GetParent()) {
           Node &pn = parent.value().get();
-          pn.Put(old_key, new_node.GetElements()[0].key_, {},
-                 new_node.GetPgid().value());
+          pn.Put(old_key, n.GetElements()[0].key_, {}, id);
         }
+        continue;
       }
 
-    } else {
-      LOG_INFO("Node did not require splitting. Writing as is: {}",
-               n.ToString());
-
-      std::size_t sz = n.GetStorageSize();
-      auto p_or_err = AllocateShadowPage(meta, (sz / disk_.PageSize()) + 1);
-      if (!p_or_err) {
-        return p_or_err.error();
-      }
-
-      auto &p = p_or_err.value().get();
-      n.Write(p);
-      LOG_DEBUG("{}", n.ToString());
-
-      if (!n.GetParent().has_value() && n.GetPgid().has_value()) {
+      LOG_DEBUG("Node written as is to page {}: {}", id, n.ToString());
+      if (!n.GetParent().has_value() && n.GetPgid() == bucket.Root()) {
         LOG_DEBUG("Node has no parent and has pgid updating root");
-        buckets.UpdateRoot(n.GetPgid().value(), p.Id());
+        bucket.SetRoot(id);
       }
 
-      n.SetPgid(p.Id());
+      n.SetPgid(id);
 
       if (auto parent = n.GetParent()) {
         Node &pn = parent.value().get();
-        pn.Put(n.GetParentKey(), n.GetElements()[0].key_, {}, p.Id());
+        pn.Put(n.GetParentKey(), n.GetElements()[0].key_, {}, id);
       }
     }
+    begin = end;
   }
 
   for (auto *old_root : old_roots) {
     LOG_DEBUG("Updating bucket root from {} to {}", old_root->GetPgid().value(),
               old_root->Root().GetPgid().value());
-    buckets.UpdateRoot(old_root->GetPgid().value(),
-                       old_root->Root().GetPgid().value());
+    if (old_root->GetPgid() == bucket.Root()) {
+      bucket.SetRoot(old_root->Root().GetPgid().value());
+    }
   }
-
-  LOG_INFO("Spill complete. All nodes persisted.");
   return {};
 }
 } // namespace kv
@@ -1,30 +1,75 @@
 #pragma once
+#include "arena.h"
+#include "bucket_meta.h"
+#include "compress.h"
 #include "disk.h"
 #include "node.h"
 #include "page.h"
+#include "trace.h"
 #include "type.h"
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <memory_resource>
 #include <sys/signal.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 namespace kv {
 
-class Buckets;
+struct BucketState;
 class ShadowPageHandler {
+  // Leaf nodes of compressed buckets may hold this many pages of raw data
+  // since they are expected to shrink to about a page once encoded.
+  static constexpr std::size_t COMPRESSED_LEAF_PAGES = 4;
+  // The data region of a compressed page starts with the raw page size and the
+  // encoded size followed by the encoded bytes.
+  static constexpr std::size_t COMPRESSED_HEADER_SIZE = 2 * sizeof(std::size_t);
+  // Upper bound on the number of decoded compressed pages kept per tx.
+  static constexpr std::size_t DECODED_PAGE_CACHE_SIZE = 64;
+  // Spill levels with fewer nodes than this are serialized on the committing
+  // thread, handing them to the pool costs more than it saves.
+  static constexpr std::size_t PARALLEL_SPILL_NODES = 64;
+
 public:
   explicit ShadowPageHandler(DiskHandler &disk, bool writable)
-      : writable_(writable), disk_(disk) {};
+      : arena_(std::make_unique<Arena>()), shadow_pages_(arena_.get()),
+        nodes_(arena_.get()), verified_(arena_.get()), writable_(writable),
+        disk_(disk) {};
 
   std::vector<Node> &Pending() noexcept { return pending_; }
 
   // GetPage returns a reference to the page with a given id.
   // If the page has been written to then a temporary bufferred page is
-  // returned.
+  // returned. Compressed pages are returned decoded. A corrupted page reads
+  // as an empty leaf and sets Err, lookups through it find nothing.
   [[nodiscard]] Page &GetPage(Pgid pgid) noexcept {
+    Page *p = nullptr;
+    // pages the run of p may span
+    std::size_t max_pages = 0;
     if (auto it = shadow_pages_.find(pgid); it != shadow_pages_.end()) {
-      return it->second.Get();
+      p = &it->second.Get();
+      max_pages = p->Overflow() + 1;
+    } else {
+      // the mmap reaches past the end of the file, pages there fault
+      const auto file_pages = disk_.FilePages();
+      if (pgid >= file_pages) {
+        LOG_ERROR("Page {} is past the end of the file", pgid);
+        Fail(Error{fmt::format("page {} is past the end of the file", pgid)});
+        return EmptyPage(pgid);
+      }
+      // Return directly from the mmap.
+      p = &disk_.GetPageFromMmap(pgid);
+      disk_.GetStats().Add(Counter::PagesRead);
+      max_pages = file_pages - pgid;
+      if (!VerifyPage(pgid, *p, max_pages)) {
+        return EmptyPage(pgid);
+      }
     }
-    // Return directly from the mmap.
-    return disk_.GetPageFromMmap(pgid);
+    if (p->Flags() & static_cast<std::size_t>(PageFlag::CompressedPage)) {
+      return DecodePage(pgid, *p, max_pages);
+    }
+    return *p;
   }
 
   // GetOrCreateNode creates a node from a page and associates with a given
@@ -35,12 +80,15 @@ public:
       return it->second;
 
     // 2. Otherwise construct a blank Node in-place inside the map.
-    auto [it, ok] = nodes_.emplace(pgid, Node{parent});
+    auto [it, ok] = nodes_.try_emplace(pgid, parent, true, arena_.get());
     assert(ok);
     Node &node = it->second;
+    disk_.GetStats().Add(Counter::NodesMaterialized);
 
-    if (parent)
+    if (parent) {
       node.SetDepth(parent->GetDepth() + 1);
+      node.SetCompressed(parent->Compressed());
+    }
 
     // read page into node …
     Page &p = GetPage(pgid);
@@ -64,7 +112,7 @@ public:
   }
 
   // Write any dirty pages to disk.
-  [[nodiscard]] std::optional<Error> WriteDirtyPages() noexcept {
+  [[nodiscard]] std::optional<Error> WriteDirtyPages(Txid txid) noexcept {
     LOG_INFO("Starting Write: flushing {} dirty shadow pages to disk.",
              shadow_pages_.size());
 
@@ -82,16 +130,24 @@ public:
               [](const Page *a, const Page *b) { return a->Id() < b->Id(); });
 
     // Write pages to disk in sorted order
-    for (const auto *p : dirty_pages) {
-      LOG_DEBUG("Writing page with id {} to disk.", p->Id());
-      auto e = disk_.WritePage(*p);
-      assert(!e);
+    for (auto *p : dirty_pages) {
+      p->UpdateChecksum(disk_.PageSize());
+    }
+    {
+      PhaseTimer timer{disk_.GetStats(), Phase::Write};
+      if (auto e = disk_.WritePages(dirty_pages)) {
+        return e;
+      }
     }
 
-    // Sync to ensure data is durable
+    // Sync so the data is durable before the meta that references it
     LOG_INFO("Syncing disk to ensure all writes are durable.");
-    auto e = disk_.Sync();
-    assert(!e);
+    if (auto e = disk_.Sync()) {
+      return e;
+    }
+    if (auto e = disk_.JournalPages(txid, dirty_pages)) {
+      return e;
+    }
 
     // Clear out the page cache after successful flush
     LOG_INFO("Clearing shadow page cache after successful flush.");
@@ -109,8 +165,11 @@ public:
     }
     auto &shadow_page = p_or_err.value();
     auto &p = shadow_page.Get();
+    // callers write small pages, clear them whole
+    p.ZeroTail(PAGE_HEADER_SIZE, disk_.PageSize());
     LOG_INFO("Allocated page with id {}, sz {}, {}", shadow_page.Get().Id(),
              count, static_cast<const void *>(&shadow_page.Get()));
+    disk_.GetStats().Add(Counter::ShadowPagesAllocated);
     // save to page cache
     shadow_pages_.insert({shadow_page.Get().Id(), std::move(shadow_page)});
     return p;
@@ -123,7 +182,7 @@ public:
     // Check if split is even needed
     if (n.GetElements().size() <= MIN_KEY_PER_PAGE * 2 ||
         // n.GetStorageSize() < 200) {
-        n.GetStorageSize() < disk_.PageSize()) {
+        n.GetStorageSize() < PageBudget(n)) {
       LOG_DEBUG("No split needed. Node has only {} elements and size {} bytes.",
                 n.GetElements().size(), n.GetStorageSize());
       return {};
@@ -132,61 +191,362 @@ public:
     LOG_DEBUG("Splitting node with {} elements and size {} bytes.",
               n.GetElements().size(), n.GetStorageSize());
 
-    std::vector<Node> nodes;
     // std::size_t threshold = 100;
-    std::size_t threshold = disk_.PageSize() / 2;
-    std::size_t cur_size = PAGE_HEADER_SIZE;
-    Node cur_node{nullptr, n.IsLeaf()};
+    const auto threshold = FillThreshold(n);
+    const auto &elements = n.GetElements();
 
-    std::size_t index = 0;
-    for (const auto &e : n.GetElements()) {
+    // find the split points first so each new node is sized exactly once
+    std::vector<std::size_t> starts{0};
+    std::size_t cur_size = PAGE_HEADER_SIZE;
+    for (std::size_t index = 0; index < elements.size(); index++) {
+      const auto &e = elements[index];
       std::size_t e_size =
           n.GetElementHeaderSize() + e.val_.Size() + e.key_.Size();
 
-      bool can_split = cur_node.GetElements().size() >= MIN_KEY_PER_PAGE &&
-                       index <= n.GetElements().size() - MIN_KEY_PER_PAGE &&
+      bool can_split = index - starts.back() >= MIN_KEY_PER_PAGE &&
+                       index <= elements.size() - MIN_KEY_PER_PAGE &&
                        cur_size + e_size >= threshold;
 
       if (can_split) {
         LOG_DEBUG("Threshold reached. Finalizing current node with {} "
                   "elements, estimated size {} bytes.",
-                  cur_node.GetElements().size(), cur_size);
-        nodes.push_back(std::move(cur_node));
-        cur_node = Node{nullptr, n.IsLeaf()};
+                  index - starts.back(), cur_size);
+        starts.push_back(index);
         cur_size = PAGE_HEADER_SIZE;
       }
 
       LOG_DEBUG("Adding element [{}] to current node. Element size: {} bytes.",
                 e.key_.ToString(), e_size);
-
-      cur_node.GetElements().push_back(e);
       cur_size += e_size;
-      ++index;
     }
 
     LOG_DEBUG("Finalizing last node with {} elements, estimated size {} bytes.",
-              cur_node.GetElements().size(), cur_size);
+              elements.size() - starts.back(), cur_size);
 
-    nodes.push_back(std::move(cur_node));
+    std::vector<Node> nodes;
+    nodes.reserve(starts.size());
+    starts.push_back(elements.size());
+    for (std::size_t i = 0; i + 1 < starts.size(); i++) {
+      // split nodes share the arena of the node they are split from
+      auto &added = nodes.emplace_back(nullptr, n.IsLeaf(), n.GetArena());
+      added.SetCompressed(n.Compressed());
+      auto &added_elements = added.GetElements();
+      added_elements.reserve(starts[i + 1] - starts[i]);
+      for (std::size_t j = starts[i]; j < starts[i + 1]; j++) {
+        added_elements.push_back(elements[j]);
+      }
+    }
 
     LOG_INFO("Splitting complete. Generated {} new node(s).", nodes.size());
+    KV_TRACE3(split, n.IsLeaf(), elements.size(), nodes.size());
     for (const auto &n : nodes) {
       LOG_DEBUG("node: {}", n.ToString());
     }
     return nodes;
   }
 
+  // FillThreshold returns the bytes a node is filled to before it splits.
+  [[nodiscard]] std::size_t FillThreshold(const Node &n) const noexcept {
+    return static_cast<std::size_t>(
+        static_cast<double>(PageBudget(n)) *
+        std::clamp(disk_.GetOptions().fill_percent_, 0.1, 1.0));
+  }
+
+  // WriteNode serializes n into a new page run of the tx and sets its pgid.
+  // Used to write trees bottom up, a node is never split.
+  [[nodiscard]] std::optional<Error> WriteNode(Meta &meta, Node &n) noexcept {
+    std::vector<NodeWrite> writes{NodeWrite{&n}};
+    if (auto e = WriteNodes(meta, writes)) {
+      return e;
+    }
+    n.SetPgid(writes.front().page_->Id());
+    return {};
+  }
+
+  // Spill writes the dirty nodes of every bucket the tx opened, nested
+  // buckets first so their new roots are written to the parent's tree before
+  // the parent is spilled.
   [[nodiscard]] std::optional<Error> Spill(Meta &meta,
-                                           Buckets &buckets) noexcept;
+                                           BucketState &catalog) noexcept;
+
+  [[nodiscard]] bool Writable() const noexcept { return writable_; }
+
+  [[nodiscard]] DiskHandler &Disk() noexcept { return disk_; }
+
+  // CopyOut copies s into the transaction arena. Values read from decoded
+  // pages are copied out so they outlive the eviction of the page.
+  [[nodiscard]] Slice CopyOut(const Slice &s) noexcept {
+    return arena_->Copy(s);
+  }
+
+  // MemoryUsage returns the bytes held by the transaction arena.
+  [[nodiscard]] std::size_t MemoryUsage() const noexcept {
+    return arena_->MemoryUsage();
+  }
+
+  // Err returns the first corrupted page seen by this transaction, a checksum
+  // mismatch or a compressed page that does not decode.
+  [[nodiscard]] const std::optional<Error> &Err() const noexcept {
+    return err_;
+  }
 
 private:
+  // NodeWrite is a node serialized into a shadow page run by WriteNodes.
+  struct NodeWrite {
+    explicit NodeWrite(Node *node) noexcept : node_(node) {}
+
+    Node *node_;
+    // size of the page run
+    std::size_t pages_{0};
+    // encoded data of a compressed leaf, empty if the node is written raw
+    std::vector<std::byte> encoded_{};
+    Page *page_{nullptr};
+  };
+
+  // PageBudget returns the bytes a node may take before it splits. Compressed
+  // leaves are allowed to grow past a page.
+  [[nodiscard]] std::size_t PageBudget(const Node &n) const noexcept {
+    return (n.IsLeaf() && n.Compressed() ? COMPRESSED_LEAF_PAGES : 1) *
+           disk_.PageSize();
+  }
+
+  // WriteNodes serializes the nodes of a spill level into one extent, page
+  // runs follow the order of writes so page ids do not depend on the thread
+  // count. Encoding and serializing run on the spill pool.
+  [[nodiscard]] std::optional<Error>
+  WriteNodes(Meta &meta, std::vector<NodeWrite> &writes) noexcept {
+    ParallelFor(writes.size(), [&](std::size_t i) { EncodeNode(writes[i]); });
+    std::size_t pages = 0;
+    for (const auto &w : writes) {
+      pages += w.pages_;
+    }
+    auto id_or_err = disk_.AllocateExtent(meta, pages);
+    if (!id_or_err) {
+      return id_or_err.error();
+    }
+    Pgid id = id_or_err.value();
+    LOG_INFO("Allocated extent of {} pages at {} for {} nodes", pages, id,
+             writes.size());
+    disk_.GetStats().Add(Counter::ShadowPagesAllocated, writes.size());
+    for (auto &w : writes) {
+      auto [it, _] =
+          shadow_pages_.emplace(id, disk_.NewShadowPage(id, w.pages_));
+      w.page_ = &it->second.Get();
+      id += w.pages_;
+    }
+    ParallelFor(writes.size(),
+                [&](std::size_t i) { SerializeNode(writes[i]); });
+    return {};
+  }
+
+  // EncodeNode sizes the page run of a node. Leaf nodes of compressed buckets
+  // are encoded when that takes fewer pages than the raw layout.
+  void EncodeNode(NodeWrite &w) noexcept {
+    const Node &n = *w.node_;
+    const std::size_t page_size = disk_.PageSize();
+    const std::size_t sz = n.GetStorageSize();
+    const std::size_t raw_pages = (sz / page_size) + 1;
+    w.pages_ = raw_pages;
+    if (!n.IsLeaf() || !n.Compressed()) {
+      return;
+    }
+
+    PageBuffer raw{raw_pages, page_size, disk_.Pool()};
+    n.Write(raw.GetPage(0));
+    auto data =
+        raw.GetBuffer().subspan(PAGE_HEADER_SIZE, sz - PAGE_HEADER_SIZE);
+    std::vector<std::byte> encoded(LzCodec::MaxCompressedSize(data.size()));
+    auto encoded_sz = LzCodec::Compress(data, encoded);
+    const std::size_t encoded_pages =
+        encoded_sz.has_value()
+            ? ((PAGE_HEADER_SIZE + COMPRESSED_HEADER_SIZE + *encoded_sz) /
+               page_size) +
+                  1
+            : raw_pages;
+
+    if (encoded_pages >= raw_pages) {
+      LOG_DEBUG("Leaf of {} bytes does not compress, writing it raw", sz);
+      return;
+    }
+    LOG_DEBUG("Compressed leaf from {} to {} bytes", sz, *encoded_sz);
+    encoded.resize(*encoded_sz);
+    w.encoded_ = std::move(encoded);
+    w.pages_ = encoded_pages;
+  }
+
+  // SerializeNode writes a node into the page run allocated for it.
+  void SerializeNode(NodeWrite &w) noexcept {
+    const Node &n = *w.node_;
+    Page &p = *w.page_;
+    if (w.encoded_.empty()) {
+      n.Write(p);
+      p.ZeroTail(n.GetStorageSize(), disk_.PageSize());
+      return;
+    }
+    p.SetFlags(PageFlag::CompressedPage);
+    p.SetCount(n.GetElements().size());
+    Serializer s{p.Data()};
+    s.Write(n.GetStorageSize());
+    s.Write(w.encoded_.size());
+    s.WriteBytes(w.encoded_.data(), w.encoded_.size());
+    p.ZeroTail(PAGE_HEADER_SIZE + COMPRESSED_HEADER_SIZE + w.encoded_.size(),
+               disk_.PageSize());
+  }
+
+  // ParallelFor calls fn for every index below n, on the spill pool when n is
+  // large enough to be worth it.
+  template <typename Fn>
+  void ParallelFor(std::size_t n, const Fn &fn) noexcept {
+    auto *pool = n >= PARALLEL_SPILL_NODES ? disk_.SpillPool() : nullptr;
+    if (pool == nullptr) {
+      for (std::size_t i = 0; i < n; i++) {
+        fn(i);
+      }
+      return;
+    }
+    // a few chunks per worker to even out nodes of different sizes
+    const std::size_t chunks = pool->Size() * 4;
+    const std::size_t chunk = (n + chunks - 1) / chunks;
+    for (std::size_t begin = 0; begin < n; begin += chunk) {
+      const std::size_t end = std::min(n, begin + chunk);
+      pool->Submit([&fn, begin, end] {
+        for (std::size_t i = begin; i < end; i++) {
+          fn(i);
+        }
+      });
+    }
+    pool->Wait();
+  }
+
+  // dirty nodes grouped by the root pgid of their tree
+  using Trees = std::unordered_map<Pgid, std::unordered_set<Node *>>;
+
+  [[nodiscard]] std::optional<Error> SpillBucket(Meta &meta, BucketState &b,
+                                                 Trees &trees) noexcept;
+
+  // SpillHash writes the leaves and directory a tx changed in the hash table
+  // of a bucket and moves the root of the bucket to the new root page.
+  [[nodiscard]] std::optional<Error> SpillHash(Meta &meta,
+                                               BucketState &b) noexcept;
+
+  // SpillTree writes the dirty nodes of one tree and moves the root of the
+  // bucket to the page its root node was written to.
+  [[nodiscard]] std::optional<Error>
+  SpillTree(Meta &meta, std::vector<Node *> nodes_to_process,
+            BucketMeta &bucket) noexcept;
+
+  // Verifies the checksum of a mmap page the first time the transaction
+  // touches it. A run longer than the max_pages left in the file is a
+  // mismatch. A mismatch is recorded in err_ so the tx can not commit.
+  [[nodiscard]] bool VerifyPage(Pgid pgid, const Page &p,
+                                std::size_t max_pages) noexcept {
+    if (!disk_.VerifyChecksums() || verified_.contains(pgid)) {
+      return true;
+    }
+    if (!p.VerifyChecksum(disk_.PageSize(), max_pages)) {
+      LOG_ERROR("Checksum mismatch on page {}", pgid);
+      Fail(Error{fmt::format("checksum mismatch on page {}", pgid)});
+      return false;
+    }
+    verified_.insert(pgid);
+    return true;
+  }
+
+  // Fail records the first error of the tx.
+  void Fail(Error err) noexcept {
+    if (!err_) {
+      err_ = std::move(err);
+    }
+  }
+
+  // EmptyPage returns an empty leaf standing in for an unusable page.
+  [[nodiscard]] Page &EmptyPage(Pgid pgid) noexcept {
+    if (!empty_page_) {
+      empty_page_.emplace(1, disk_.PageSize());
+      empty_page_->GetPage(0).SetFlags(PageFlag::LeafPage);
+    }
+    auto &p = empty_page_->GetPage(0);
+    p.SetId(pgid);
+    return p;
+  }
+
+  // Decodes a compressed page into the per transaction decoded page cache.
+  // The cache keeps the last DECODED_PAGE_CACHE_SIZE pages, slices into a
+  // decoded page are only valid until it is evicted, see CopyOut.
+  // The sizes in the page are checked against its run of at most max_pages,
+  // a page that does not decode reads as an empty leaf and sets err_.
+  [[nodiscard]] Page &DecodePage(Pgid pgid, Page &p,
+                                 std::size_t max_pages) noexcept {
+    if (auto it = decoded_pages_.find(pgid); it != decoded_pages_.end()) {
+      return it->second.GetPage(0);
+    }
+    if (decoded_pages_.size() >= DECODED_PAGE_CACHE_SIZE) {
+      decoded_pages_.erase(decoded_order_.front());
+      decoded_order_.pop_front();
+    }
+
+    const std::size_t page_size = disk_.PageSize();
+    if (p.Overflow() >= max_pages) {
+      LOG_ERROR("Compressed page {} runs past the end of the file", pgid);
+      Fail(Error{fmt::format("corrupted compressed page {}", pgid)});
+      return EmptyPage(pgid);
+    }
+    const std::size_t run_pages = p.Overflow() + 1;
+    const std::size_t data_sz =
+        run_pages * page_size - PAGE_HEADER_SIZE - COMPRESSED_HEADER_SIZE;
+    Deserializer d{p};
+    const auto raw_sz = d.Read<std::size_t>();
+    const auto encoded_sz = d.Read<std::size_t>();
+    if (encoded_sz > data_sz || raw_sz < PAGE_HEADER_SIZE ||
+        raw_sz - PAGE_HEADER_SIZE > LzCodec::MaxDecompressedSize(encoded_sz)) {
+      LOG_ERROR("Compressed page {} has invalid sizes {} and {}", pgid, raw_sz,
+                encoded_sz);
+      Fail(Error{fmt::format("corrupted compressed page {}", pgid)});
+      return EmptyPage(pgid);
+    }
+    const auto *encoded = static_cast<const std::byte *>(p.Data()) +
+                          COMPRESSED_HEADER_SIZE;
+
+    PageBuffer buf{(raw_sz / page_size) + 1, page_size, disk_.Pool()};
+    auto &decoded = buf.GetPage(0);
+    decoded.SetId(pgid);
+    decoded.SetFlags(PageFlag::LeafPage);
+    decoded.SetCount(p.Count());
+    decoded.SetOverflow(raw_sz / page_size);
+    auto n = LzCodec::Decompress(
+        {encoded, encoded_sz},
+        buf.GetBuffer().subspan(PAGE_HEADER_SIZE, raw_sz - PAGE_HEADER_SIZE));
+    if (!n.has_value() || *n != raw_sz - PAGE_HEADER_SIZE) {
+      LOG_ERROR("Failed to decode compressed page {}", pgid);
+      Fail(Error{fmt::format("corrupted compressed page {}", pgid)});
+      return EmptyPage(pgid);
+    }
+
+    decoded_order_.push_back(pgid);
+    auto [it, _] = decoded_pages_.emplace(pgid, std::move(buf));
+    return it->second.GetPage(0);
+  }
+
   std::vector<Node> pending_;
+  // Backs the containers below and the nodes. Held by pointer so it stays put
+  // when the tx is moved, declared first so it is freed last.
+  std::unique_ptr<Arena> arena_;
   // Dirty shadow pages, only used for write only transactions
-  std::unordered_map<Pgid, ShadowPage> shadow_pages_{};
+  std::pmr::unordered_map<Pgid, ShadowPage> shadow_pages_;
   // nodes_ represents the in-memory version of pages allowing for key value
   // changes.
-  std::unordered_map<Pgid, Node> nodes_{};
-  [[maybe_unused]] const bool writable_;
+  std::pmr::unordered_map<Pgid, Node> nodes_;
+  // Decoded copies of compressed pages read by this tx, evicted in FIFO order.
+  // Kept off the arena, which would never reclaim the evicted entries.
+  std::unordered_map<Pgid, PageBuffer> decoded_pages_{};
+  std::deque<Pgid> decoded_order_{};
+  // Mmap pages whose checksum has been verified by this tx.
+  std::pmr::unordered_set<Pgid> verified_;
+  // First corrupted page seen by this tx.
+  std::optional<Error> err_{};
+  // Stands in for the pages that failed verification or decoding.
+  std::optional<PageBuffer> empty_page_{};
+  const bool writable_;
   DiskHandler &disk_;
 };
 } // namespace kv
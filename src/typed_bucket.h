@@ -0,0 +1,277 @@
+#pragma once
+
+#include "bucket.h"
+#include "error.h"
+#include "slice.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace kv {
+
+// OrderedCodec<T> encodes values of T so their encodings sort bytewise like
+// the values. A codec has:
+//   SIZE            the encoded size if it is fixed, 0 otherwise
+//   Size<LAST>(v)   the encoded size of v
+//   Encode<LAST>(v, out) writes v at out and returns the end of the encoding
+//   Decode<LAST>(in, end) reads a value at in and moves in past it
+// LAST is set for the last field of a key or value, which ends with the
+// slice and needs no terminator.
+template <typename T> struct OrderedCodec;
+
+// Unsigned integers are stored big endian.
+template <std::unsigned_integral T>
+  requires(!std::same_as<T, bool>)
+struct OrderedCodec<T> {
+  static constexpr std::size_t SIZE = sizeof(T);
+
+  template <bool LAST>
+  [[nodiscard]] static constexpr std::size_t Size(T) noexcept {
+    return SIZE;
+  }
+
+  template <bool LAST>
+  static std::byte *Encode(T v, std::byte *out) noexcept {
+    if constexpr (std::endian::native == std::endian::little) {
+      v = std::byteswap(v);
+    }
+    std::memcpy(out, &v, SIZE);
+    return out + SIZE;
+  }
+
+  template <bool LAST>
+  [[nodiscard]] static T Decode(const std::byte *&in,
+                                const std::byte *) noexcept {
+    T v;
+    std::memcpy(&v, in, SIZE);
+    in += SIZE;
+    if constexpr (std::endian::native == std::endian::little) {
+      v = std::byteswap(v);
+    }
+    return v;
+  }
+};
+
+// Signed integers flip the sign bit so negative values sort first.
+template <std::signed_integral T> struct OrderedCodec<T> {
+  using U = std::make_unsigned_t<T>;
+  static constexpr U SIGN = U{1} << (sizeof(T) * 8 - 1);
+  static constexpr std::size_t SIZE = sizeof(T);
+
+  template <bool LAST>
+  [[nodiscard]] static constexpr std::size_t Size(T) noexcept {
+    return SIZE;
+  }
+
+  template <bool LAST>
+  static std::byte *Encode(T v, std::byte *out) noexcept {
+    return OrderedCodec<U>::template Encode<LAST>(static_cast<U>(v) ^ SIGN,
+                                                  out);
+  }
+
+  template <bool LAST>
+  [[nodiscard]] static T Decode(const std::byte *&in,
+                                const std::byte *end) noexcept {
+    return static_cast<T>(OrderedCodec<U>::template Decode<LAST>(in, end) ^
+                          SIGN);
+  }
+};
+
+// Strings are stored raw when last. Otherwise 0x00 is escaped as 0x00 0xff
+// and the string ends with 0x00 0x01, so a string sorts before the strings
+// it is a prefix of.
+template <typename S>
+  requires std::same_as<S, std::string> || std::same_as<S, std::string_view>
+struct OrderedCodec<S> {
+  static constexpr std::size_t SIZE = 0;
+
+  template <bool LAST>
+  [[nodiscard]] static std::size_t Size(std::string_view v) noexcept {
+    if constexpr (LAST) {
+      return v.size();
+    } else {
+      return v.size() + static_cast<std::size_t>(std::count(
+                            v.begin(), v.end(), '\0')) +
+             2;
+    }
+  }
+
+  template <bool LAST>
+  static std::byte *Encode(std::string_view v, std::byte *out) noexcept {
+    if constexpr (LAST) {
+      std::memcpy(out, v.data(), v.size());
+      return out + v.size();
+    } else {
+      for (char c : v) {
+        *out++ = static_cast<std::byte>(c);
+        if (c == '\0') {
+          *out++ = std::byte{0xff};
+        }
+      }
+      *out++ = std::byte{0x00};
+      *out++ = std::byte{0x01};
+      return out;
+    }
+  }
+
+  // Decode of a string_view points into the slice, it is only valid for the
+  // last field and as long as the tx.
+  template <bool LAST>
+  [[nodiscard]] static S Decode(const std::byte *&in,
+                                const std::byte *end) noexcept {
+    if constexpr (LAST) {
+      S v{reinterpret_cast<const char *>(in),
+          static_cast<std::size_t>(end - in)};
+      in = end;
+      return v;
+    } else {
+      static_assert(std::same_as<S, std::string>,
+                    "only the last field can be a string_view");
+      std::string v;
+      while (in + 1 < end &&
+             !(in[0] == std::byte{0x00} && in[1] == std::byte{0x01})) {
+        v.push_back(static_cast<char>(*in));
+        // skip the escape of a 0x00
+        in += *in == std::byte{0x00} ? 2 : 1;
+      }
+      in += 2;
+      return v;
+    }
+  }
+};
+
+// Tuples concatenate the encodings of their fields, the first field sorts
+// first.
+template <typename... Ts> struct OrderedCodec<std::tuple<Ts...>> {
+  static constexpr std::size_t SIZE =
+      ((OrderedCodec<Ts>::SIZE != 0) && ...) ? (OrderedCodec<Ts>::SIZE + ...)
+                                             : 0;
+
+  template <bool LAST>
+  [[nodiscard]] static std::size_t
+  Size(const std::tuple<Ts...> &v) noexcept {
+    return SizeOf<LAST>(v, std::index_sequence_for<Ts...>{});
+  }
+
+  template <bool LAST>
+  static std::byte *Encode(const std::tuple<Ts...> &v,
+                           std::byte *out) noexcept {
+    return EncodeAll<LAST>(v, out, std::index_sequence_for<Ts...>{});
+  }
+
+  template <bool LAST>
+  [[nodiscard]] static std::tuple<Ts...> Decode(const std::byte *&in,
+                                                const std::byte *end) noexcept {
+    return DecodeAll<LAST>(in, end, std::index_sequence_for<Ts...>{});
+  }
+
+private:
+  // the last field of a tuple is last when the tuple is
+  template <bool LAST, std::size_t I>
+  static constexpr bool FIELD_LAST = LAST && I + 1 == sizeof...(Ts);
+
+  template <bool LAST, std::size_t... I>
+  [[nodiscard]] static std::size_t
+  SizeOf(const std::tuple<Ts...> &v, std::index_sequence<I...>) noexcept {
+    return (OrderedCodec<Ts>::template Size<FIELD_LAST<LAST, I>>(
+                std::get<I>(v)) +
+            ...);
+  }
+
+  template <bool LAST, std::size_t... I>
+  static std::byte *EncodeAll(const std::tuple<Ts...> &v, std::byte *out,
+                              std::index_sequence<I...>) noexcept {
+    ((out = OrderedCodec<Ts>::template Encode<FIELD_LAST<LAST, I>>(
+          std::get<I>(v), out)),
+     ...);
+    return out;
+  }
+
+  template <bool LAST, std::size_t... I>
+  [[nodiscard]] static std::tuple<Ts...>
+  DecodeAll(const std::byte *&in, const std::byte *end,
+            std::index_sequence<I...>) noexcept {
+    // a braced list decodes the fields in order
+    return std::tuple<Ts...>{
+        OrderedCodec<Ts>::template Decode<FIELD_LAST<LAST, I>>(in, end)...};
+  }
+};
+
+// TypedBucket puts and gets keys of K and values of V in a bucket, encoded
+// with Codec. Fixed size encodings are built on the stack and other ones up
+// to INLINE_BYTES too, so lookups do not allocate. Buckets whose keys have a
+// fixed size search with FixedOrder, which breaks prefix ties without a
+// bytewise compare.
+template <typename K, typename V,
+          template <typename> class Codec = OrderedCodec>
+class TypedBucket {
+  using KeyCodec = Codec<K>;
+  using ValueCodec = Codec<V>;
+  static constexpr std::size_t INLINE_BYTES = 128;
+
+public:
+  using Order = std::conditional_t<KeyCodec::SIZE != 0,
+                                   FixedOrder<KeyCodec::SIZE>, BytewiseOrder>;
+
+  explicit TypedBucket(Bucket bucket) noexcept : bucket_(std::move(bucket)) {}
+
+  // Get returns the value of key. Values decoded as string_view point into
+  // the tx and are valid as long as it is.
+  [[nodiscard]] std::optional<V> Get(const K &key) const noexcept {
+    return WithEncoded<KeyCodec>(key, [&](const Slice &k) -> std::optional<V> {
+      auto v = bucket_.template Get<Order>(k);
+      if (!v) {
+        return std::nullopt;
+      }
+      const std::byte *in = v->Data();
+      return ValueCodec::template Decode<true>(in, in + v->Size());
+    });
+  }
+
+  [[nodiscard]] std::optional<Error> Put(const K &key, const V &val) noexcept {
+    return WithEncoded<KeyCodec>(key, [&](const Slice &k) {
+      return WithEncoded<ValueCodec>(val, [&](const Slice &v) {
+        return bucket_.template Put<Order>(k, v);
+      });
+    });
+  }
+
+  // Raw returns the untyped bucket.
+  [[nodiscard]] Bucket &Raw() noexcept { return bucket_; }
+
+private:
+  // WithEncoded calls fn with the encoding of v.
+  template <typename C, typename T, typename Fn>
+  static auto WithEncoded(const T &v, const Fn &fn) noexcept {
+    if constexpr (C::SIZE != 0) {
+      std::array<std::byte, C::SIZE> buf;
+      C::template Encode<true>(v, buf.data());
+      return fn(Slice{buf.data(), buf.size()});
+    } else {
+      const auto size = C::template Size<true>(v);
+      std::array<std::byte, INLINE_BYTES> inline_buf;
+      std::vector<std::byte> heap_buf;
+      auto *out = inline_buf.data();
+      if (size > INLINE_BYTES) {
+        heap_buf.resize(size);
+        out = heap_buf.data();
+      }
+      C::template Encode<true>(v, out);
+      return fn(Slice{out, size});
+    }
+  }
+
+  Bucket bucket_;
+};
+
+} // namespace kv
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "slice.h"
+#include "stats.h"
+#include "type.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace kv {
+
+// ValueCache shares the results of point lookups of read txs across txs, so
+// hot keys are served without descending the bucket tree. A value is cached
+// as its location in the file, pages below the watermark are never rewritten
+// so the location holds for every later snapshot until a commit writes the
+// key again. Keys that were not found are cached too.
+//
+// An entry remembers the snapshot it was found in and serves txs from that
+// snapshot up to the last commit whose writes were invalidated. A commit
+// first refuses entries found in older snapshots, then drops the keys it
+// wrote, then opens its snapshot to hits. Entries are evicted with CLOCK
+// once a shard outgrows its share of the memory budget.
+class ValueCache {
+  static constexpr std::size_t SHARDS = 64;
+  // bookkeeping bytes charged per entry on top of its key
+  static constexpr std::size_t ENTRY_OVERHEAD = 96;
+
+public:
+  // Location of a value in the file, found_ is false for missing keys.
+  struct Location {
+    std::uint64_t pos_{0};
+    std::uint64_t len_{0};
+    bool found_{false};
+  };
+
+  ValueCache(std::size_t budget, Stats &stats) noexcept
+      : shard_budget_(budget / SHARDS), stats_(stats),
+        shards_(std::make_unique<Shard[]>(SHARDS)) {}
+
+  // Key returns the cache key of key in the bucket at path.
+  [[nodiscard]] static std::string Key(const std::string &path,
+                                       const Slice &key) noexcept {
+    std::string k;
+    const auto len = static_cast<std::uint32_t>(path.size());
+    k.reserve(sizeof(len) + path.size() + key.Size());
+    k.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    k.append(path);
+    k.append(reinterpret_cast<const char *>(key.Data()), key.Size());
+    return k;
+  }
+
+  // Get returns the location of key as seen by a tx of snapshot txid.
+  [[nodiscard]] std::optional<Location> Get(Txid txid,
+                                            std::string_view key) noexcept {
+    auto &s = ShardOf(key);
+    {
+      std::lock_guard lock(s.mu_);
+      auto it = s.index_.find(key);
+      if (it != s.index_.end()) {
+        auto &slot = s.slots_[it->second];
+        if (slot.txid_ <= txid &&
+            txid <= invalidated_.load(std::memory_order_acquire)) {
+          slot.ref_ = true;
+          stats_.Add(Counter::ValueCacheHits);
+          return slot.loc_;
+        }
+      }
+    }
+    stats_.Add(Counter::ValueCacheMisses);
+    return std::nullopt;
+  }
+
+  // Put caches the location of key a tx of snapshot txid found.
+  void Put(Txid txid, std::string key, Location loc) noexcept {
+    const auto cost = key.size() + ENTRY_OVERHEAD;
+    if (cost > shard_budget_) {
+      return;
+    }
+    auto &s = ShardOf(key);
+    std::lock_guard lock(s.mu_);
+    // a commit newer than the snapshot may have written the key
+    if (txid < published_.load(std::memory_order_acquire)) {
+      return;
+    }
+    if (auto it = s.index_.find(key); it != s.index_.end()) {
+      auto &slot = s.slots_[it->second];
+      slot.loc_ = loc;
+      slot.txid_ = txid;
+      return;
+    }
+    MakeRoom(s, cost);
+    std::size_t i = 0;
+    if (!s.free_.empty()) {
+      i = s.free_.back();
+      s.free_.pop_back();
+    } else {
+      i = s.slots_.size();
+      s.slots_.emplace_back();
+    }
+    auto &slot = s.slots_[i];
+    slot.key_ = std::move(key);
+    slot.loc_ = loc;
+    slot.txid_ = txid;
+    slot.ref_ = false;
+    slot.used_ = true;
+    s.index_.emplace(slot.key_, i);
+    s.bytes_ += cost;
+  }
+
+  // Publish invalidates the keys written by the commit of txid, all of them
+  // if all is set, and opens the snapshot to hits. Called by the writer once
+  // the commit is durable.
+  void Publish(Txid txid, std::span<const std::string> keys,
+               bool all) noexcept {
+    published_.store(txid, std::memory_order_release);
+    // a commit that was never published may have written any key
+    if (all || txid != invalidated_.load(std::memory_order_relaxed) + 1) {
+      Clear();
+    } else {
+      for (const auto &key : keys) {
+        auto &s = ShardOf(key);
+        std::lock_guard lock(s.mu_);
+        if (auto it = s.index_.find(std::string_view{key});
+            it != s.index_.end()) {
+          Evict(s, it->second);
+        }
+      }
+    }
+    invalidated_.store(txid, std::memory_order_release);
+  }
+
+  // Reset empties the cache and opens the snapshot of txid to hits, used
+  // when the db is opened or its file replaced.
+  void Reset(Txid txid) noexcept {
+    published_.store(txid, std::memory_order_release);
+    Clear();
+    invalidated_.store(txid, std::memory_order_release);
+  }
+
+  // Bytes returns the bytes charged to the cached entries.
+  [[nodiscard]] std::size_t Bytes() const noexcept {
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < SHARDS; i++) {
+      std::lock_guard lock(shards_[i].mu_);
+      bytes += shards_[i].bytes_;
+    }
+    return bytes;
+  }
+
+private:
+  struct Slot {
+    std::string key_;
+    Location loc_;
+    // snapshot the location was found in
+    Txid txid_{0};
+    // CLOCK reference bit, set on hits
+    bool ref_{false};
+    bool used_{false};
+  };
+
+  struct Shard {
+    mutable std::mutex mu_;
+    // slots never move, the index points into their keys
+    std::deque<Slot> slots_;
+    std::unordered_map<std::string_view, std::size_t> index_;
+    std::vector<std::size_t> free_;
+    // CLOCK hand
+    std::size_t hand_{0};
+    std::size_t bytes_{0};
+  };
+
+  [[nodiscard]] Shard &ShardOf(std::string_view key) noexcept {
+    return shards_[std::hash<std::string_view>{}(key) % SHARDS];
+  }
+
+  // MakeRoom evicts entries until cost more bytes fit the shard's budget.
+  // Entries hit since the hand last passed get a second chance.
+  void MakeRoom(Shard &s, std::size_t cost) noexcept {
+    while (s.bytes_ + cost > shard_budget_ && s.bytes_ > 0) {
+      const auto i = s.hand_;
+      s.hand_ = (s.hand_ + 1) % s.slots_.size();
+      auto &slot = s.slots_[i];
+      if (!slot.used_) {
+        continue;
+      }
+      if (slot.ref_) {
+        slot.ref_ = false;
+        continue;
+      }
+      Evict(s, i);
+      stats_.Add(Counter::ValueCacheEvictions);
+    }
+  }
+
+  void Evict(Shard &s, std::size_t i) noexcept {
+    auto &slot = s.slots_[i];
+    s.index_.erase(std::string_view{slot.key_});
+    s.bytes_ -= slot.key_.size() + ENTRY_OVERHEAD;
+    slot.key_.clear();
+    slot.used_ = false;
+    s.free_.push_back(i);
+  }
+
+  void Clear() noexcept {
+    for (std::size_t i = 0; i < SHARDS; i++) {
+      auto &s = shards_[i];
+      std::lock_guard lock(s.mu_);
+      s.index_.clear();
+      s.slots_.clear();
+      s.free_.clear();
+      s.hand_ = 0;
+      s.bytes_ = 0;
+    }
+  }
+
+  const std::size_t shard_budget_;
+  Stats &stats_;
+  std::unique_ptr<Shard[]> shards_;
+  // txs of snapshots older than this may not add entries
+  std::atomic<Txid> published_{0};
+  // last commit whose writes were invalidated, newer snapshots miss
+  std::atomic<Txid> invalidated_{0};
+};
+
+} // namespace kv
@@ -0,0 +1,62 @@
+#include "arena.h"
+#include "node.h"
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string>
+
+namespace test {
+
+TEST(ArenaTest, AllocationsAreAlignedAndDisjoint) {
+  kv::Arena arena;
+  std::vector<std::pair<std::byte *, std::size_t>> allocs;
+  for (std::size_t i = 1; i < 2000; i += 7) {
+    const std::size_t align = std::size_t{1} << (i % 5);
+    auto *p = static_cast<std::byte *>(arena.allocate(i, align));
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(p) % align, 0);
+    std::memset(p, static_cast<int>(i & 0xFF), i);
+    allocs.emplace_back(p, i);
+  }
+  for (const auto &[p, n] : allocs) {
+    for (std::size_t j = 0; j < n; j++) {
+      ASSERT_EQ(p[j], static_cast<std::byte>(n & 0xFF));
+    }
+  }
+
+  // large allocations get their own block and keep the current one
+  const auto blocks = arena.BlockCount();
+  auto *large = arena.allocate(1 << 20, 64);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(large) % 64, 0);
+  EXPECT_EQ(arena.BlockCount(), blocks + 1);
+  EXPECT_GE(arena.MemoryUsage(), std::size_t{1} << 20);
+}
+
+TEST(ArenaTest, CopyOutlivesSource) {
+  kv::Arena arena;
+  kv::Slice copy;
+  {
+    std::string src = "a key that is longer than the small string buffer";
+    copy = arena.Copy(src);
+    src.assign(src.size(), 'x');
+  }
+  EXPECT_EQ(copy.ToString(),
+            "a key that is longer than the small string buffer");
+  EXPECT_EQ(arena.Copy(kv::Slice{}).Size(), 0);
+}
+
+TEST(ArenaTest, NodeCopiesPutsIntoArena) {
+  kv::Arena arena;
+  kv::Node n{nullptr, true, &arena};
+  for (int i = 0; i < 100; i++) {
+    std::string key = "key" + std::to_string(1000 + i);
+    n.Put(key, std::string(50, static_cast<char>('a' + i % 26)));
+  }
+  ASSERT_EQ(n.GetElements().size(), 100);
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(n.GetElements()[i].key_.ToString(),
+              "key" + std::to_string(1000 + i));
+    EXPECT_EQ(n.GetElements()[i].val_.ToString(),
+              std::string(50, static_cast<char>('a' + i % 26)));
+  }
+  EXPECT_GT(arena.MemoryUsage(), 0);
+}
+} // namespace test
@@ -0,0 +1,290 @@
+#include "db.h"
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB GetTmpDB(const std::filesystem::path &path,
+                                       const kv::Options &options = {}) {
+  auto db_or_err = kv::DB::Open(path, options);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+PutKeys(kv::DB &db, int from, int to, const std::string &suffix = "-value") {
+  return db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    for (int i = from; i < to; i++) {
+      auto key = "key" + std::to_string(i);
+      if (auto e = b->Put(key, key + suffix)) {
+        return e;
+      }
+    }
+    return {};
+  });
+}
+
+TEST(BackupTest, WriteToCopiesTheSnapshotOfTheReadTx) {
+  const std::filesystem::path path = "./backup_src.db";
+  const std::filesystem::path copy = "./backup_copy.db";
+  std::filesystem::remove(path);
+  std::filesystem::remove(copy);
+  constexpr int keys = 2000;
+  {
+    auto db = GetTmpDB(path);
+    auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.CreateBucket("b");
+      return b ? std::nullopt : std::optional{b.error()};
+    });
+    ASSERT_FALSE(err.has_value());
+    ASSERT_FALSE(PutKeys(*db, 0, keys).has_value());
+
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      // commits after the read tx began must not show up in the copy
+      if (auto e = PutKeys(*db, keys, 2 * keys)) {
+        return e;
+      }
+      kv::Fd fd{::open(copy.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+      EXPECT_TRUE(fd.IsValid());
+      auto written = tx.WriteTo(fd.GetFd());
+      if (!written) {
+        return written.error();
+      }
+      EXPECT_EQ(*written, std::filesystem::file_size(copy));
+      return fd.Sync();
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  auto db = GetTmpDB(copy);
+  auto result = db->Check();
+  EXPECT_TRUE(result.Ok());
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    EXPECT_TRUE(b.has_value());
+    for (int i = 0; i < keys; i++) {
+      auto key = "key" + std::to_string(i);
+      auto val = b->Get(key);
+      EXPECT_TRUE(val.has_value());
+      EXPECT_EQ(val->ToString(), key + "-value");
+    }
+    EXPECT_FALSE(b->Get("key" + std::to_string(keys)).has_value());
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(BackupTest, WriteToIsThrottled) {
+  const std::filesystem::path path = "./backup_throttle.db";
+  const std::filesystem::path copy = "./backup_throttle_copy.db";
+  std::filesystem::remove(path);
+  std::filesystem::remove(copy);
+  auto db = GetTmpDB(path);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+  ASSERT_FALSE(PutKeys(*db, 0, 2000).has_value());
+
+  err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::Fd fd{::open("/dev/null", O_WRONLY)};
+    auto written = tx.WriteTo(fd.GetFd());
+    EXPECT_FALSE(written.has_value());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::Fd fd{::open(copy.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+    kv::BackupOptions options;
+    options.bytes_per_sec_ = 1 << 20;
+    const auto start = std::chrono::steady_clock::now();
+    auto written = tx.WriteTo(fd.GetFd(), options);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (!written) {
+      return written.error();
+    }
+    const auto pages = *written / db->PageSize();
+    // all but the meta pages are paced at the rate
+    const std::chrono::duration<double> min{
+        static_cast<double>((pages - 2) * db->PageSize()) / (1 << 20)};
+    EXPECT_GE(elapsed, min);
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(BackupTest, IncrementalBackupsApplyOntoAFullCopy) {
+  const std::filesystem::path path = "./backup_incr.db";
+  const std::filesystem::path copy = "./backup_incr_copy.db";
+  const std::filesystem::path incr = "./backup_incr.inc";
+  for (const auto &p : {path, copy, incr, kv::PageJournal::PathFor(path)}) {
+    std::filesystem::remove(p);
+  }
+  kv::Options options;
+  options.page_journal_ = true;
+  auto db = GetTmpDB(path, options);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+  ASSERT_FALSE(PutKeys(*db, 0, 2000).has_value());
+
+  kv::Txid base = 0;
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    base = tx.GetTxid();
+    kv::Fd fd{::open(copy.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+    auto written = tx.WriteTo(fd.GetFd());
+    return written ? std::nullopt : std::optional{written.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  // two rounds of incrementals, each applied to the copy of the last
+  for (int round = 0; round < 2; round++) {
+    const auto suffix = "-round" + std::to_string(round);
+    // a key range that is contiguous in key order touches a few leaves
+    ASSERT_FALSE(PutKeys(*db, 1000, 1100, suffix).has_value());
+    ASSERT_FALSE(PutKeys(*db, 2000 + round * 100, 2100 + round * 100, suffix)
+                     .has_value());
+    kv::Txid txid = 0;
+    std::size_t file_size = 0;
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      txid = tx.GetTxid();
+      kv::Fd fd{::open(incr.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+      auto written = tx.WriteIncrementalTo(fd.GetFd(), base);
+      if (!written) {
+        return written.error();
+      }
+      file_size = *written;
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+    EXPECT_EQ(file_size, std::filesystem::file_size(incr));
+    EXPECT_LT(file_size, std::filesystem::file_size(copy) / 2);
+
+    kv::Fd fd{::open(incr.c_str(), O_RDONLY)};
+    auto applied = kv::ApplyIncremental(copy, fd.GetFd());
+    ASSERT_TRUE(applied.has_value());
+    EXPECT_EQ(*applied, txid);
+    // the copy moved on, the same incremental no longer applies
+    EXPECT_FALSE(kv::ApplyIncremental(copy, fd.GetFd()).has_value());
+    base = txid;
+  }
+
+  auto restored = GetTmpDB(copy);
+  EXPECT_TRUE(restored->Check().Ok());
+  err = restored->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    EXPECT_TRUE(b.has_value());
+    EXPECT_EQ(b->Get("key1050")->ToString(), "key1050-round1");
+    EXPECT_EQ(b->Get("key1999")->ToString(), "key1999-value");
+    EXPECT_EQ(b->Get("key2050")->ToString(), "key2050-round0");
+    EXPECT_EQ(b->Get("key2150")->ToString(), "key2150-round1");
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+
+  // txids committed while the journal was off leave a gap
+  db.reset();
+  db = GetTmpDB(path);
+  ASSERT_FALSE(PutKeys(*db, 0, 10).has_value());
+  db.reset();
+  db = GetTmpDB(path, options);
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::Fd fd{::open(incr.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+    EXPECT_FALSE(tx.WriteIncrementalTo(fd.GetFd(), base).has_value());
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(BackupTest, ApplyIncrementalRejectsForgedBackups) {
+  const std::filesystem::path path = "./backup_forged.db";
+  const std::filesystem::path copy = "./backup_forged_copy.db";
+  const std::filesystem::path incr = "./backup_forged.inc";
+  for (const auto &p : {path, copy, incr, kv::PageJournal::PathFor(path)}) {
+    std::filesystem::remove(p);
+  }
+  kv::Options options;
+  options.page_journal_ = true;
+  auto db = GetTmpDB(path, options);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+  ASSERT_FALSE(PutKeys(*db, 0, 500).has_value());
+  kv::Txid base = 0;
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    base = tx.GetTxid();
+    kv::Fd fd{::open(copy.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+    auto written = tx.WriteTo(fd.GetFd());
+    return written ? std::nullopt : std::optional{written.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+  ASSERT_FALSE(PutKeys(*db, 100, 200, "-new").has_value());
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::Fd fd{::open(incr.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)};
+    auto written = tx.WriteIncrementalTo(fd.GetFd(), base);
+    return written ? std::nullopt : std::optional{written.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  std::string backup(std::filesystem::file_size(incr), '\0');
+  {
+    kv::Fd fd{::open(incr.c_str(), O_RDONLY)};
+    ASSERT_FALSE(kv::PosixFile{fd.GetFd()}
+                     .ReadAt(backup.data(), backup.size(), 0)
+                     .has_value());
+  }
+  kv::IncrementalHeader header;
+  std::memcpy(&header, backup.data(), sizeof(header));
+  ASSERT_GT(header.runs_, 0);
+  std::vector<kv::PageRun> runs(header.runs_);
+  std::memcpy(runs.data(), backup.data() + sizeof(header),
+              runs.size() * sizeof(kv::PageRun));
+  auto *meta_page = reinterpret_cast<kv::Page *>(
+      backup.data() + sizeof(header) + runs.size() * sizeof(kv::PageRun));
+  const auto watermark = meta_page->GetDataAs<kv::Meta>()->GetWatermark();
+
+  // each forgery keeps the header checksum valid unless noted
+  auto apply = [&](auto forge) {
+    auto h = header;
+    auto r = runs;
+    forge(h, r);
+    h.checksum_ = h.Checksum(r);
+    auto forged = backup;
+    std::memcpy(forged.data(), &h, sizeof(h));
+    std::memcpy(forged.data() + sizeof(h), r.data(),
+                r.size() * sizeof(kv::PageRun));
+    kv::Fd fd{::open(incr.c_str(), O_RDWR | O_TRUNC)};
+    EXPECT_FALSE(kv::PosixFile{fd.GetFd()}
+                     .WriteAt(forged.data(), forged.size(), 0)
+                     .has_value());
+    return kv::ApplyIncremental(copy, fd.GetFd());
+  };
+  // a run count larger than the input is rejected before it is allocated
+  EXPECT_FALSE(apply([](auto &h, auto &) { h.runs_ = 1ULL << 60; }));
+  // the meta must be the one of the snapshot the header names
+  EXPECT_FALSE(apply([](auto &h, auto &) { h.txid_++; }));
+  EXPECT_FALSE(apply([&](auto &, auto &r) { r.back().pgid_ = watermark; }));
+  EXPECT_FALSE(apply([](auto &, auto &r) { r.back().count_ = 1ULL << 60; }));
+
+  // the copy is left as it was, the real backup still applies
+  EXPECT_TRUE(apply([](auto &, auto &) {}).has_value());
+  auto restored = GetTmpDB(copy);
+  EXPECT_TRUE(restored->Check().Ok());
+  err = restored->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_EQ(tx.GetBucket("b")->Get("key150")->ToString(), "key150-new");
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+} // namespace test
@@ -0,0 +1,169 @@
+#include "bloom.h"
+#include "db.h"
+#include <cassert>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace test {
+
+// WaitForFilters looks a missing key up in bucket b and the bucket nested in
+// it, if any, until the filters built in the background answer both.
+[[nodiscard]] bool WaitForFilters(kv::DB &db) {
+  for (int i = 0; i < 1000; i++) {
+    const auto checks = db.GetStats().bloom_checks_;
+    std::uint64_t lookups = 0;
+    auto err = db.View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("b");
+      EXPECT_FALSE(b->Get("probe").has_value());
+      lookups++;
+      if (auto nested = b->GetBucket("nested")) {
+        EXPECT_FALSE(nested->Get("probe").has_value());
+        lookups++;
+      }
+      return {};
+    });
+    if (err || db.GetStats().bloom_checks_ - checks == lookups) {
+      return !err;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+TEST(BloomTest, FilterHasNoFalseNegativesAndKeepsItsRate) {
+  constexpr std::size_t keys = 10000;
+  constexpr double fp_rate = 0.01;
+  kv::BloomFilter filter{keys, fp_rate};
+  for (std::size_t i = 0; i < keys; i++) {
+    filter.Add(kv::BloomFilter::Hash("key" + std::to_string(i)));
+  }
+  for (std::size_t i = 0; i < keys; i++) {
+    EXPECT_TRUE(
+        filter.MayContain(kv::BloomFilter::Hash("key" + std::to_string(i))));
+  }
+  constexpr std::size_t probes = 100000;
+  std::size_t false_positives = 0;
+  for (std::size_t i = 0; i < probes; i++) {
+    false_positives +=
+        filter.MayContain(kv::BloomFilter::Hash("missing" + std::to_string(i)));
+  }
+  EXPECT_LT(static_cast<double>(false_positives) / probes, 2 * fp_rate);
+  EXPECT_FALSE(filter.Full());
+}
+
+TEST(BloomTest, ReadTxsSkipMissingKeysAndSeeNewOnes) {
+  const std::filesystem::path path = "./bloom.db";
+  std::filesystem::remove(path);
+  kv::Options options;
+  options.bloom_fp_rate_ = 0.01;
+  auto db_or_err = kv::DB::Open(path, options);
+  ASSERT_TRUE(db_or_err);
+  auto &db = *db_or_err;
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    if (!b) {
+      return b.error();
+    }
+    auto bucket = tx.GetBucket("b");
+    if (auto c = bucket->CreateBucket("nested"); !c) {
+      return c.error();
+    }
+    for (int i = 0; i < 5000; i++) {
+      auto key = "key" + std::to_string(i);
+      if (auto e = bucket->Put(key, key)) {
+        return e;
+      }
+    }
+    return bucket->GetBucket("nested")->Put("inner", "inner");
+  });
+  ASSERT_FALSE(err.has_value());
+
+  constexpr int missing = 2000;
+  bool put_absent7 = false;
+  auto lookup = [&] {
+    return db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("b");
+      for (int i = 0; i < 5000; i += 7) {
+        auto key = "key" + std::to_string(i);
+        EXPECT_EQ(b->Get(key)->ToString(), key);
+      }
+      for (int i = 0; i < missing; i++) {
+        EXPECT_EQ(b->Get("absent" + std::to_string(i)).has_value(),
+                  put_absent7 && i == 7);
+      }
+      EXPECT_FALSE(b->Get("nested").has_value());
+      EXPECT_EQ(b->GetBucket("nested")->Get("inner")->ToString(), "inner");
+      return {};
+    });
+  };
+  // lookups go to the tree until the filter is built
+  ASSERT_FALSE(lookup().has_value());
+  ASSERT_TRUE(WaitForFilters(*db));
+  const auto before = db->GetStats();
+  ASSERT_FALSE(lookup().has_value());
+  auto snap = db->GetStats();
+  snap.bloom_checks_ -= before.bloom_checks_;
+  snap.bloom_negatives_ -= before.bloom_negatives_;
+  snap.bloom_false_positives_ -= before.bloom_false_positives_;
+  EXPECT_GT(snap.bloom_negatives_, missing * 9 / 10);
+  EXPECT_EQ(snap.bloom_checks_ - snap.bloom_negatives_ -
+                snap.bloom_false_positives_,
+            5000 / 7 + 1 + 1);
+
+  // keys a commit puts are added to the filter
+  err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    return tx.GetBucket("b")->Put("absent7", "now here");
+  });
+  ASSERT_FALSE(err.has_value());
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_EQ(tx.GetBucket("b")->Get("absent7")->ToString(), "now here");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  put_absent7 = true;
+  ASSERT_FALSE(lookup().has_value());
+}
+
+TEST(BloomTest, CompactDropsFiltersOfTheOldFile) {
+  const std::filesystem::path path = "./bloom_compact.db";
+  std::filesystem::remove(path);
+  kv::Options options;
+  options.bloom_fp_rate_ = 0.01;
+  auto db_or_err = kv::DB::Open(path, options);
+  ASSERT_TRUE(db_or_err);
+  auto &db = *db_or_err;
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("b"); !b) {
+      return b.error();
+    }
+    auto b = tx.GetBucket("b");
+    for (int i = 0; i < 20000; i++) {
+      auto key = "key" + std::to_string(i);
+      if (auto e = b->Put(key, key)) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  // starts a build the compaction cancels or waits for
+  ASSERT_FALSE(db->View([](kv::Tx &tx) -> std::optional<kv::Error> {
+                   EXPECT_FALSE(tx.GetBucket("b")->Get("absent").has_value());
+                   return {};
+                 }).has_value());
+  ASSERT_FALSE(db->Compact().has_value());
+
+  ASSERT_TRUE(WaitForFilters(*db));
+  err = db->View([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    for (int i = 0; i < 20000; i += 13) {
+      auto key = "key" + std::to_string(i);
+      EXPECT_EQ(b->Get(key)->ToString(), key);
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+
+} // namespace test
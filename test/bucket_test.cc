@@ -188,4 +188,158 @@ TEST(BucketTest, BucketCreateAndReadLargeTest) {
   });
   assert(!err);
 }
+
+TEST(BucketTest, CatalogTreeWithNestedBuckets) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  constexpr int bucket_cnt = 2000;
+  {
+    auto db = GetTmpDB();
+    // enough buckets to split the catalog over many pages
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      for (int i = 0; i < bucket_cnt; i++) {
+        if (auto b = tx.CreateBucket("bucket" + std::to_string(i)); !b) {
+          return b.error();
+        }
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto parent = tx.GetBucket("bucket7");
+      if (!parent) {
+        return kv::Error{"Bucket not found"};
+      }
+      if (auto e = parent->Put("key", "val")) {
+        return e;
+      }
+      if (auto b = parent->CreateBucket("child"); !b) {
+        return b.error();
+      }
+      auto child = parent->GetBucket("child");
+      if (!child) {
+        return kv::Error{"Nested bucket not found"};
+      }
+      for (int i = 0; i < 200; i++) {
+        auto key = "key" + std::to_string(i);
+        if (auto e = child->Put(key, "val" + std::to_string(i))) {
+          return e;
+        }
+      }
+      if (auto b = child->CreateBucket("grandchild"); !b) {
+        return b.error();
+      }
+      return child->GetBucket("grandchild")->Put("deep", "val");
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  auto db = GetTmpDB();
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    for (int i = 0; i < bucket_cnt; i++) {
+      if (!tx.GetBucket("bucket" + std::to_string(i))) {
+        return kv::Error{"Bucket not found"};
+      }
+    }
+    auto parent = tx.GetBucket("bucket7");
+    EXPECT_EQ(parent->Get("key")->ToString(), "val");
+    // bucket entries are not values
+    EXPECT_FALSE(parent->Get("child").has_value());
+    EXPECT_FALSE(tx.GetBucket("child").has_value());
+    EXPECT_FALSE(parent->GetBucket("key").has_value());
+
+    auto child = parent->GetBucket("child");
+    if (!child) {
+      return kv::Error{"Nested bucket not found"};
+    }
+    for (int i = 0; i < 200; i++) {
+      auto v = child->Get("key" + std::to_string(i));
+      EXPECT_TRUE(v && v->ToString() == "val" + std::to_string(i));
+    }
+    auto grandchild = child->GetBucket("grandchild");
+    if (!grandchild) {
+      return kv::Error{"Nested bucket not found"};
+    }
+    EXPECT_EQ(grandchild->Get("deep")->ToString(), "val");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto parent = tx.GetBucket("bucket7");
+    EXPECT_TRUE(parent->Put("child", "val").has_value());
+    EXPECT_FALSE(parent->CreateBucket("child").has_value());
+    EXPECT_FALSE(parent->CreateBucket("key").has_value());
+    EXPECT_FALSE(tx.CreateBucket("bucket7").has_value());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  // the checker follows the catalog into nested buckets
+  auto result = db->Check();
+  EXPECT_TRUE(result.Ok());
+  EXPECT_GT(result.reachable_pages_, bucket_cnt);
+}
+
+TEST(BucketTest, StatsReportsTreeShape) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  auto db = GetTmpDB();
+  constexpr int keys = 5000;
+  const std::string val(100, 'v');
+  const std::string large(3 * kv::OS::DEFAULT_PAGE_SIZE, 'l');
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("b"); !b) {
+      return b.error();
+    }
+    auto b = tx.GetBucket("b");
+    if (auto c = b->CreateBucket("child"); !c) {
+      return c.error();
+    }
+    for (int i = 0; i < keys; i++) {
+      if (auto e = b->Put("key" + std::to_string(i), val)) {
+        return e;
+      }
+    }
+    // a value larger than a page puts its leaf on a page run
+    return b->Put("large", large);
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_FALSE(tx.GetBucket("b")->Stats().has_value());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto stats = tx.GetBucket("b")->Stats(4);
+    EXPECT_TRUE(stats.has_value());
+    EXPECT_GE(stats->depth_, 2);
+    EXPECT_EQ(stats->levels_.size(), stats->depth_);
+    EXPECT_EQ(stats->levels_.front().pages_, 1);
+    EXPECT_EQ(stats->levels_.back().pages_, stats->leaf_pages_);
+    EXPECT_GT(stats->branch_pages_, 0);
+    EXPECT_EQ(stats->keys_, keys + 1);
+    EXPECT_EQ(stats->nested_buckets_, 1);
+    EXPECT_EQ(stats->value_bytes_, keys * val.size() + large.size());
+    EXPECT_GE(stats->overflow_nodes_, 1);
+    EXPECT_GE(stats->overflow_pages_, 3);
+    EXPECT_GE(stats->overflow_bytes_, large.size());
+    EXPECT_EQ(stats->inline_nodes_ + stats->overflow_nodes_,
+              stats->branch_pages_ + stats->leaf_pages_);
+    for (const auto &level : stats->levels_) {
+      EXPECT_GT(level.FillPercent(), 0.0);
+      EXPECT_LE(level.FillPercent(), 100.0);
+    }
+
+    // the walk does not depend on the number of workers
+    auto serial = tx.GetBucket("b")->Stats(1);
+    EXPECT_EQ(serial->ToString(), stats->ToString());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+
 } // namespace test
@@ -0,0 +1,110 @@
+#include "db.h"
+#include <cassert>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB
+GetTmpDB(const std::filesystem::path &path = "./check.db",
+         kv::CheckMode check = kv::CheckMode::None) {
+  auto db_or_err = kv::DB::Open(path, {.check_mode_ = check});
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./check.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+// Fills two buckets over several transactions and returns the root of the
+// first one.
+kv::Pgid Populate(kv::DB &db) {
+  auto err = db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("plain"); !b) {
+      return b.error();
+    }
+    if (auto b = tx.CreateBucket("packed", kv::BucketFlag::Compressed); !b) {
+      return b.error();
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+
+  for (int batch = 0; batch < 4; ++batch) {
+    err = db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      for (const char *name : {"plain", "packed"}) {
+        auto bucket = tx.GetBucket(name);
+        for (int i = batch; i < 400; i += 4) {
+          auto key = "key" + std::to_string(i);
+          if (auto e = bucket->Put(key, "value" + std::to_string(i))) {
+            return e;
+          }
+        }
+      }
+      return {};
+    });
+    EXPECT_FALSE(err.has_value());
+  }
+
+  kv::Pgid root = 0;
+  err = db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    root = tx.GetBucket("plain")->GetMetaTest().Root();
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+  return root;
+}
+
+TEST(CheckTest, ConsistentFilePasses) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  auto db = GetTmpDB();
+  Populate(*db);
+
+  for (std::size_t threads : {1, 4}) {
+    auto result = db->Check(threads);
+    EXPECT_TRUE(result.Ok());
+    EXPECT_GT(result.reachable_pages_, 4);
+  }
+}
+
+TEST(CheckTest, CorruptedPageIsReported) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  kv::Pgid root = 0;
+  {
+    auto db = GetTmpDB();
+    root = Populate(*db);
+  }
+
+  {
+    std::fstream f{"./check.db",
+                   std::ios::in | std::ios::out | std::ios::binary};
+    f.seekp((root + 1) * kv::OS::OSPageSize() - 1);
+    f.put('x');
+  }
+
+  auto open_or_err =
+      kv::DB::Open("./check.db", {.check_mode_ = kv::CheckMode::Blocking});
+  EXPECT_FALSE(open_or_err.has_value());
+
+  auto db = GetTmpDB("./check.db", kv::CheckMode::Background);
+  auto result = db->BackgroundCheck();
+  ASSERT_TRUE(result.has_value());
+  ASSERT_EQ(result->errors_.size(), 1);
+  EXPECT_EQ(result->errors_[0].message(),
+            "page " + std::to_string(root) + " checksum mismatch");
+}
+} // namespace test
@@ -0,0 +1,169 @@
+#include "checksum.h"
+#include "db.h"
+#include <cassert>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB
+GetTmpDB(const std::filesystem::path &path = "./checksum.db") {
+  auto db_or_err = kv::DB::Open(path);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./checksum.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+TEST(ChecksumTest, KnownVectors) {
+  const std::string digits = "123456789";
+  EXPECT_EQ(kv::Crc32c::Value(digits.data(), digits.size()), 0xE3069283);
+  EXPECT_EQ(kv::Crc32c::ExtendSw(0, digits.data(), digits.size()), 0xE3069283);
+
+  const std::string zeros(32, '\0');
+  EXPECT_EQ(kv::Crc32c::Value(zeros.data(), zeros.size()), 0x8A9136AA);
+}
+
+TEST(ChecksumTest, ExtendMatchesSoftware) {
+  std::mt19937 rng(42);
+  std::vector<std::uint8_t> data(10000);
+  for (auto &b : data) {
+    b = static_cast<std::uint8_t>(rng());
+  }
+  for (std::size_t split : {0, 1, 7, 13, 4096, 9999}) {
+    auto crc = kv::Crc32c::Value(data.data(), split);
+    crc = kv::Crc32c::Extend(crc, data.data() + split, data.size() - split);
+    EXPECT_EQ(crc, kv::Crc32c::ExtendSw(0, data.data(), data.size()));
+  }
+}
+
+TEST(ChecksumTest, CorruptedPageIsDetected) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  kv::Pgid root = 0;
+  std::size_t page_size = 0;
+  {
+    auto db = GetTmpDB();
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.CreateBucket("bucket");
+      if (!b.has_value()) {
+        return b.error();
+      }
+      return tx.GetBucket("bucket")->Put("key", "val");
+    });
+    ASSERT_FALSE(err.has_value());
+
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto bucket = tx.GetBucket("bucket");
+      EXPECT_TRUE(bucket->Get("key").has_value());
+      EXPECT_FALSE(tx.Err().has_value());
+      root = bucket->GetMetaTest().Root();
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+    page_size = kv::OS::OSPageSize();
+  }
+
+  // flip a byte in the unused tail of the bucket root leaf
+  {
+    std::fstream f{"./checksum.db",
+                   std::ios::in | std::ios::out | std::ios::binary};
+    f.seekp((root + 1) * page_size - 1);
+    f.put('x');
+  }
+
+  auto db = GetTmpDB();
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_FALSE(tx.GetBucket("bucket")->Get("key").has_value());
+    EXPECT_TRUE(tx.Err().has_value());
+    return {};
+  });
+  EXPECT_TRUE(err.has_value());
+
+  // reads fail the same way and are not served from the shared caches
+  for (int i = 0; i < 2; i++) {
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      EXPECT_FALSE(tx.GetBucket("bucket")->Get("key").has_value());
+      return {};
+    });
+    EXPECT_TRUE(err.has_value());
+  }
+
+  db->SetVerifyChecksums(false);
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_TRUE(tx.GetBucket("bucket")->Get("key").has_value());
+    EXPECT_FALSE(tx.Err().has_value());
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(ChecksumTest, CorruptedOverflowIsAMismatch) {
+  // a run far past the mmap, and one past the end of the file that stays
+  // inside the mmap and would fault when read
+  const std::size_t page_size = kv::OS::OSPageSize();
+  for (bool far : {true, false}) {
+    auto err = DeleteDBFile();
+    ASSERT_FALSE(err.has_value());
+
+    kv::Pgid root = 0;
+    {
+      auto db = GetTmpDB();
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        auto b = tx.CreateBucket("bucket");
+        if (!b.has_value()) {
+          return b.error();
+        }
+        return tx.GetBucket("bucket")->Put("key", "val");
+      });
+      ASSERT_FALSE(err.has_value());
+      err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        root = tx.GetBucket("bucket")->GetMetaTest().Root();
+        return {};
+      });
+      ASSERT_FALSE(err.has_value());
+    }
+
+    const auto file_pages = std::filesystem::file_size("./checksum.db") /
+                            page_size;
+    ASSERT_LT(root, file_pages);
+    const std::size_t overflow =
+        far ? std::size_t{1} << 40 : file_pages - root + 2;
+    {
+      std::fstream f{"./checksum.db",
+                     std::ios::in | std::ios::out | std::ios::binary};
+      f.seekp(root * page_size + 2 * sizeof(std::size_t));
+      f.write(reinterpret_cast<const char *>(&overflow), sizeof(overflow));
+    }
+
+    auto db = GetTmpDB();
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      EXPECT_FALSE(tx.GetBucket("bucket")->Get("key").has_value());
+      EXPECT_TRUE(tx.Err().has_value());
+      return {};
+    });
+    EXPECT_TRUE(err.has_value());
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      (void)tx.GetBucket("bucket")->Get("key");
+      EXPECT_TRUE(tx.Err().has_value());
+      return {};
+    });
+    EXPECT_TRUE(err.has_value());
+  }
+}
+} // namespace test
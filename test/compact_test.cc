@@ -0,0 +1,226 @@
+#include "db.h"
+#include <atomic>
+#include <cassert>
+#include <future>
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB GetTmpDB(const std::filesystem::path &path) {
+  auto db_or_err = kv::DB::Open(path);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+std::string Val(int i, int round) {
+  return "value" + std::to_string(i) + "-" + std::to_string(round);
+}
+
+TEST(CompactTest, CompactRewritesBucketsIntoSmallerFile) {
+  const std::filesystem::path path = "./compact.db";
+  std::filesystem::remove(path);
+  constexpr int keys = 3000;
+  constexpr int rounds = 5;
+  {
+    auto db = GetTmpDB(path);
+    auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+      for (auto [name, flags] :
+           {std::pair{"plain", kv::BucketFlag::None},
+            std::pair{"packed", kv::BucketFlag::Compressed},
+            std::pair{"hashed", kv::BucketFlag::Hash}}) {
+        if (auto b = tx.CreateBucket(name, flags); !b) {
+          return b.error();
+        }
+      }
+      auto b = tx.GetBucket("plain");
+      if (auto c = b->CreateBucket("child"); !c) {
+        return c.error();
+      }
+      return b->GetBucket("child")->Put("nested", "val");
+    });
+    ASSERT_FALSE(err.has_value());
+    // every round rewrites all keys, copy on write leaves the old pages behind
+    for (int round = 0; round < rounds; round++) {
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        for (const char *name : {"plain", "packed", "hashed"}) {
+          auto b = tx.GetBucket(name);
+          for (int i = 0; i < keys; i++) {
+            if (auto e = b->Put("key" + std::to_string(i), Val(i, round))) {
+              return e;
+            }
+          }
+        }
+        return {};
+      });
+      ASSERT_FALSE(err.has_value());
+    }
+
+    const auto before = std::filesystem::file_size(path);
+    ASSERT_FALSE(db->Compact().has_value());
+    const auto after = std::filesystem::file_size(path);
+    EXPECT_LT(after * 2, before);
+    EXPECT_FALSE(std::filesystem::exists("./compact.db.compact"));
+
+    // every page of the copy is reachable from its meta
+    auto result = db->Check();
+    EXPECT_TRUE(result.Ok());
+    EXPECT_EQ(result.unreachable_pages_, 0);
+    EXPECT_EQ(result.reachable_pages_ * db->PageSize(), after);
+
+    // the compacted db takes writes
+    err = db->Update([](kv::Tx &tx) {
+      return tx.GetBucket("plain")->Put("after", "compact");
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  auto db = GetTmpDB(path);
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    for (const char *name : {"plain", "packed", "hashed"}) {
+      auto b = tx.GetBucket(name);
+      EXPECT_TRUE(b.has_value());
+      for (int i = 0; i < keys; i++) {
+        auto val = b->Get("key" + std::to_string(i));
+        EXPECT_TRUE(val.has_value());
+        EXPECT_EQ(val->ToString(), Val(i, rounds - 1));
+      }
+    }
+    EXPECT_TRUE(tx.GetBucket("packed")->GetMetaTest().Compressed());
+    EXPECT_TRUE(tx.GetBucket("hashed")->GetMetaTest().Hashed());
+    auto plain = tx.GetBucket("plain");
+    EXPECT_EQ(plain->Get("after")->ToString(), "compact");
+    EXPECT_EQ(plain->GetBucket("child")->Get("nested")->ToString(), "val");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+
+TEST(CompactTest, CompactWaitsForReadTxs) {
+  const std::filesystem::path path = "./compact_readers.db";
+  std::filesystem::remove(path);
+  constexpr int keys = 2000;
+  auto db = GetTmpDB(path);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("b"); !b) {
+      return b.error();
+    }
+    auto b = tx.GetBucket("b");
+    for (int i = 0; i < keys; i++) {
+      if (auto e = b->Put("key" + std::to_string(i), Val(i, 0))) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  std::promise<void> started;
+  std::atomic<bool> done{false};
+  std::thread reader{[&] {
+    auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      started.set_value();
+      // give the compaction time to reach the swap
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      auto b = tx.GetBucket("b");
+      EXPECT_TRUE(b.has_value());
+      for (int i = 0; b && i < keys; i++) {
+        auto val = b->Get("key" + std::to_string(i));
+        EXPECT_TRUE(val.has_value());
+        EXPECT_EQ(val->ToString(), Val(i, 0));
+      }
+      done = true;
+      return {};
+    });
+    EXPECT_FALSE(err.has_value());
+  }};
+  started.get_future().wait();
+  EXPECT_FALSE(db->Compact().has_value());
+  EXPECT_TRUE(done);
+  reader.join();
+  EXPECT_TRUE(db->Check().Ok());
+}
+
+TEST(CompactTest, CompactWaitsForWriteTx) {
+  const std::filesystem::path path = "./compact_writer.db";
+  std::filesystem::remove(path);
+  constexpr int keys = 2000;
+  auto db = GetTmpDB(path);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("b"); !b) {
+      return b.error();
+    }
+    auto b = tx.GetBucket("b");
+    for (int i = 0; i < keys; i++) {
+      if (auto e = b->Put("key" + std::to_string(i), Val(i, 0))) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  std::promise<void> started;
+  std::thread writer{[&] {
+    auto tx = db->Begin(true);
+    ASSERT_TRUE(tx.has_value());
+    EXPECT_FALSE(tx->GetBucket("b")->Put("during", "compact").has_value());
+    started.set_value();
+    // give the compaction time to copy the file
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    EXPECT_FALSE(tx->Commit().has_value());
+  }};
+  started.get_future().wait();
+  EXPECT_FALSE(db->Compact().has_value());
+  writer.join();
+
+  // the commit landed before the copy, not on top of the copy after it
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("b");
+    EXPECT_TRUE(b.has_value());
+    for (int i = 0; b && i < keys; i++) {
+      auto val = b->Get("key" + std::to_string(i));
+      EXPECT_TRUE(val.has_value());
+      EXPECT_EQ(val->ToString(), Val(i, 0));
+    }
+    EXPECT_TRUE(b && b->Get("during").has_value());
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+  EXPECT_TRUE(db->Check().Ok());
+}
+
+TEST(CompactTest, FillPercentControlsLeafCount) {
+  auto leaves = [](double fill_percent) {
+    const std::filesystem::path path = "./compact_fill.db";
+    std::filesystem::remove(path);
+    auto db = GetTmpDB(path);
+    auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+      if (auto b = tx.CreateBucket("b"); !b) {
+        return b.error();
+      }
+      auto b = tx.GetBucket("b");
+      for (int i = 0; i < 5000; i++) {
+        if (auto e = b->Put("key" + std::to_string(i), std::string(50, 'v'))) {
+          return e;
+        }
+      }
+      return {};
+    });
+    EXPECT_FALSE(err.has_value());
+    EXPECT_FALSE(db->Compact(fill_percent).has_value());
+    std::size_t leaf_pages = 0;
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto stats = tx.GetBucket("b")->Stats();
+      EXPECT_TRUE(stats.has_value());
+      leaf_pages = stats->leaf_pages_;
+      EXPECT_GT(stats->levels_.back().FillPercent(), fill_percent * 100 - 15);
+      return {};
+    });
+    EXPECT_FALSE(err.has_value());
+    return leaf_pages;
+  };
+  EXPECT_LT(leaves(1.0) * 3, leaves(0.4) * 2);
+}
+
+} // namespace test
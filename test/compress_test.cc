@@ -0,0 +1,246 @@
+#include "compress.h"
+#include "db.h"
+#include <array>
+#include <cassert>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB
+GetTmpDB(const std::filesystem::path &path = "./compress.db") {
+  auto db_or_err = kv::DB::Open(path);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./compress.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+std::vector<std::byte> RoundTrip(const std::string &input) {
+  std::span<const std::byte> src{
+      reinterpret_cast<const std::byte *>(input.data()), input.size()};
+  std::vector<std::byte> encoded(kv::LzCodec::MaxCompressedSize(src.size()));
+  auto encoded_sz = kv::LzCodec::Compress(src, encoded);
+  EXPECT_TRUE(encoded_sz.has_value());
+  encoded.resize(*encoded_sz);
+
+  std::vector<std::byte> decoded(src.size());
+  auto decoded_sz = kv::LzCodec::Decompress(encoded, decoded);
+  EXPECT_TRUE(decoded_sz.has_value());
+  EXPECT_EQ(*decoded_sz, src.size());
+  EXPECT_TRUE(std::equal(decoded.begin(), decoded.end(), src.begin()));
+  return encoded;
+}
+
+TEST(CompressTest, CodecRoundTrip) {
+  RoundTrip("abc");
+  RoundTrip(std::string(1000, 'a'));
+
+  std::string json;
+  for (int i = 0; i < 200; ++i) {
+    json += R"({"id": )" + std::to_string(i) +
+            R"(, "name": "user", "active": true, "tags": ["a", "b"]})";
+  }
+  auto encoded = RoundTrip(json);
+  EXPECT_LT(encoded.size() * 3, json.size());
+
+  std::mt19937 rng(42);
+  std::string noise(5000, '\0');
+  for (auto &c : noise) {
+    c = static_cast<char>(rng());
+  }
+  RoundTrip(noise);
+}
+
+TEST(CompressTest, CodecRejectsTruncatedInput) {
+  std::string input(4000, 'x');
+  std::span<const std::byte> src{
+      reinterpret_cast<const std::byte *>(input.data()), input.size()};
+  std::vector<std::byte> encoded(kv::LzCodec::MaxCompressedSize(src.size()));
+  auto encoded_sz = kv::LzCodec::Compress(src, encoded);
+  ASSERT_TRUE(encoded_sz.has_value());
+
+  std::vector<std::byte> decoded(input.size() - 1);
+  EXPECT_FALSE(kv::LzCodec::Decompress(
+                   std::span{encoded.data(), *encoded_sz}, decoded)
+                   .has_value());
+}
+
+TEST(CompressTest, CompressedBucketPersists) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  std::vector<std::pair<std::string, std::string>> keys_and_vals;
+  for (int i = 0; i < 1000; ++i) {
+    std::ostringstream key_stream;
+    key_stream << "key" << std::setw(5) << std::setfill('0') << i;
+    keys_and_vals.emplace_back(
+        key_stream.str(), R"({"id": )" + std::to_string(i) +
+                              R"(, "name": "user", "active": true})");
+  }
+
+  {
+    auto db = GetTmpDB();
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.CreateBucket("bucket", kv::BucketFlag::Compressed);
+      if (!b.has_value()) {
+        return b.error();
+      }
+      auto bucket_opt = tx.GetBucket("bucket");
+      if (!bucket_opt.has_value()) {
+        return kv::Error{"Bucket not found"};
+      }
+      for (const auto &[key, val] : keys_and_vals) {
+        if (auto e = bucket_opt->Put(key, val)) {
+          return e;
+        }
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  auto db = GetTmpDB();
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    if (!bucket_opt.has_value()) {
+      return kv::Error{"Bucket not found"};
+    }
+    EXPECT_TRUE(bucket_opt->GetMetaTest().Compressed());
+    for (const auto &[key, val] : keys_and_vals) {
+      auto get_result = bucket_opt->Get(key);
+      EXPECT_TRUE(get_result.has_value() && get_result.value() == val);
+    }
+    // updates go through the decoded leaf
+    return bucket_opt->Put(keys_and_vals[10].first, "updated");
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    auto get_result = bucket_opt->Get(keys_and_vals[10].first);
+    EXPECT_TRUE(get_result.has_value() && get_result.value() == "updated");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+
+TEST(CompressTest, CorruptedCompressedPageFailsTx) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < 1000; ++i) {
+    keys.push_back("key" + std::to_string(10000 + i));
+  }
+  {
+    auto db = GetTmpDB();
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.CreateBucket("bucket", kv::BucketFlag::Compressed);
+      if (!b.has_value()) {
+        return b.error();
+      }
+      auto bucket_opt = tx.GetBucket("bucket");
+      for (const auto &key : keys) {
+        if (auto e = bucket_opt->Put(key, std::string(64, 'v'))) {
+          return e;
+        }
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  // shrink the raw size of the first compressed leaf below a page header
+  {
+    const auto page_size = kv::OS::OSPageSize();
+    std::fstream f{"./compress.db",
+                   std::ios::in | std::ios::out | std::ios::binary};
+    bool found = false;
+    for (std::size_t pos = 0; !found; pos += page_size) {
+      std::array<std::size_t, 5> header{};
+      f.seekg(pos);
+      if (!f.read(reinterpret_cast<char *>(header.data()), sizeof(header))) {
+        break;
+      }
+      const auto compressed =
+          static_cast<std::size_t>(kv::PageFlag::CompressedPage);
+      if (header[4] != kv::MAGIC || !(header[1] & compressed)) {
+        continue;
+      }
+      const std::size_t raw_sz = 1;
+      f.seekp(pos + kv::PAGE_HEADER_SIZE);
+      f.write(reinterpret_cast<const char *>(&raw_sz), sizeof(raw_sz));
+      found = true;
+    }
+    ASSERT_TRUE(found);
+  }
+
+  // without checksums the sizes themselves have to be checked
+  auto db = GetTmpDB();
+  db->SetVerifyChecksums(false);
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    for (const auto &key : keys) {
+      (void)bucket_opt->Get(key);
+    }
+    EXPECT_TRUE(tx.Err().has_value());
+    return {};
+  });
+  EXPECT_TRUE(err.has_value());
+}
+
+TEST(CompressTest, ValuesOutliveEvictedPages) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  // enough leaves to cycle the decoded page cache of a tx
+  auto db = GetTmpDB();
+  constexpr int N = 20000;
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("bucket", kv::BucketFlag::Compressed);
+    if (!b.has_value()) {
+      return b.error();
+    }
+    auto bucket_opt = tx.GetBucket("bucket");
+    for (int i = 0; i < N; i++) {
+      const auto key = std::to_string(100000 + i);
+      if (auto e = bucket_opt->Put(key, key + std::string(100, 'v'))) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    std::vector<kv::Slice> vals;
+    for (int i = 0; i < N; i++) {
+      auto val = bucket_opt->Get(std::to_string(100000 + i));
+      EXPECT_TRUE(val.has_value());
+      vals.push_back(*val);
+    }
+    for (int i = 0; i < N; i++) {
+      const auto key = std::to_string(100000 + i);
+      EXPECT_TRUE(vals[i] == key + std::string(100, 'v'));
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+} // namespace test
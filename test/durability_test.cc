@@ -0,0 +1,278 @@
+#include "db.h"
+#include <cassert>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+
+namespace test {
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./durability.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+// CrashState records how to get back to the file as of the last sync. Crash
+// restores that image, modelling an os crash that drops every write still in
+// the page cache.
+struct CrashState {
+  struct Undo {
+    std::size_t offset_;
+    std::vector<std::byte> old_;
+  };
+
+  void Crash(const std::filesystem::path &path) {
+    std::lock_guard lock(mu_);
+    crashed_ = true;
+    auto fd = ::open(path.c_str(), O_RDWR);
+    ASSERT_NE(fd, -1);
+    for (auto it = undo_.rbegin(); it != undo_.rend(); ++it) {
+      ASSERT_EQ(::pwrite(fd, it->old_.data(), it->old_.size(), it->offset_),
+                static_cast<ssize_t>(it->old_.size()));
+    }
+    ASSERT_EQ(::ftruncate(fd, static_cast<off_t>(synced_size_)), 0);
+    ::close(fd);
+    undo_.clear();
+  }
+
+  std::mutex mu_;
+  std::vector<Undo> undo_;
+  std::size_t size_{0};
+  std::size_t synced_size_{0};
+  std::size_t syncs_{0};
+  bool fail_sync_{false};
+  bool crashed_{false};
+};
+
+// CrashFile forwards to the real file and keeps an undo log of unsynced writes
+// in the shared CrashState.
+class CrashFile final : public kv::File {
+public:
+  CrashFile(std::unique_ptr<kv::File> file, std::shared_ptr<CrashState> state)
+      : file_(std::move(file)), state_(std::move(state)) {}
+
+  [[nodiscard]] std::optional<kv::Error>
+  WriteAt(const void *data, std::size_t n, std::size_t offset) noexcept final {
+    std::lock_guard lock(state_->mu_);
+    if (state_->crashed_) {
+      return std::nullopt;
+    }
+    CrashState::Undo undo{offset, {}};
+    if (offset < state_->size_) {
+      undo.old_.resize(std::min(n, state_->size_ - offset));
+      auto err = file_->ReadAt(undo.old_.data(), undo.old_.size(), offset);
+      if (err) {
+        return err;
+      }
+    }
+    state_->undo_.push_back(std::move(undo));
+    state_->size_ = std::max(state_->size_, offset + n);
+    return file_->WriteAt(data, n, offset);
+  }
+
+  [[nodiscard]] std::optional<kv::Error>
+  ReadAt(void *data, std::size_t n, std::size_t offset) noexcept final {
+    return file_->ReadAt(data, n, offset);
+  }
+
+  [[nodiscard]] std::optional<kv::Error> Sync() noexcept final {
+    return MarkSynced(0, SIZE_MAX);
+  }
+
+  [[nodiscard]] std::optional<kv::Error> DataSync() noexcept final {
+    return MarkSynced(0, SIZE_MAX);
+  }
+
+  [[nodiscard]] std::optional<kv::Error>
+  SyncRange(std::size_t offset, std::size_t n) noexcept final {
+    return MarkSynced(offset, offset + n);
+  }
+
+private:
+  // MarkSynced makes the writes within [begin, end) durable.
+  [[nodiscard]] std::optional<kv::Error> MarkSynced(std::size_t begin,
+                                                    std::size_t end) noexcept {
+    std::lock_guard lock(state_->mu_);
+    if (state_->crashed_) {
+      return std::nullopt;
+    }
+    if (state_->fail_sync_) {
+      return kv::Error{"injected sync failure"};
+    }
+    std::erase_if(state_->undo_, [&](const CrashState::Undo &u) {
+      return u.offset_ >= begin && u.offset_ < end;
+    });
+    state_->synced_size_ = state_->size_;
+    state_->syncs_++;
+    return std::nullopt;
+  }
+
+  std::unique_ptr<kv::File> file_;
+  std::shared_ptr<CrashState> state_;
+};
+
+[[nodiscard]] kv::DB::RAII_DB
+OpenCrashDB(std::shared_ptr<CrashState> state, kv::Options options = {}) {
+  options.wrap_file_ = [state](std::unique_ptr<kv::File> file) {
+    return std::make_unique<CrashFile>(std::move(file), state);
+  };
+  auto db_or_err = kv::DB::Open("./durability.db", options);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+// Commit puts key in its own transaction, creating the bucket if needed.
+[[nodiscard]] std::optional<kv::Error> Commit(kv::DB &db,
+                                              const std::string &key) {
+  return db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (!tx.GetBucket("bucket")) {
+      if (auto b = tx.CreateBucket("bucket"); !b) {
+        return b.error();
+      }
+    }
+    return tx.GetBucket("bucket")->Put(key, "val");
+  });
+}
+
+// Surviving returns which of keys 0..n-1 are in the reopened file.
+std::vector<bool> Surviving(int n) {
+  auto db_or_err = kv::DB::Open("./durability.db");
+  EXPECT_TRUE(db_or_err.has_value());
+  if (!db_or_err) {
+    return {};
+  }
+  auto &db = *db_or_err;
+  EXPECT_TRUE(db->Check(2).Ok());
+  std::vector<bool> found(n, false);
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    for (int i = 0; bucket_opt && i < n; ++i) {
+      found[i] = bucket_opt->Get("key" + std::to_string(i)).has_value();
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+  return found;
+}
+
+TEST(DurabilityTest, SyncedModesKeepEveryCommit) {
+  for (auto mode :
+       {kv::SyncMode::Full, kv::SyncMode::Data, kv::SyncMode::Range}) {
+    ASSERT_FALSE(DeleteDBFile().has_value());
+    auto state = std::make_shared<CrashState>();
+    {
+      auto db = OpenCrashDB(state, {.sync_mode_ = mode});
+      for (int i = 0; i < 5; ++i) {
+        ASSERT_FALSE(Commit(*db, "key" + std::to_string(i)).has_value());
+      }
+      state->Crash("./durability.db");
+    }
+    EXPECT_EQ(Surviving(5), std::vector<bool>(5, true));
+  }
+}
+
+TEST(DurabilityTest, NoSyncLosesCommitsAfterLastSync) {
+  ASSERT_FALSE(DeleteDBFile().has_value());
+  auto state = std::make_shared<CrashState>();
+  {
+    auto db = OpenCrashDB(state, {.sync_mode_ = kv::SyncMode::None});
+    ASSERT_FALSE(Commit(*db, "key0").has_value());
+    ASSERT_FALSE(Commit(*db, "key1").has_value());
+    ASSERT_FALSE(db->Sync().has_value());
+    ASSERT_FALSE(Commit(*db, "key2").has_value());
+    state->Crash("./durability.db");
+  }
+  EXPECT_EQ(Surviving(3), (std::vector<bool>{true, true, false}));
+}
+
+TEST(DurabilityTest, PeriodicSyncEveryNCommits) {
+  ASSERT_FALSE(DeleteDBFile().has_value());
+  auto state = std::make_shared<CrashState>();
+  {
+    auto db = OpenCrashDB(state,
+                          {.sync_mode_ = kv::SyncMode::Periodic,
+                           .sync_every_commits_ = 3,
+                           .sync_interval_ = std::chrono::milliseconds{0}});
+    for (int i = 0; i < 5; ++i) {
+      ASSERT_FALSE(Commit(*db, "key" + std::to_string(i)).has_value());
+    }
+    state->Crash("./durability.db");
+  }
+  EXPECT_EQ(Surviving(5), (std::vector<bool>{true, true, true, false, false}));
+}
+
+TEST(DurabilityTest, PeriodicSyncFlusher) {
+  ASSERT_FALSE(DeleteDBFile().has_value());
+  auto state = std::make_shared<CrashState>();
+  {
+    auto db = OpenCrashDB(state,
+                          {.sync_mode_ = kv::SyncMode::Periodic,
+                           .sync_every_commits_ = 0,
+                           .sync_interval_ = std::chrono::milliseconds{5}});
+    ASSERT_FALSE(Commit(*db, "key0").has_value());
+    // the flusher syncs the commit without another commit or an explicit sync
+    for (int i = 0; i < 1000; ++i) {
+      {
+        std::lock_guard lock(state->mu_);
+        if (state->undo_.empty()) {
+          break;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    }
+    state->Crash("./durability.db");
+  }
+  EXPECT_EQ(Surviving(1), std::vector<bool>{true});
+}
+
+TEST(DurabilityTest, SyncFailureFailsCommit) {
+  ASSERT_FALSE(DeleteDBFile().has_value());
+  auto state = std::make_shared<CrashState>();
+  auto db = OpenCrashDB(state);
+  ASSERT_FALSE(Commit(*db, "key0").has_value());
+  {
+    std::lock_guard lock(state->mu_);
+    state->fail_sync_ = true;
+  }
+  EXPECT_TRUE(Commit(*db, "key1").has_value());
+}
+
+TEST(DurabilityTest, PeriodicSyncFailureIsReportedBySync) {
+  ASSERT_FALSE(DeleteDBFile().has_value());
+  auto state = std::make_shared<CrashState>();
+  auto db = OpenCrashDB(state,
+                        {.sync_mode_ = kv::SyncMode::Periodic,
+                         .sync_every_commits_ = 1,
+                         .sync_interval_ = std::chrono::milliseconds{0}});
+  {
+    std::lock_guard lock(state->mu_);
+    state->fail_sync_ = true;
+  }
+  // the commit landed before its fsync failed
+  ASSERT_FALSE(Commit(*db, "key0").has_value());
+  EXPECT_EQ(db->GetStats().fsync_errors_, 1u);
+  auto err = db->View([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    EXPECT_TRUE(bucket_opt && bucket_opt->Get("key0"));
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+
+  {
+    std::lock_guard lock(state->mu_);
+    state->fail_sync_ = false;
+  }
+  EXPECT_TRUE(db->Sync().has_value());
+  EXPECT_FALSE(db->Sync().has_value());
+}
+} // namespace test
@@ -0,0 +1,188 @@
+#include "db.h"
+#include <cassert>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB GetHashDB(const std::filesystem::path &path,
+                                        const kv::Options &options = {}) {
+  std::filesystem::remove(path);
+  auto db_or_err = kv::DB::Open(path, options);
+  assert(db_or_err);
+  auto &db = *db_or_err;
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("h", kv::BucketFlag::Hash);
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  assert(!err);
+  return std::move(db);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+PutHashKeys(kv::DB &db, int from, int to, const std::string &suffix) {
+  return db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("h");
+    for (int i = from; i < to; i++) {
+      auto key = "key" + std::to_string(i);
+      if (auto e = b->Put(key, key + suffix)) {
+        return e;
+      }
+    }
+    return {};
+  });
+}
+
+TEST(HashBucketTest, PutAndGetAcrossSplitsAndCommits) {
+  const std::filesystem::path path = "./hash_bucket.db";
+  auto db = GetHashDB(path);
+  constexpr int keys = 20000;
+  // the first batch splits leaves within the tx, the next ones split
+  // committed leaves and double the directory
+  ASSERT_FALSE(PutHashKeys(*db, 0, keys / 4, "-a").has_value());
+  ASSERT_FALSE(PutHashKeys(*db, keys / 4, keys, "-a").has_value());
+  ASSERT_FALSE(PutHashKeys(*db, 0, keys / 2, "-b").has_value());
+
+  auto err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("h");
+    // the tx sees committed and dirty leaves
+    EXPECT_FALSE(b->Put("key1", "key1-c").has_value());
+    EXPECT_EQ(b->Get("key1")->ToString(), "key1-c");
+    EXPECT_EQ(b->Get("key2")->ToString(), "key2-b");
+    EXPECT_EQ(b->Get("key19999")->ToString(), "key19999-a");
+    EXPECT_FALSE(b->Get("missing").has_value());
+    EXPECT_FALSE(b->CreateBucket("nested").has_value());
+    EXPECT_FALSE(b->GetBucket("nested").has_value());
+    EXPECT_FALSE(b->CreateCursor().has_value());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  auto result = db->Check();
+  for (const auto &e : result.errors_) {
+    ADD_FAILURE() << e.message();
+  }
+  EXPECT_TRUE(result.Ok());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("h");
+    for (int i = 0; i < keys; i++) {
+      auto key = "key" + std::to_string(i);
+      auto val = b->Get(key);
+      EXPECT_TRUE(val.has_value()) << key;
+      const auto suffix = i == 1 ? "-c" : (i < keys / 2 ? "-b" : "-a");
+      EXPECT_EQ(val->ToString(), key + suffix);
+    }
+    EXPECT_FALSE(b->Get("key" + std::to_string(keys)).has_value());
+
+    auto stats = b->Stats(2);
+    EXPECT_TRUE(stats.has_value());
+    EXPECT_EQ(stats->keys_, static_cast<std::size_t>(keys));
+    EXPECT_EQ(stats->depth_, 2);
+    EXPECT_GT(stats->leaf_pages_, 100);
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(HashBucketTest, GetReadsAFixedNumberOfPages) {
+  const std::filesystem::path path = "./hash_bucket_reads.db";
+  auto db = GetHashDB(path);
+  for (int i = 0; i < 50000; i += 10000) {
+    ASSERT_FALSE(PutHashKeys(*db, i, i + 10000, "-value").has_value());
+  }
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.GetBucket("h");
+    for (int i = 0; i < 50000; i += 997) {
+      const auto before = db->GetStats().pages_read_;
+      EXPECT_TRUE(b->Get("key" + std::to_string(i)).has_value());
+      // the root, a directory segment and a leaf
+      EXPECT_EQ(db->GetStats().pages_read_ - before, 3);
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+TEST(HashBucketTest, CorruptedSegmentFailsTheTx) {
+  const std::filesystem::path path = "./hash_bucket_corrupt.db";
+  kv::Pgid root = 0;
+  std::size_t page_size = 0;
+  {
+    auto db = GetHashDB(path);
+    ASSERT_FALSE(PutHashKeys(*db, 0, 5000, "-value").has_value());
+    page_size = db->PageSize();
+    auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      root = tx.GetBucket("h")->GetMetaTest().Root();
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+  {
+    // the first segment id follows the global depth in the root
+    std::fstream f{path, std::ios::in | std::ios::out | std::ios::binary};
+    kv::Pgid segment = 0;
+    f.seekg(root * page_size + kv::PAGE_HEADER_SIZE + sizeof(std::uint64_t));
+    f.read(reinterpret_cast<char *>(&segment), sizeof(segment));
+    f.seekp(segment * page_size + kv::PAGE_HEADER_SIZE);
+    f.write("junk", 4);
+  }
+
+  auto db_or_err = kv::DB::Open(path);
+  ASSERT_TRUE(db_or_err);
+  auto &db = *db_or_err;
+  auto err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_FALSE(tx.GetBucket("h")->Get("key1").has_value());
+    EXPECT_TRUE(tx.Err().has_value());
+    EXPECT_FALSE(tx.GetBucket("h")->Stats().has_value());
+    return {};
+  });
+  EXPECT_TRUE(err.has_value());
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_TRUE(tx.GetBucket("h")->Put("key1", "new").has_value());
+    return {};
+  });
+  EXPECT_TRUE(err.has_value());
+}
+
+TEST(HashBucketTest, CompactAndCompressionKeepHashBuckets) {
+  const std::filesystem::path path = "./hash_bucket_compact.db";
+  auto db = GetHashDB(path);
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket(
+        "z", static_cast<kv::BucketFlag>(
+                 static_cast<std::size_t>(kv::BucketFlag::Hash) |
+                 static_cast<std::size_t>(kv::BucketFlag::Compressed)));
+    if (!b) {
+      return b.error();
+    }
+    auto z = tx.GetBucket("z");
+    for (int i = 0; i < 5000; i++) {
+      if (auto e = z->Put("key" + std::to_string(i), std::string(100, 'z'))) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  ASSERT_FALSE(PutHashKeys(*db, 0, 5000, "-value").has_value());
+  ASSERT_FALSE(db->Compact().has_value());
+  EXPECT_TRUE(db->Check().Ok());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto h = tx.GetBucket("h");
+    auto z = tx.GetBucket("z");
+    EXPECT_TRUE(h->GetMetaTest().Hashed());
+    EXPECT_TRUE(z->GetMetaTest().Hashed());
+    EXPECT_TRUE(z->GetMetaTest().Compressed());
+    for (int i = 0; i < 5000; i++) {
+      auto key = "key" + std::to_string(i);
+      EXPECT_EQ(h->Get(key)->ToString(), key + "-value");
+      EXPECT_EQ(z->Get(key)->ToString(), std::string(100, 'z'));
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+} // namespace test
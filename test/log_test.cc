@@ -0,0 +1,92 @@
+#include "log.h"
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace test {
+
+// Restores the log level and stream a test changed.
+struct LogGuard {
+  LogGuard() noexcept : level_(GetLogLevel()), out_(LOG_OUTPUT_STREAM) {}
+  ~LogGuard() {
+    SetLogAsync(false);
+    SetLogLevel(level_);
+    LOG_OUTPUT_STREAM = out_;
+  }
+  LogLevel level_;
+  FILE *out_;
+};
+
+std::string ReadAll(FILE *f) {
+  std::string s;
+  std::rewind(f);
+  for (int c = std::fgetc(f); c != EOF; c = std::fgetc(f)) {
+    s.push_back(static_cast<char>(c));
+  }
+  return s;
+}
+
+TEST(LogTest, DisabledLevelDoesNotEvaluateArguments) {
+  LogGuard guard;
+  FILE *out = std::tmpfile();
+  LOG_OUTPUT_STREAM = out;
+  int calls = 0;
+  auto expensive = [&] {
+    calls++;
+    return std::string{"expensive"};
+  };
+
+  SetLogLevel(LogLevel::OFF);
+  LOG_ERROR("{}", expensive());
+  LOG_DEBUG("{}", expensive());
+  EXPECT_EQ(calls, 0);
+
+  SetLogLevel(LogLevel::INFO);
+  LOG_DEBUG("{}", expensive());
+  EXPECT_EQ(calls, 0);
+  LOG_INFO("{}", expensive());
+  LOG_ERROR("{}", expensive());
+  EXPECT_EQ(calls, 2);
+
+  auto text = ReadAll(out);
+  EXPECT_NE(text.find("INFO  - expensive"), std::string::npos);
+  EXPECT_NE(text.find("ERROR - expensive"), std::string::npos);
+  std::fclose(out);
+}
+
+TEST(LogTest, AsyncSinkWritesEveryLineFromEveryThread) {
+  LogGuard guard;
+  FILE *out = std::tmpfile();
+  LOG_OUTPUT_STREAM = out;
+  SetLogLevel(LogLevel::DEBUG);
+  SetLogAsync(true);
+
+  constexpr int threads = 4;
+  constexpr int lines = 200;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([t] {
+      for (int i = 0; i < lines; i++) {
+        LOG_DEBUG("thread {} line {}", t, i);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  FlushLog();
+
+  auto text = ReadAll(out);
+  std::size_t written = 0;
+  for (auto pos = text.find("line "); pos != std::string::npos;
+       pos = text.find("line ", pos + 1)) {
+    written++;
+  }
+  EXPECT_EQ(written + GetLogRing().Dropped(), threads * lines);
+  EXPECT_NE(text.find("thread 3 line 199"), std::string::npos);
+  std::fclose(out);
+}
+
+} // namespace test
@@ -2,6 +2,8 @@
 #include "os.h"
 #include "page.h"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <fmt/format.h>
 #include <random>
 
 namespace test {
@@ -123,4 +125,74 @@ TEST(NodeTest, RandomByteInsertionsPreserveOrder) {
   }
 }
 
+TEST(NodeTest, RandomPutsWithSharedPrefixes) {
+  // keys share their first 8 bytes so lookups fall back to full compares
+  std::mt19937 rng(7);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 500; i++) {
+    keys.push_back(fmt::format("prefix__{:05}", i));
+  }
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  kv::Node n{};
+  std::size_t bytes = 0;
+  for (const auto &k : keys) {
+    n.Put(k, k);
+    bytes += 2 * k.size();
+  }
+  // overwriting keeps the count and updates the storage size
+  for (int i = 0; i < 500; i += 5) {
+    const auto k = fmt::format("prefix__{:05}", i);
+    n.Put(k, "v");
+    bytes -= k.size() - 1;
+  }
+
+  const auto &elements = n.GetElements();
+  ASSERT_EQ(elements.size(), keys.size());
+  EXPECT_EQ(n.GetStorageSize(), n.GetHeaderSize() + bytes);
+  for (std::size_t i = 0; i < elements.size(); i++) {
+    const auto k = fmt::format("prefix__{:05}", i);
+    ASSERT_EQ(elements[i].key_.ToString(), k);
+    EXPECT_EQ(elements[i].val_.ToString(), i % 5 == 0 ? "v" : k);
+    EXPECT_EQ(n.FindFirstGreaterOrEqualTo(k), std::make_pair(i, true));
+  }
+  EXPECT_EQ(n.FindFirstGreaterOrEqualTo("prefix__00001a"),
+            std::make_pair(std::size_t{2}, false));
+  EXPECT_EQ(n.FindFirstGreaterOrEqualTo("prefix"),
+            std::make_pair(std::size_t{0}, false));
+  EXPECT_EQ(n.FindFirstGreaterOrEqualTo("z"),
+            std::make_pair(keys.size(), false));
+}
+
+TEST(NodeTest, PageSearchUsesInlinePrefixes) {
+  kv::Node leaf{};
+  kv::Node branch{nullptr, false};
+  for (int i = 0; i < 60; i++) {
+    // every other key shares the first 8 bytes with its neighbour
+    const auto k = fmt::format("{:07}{}", i / 2, i % 2 ? "-b" : "-a");
+    leaf.Put(k, k);
+    branch.Put(k, static_cast<kv::Pgid>(i + 10));
+  }
+  kv::PageBuffer leaf_buf{1, kv::OS::DEFAULT_PAGE_SIZE};
+  kv::PageBuffer branch_buf{1, kv::OS::DEFAULT_PAGE_SIZE};
+  leaf.Write(leaf_buf.GetPage(0));
+  branch.Write(branch_buf.GetPage(0));
+  auto &lp = leaf_buf.GetPage(0).AsPage<kv::LeafPage>();
+  auto &bp = branch_buf.GetPage(0).AsPage<kv::BranchPage>();
+
+  for (int i = 0; i < 60; i++) {
+    const auto k = fmt::format("{:07}{}", i / 2, i % 2 ? "-b" : "-a");
+    ASSERT_EQ(lp.GetElement(i).prefix_, kv::Slice{k}.Prefix());
+    EXPECT_EQ(lp.FindLastLessThan(k), i - 1);
+    EXPECT_EQ(bp.FindFirstGreaterOrEqualTo(k),
+              std::make_pair(static_cast<std::size_t>(i), true));
+    EXPECT_EQ(bp.GetPgid(i), static_cast<kv::Pgid>(i + 10));
+  }
+  EXPECT_EQ(bp.FindFirstGreaterOrEqualTo("0000003-c"),
+            std::make_pair(std::size_t{8}, false));
+  EXPECT_EQ(lp.FindLastLessThan("0000003"), 5);
+  EXPECT_EQ(lp.FindLastLessThan(""), -1);
+  EXPECT_EQ(lp.FindLastLessThan("z"), 59);
+}
+
 } // namespace test
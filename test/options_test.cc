@@ -0,0 +1,116 @@
+#include "db.h"
+#include <cassert>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB
+GetTmpDB(const std::filesystem::path &path = "./options.db",
+         const kv::Options &options = {}) {
+  auto db_or_err = kv::DB::Open(path, options);
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./options.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+std::string Key(int i) {
+  std::ostringstream key_stream;
+  key_stream << "key" << std::setw(5) << std::setfill('0') << i;
+  return key_stream.str();
+}
+
+TEST(OptionsTest, PageSizePersists) {
+  for (std::size_t page_size : {1 << 12, 1 << 14, 1 << 16}) {
+    auto err = DeleteDBFile();
+    ASSERT_FALSE(err.has_value());
+
+    {
+      auto db = GetTmpDB("./options.db", {.page_size_ = page_size});
+      EXPECT_EQ(db->PageSize(), page_size);
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        auto b = tx.CreateBucket("bucket");
+        if (!b.has_value()) {
+          return b.error();
+        }
+        auto bucket_opt = tx.GetBucket("bucket");
+        for (int i = 0; i < 500; ++i) {
+          if (auto e = bucket_opt->Put(Key(i), "val" + std::to_string(i))) {
+            return e;
+          }
+        }
+        return {};
+      });
+      ASSERT_FALSE(err.has_value());
+    }
+
+    // the page size stored in the file wins over the option
+    auto db = GetTmpDB("./options.db", {.page_size_ = 1 << 13});
+    EXPECT_EQ(db->PageSize(), page_size);
+    EXPECT_TRUE(db->Check(2).Ok());
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto bucket_opt = tx.GetBucket("bucket");
+      EXPECT_TRUE(bucket_opt.has_value());
+      for (int i = 0; i < 500; ++i) {
+        auto get_result = bucket_opt->Get(Key(i));
+        EXPECT_TRUE(get_result.has_value() &&
+                    get_result.value() == "val" + std::to_string(i));
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+}
+
+TEST(OptionsTest, InvalidPageSize) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  EXPECT_FALSE(kv::DB::Open("./options.db", {.page_size_ = 3000}).has_value());
+  EXPECT_FALSE(kv::DB::Open("./options.db", {.page_size_ = 512}).has_value());
+}
+
+TEST(OptionsTest, ReadOnly) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  // a read only db can not create the file
+  EXPECT_FALSE(kv::DB::Open("./options.db", {.read_only_ = true}).has_value());
+
+  {
+    auto db = GetTmpDB();
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.CreateBucket("bucket");
+      if (!b.has_value()) {
+        return b.error();
+      }
+      return tx.GetBucket("bucket")->Put("key", "val");
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+
+  auto db = GetTmpDB("./options.db", {.read_only_ = true});
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto get_result = tx.GetBucket("bucket")->Get("key");
+    EXPECT_TRUE(get_result.has_value() && get_result.value() == "val");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->Update(
+      [&](kv::Tx &) -> std::optional<kv::Error> { return std::nullopt; });
+  EXPECT_TRUE(err.has_value());
+}
+} // namespace test
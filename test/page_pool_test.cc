@@ -0,0 +1,200 @@
+#include "db.h"
+#include "page_pool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] std::optional<kv::Error>
+DeleteDBFile(const std::filesystem::path &path = "./page_pool.db") noexcept {
+  if (!std::filesystem::exists(path)) {
+    return std::nullopt;
+  }
+
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  if (ec) {
+    return kv::Error{"Failed to delete DB file: " + ec.message()};
+  }
+
+  return std::nullopt;
+}
+
+TEST(PagePoolTest, ReusesAlignedBuffers) {
+  kv::PagePool pool;
+  pool.SetPageSize(4096);
+
+  auto *a = pool.Acquire(1);
+  auto *b = pool.Acquire(3);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(a) % 4096, 0);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % 4096, 0);
+  pool.Release(a, 1);
+  pool.Release(b, 3);
+  EXPECT_EQ(pool.IdlePages(), 4);
+
+  // buffers are reused for runs of the same length only
+  EXPECT_EQ(pool.Acquire(3), b);
+  EXPECT_EQ(pool.Acquire(1), a);
+  EXPECT_EQ(pool.Hits(), 2);
+  EXPECT_EQ(pool.IdlePages(), 0);
+  pool.Release(a, 1);
+  pool.Release(b, 3);
+
+  // long runs are not pooled
+  auto *c = pool.Acquire(64);
+  pool.Release(c, 64);
+  EXPECT_EQ(pool.IdlePages(), 4);
+}
+
+TEST(PagePoolTest, PageBufferReturnsToPool) {
+  kv::PagePool pool;
+  pool.SetPageSize(4096);
+  std::byte *data = nullptr;
+  {
+    kv::PageBuffer buf{2, 4096, pool};
+    data = buf.GetBuffer().data();
+    EXPECT_EQ(buf.GetPage(0).Count(), 0);
+    kv::PageBuffer moved{std::move(buf)};
+    EXPECT_EQ(moved.GetBuffer().data(), data);
+  }
+  EXPECT_EQ(pool.IdlePages(), 2);
+  kv::PageBuffer reused{2, 4096, pool};
+  EXPECT_EQ(reused.GetBuffer().data(), data);
+}
+
+TEST(PagePoolTest, DirectIO) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  {
+    auto db_or_err = kv::DB::Open("./page_pool.db", {.direct_io_ = true});
+    ASSERT_TRUE(db_or_err.has_value());
+    auto &db = *db_or_err;
+    for (int c = 0; c < 5; ++c) {
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        if (c == 0) {
+          if (auto b = tx.CreateBucket("bucket"); !b) {
+            return b.error();
+          }
+        }
+        auto bucket_opt = tx.GetBucket("bucket");
+        for (int i = c * 200; i < (c + 1) * 200; ++i) {
+          if (auto e = bucket_opt->Put("key" + std::to_string(i),
+                                       "val" + std::to_string(i))) {
+            return e;
+          }
+        }
+        return {};
+      });
+      ASSERT_FALSE(err.has_value());
+    }
+  }
+
+  auto db_or_err = kv::DB::Open("./page_pool.db");
+  ASSERT_TRUE(db_or_err.has_value());
+  auto &db = *db_or_err;
+  EXPECT_TRUE(db->Check(2).Ok());
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto bucket_opt = tx.GetBucket("bucket");
+    EXPECT_TRUE(bucket_opt.has_value());
+    for (int i = 0; i < 1000; ++i) {
+      auto get_result = bucket_opt->Get("key" + std::to_string(i));
+      EXPECT_TRUE(get_result.has_value() &&
+                  get_result.value() == "val" + std::to_string(i));
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
+
+TEST(PagePoolTest, DirectIOSmallPages) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  // pages below the direct io alignment of the device are written buffered
+  auto db_or_err = kv::DB::Open(
+      "./page_pool.db",
+      {.page_size_ = kv::Options::MIN_PAGE_SIZE, .direct_io_ = true});
+  ASSERT_TRUE(db_or_err.has_value());
+  auto &db = *db_or_err;
+  for (int c = 0; c < 3; ++c) {
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      if (c == 0) {
+        if (auto b = tx.CreateBucket("bucket"); !b) {
+          return b.error();
+        }
+      }
+      auto bucket_opt = tx.GetBucket("bucket");
+      for (int i = c * 100; i < (c + 1) * 100; ++i) {
+        if (auto e = bucket_opt->Put("key" + std::to_string(i),
+                                     "val" + std::to_string(i))) {
+          return e;
+        }
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+  EXPECT_TRUE(db->Check(2).Ok());
+}
+
+TEST(PagePoolTest, UnusedTailsAreZeroed) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+
+  {
+    auto db_or_err = kv::DB::Open("./page_pool.db");
+    ASSERT_TRUE(db_or_err.has_value());
+    auto &db = *db_or_err;
+    // full leaves first, then small ones written into the recycled buffers
+    for (int c = 0; c < 4; ++c) {
+      err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+        if (c == 0) {
+          if (auto b = tx.CreateBucket("bucket"); !b) {
+            return b.error();
+          }
+        }
+        auto bucket_opt = tx.GetBucket("bucket");
+        const std::string val(c == 0 ? 500 : 1, 'x');
+        for (int i = 0; i < 200; ++i) {
+          if (auto e = bucket_opt->Put("key" + std::to_string(i), val)) {
+            return e;
+          }
+        }
+        return {};
+      });
+      ASSERT_FALSE(err.has_value());
+    }
+  }
+
+  std::ifstream f{"./page_pool.db", std::ios::binary};
+  std::vector<char> file{std::istreambuf_iterator<char>(f),
+                         std::istreambuf_iterator<char>()};
+  const auto page_size = kv::OS::OSPageSize();
+  std::size_t leaves = 0;
+  for (std::size_t id = 0; (id + 1) * page_size <= file.size(); ++id) {
+    auto &p = *reinterpret_cast<kv::Page *>(file.data() + id * page_size);
+    const auto run = (p.Overflow() + 1) * page_size;
+    if (!p.ValidMagic() || p.Id() != id ||
+        !(p.Flags() & static_cast<std::size_t>(kv::PageFlag::LeafPage)) ||
+        id * page_size + run > file.size()) {
+      continue;
+    }
+    auto &leaf = p.AsPage<kv::LeafPage>();
+    std::size_t used = kv::PAGE_HEADER_SIZE;
+    for (std::size_t i = 0; i < leaf.Count(); ++i) {
+      const auto &e = leaf.GetElement(i);
+      used = std::max(used, e.offset_ + e.ksize_ + e.vsize_);
+    }
+    const auto *bytes = file.data() + id * page_size;
+    EXPECT_TRUE(std::all_of(bytes + used, bytes + run,
+                            [](char b) { return b == 0; }))
+        << "leaf " << id;
+    leaves++;
+  }
+  EXPECT_GT(leaves, 0);
+}
+} // namespace test
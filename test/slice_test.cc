@@ -1,5 +1,7 @@
 #include "slice.h"
 #include "gtest/gtest.h"
+#include <string>
+#include <vector>
 
 namespace test {
 
@@ -29,4 +31,16 @@ TEST(SliceTest, StrongOrdering) {
   ASSERT_TRUE(s6 < s7);
   ASSERT_TRUE(s7 > s6);
 }
+
+TEST(SliceTest, PrefixOrdersLikeSlice) {
+  ASSERT_EQ(kv::Slice{}.Prefix(), 0);
+  ASSERT_EQ(kv::Slice{"a"}.Prefix(), 0x6100000000000000);
+  ASSERT_EQ(kv::Slice{"abcdefghij"}.Prefix(), kv::Slice{"abcdefgh"}.Prefix());
+
+  const std::vector<std::string> sorted = {"", "\x01", "a", "ab", "abcdefgh",
+                                           "abcdefgi", "b", "\xff"};
+  for (std::size_t i = 1; i < sorted.size(); i++) {
+    ASSERT_LT(kv::Slice{sorted[i - 1]}.Prefix(), kv::Slice{sorted[i]}.Prefix());
+  }
+}
 } // namespace test
@@ -0,0 +1,137 @@
+#include "db.h"
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <gtest/gtest.h>
+
+namespace test {
+
+[[nodiscard]] kv::DB::RAII_DB GetTmpDB(const std::filesystem::path &path,
+                                       std::size_t spill_threads) {
+  std::filesystem::remove(path);
+  auto db_or_err = kv::DB::Open(path, {.spill_threads_ = spill_threads});
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+struct CommitResult {
+  kv::Pgid plain_root_;
+  kv::Pgid packed_root_;
+  std::chrono::microseconds commit_time_;
+};
+
+// Fills a plain and a compressed bucket, then rewrites every key in one tx so
+// all leaves are dirty and times its commit.
+CommitResult LargeCommit(kv::DB &db, int keys) {
+  constexpr int batch = 500;
+  auto err = db.Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto b = tx.CreateBucket("plain"); !b) {
+      return b.error();
+    }
+    if (auto b = tx.CreateBucket("packed", kv::BucketFlag::Compressed); !b) {
+      return b.error();
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+
+  auto put = [&](kv::Tx &tx, int from, int to,
+                 const std::string &prefix) -> std::optional<kv::Error> {
+    for (const char *name : {"plain", "packed"}) {
+      auto bucket = tx.GetBucket(name);
+      for (int i = from; i < to; i++) {
+        auto key = "key" + std::to_string(i);
+        if (auto e = bucket->Put(key, prefix + std::to_string(i))) {
+          return e;
+        }
+      }
+    }
+    return {};
+  };
+  for (int i = 0; i < keys; i += batch) {
+    err = db.Update([&](kv::Tx &tx) { return put(tx, i, i + batch, "old"); });
+    EXPECT_FALSE(err.has_value());
+  }
+
+  auto tx = db.Begin(true);
+  EXPECT_TRUE(tx.has_value());
+  EXPECT_FALSE(put(*tx, 0, keys, "value").has_value());
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(tx->Commit().has_value());
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  CommitResult result{0, 0, elapsed};
+  err = db.View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto plain = tx.GetBucket("plain");
+    auto packed = tx.GetBucket("packed");
+    result.plain_root_ = plain->GetMetaTest().Root();
+    result.packed_root_ = packed->GetMetaTest().Root();
+    for (int i = 0; i < keys; i += 97) {
+      auto key = "key" + std::to_string(i);
+      auto val = "value" + std::to_string(i);
+      EXPECT_EQ(plain->Get(key)->ToString(), val);
+      EXPECT_EQ(packed->Get(key)->ToString(), val);
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+  return result;
+}
+
+TEST(SpillTest, ParallelSpillMatchesSerialSpill) {
+  constexpr int keys = 10000;
+  auto serial_db = GetTmpDB("./spill_serial.db", 1);
+  auto serial = LargeCommit(*serial_db, keys);
+  auto parallel_db = GetTmpDB("./spill_parallel.db", 4);
+  auto parallel = LargeCommit(*parallel_db, keys);
+
+  // pages are allocated in the same order whatever the thread count
+  EXPECT_EQ(serial.plain_root_, parallel.plain_root_);
+  EXPECT_EQ(serial.packed_root_, parallel.packed_root_);
+  EXPECT_TRUE(parallel_db->Check().Ok());
+
+  RecordProperty("serial_commit_us",
+                 static_cast<int>(serial.commit_time_.count()));
+  RecordProperty("parallel_commit_us",
+                 static_cast<int>(parallel.commit_time_.count()));
+}
+
+// Collects the leaf pages below root in key order.
+void CollectLeaves(std::vector<std::uint64_t> &file, kv::Pgid root,
+                   std::vector<kv::Page *> &leaves) {
+  auto *p = reinterpret_cast<kv::Page *>(
+      reinterpret_cast<std::byte *>(file.data()) +
+      root * kv::OS::DEFAULT_PAGE_SIZE);
+  if ((p->Flags() & static_cast<std::size_t>(kv::PageFlag::LeafPage)) != 0) {
+    leaves.push_back(p);
+    return;
+  }
+  auto &branch = p->AsPage<kv::BranchPage>();
+  for (std::size_t i = 0; i < branch.Count(); i++) {
+    CollectLeaves(file, branch.GetElement(i).pgid_, leaves);
+  }
+}
+
+TEST(SpillTest, DirtyLeavesAreWrittenAsOneExtentInKeyOrder) {
+  constexpr int keys = 10000;
+  const std::filesystem::path path = "./spill_extent.db";
+  auto db = GetTmpDB(path, 1);
+  auto result = LargeCommit(*db, keys);
+
+  const auto size = std::filesystem::file_size(path);
+  std::vector<std::uint64_t> file(size / sizeof(std::uint64_t));
+  std::ifstream in{path, std::ios::binary};
+  in.read(reinterpret_cast<char *>(file.data()), size);
+  ASSERT_TRUE(in.good());
+
+  std::vector<kv::Page *> leaves;
+  CollectLeaves(file, result.plain_root_, leaves);
+  ASSERT_GT(leaves.size(), 1);
+  for (std::size_t i = 1; i < leaves.size(); i++) {
+    EXPECT_EQ(leaves[i]->Id(),
+              leaves[i - 1]->Id() + leaves[i - 1]->Overflow() + 1);
+  }
+}
+
+} // namespace test
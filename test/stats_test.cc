@@ -0,0 +1,78 @@
+#include "db.h"
+#include "stats.h"
+#include <cassert>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+namespace test {
+
+TEST(StatsTest, CountersFromManyThreadsAreSummed) {
+  kv::Stats stats;
+  constexpr int threads = 8;
+  constexpr int adds = 10000;
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      for (int i = 0; i < adds; i++) {
+        stats.Add(kv::Counter::PagesRead);
+        stats.Record(kv::Phase::Sync, std::chrono::microseconds{i % 100});
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  auto snap = stats.Snapshot();
+  EXPECT_EQ(snap.pages_read_, threads * adds);
+  EXPECT_EQ(snap.sync_.count_, threads * adds);
+  EXPECT_LE(snap.sync_.Percentile(0.5), std::chrono::microseconds{100});
+  EXPECT_GE(snap.sync_.Percentile(0.999), std::chrono::microseconds{64});
+}
+
+TEST(StatsTest, CommitsAndReadsAreCounted) {
+  std::filesystem::remove("./stats.db");
+  auto db_or_err = kv::DB::Open("./stats.db");
+  ASSERT_TRUE(db_or_err);
+  auto &db = *db_or_err;
+
+  constexpr int commits = 5;
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("b");
+    return b ? std::nullopt : std::optional{b.error()};
+  });
+  ASSERT_FALSE(err.has_value());
+  for (int c = 0; c < commits; c++) {
+    err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket("b");
+      for (int i = 0; i < 500; i++) {
+        auto key = "key" + std::to_string(c * 500 + i);
+        if (auto e = b->Put(key, key)) {
+          return e;
+        }
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+  err = db->View([](kv::Tx &tx) -> std::optional<kv::Error> {
+    EXPECT_EQ(tx.GetBucket("b")->Get("key42")->ToString(), "key42");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  auto snap = db->GetStats();
+  EXPECT_EQ(snap.spill_.count_, commits + 1);
+  EXPECT_EQ(snap.meta_.count_, commits + 1);
+  // one barrier for the data pages and one for the meta page
+  EXPECT_EQ(snap.sync_.count_, 2 * (commits + 1));
+  EXPECT_GE(snap.fsyncs_, 2 * (commits + 1));
+  EXPECT_GT(snap.pages_written_, snap.shadow_pages_allocated_);
+  EXPECT_GT(snap.splits_, 0);
+  EXPECT_GT(snap.nodes_materialized_, 0);
+  EXPECT_GT(snap.pages_read_, 0);
+  EXPECT_EQ(snap.tx_cnt_, 1);
+  EXPECT_FALSE(snap.ToString().empty());
+}
+
+} // namespace test
@@ -84,4 +84,71 @@ TEST(BucketTest, TransactionalInsertAndReadSequence) {
     ASSERT_FALSE(err.has_value());
   }
 }
+
+TEST(BucketTest, BucketCatalogIsSharedAcrossTxs) {
+  auto err = DeleteDBFile();
+  ASSERT_FALSE(err.has_value());
+  auto db = GetTmpDB();
+
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    for (int i = 0; i < 100; i++) {
+      if (!tx.CreateBucket("bucket" + std::to_string(i))) {
+        return kv::Error{"Failed to create bucket"};
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  const auto &cache = db->GetBucketsCache();
+  const auto misses = cache.Misses();
+
+  // readers reuse the catalog published by the commit
+  for (int i = 0; i < 10; i++) {
+    err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      if (!tx.GetBucket("bucket" + std::to_string(i))) {
+        return kv::Error{"Bucket not found"};
+      }
+      return {};
+    });
+    ASSERT_FALSE(err.has_value());
+  }
+  EXPECT_EQ(cache.Misses(), misses);
+  EXPECT_GE(cache.Hits(), 10);
+
+  // a reader keeps its catalog while a writer adds a bucket
+  auto reader = db->Begin(false);
+  ASSERT_TRUE(reader);
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (!tx.CreateBucket("new")) {
+      return kv::Error{"Failed to create bucket"};
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  EXPECT_FALSE(reader->GetBucket("new"));
+  EXPECT_TRUE(reader->GetBucket("bucket0"));
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (!tx.GetBucket("new") || !tx.GetBucket("bucket99")) {
+      return kv::Error{"Bucket not found"};
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+  EXPECT_EQ(cache.Misses(), misses);
+
+  // a rolled back writer does not leak its buckets
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    (void)tx.CreateBucket("rolled_back");
+    return kv::Error{"abort"};
+  });
+  ASSERT_TRUE(err.has_value());
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (tx.GetBucket("rolled_back")) {
+      return kv::Error{"Bucket leaked"};
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+}
 } // namespace test
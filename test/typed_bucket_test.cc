@@ -0,0 +1,196 @@
+#include "db.h"
+#include "typed_bucket.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace test {
+
+template <typename T> [[nodiscard]] std::string Encoded(const T &v) {
+  using Codec = kv::OrderedCodec<T>;
+  std::string out(Codec::template Size<false>(v), '\0');
+  auto *end = Codec::template Encode<false>(
+      v, reinterpret_cast<std::byte *>(out.data()));
+  EXPECT_EQ(end, reinterpret_cast<std::byte *>(out.data()) + out.size());
+  const auto *in = reinterpret_cast<const std::byte *>(out.data());
+  EXPECT_EQ(Codec::template Decode<false>(in, in + out.size()), v);
+  EXPECT_EQ(in, reinterpret_cast<const std::byte *>(out.data()) + out.size());
+  return out;
+}
+
+// ExpectOrdered checks that sorted values encode to sorted byte strings.
+template <typename T> void ExpectOrdered(const std::vector<T> &sorted) {
+  for (std::size_t i = 1; i < sorted.size(); i++) {
+    EXPECT_LT(Encoded(sorted[i - 1]), Encoded(sorted[i])) << i;
+  }
+}
+
+TEST(TypedBucketTest, CodecsPreserveOrder) {
+  ExpectOrdered<std::uint32_t>({0, 1, 255, 256, 1 << 20, UINT32_MAX});
+  ExpectOrdered<std::int64_t>(
+      {INT64_MIN, -1000000, -256, -1, 0, 1, 255, 1 << 20, INT64_MAX});
+  ExpectOrdered<std::int8_t>({-128, -1, 0, 1, 127});
+  ExpectOrdered<std::string>(
+      {"", std::string(1, '\0'), std::string("\0\0", 2), "\x01", "a",
+       std::string("a\0", 2), std::string("a\0b", 3), "ab", "b"});
+  ExpectOrdered<std::tuple<std::string, std::int32_t>>(
+      {{"", 5}, {"a", -7}, {"a", 3}, {std::string("a\0", 2), -9}, {"ab", 0}});
+  ExpectOrdered<std::tuple<std::uint32_t, std::int64_t>>(
+      {{0, -1}, {0, 0}, {1, INT64_MIN}, {1, 2}, {UINT32_MAX, 0}});
+
+  static_assert(kv::OrderedCodec<std::int64_t>::SIZE == 8);
+  static_assert(
+      kv::OrderedCodec<std::tuple<std::uint32_t, std::uint64_t>>::SIZE == 12);
+  static_assert(
+      kv::OrderedCodec<std::tuple<std::uint32_t, std::string>>::SIZE == 0);
+  static_assert(std::is_same_v<
+                kv::TypedBucket<std::int64_t, std::string>::Order,
+                kv::FixedOrder<8>>);
+  static_assert(std::is_same_v<kv::TypedBucket<std::string, std::string>::Order,
+                               kv::BytewiseOrder>);
+}
+
+TEST(TypedBucketTest, FixedOrderMatchesBytewiseOrder) {
+  using Key = std::tuple<std::uint64_t, std::uint32_t, std::uint16_t>;
+  using Codec = kv::OrderedCodec<Key>;
+  using Order = kv::FixedOrder<Codec::SIZE>;
+  std::vector<std::string> keys;
+  for (std::uint64_t a : {0ul, 7ul}) {
+    for (std::uint32_t b : {0u, 1u, 70000u}) {
+      for (std::uint16_t c : {0, 9, 300}) {
+        keys.push_back(Encoded(Key{a, b, c}));
+      }
+    }
+  }
+  for (const auto &a : keys) {
+    for (const auto &b : keys) {
+      const kv::Slice sa{a};
+      const kv::Slice sb{b};
+      if (sa.Prefix() != sb.Prefix()) {
+        continue;
+      }
+      EXPECT_EQ(Order::TieLess(sa, sb), sa < sb);
+      EXPECT_EQ(Order::TieEqual(sa, sb), sa == sb);
+      EXPECT_EQ(Order::Equal(sa, sb), sa == sb);
+    }
+  }
+}
+
+[[nodiscard]] kv::DB::RAII_DB GetTypedDB(const std::filesystem::path &path) {
+  std::filesystem::remove(path);
+  auto db_or_err = kv::DB::Open(path, {});
+  assert(db_or_err);
+  return std::move(*db_or_err);
+}
+
+TEST(TypedBucketTest, PutAndGetFixedWidthKeys) {
+  const std::filesystem::path path = "./typed_bucket.db";
+  auto db = GetTypedDB(path);
+  constexpr std::int64_t keys = 5000;
+  auto err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    auto b = tx.CreateBucket("ints");
+    if (!b) {
+      return b.error();
+    }
+    kv::TypedBucket<std::int64_t, std::string> ints{std::move(*tx.GetBucket(
+        "ints"))};
+    for (std::int64_t i = -keys; i < keys; i += 2) {
+      if (auto e = ints.Put(i * 1000003, "v" + std::to_string(i))) {
+        return e;
+      }
+    }
+    // a nested bucket name is not 8 bytes and compares bytewise
+    if (auto nested = ints.Raw().CreateBucket("nested"); !nested) {
+      return nested.error();
+    }
+    EXPECT_EQ(ints.Get(-4 * 1000003), "v-4");
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::TypedBucket<std::int64_t, std::string> ints{std::move(*tx.GetBucket(
+        "ints"))};
+    EXPECT_EQ(ints.Get(-keys * 1000003), "v-5000");
+    EXPECT_FALSE(ints.Get(-keys * 1000003 + 1).has_value());
+    EXPECT_FALSE(ints.Put(7, "seven").has_value());
+    EXPECT_EQ(ints.Get(7), "seven");
+    EXPECT_TRUE(ints.Raw().GetBucket("nested").has_value());
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::TypedBucket<std::int64_t, std::string_view> ints{std::move(
+        *tx.GetBucket("ints"))};
+    for (std::int64_t i = -keys; i < keys; i++) {
+      auto v = ints.Get(i * 1000003);
+      EXPECT_EQ(v.has_value(), i % 2 == 0) << i;
+      if (v) {
+        EXPECT_EQ(*v, "v" + std::to_string(i));
+      }
+    }
+    EXPECT_EQ(ints.Get(7), "seven");
+
+    // the tree the fixed order built is searchable bytewise
+    for (std::int64_t i = -keys; i < keys; i += 98) {
+      const auto raw = ints.Raw().Get(Encoded(i * 1000003));
+      EXPECT_EQ(raw.has_value(), i % 2 == 0) << i;
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+  EXPECT_TRUE(db->Check().Ok());
+}
+
+TEST(TypedBucketTest, PutAndGetTupleKeys) {
+  const std::filesystem::path path = "./typed_bucket_tuple.db";
+  auto db = GetTypedDB(path);
+  using Wide = std::tuple<std::uint32_t, std::uint64_t>;
+  using Named = std::tuple<std::string, std::int32_t>;
+  auto err = db->Update([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    for (const auto *name : {"wide", "named"}) {
+      if (auto b = tx.CreateBucket(name); !b) {
+        return b.error();
+      }
+    }
+    kv::TypedBucket<Wide, std::uint64_t> wide{std::move(*tx.GetBucket(
+        "wide"))};
+    kv::TypedBucket<Named, Wide> named{std::move(*tx.GetBucket("named"))};
+    for (std::uint32_t i = 0; i < 2000; i++) {
+      // keys share their first 8 bytes in runs of 100
+      if (auto e = wide.Put({i / 100, i}, i)) {
+        return e;
+      }
+      // a long name spills past the inline buffer
+      const auto name = std::string(i % 3 == 0 ? 200 : 3, 'a' + i % 26);
+      if (auto e = named.Put({name, -static_cast<std::int32_t>(i)}, {i, i})) {
+        return e;
+      }
+    }
+    return {};
+  });
+  ASSERT_FALSE(err.has_value());
+
+  err = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+    kv::TypedBucket<Wide, std::uint64_t> wide{std::move(*tx.GetBucket(
+        "wide"))};
+    kv::TypedBucket<Named, Wide> named{std::move(*tx.GetBucket("named"))};
+    for (std::uint32_t i = 0; i < 2000; i++) {
+      EXPECT_EQ(wide.Get({i / 100, i}), i);
+      EXPECT_FALSE(wide.Get({i / 100 + 1, i}).has_value());
+      const auto name = std::string(i % 3 == 0 ? 200 : 3, 'a' + i % 26);
+      EXPECT_EQ(named.Get({name, -static_cast<std::int32_t>(i)}), Wide(i, i));
+      EXPECT_FALSE(
+          named.Get({name, static_cast<std::int32_t>(i) + 1}).has_value());
+    }
+    return {};
+  });
+  EXPECT_FALSE(err.has_value());
+}
+
+} // namespace test
@@ -0,0 +1,129 @@
+#include "db.h"
+#include "value_cache.h"
+#include <cassert>
+#include <gtest/gtest.h>
+
+namespace test {
+
+TEST(ValueCacheTest, EntriesServeSnapshotsUntilTheKeyIsWritten) {
+  kv::Stats stats;
+  kv::ValueCache cache{1 << 20, stats};
+  cache.Reset(10);
+  const auto key = kv::ValueCache::Key("", "k");
+  cache.Put(10, key, {100, 5, true});
+  auto loc = cache.Get(10, key);
+  ASSERT_TRUE(loc.has_value());
+  EXPECT_EQ(loc->pos_, 100);
+  EXPECT_EQ(loc->len_, 5);
+  // an older snapshot may have seen another value
+  EXPECT_FALSE(cache.Get(9, key).has_value());
+  // a snapshot the cache has not been published up to yet
+  EXPECT_FALSE(cache.Get(11, key).has_value());
+
+  // a commit that does not write the key keeps it
+  cache.Publish(11, {}, false);
+  EXPECT_TRUE(cache.Get(11, key).has_value());
+  // one that writes it drops it
+  std::vector<std::string> written{key};
+  cache.Publish(12, written, false);
+  EXPECT_FALSE(cache.Get(12, key).has_value());
+  // and refuses lookups of older snapshots
+  cache.Put(11, key, {100, 5, true});
+  EXPECT_FALSE(cache.Get(12, key).has_value());
+  cache.Put(12, key, {200, 5, true});
+  EXPECT_EQ(cache.Get(12, key)->pos_, 200);
+
+  auto snap = stats.Snapshot();
+  EXPECT_EQ(snap.value_cache_hits_, 3);
+  EXPECT_EQ(snap.value_cache_misses_, 4);
+}
+
+TEST(ValueCacheTest, EvictsToTheBudget) {
+  kv::Stats stats;
+  constexpr std::size_t budget = 64 << 10;
+  kv::ValueCache cache{budget, stats};
+  cache.Reset(1);
+  const auto hot = kv::ValueCache::Key("", "hot");
+  cache.Put(1, hot, {});
+  for (int i = 0; i < 10000; i++) {
+    cache.Put(1, kv::ValueCache::Key("", "key" + std::to_string(i)), {});
+    // CLOCK keeps the entry that is hit between insertions
+    EXPECT_TRUE(cache.Get(1, hot).has_value());
+  }
+  EXPECT_LE(cache.Bytes(), budget);
+  EXPECT_GT(stats.Snapshot().value_cache_evictions_, 0);
+}
+
+TEST(ValueCacheTest, ReadTxsShareLookupsAcrossCommits) {
+  const std::filesystem::path path = "./value_cache.db";
+  std::filesystem::remove(path);
+  kv::Options options;
+  options.value_cache_bytes_ = 1 << 20;
+  auto db_or_err = kv::DB::Open(path, options);
+  ASSERT_TRUE(db_or_err);
+  auto &db = *db_or_err;
+  auto err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    for (auto name : {"a", "b"}) {
+      auto b = tx.CreateBucket(name);
+      if (!b) {
+        return b.error();
+      }
+      if (auto c = tx.GetBucket(name)->CreateBucket("nested"); !c) {
+        return c.error();
+      }
+    }
+    for (int i = 0; i < 1000; i++) {
+      auto key = "key" + std::to_string(i);
+      if (auto e = tx.GetBucket("a")->Put(key, "a-" + key)) {
+        return e;
+      }
+    }
+    if (auto e = tx.GetBucket("b")->Put("key1", "b-key1")) {
+      return e;
+    }
+    return tx.GetBucket("a")->GetBucket("nested")->Put("key1", "nested-key1");
+  });
+  ASSERT_FALSE(err.has_value());
+
+  auto expect = [&](const std::string &bucket, const std::string &key,
+                    std::optional<std::string> want) {
+    auto e = db->View([&](kv::Tx &tx) -> std::optional<kv::Error> {
+      auto b = tx.GetBucket(bucket);
+      auto v = b->Get(key);
+      EXPECT_EQ(v.has_value(), want.has_value()) << bucket << " " << key;
+      if (v && want) {
+        EXPECT_EQ(v->ToString(), *want);
+      }
+      auto nested = b->GetBucket("nested");
+      if (nested && bucket == "a" && key == "key1") {
+        EXPECT_EQ(nested->Get(key)->ToString(), "nested-key1");
+      }
+      return {};
+    });
+    EXPECT_FALSE(e.has_value());
+  };
+  for (int round = 0; round < 2; round++) {
+    expect("a", "key1", "a-key1");
+    expect("b", "key1", "b-key1");
+    expect("a", "missing", std::nullopt);
+  }
+  // the second round hits for the three lookups and the nested key1
+  auto snap = db->GetStats();
+  EXPECT_EQ(snap.value_cache_hits_, 4);
+
+  // an update is seen by the next read tx, other keys stay cached
+  err = db->Update([](kv::Tx &tx) -> std::optional<kv::Error> {
+    if (auto e = tx.GetBucket("a")->Put("key1", "updated")) {
+      return e;
+    }
+    return tx.GetBucket("a")->Put("missing", "found");
+  });
+  ASSERT_FALSE(err.has_value());
+  expect("a", "key1", "updated");
+  expect("a", "missing", "found");
+  expect("b", "key1", "b-key1");
+  // the nested key1 and b's key1 were not written
+  EXPECT_EQ(db->GetStats().value_cache_hits_, 6);
+}
+
+} // namespace test